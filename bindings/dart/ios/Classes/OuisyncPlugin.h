@@ -10,6 +10,7 @@
 
 enum DartCObjectType {
   TypedData = 7,
+  ExternalTypedData = 8,
 };
 typedef int32_t DartCObjectType;
 
@@ -133,8 +134,19 @@ typedef struct DartTypedData {
   uint8_t *values;
 } DartTypedData;
 
+typedef void (*DartHandleFinalizer)(void *isolate_callback_data, void *peer);
+
+typedef struct DartExternalTypedData {
+  DartTypedDataType type_;
+  intptr_t length;
+  uint8_t *data;
+  void *peer;
+  DartHandleFinalizer callback;
+} DartExternalTypedData;
+
 typedef union DartCObjectValue {
   struct DartTypedData as_typed_data;
+  struct DartExternalTypedData as_external_typed_data;
   uint64_t _align[5];
 } DartCObjectValue;
 
@@ -149,6 +161,10 @@ typedef uint64_t Handle_Arc_FileHolder;
 
 typedef Handle_Arc_FileHolder FileHandle;
 
+typedef uint64_t Handle_Arc_FileStream;
+
+typedef Handle_Arc_FileStream FileStreamHandle;
+
 /**
  * Creates a ouisync session (common C-like API)
  *
@@ -267,6 +283,90 @@ void file_copy_to_raw_fd_dart(SessionHandle _session,
                               PostDartCObjectFn post_c_object_fn,
                               Port port);
 
+/**
+ * Opens a stream that pushes the file contents, starting at `offset`, to the given port in chunks
+ * of at most `chunk_size` bytes (dart-specific API).
+ *
+ * Each message starts with a one byte tag: `0` - chunk of data follows, `1` - end of file, `2` -
+ * error (followed by the error code and message). The stream sends at most `credits` chunks and
+ * then pauses until more are granted with `file_stream_grant`. Credits above the supported
+ * maximum are clamped to it. A zero `chunk_size` is rejected with `InvalidArgument` and one
+ * above 1 MiB is clamped to 1 MiB. Returns a handle to the stream which must be eventually
+ * closed with `file_stream_close`. On failure returns the null handle and posts the error to
+ * the port.
+ *
+ * # Safety
+ *
+ * - `session` must be a valid session handle
+ * - `handle` must be a valid file holder handle
+ * - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+ * - `port` must be a valid dart native port
+ */
+FileStreamHandle file_read_stream_open_dart(SessionHandle session,
+                                            FileHandle handle,
+                                            uint64_t offset,
+                                            uint64_t chunk_size,
+                                            uint64_t credits,
+                                            PostDartCObjectFn post_c_object_fn,
+                                            Port port);
+
+/**
+ * Opens a stream that writes chunks passed to `file_stream_write` into the file, starting at
+ * `offset` (dart-specific API).
+ *
+ * Every written chunk is acknowledged by posting a message with the tag `0` to the given port so
+ * the caller can limit the number of chunks in flight. After `file_stream_close` the remaining
+ * chunks are written, the file is flushed and `1` is posted. Errors are posted with the tag `2`
+ * followed by the error code and message. On failure returns the null handle and posts the error
+ * to the port.
+ *
+ * # Safety
+ *
+ * - `session` must be a valid session handle
+ * - `handle` must be a valid file holder handle
+ * - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+ * - `port` must be a valid dart native port
+ */
+FileStreamHandle file_write_stream_open_dart(SessionHandle session,
+                                             FileHandle handle,
+                                             uint64_t offset,
+                                             PostDartCObjectFn post_c_object_fn,
+                                             Port port);
+
+/**
+ * Allows a read stream to push `credits` more chunks (clamped so the total stays within the
+ * supported maximum). Does nothing for write streams or invalid handles.
+ *
+ * # Safety
+ *
+ * `session` must be a valid session handle.
+ */
+void file_stream_grant(SessionHandle session, FileStreamHandle stream, uint64_t credits);
+
+/**
+ * Enqueues a chunk to be written by a write stream. Returns `false` if the handle is invalid or
+ * doesn't refer to a write stream.
+ *
+ * # Safety
+ *
+ * `session` must be a valid session handle, `chunk_ptr` must be a pointer to a byte buffer whose
+ * length is at least `chunk_len` bytes.
+ */
+bool file_stream_write(SessionHandle session,
+                       FileStreamHandle stream,
+                       const uint8_t *chunk_ptr,
+                       uint64_t chunk_len);
+
+/**
+ * Closes a file stream. Read streams stop immediately, write streams finish writing the pending
+ * chunks and flush the file first.
+ *
+ * # Safety
+ *
+ * `session` must be a valid session handle.
+ */
+void file_stream_close(SessionHandle session, FileStreamHandle stream);
+
 /**
  * Deallocate string that has been allocated on the rust side
  *
@@ -43,6 +43,26 @@ typedef _file_copy_to_raw_fd_c = Void Function(
 typedef file_copy_to_raw_fd_dart = void Function(
     int, int, int, Pointer<NativeFunction<PostCObject>>, int);
 
+typedef _file_read_stream_open_c = Uint64 Function(Uint64, Uint64, Uint64,
+    Uint64, Uint64, Pointer<NativeFunction<PostCObject>>, Int64);
+typedef file_read_stream_open_dart = int Function(
+    int, int, int, int, int, Pointer<NativeFunction<PostCObject>>, int);
+
+typedef _file_write_stream_open_c = Uint64 Function(
+    Uint64, Uint64, Uint64, Pointer<NativeFunction<PostCObject>>, Int64);
+typedef file_write_stream_open_dart = int Function(
+    int, int, int, Pointer<NativeFunction<PostCObject>>, int);
+
+typedef _file_stream_grant_c = Void Function(Uint64, Uint64, Uint64);
+typedef file_stream_grant_dart = void Function(int, int, int);
+
+typedef _file_stream_write_c = Bool Function(
+    Uint64, Uint64, Pointer<Uint8>, Uint64);
+typedef file_stream_write_dart = bool Function(int, int, Pointer<Uint8>, int);
+
+typedef _file_stream_close_c = Void Function(Uint64, Uint64);
+typedef file_stream_close_dart = void Function(int, int);
+
 typedef _log_print_c = Void Function(Uint8, Pointer<Char>, Pointer<Char>);
 typedef log_print_dart = void Function(int, Pointer<Char>, Pointer<Char>);
 
@@ -79,6 +99,23 @@ class Bindings {
             .lookup<NativeFunction<_file_copy_to_raw_fd_c>>(
                 'file_copy_to_raw_fd_dart')
             .asFunction(),
+        file_read_stream_open = library
+            .lookup<NativeFunction<_file_read_stream_open_c>>(
+                'file_read_stream_open_dart')
+            .asFunction(),
+        file_write_stream_open = library
+            .lookup<NativeFunction<_file_write_stream_open_c>>(
+                'file_write_stream_open_dart')
+            .asFunction(),
+        file_stream_grant = library
+            .lookup<NativeFunction<_file_stream_grant_c>>('file_stream_grant')
+            .asFunction(),
+        file_stream_write = library
+            .lookup<NativeFunction<_file_stream_write_c>>('file_stream_write')
+            .asFunction(),
+        file_stream_close = library
+            .lookup<NativeFunction<_file_stream_close_c>>('file_stream_close')
+            .asFunction(),
         log_print = library
             .lookup<NativeFunction<_log_print_c>>('log_print')
             .asFunction(),
@@ -91,6 +128,11 @@ class Bindings {
   final session_close_dart session_close;
   final session_close_blocking_dart session_close_blocking;
   final file_copy_to_raw_fd_dart file_copy_to_raw_fd;
+  final file_read_stream_open_dart file_read_stream_open;
+  final file_write_stream_open_dart file_write_stream_open;
+  final file_stream_grant_dart file_stream_grant;
+  final file_stream_write_dart file_stream_write;
+  final file_stream_close_dart file_stream_close;
   final log_print_dart log_print;
   final free_string_dart free_string;
 }
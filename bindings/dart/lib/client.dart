@@ -57,6 +57,57 @@ class Client {
     }
   }
 
+  /// Sends multiple requests in a single frame and returns their results in the same order. The
+  /// requests are handled one after another in the given order.
+  /// Failed requests complete with an error in the corresponding future only, they don't affect
+  /// the other requests in the batch.
+  List<Future<Object?>> invokeBatch(List<(String, Object?)> requests) {
+    final completers = <int, Completer<Object?>>{};
+    final batch = <List<Object?>>[];
+
+    for (final (method, args) in requests) {
+      final id = _nextMessageId++;
+      completers[id] = Completer();
+      batch.add([id, {method: args}]);
+    }
+
+    unawaited(invoke<List<Object?>>('batch', batch).then(
+      (results) {
+        for (final result in results) {
+          if (result is! List || result.length != 2) {
+            continue;
+          }
+
+          final completer = completers.remove(result[0]);
+          final message = result[1];
+
+          if (completer == null || message is! Map) {
+            continue;
+          }
+
+          if (message.containsKey('success')) {
+            _handleResponseSuccess(completer, message['success']);
+          } else if (message.containsKey('failure')) {
+            _handleResponseFailure(completer, message['failure']);
+          } else {
+            _handleInvalidResponse(completer);
+          }
+        }
+
+        for (final completer in completers.values) {
+          _handleInvalidResponse(completer);
+        }
+      },
+      onError: (Object error, StackTrace stackTrace) {
+        for (final completer in completers.values) {
+          completer.completeError(error, stackTrace);
+        }
+      },
+    ));
+
+    return completers.values.map((completer) => completer.future).toList();
+  }
+
   int close() {
     final handle = _handle;
     _handle = 0;
@@ -88,7 +139,8 @@ class Client {
       }
 
       final id = bytes.buffer.asByteData().getUint64(0);
-      final message = deserialize(bytes.sublist(8));
+      // Large messages are backed by native memory, avoid copying them.
+      final message = deserialize(Uint8List.sublistView(bytes, 8));
 
       // DEBUG
       //print('recv: id: $id, message: $message');
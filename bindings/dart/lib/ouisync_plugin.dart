@@ -912,6 +912,148 @@ class File {
       ),
     );
   }
+
+  /// Reads the file starting at [offset] as a stream of chunks of at most [chunkSize] bytes.
+  ///
+  /// The chunks are pushed by the native side without a request per chunk. At most [window]
+  /// chunks are in flight at any time and more are granted as the returned stream is consumed.
+  Stream<Uint8List> readStream({
+    int offset = 0,
+    int chunkSize = 64 * 1024,
+    int window = 8,
+  }) async* {
+    if (debugTrace) {
+      print("File.readStream");
+    }
+
+    final recvPort = ReceivePort();
+    final messages = StreamIterator(recvPort.cast<Uint8List>());
+    final stream = bindings.file_read_stream_open(
+      _client.handle,
+      _handle,
+      offset,
+      chunkSize,
+      window,
+      NativeApi.postCObject,
+      recvPort.sendPort.nativePort,
+    );
+
+    try {
+      while (true) {
+        final chunk = await _receiveStreamMessage(messages);
+        if (chunk == null) {
+          break;
+        }
+
+        yield chunk;
+
+        bindings.file_stream_grant(_client.handle, stream, 1);
+      }
+    } finally {
+      if (stream != 0) {
+        bindings.file_stream_close(_client.handle, stream);
+      }
+
+      await messages.cancel();
+      recvPort.close();
+    }
+  }
+
+  /// Writes the chunks of [data] into the file starting at [offset] and flushes it.
+  ///
+  /// At most [window] chunks are queued on the native side at any time, the rest of [data] is not
+  /// consumed until some of them are written.
+  Future<void> writeStream(
+    Stream<List<int>> data, {
+    int offset = 0,
+    int window = 8,
+  }) async {
+    if (debugTrace) {
+      print("File.writeStream");
+    }
+
+    final recvPort = ReceivePort();
+    final messages = StreamIterator(recvPort.cast<Uint8List>());
+    var stream = bindings.file_write_stream_open(
+      _client.handle,
+      _handle,
+      offset,
+      NativeApi.postCObject,
+      recvPort.sendPort.nativePort,
+    );
+
+    try {
+      if (stream == 0) {
+        // The error has been posted to the port.
+        await _receiveStreamMessage(messages);
+        return;
+      }
+
+      var inFlight = 0;
+
+      await for (final chunk in data) {
+        while (inFlight >= window) {
+          await _receiveStreamMessage(messages);
+          inFlight--;
+        }
+
+        final buffer = malloc<Uint8>(chunk.length);
+
+        try {
+          buffer.asTypedList(chunk.length).setAll(0, chunk);
+          bindings.file_stream_write(
+              _client.handle, stream, buffer, chunk.length);
+        } finally {
+          malloc.free(buffer);
+        }
+
+        inFlight++;
+      }
+
+      bindings.file_stream_close(_client.handle, stream);
+      stream = 0;
+
+      // Wait for the remaining acknowledgements and the final flush.
+      while (await _receiveStreamMessage(messages) != null) {}
+    } finally {
+      if (stream != 0) {
+        bindings.file_stream_close(_client.handle, stream);
+      }
+
+      await messages.cancel();
+      recvPort.close();
+    }
+  }
+}
+
+// Tags of the messages sent by native file streams.
+const _streamTagChunk = 0;
+const _streamTagEnd = 1;
+const _streamTagError = 2;
+
+// Receives next message from a native file stream. Returns the chunk payload (empty for write
+// acknowledgments), null at the end of the stream or throws on error.
+Future<Uint8List?> _receiveStreamMessage(
+    StreamIterator<Uint8List> messages) async {
+  if (!await messages.moveNext()) {
+    return null;
+  }
+
+  final message = messages.current;
+
+  switch (message.isNotEmpty ? message[0] : -1) {
+    case _streamTagChunk:
+      return Uint8List.sublistView(message, 1);
+    case _streamTagEnd:
+      return null;
+    case _streamTagError:
+      final code = ErrorCode.decode(
+          ByteData.sublistView(message, 1).getUint16(0));
+      final text = utf8.decode(Uint8List.sublistView(message, 3));
+      throw Error(code, text);
+    default:
+      throw Exception('invalid stream message');
+  }
 }
 
 /// Print log message
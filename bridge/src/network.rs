@@ -1,5 +1,5 @@
 use crate::config::{ConfigKey, ConfigStore};
-use ouisync_lib::network::{peer_addr::PeerAddr, Network};
+use ouisync_lib::network::{peer_addr::PeerAddr, Network, QuicConfig};
 use serde::{Deserialize, Serialize};
 use std::net::SocketAddr;
 
@@ -12,6 +12,12 @@ const PORT_FORWARDING_ENABLED_KEY: ConfigKey<bool> =
 const LOCAL_DISCOVERY_ENABLED_KEY: ConfigKey<bool> =
     ConfigKey::new("local_discovery_enabled", "Enable local discovery");
 
+const QUIC_HIGH_THROUGHPUT_KEY: ConfigKey<bool> = ConfigKey::new(
+    "quic_high_throughput",
+    "Use the BBR congestion controller and larger flow control windows for QUIC connections.\n\
+     Improves throughput on long distance links with random loss. Applied on startup.",
+);
+
 const PEERS_KEY: ConfigKey<Vec<PeerAddr>> = ConfigKey::new(
     "peers",
     "List of peers to connect to in addition to the ones found by various discovery mechanisms\n\
@@ -51,6 +57,13 @@ pub struct NetworkDefaults {
 
 /// Initialize the network according to the config.
 pub async fn init(network: &Network, config: &ConfigStore, defaults: NetworkDefaults) {
+    let high_throughput = config
+        .entry(QUIC_HIGH_THROUGHPUT_KEY)
+        .get()
+        .await
+        .unwrap_or(false);
+    network.set_quic_config(QuicConfig { high_throughput });
+
     let bind_addrs = config.entry(BIND_KEY).get().await.unwrap_or_default();
     bind_with_reuse_ports(network, config, &bind_addrs).await;
 
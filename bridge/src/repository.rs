@@ -4,12 +4,19 @@ use crate::{
     protocol::remote::{v1, Request, ServerError},
     transport::RemoteClient,
 };
+use metrics::Label;
+use metrics_ext::{AddLabels, Shared};
 use ouisync_lib::{
     crypto::sign::Signature, Access, AccessMode, AccessSecrets, LocalSecret, Repository,
     RepositoryId, RepositoryParams, SetLocalSecret, ShareToken, StorageSize, WriteSecrets,
 };
 use state_monitor::StateMonitor;
-use std::{io, path::PathBuf, sync::Arc, time::Duration};
+use std::{
+    io,
+    path::{Path, PathBuf},
+    sync::Arc,
+    time::Duration,
+};
 use thiserror::Error;
 use tokio_rustls::rustls;
 use tracing::instrument;
@@ -49,6 +56,9 @@ pub enum RemoteError {
 /// any                |  None                |  write         |  read (only!) with secret key
 /// None               |  any                 |  write         |  read without secret, require secret key for writing
 /// any                |  any                 |  write         |  read with secret key, write with (same or different) secret key
+///
+/// If `recorder` is set, the repository metrics are recorded into it too, labeled with the
+/// repository name.
 pub async fn create(
     store: PathBuf,
     local_read_secret: Option<SetLocalSecret>,
@@ -56,7 +66,9 @@ pub async fn create(
     share_token: Option<ShareToken>,
     config: &ConfigStore,
     repos_monitor: &StateMonitor,
+    recorder: Option<&Shared>,
 ) -> Result<Repository, OpenError> {
+    let recorder = recorder.map(|recorder| labeled_recorder(recorder, &store));
     let params = RepositoryParams::new(store)
         .with_device_id(device_id::get_or_create(config).await?)
         .with_parent_monitor(repos_monitor.clone());
@@ -69,7 +81,11 @@ pub async fn create(
 
     let access = Access::new(local_read_secret, local_write_secret, access_secrets);
 
-    let repository = Repository::create(&params, access).await?;
+    let repository = if let Some(recorder) = recorder {
+        Repository::create(&params.with_recorder(recorder), access).await?
+    } else {
+        Repository::create(&params, access).await?
+    };
 
     let quota = get_default_quota(config).await?;
     repository.set_quota(quota).await?;
@@ -80,22 +96,43 @@ pub async fn create(
     Ok(repository)
 }
 
-/// Opens an existing repository.
+/// Opens an existing repository. See [`create`] for the meaning of `recorder`.
 pub async fn open(
     store: PathBuf,
     local_secret: Option<LocalSecret>,
     config: &ConfigStore,
     repos_monitor: &StateMonitor,
+    recorder: Option<&Shared>,
 ) -> Result<Repository, OpenError> {
+    let recorder = recorder.map(|recorder| labeled_recorder(recorder, &store));
     let params = RepositoryParams::new(store)
         .with_device_id(device_id::get_or_create(config).await?)
         .with_parent_monitor(repos_monitor.clone());
 
-    let repository = Repository::open(&params, local_secret, AccessMode::Write).await?;
+    let repository = if let Some(recorder) = recorder {
+        Repository::open(
+            &params.with_recorder(recorder),
+            local_secret,
+            AccessMode::Write,
+        )
+        .await?
+    } else {
+        Repository::open(&params, local_secret, AccessMode::Write).await?
+    };
 
     Ok(repository)
 }
 
+fn labeled_recorder(recorder: &Shared, store: &Path) -> AddLabels<Shared> {
+    let name = store
+        .file_stem()
+        .unwrap_or(store.as_os_str())
+        .to_string_lossy()
+        .into_owned();
+
+    AddLabels::new(vec![Label::new("repo", name)], recorder.clone())
+}
+
 /// The `key` parameter is optional, if `None` the current access level of the opened
 /// repository is used. If provided, the highest access level that the key can unlock is used.
 pub async fn create_share_token(
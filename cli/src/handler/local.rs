@@ -88,6 +88,7 @@ impl ouisync_bridge::transport::Handler for LocalHandler {
                     share_token,
                     &self.state.config,
                     &self.state.repositories_monitor,
+                    Some(self.state.metrics_server.recorder()),
                 )
                 .await?;
 
@@ -131,6 +132,7 @@ impl ouisync_bridge::transport::Handler for LocalHandler {
                     password.map(Password::from).map(LocalSecret::Password),
                     &self.state.config,
                     &self.state.repositories_monitor,
+                    Some(self.state.metrics_server.recorder()),
                 )
                 .await?;
 
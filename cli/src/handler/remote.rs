@@ -137,6 +137,7 @@ async fn create_repository(
         Some(ShareToken::from(secrets)),
         &state.config,
         &state.repositories_monitor,
+        Some(state.metrics_server.recorder()),
     )
     .await
     .map_err(|error| ServerError::Internal(error.to_string()))?;
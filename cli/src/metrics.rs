@@ -10,10 +10,11 @@ use hyper::{
 };
 use hyper_rustls::TlsAcceptor;
 use metrics::{Gauge, Key, KeyName, Label, Level, Metadata, Recorder, Unit};
-use metrics_exporter_prometheus::{PrometheusBuilder, PrometheusRecorder};
+use metrics_exporter_prometheus::{PrometheusBuilder, PrometheusHandle};
+use metrics_ext::Shared;
 use ouisync_bridge::config::{ConfigError, ConfigKey};
 use ouisync_lib::{network::PeerState, PeerInfoCollector, PublicRuntimeId};
-use scoped_task::ScopedAbortHandle;
+use scoped_task::{ScopedAbortHandle, ScopedJoinHandle};
 use std::{
     collections::HashMap,
     convert::Infallible,
@@ -23,7 +24,7 @@ use std::{
     sync::Mutex,
     time::{Duration, Instant},
 };
-use tokio::task;
+use tokio::{task, time};
 
 const BIND_METRICS_KEY: ConfigKey<SocketAddr> =
     ConfigKey::new("bind_metrics", "Addresses to bind the metrics endpoint to");
@@ -34,17 +35,38 @@ const GEO_IP_PATH: &str = "GeoLite2-Country.mmdb";
 // Rate limit for metrics collection (at most once per this interval)
 const COLLECT_INTERVAL: Duration = Duration::from_secs(10);
 
+// How often to drain the histogram samples recorded since the last upkeep. Without it they
+// accumulate for as long as nobody scrapes the metrics (the same interval the exporter uses when
+// installed as the global recorder).
+const UPKEEP_INTERVAL: Duration = Duration::from_secs(5);
+
 pub(crate) struct MetricsServer {
     handle: Mutex<Option<ScopedAbortHandle>>,
+    recorder: Shared,
+    recorder_handle: PrometheusHandle,
+    _upkeep: ScopedJoinHandle<()>,
 }
 
 impl MetricsServer {
     pub fn new() -> Self {
+        let recorder = PrometheusBuilder::new().build_recorder();
+        let recorder_handle = recorder.handle();
+        let upkeep = scoped_task::spawn(upkeep(recorder_handle.clone()));
+
         Self {
             handle: Mutex::new(None),
+            recorder: Shared::new(recorder),
+            recorder_handle,
+            _upkeep: upkeep,
         }
     }
 
+    /// Recorder whose metrics are served by this server. The repositories record into it so their
+    /// metrics (e.g., the latency histograms) are available even before the server is bound.
+    pub fn recorder(&self) -> &Shared {
+        &self.recorder
+    }
+
     pub async fn init(&self, state: &State) -> Result<()> {
         let entry = state.config.entry(BIND_METRICS_KEY);
 
@@ -55,7 +77,7 @@ impl MetricsServer {
         };
 
         if let Some(addr) = addr {
-            let handle = start(state, addr).await?;
+            let handle = self.start(state, addr).await?;
             *self.handle.lock().unwrap() = Some(handle);
         }
 
@@ -66,7 +88,7 @@ impl MetricsServer {
         let entry = state.config.entry(BIND_METRICS_KEY);
 
         if let Some(addr) = addr {
-            let handle = start(state, addr).await?;
+            let handle = self.start(state, addr).await?;
             *self.handle.lock().unwrap() = Some(handle);
             entry.set(&addr).await?;
         } else {
@@ -80,12 +102,24 @@ impl MetricsServer {
     pub fn close(&self) {
         self.handle.lock().unwrap().take();
     }
-}
 
-async fn start(state: &State, addr: SocketAddr) -> Result<ScopedAbortHandle> {
-    let recorder = PrometheusBuilder::new().build_recorder();
-    let recorder_handle = recorder.handle();
+    async fn start(&self, state: &State, addr: SocketAddr) -> Result<ScopedAbortHandle> {
+        start(
+            state,
+            addr,
+            self.recorder.clone(),
+            self.recorder_handle.clone(),
+        )
+        .await
+    }
+}
 
+async fn start(
+    state: &State,
+    addr: SocketAddr,
+    recorder: Shared,
+    recorder_handle: PrometheusHandle,
+) -> Result<ScopedAbortHandle> {
     let (collect_requester, collect_acceptor) = sync::new(COLLECT_INTERVAL);
 
     let make_service = make_service_fn(move |_| {
@@ -135,9 +169,18 @@ async fn start(state: &State, addr: SocketAddr) -> Result<ScopedAbortHandle> {
     Ok(handle)
 }
 
+async fn upkeep(recorder_handle: PrometheusHandle) {
+    let mut interval = time::interval(UPKEEP_INTERVAL);
+
+    loop {
+        interval.tick().await;
+        recorder_handle.run_upkeep();
+    }
+}
+
 async fn collect(
     mut acceptor: sync::Acceptor,
-    recorder: PrometheusRecorder,
+    recorder: Shared,
     peer_info_collector: PeerInfoCollector,
     geo_ip_path: PathBuf,
 ) {
@@ -208,12 +251,7 @@ async fn collect(
 struct GaugeMap(HashMap<CountryCode, Gauge>);
 
 impl GaugeMap {
-    fn fetch(
-        &mut self,
-        country: CountryCode,
-        recorder: &PrometheusRecorder,
-        key_name: &KeyName,
-    ) -> &Gauge {
+    fn fetch(&mut self, country: CountryCode, recorder: &Shared, key_name: &KeyName) -> &Gauge {
         self.0.entry(country).or_insert_with(|| {
             let label = Label::new("country", country.to_string());
             let key = Key::from_parts(key_name.clone(), vec![label]);
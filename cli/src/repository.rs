@@ -1,6 +1,7 @@
 use crate::{options::Dirs, utils, DB_EXTENSION};
 use anyhow::{Context as _, Result};
 use camino::Utf8Path;
+use metrics_ext::Shared;
 use ouisync_bridge::{config::ConfigStore, protocol::remote::v1, transport::RemoteClient};
 use ouisync_lib::{
     network::{Network, Registration},
@@ -418,6 +419,7 @@ pub(crate) async fn find_all(
     network: &Network,
     config: &ConfigStore,
     monitor: &StateMonitor,
+    recorder: &Shared,
 ) -> RepositoryMap {
     let repositories = RepositoryMap::new();
 
@@ -446,15 +448,21 @@ pub(crate) async fn find_all(
             continue;
         }
 
-        let repository =
-            match ouisync_bridge::repository::open(path.to_path_buf(), None, config, monitor).await
-            {
-                Ok(repository) => repository,
-                Err(error) => {
-                    tracing::error!(?error, ?path, "Failed to open repository");
-                    continue;
-                }
-            };
+        let repository = match ouisync_bridge::repository::open(
+            path.to_path_buf(),
+            None,
+            config,
+            monitor,
+            Some(recorder),
+        )
+        .await
+        {
+            Ok(repository) => repository,
+            Err(error) => {
+                tracing::error!(?error, ?path, "Failed to open repository");
+                continue;
+            }
+        };
 
         let metadata = repository.metadata();
 
@@ -52,9 +52,17 @@ impl State {
         )
         .await;
 
+        let metrics_server = MetricsServer::new();
+
         let repositories_monitor = monitor.make_child("Repositories");
-        let repositories =
-            repository::find_all(dirs, &network, &config, &repositories_monitor).await;
+        let repositories = repository::find_all(
+            dirs,
+            &network,
+            &config,
+            &repositories_monitor,
+            metrics_server.recorder(),
+        )
+        .await;
 
         let state = Self {
             config,
@@ -64,7 +72,7 @@ impl State {
             repositories,
             repositories_monitor,
             rpc_servers: ServerContainer::new(),
-            metrics_server: MetricsServer::new(),
+            metrics_server,
             server_config: OnceCell::new(),
             client_config: OnceCell::new(),
         };
@@ -5,7 +5,12 @@
 
 use crate::sender::Sender;
 use bytes::Bytes;
-use std::mem;
+use std::{ffi::c_void, mem};
+
+/// Messages at least this big are posted to dart as external typed data (backed directly by the
+/// rust-side buffer) instead of being copied into the dart heap. For smaller messages the copy is
+/// cheaper than the finalizer bookkeeping.
+const EXTERNAL_TYPED_DATA_THRESHOLD: usize = 4 * 1024;
 
 pub(crate) struct PortSender {
     post_c_object_fn: PostDartCObjectFn,
@@ -26,10 +31,14 @@ impl PortSender {
 
 impl Sender for PortSender {
     fn send(&self, msg: Bytes) {
+        let mut object = DartCObject::from(msg);
+
         // Safety: `self` must be created via `PortSender::new` and its safety instructions must be
         // followed and `self.post_c_object_fn` can't be modified afterwards.
-        unsafe {
-            (self.post_c_object_fn)(self.port, &mut msg.into());
+        let posted = unsafe { (self.post_c_object_fn)(self.port, &mut object) };
+
+        if posted {
+            object.release_external();
         }
     }
 }
@@ -43,9 +52,47 @@ pub struct DartCObject {
     value: DartCObjectValue,
 }
 
-// TODO: consider using `ExternallyTypedData` to avoid copies
+impl DartCObject {
+    /// Forgets the buffer backing this object if it's external typed data. Must be called after
+    /// the object has been successfully posted, because from then on the buffer is owned by dart
+    /// and is released by the finalizer.
+    fn release_external(self) {
+        match self.type_ {
+            DartCObjectType::TypedData => (),
+            DartCObjectType::ExternalTypedData => mem::forget(self),
+        }
+    }
+
+    // Hands the buffer over to dart without copying. The `Bytes` handle is kept alive as the
+    // finalizer peer and dropped when dart garbage-collects the typed data.
+    fn external(value: Bytes) -> Self {
+        let length = value.len() as isize;
+        // NOTE: dart sees the data as mutable but the client never writes into the received
+        // messages.
+        let data = value.as_ptr() as *mut u8;
+        let peer = Box::into_raw(Box::new(value)) as *mut c_void;
+
+        Self {
+            type_: DartCObjectType::ExternalTypedData,
+            value: DartCObjectValue {
+                as_external_typed_data: DartExternalTypedData {
+                    type_: DartTypedDataType::Uint8,
+                    length,
+                    data,
+                    peer,
+                    callback: finalize_external_typed_data,
+                },
+            },
+        }
+    }
+}
+
 impl From<Bytes> for DartCObject {
     fn from(value: Bytes) -> Self {
+        if value.len() >= EXTERNAL_TYPED_DATA_THRESHOLD {
+            return Self::external(value);
+        }
+
         let value = Vec::from(value);
         let mut slice = value.into_boxed_slice();
         let ptr = slice.as_mut_ptr();
@@ -65,6 +112,15 @@ impl From<Bytes> for DartCObject {
     }
 }
 
+unsafe extern "C" fn finalize_external_typed_data(
+    _isolate_callback_data: *mut c_void,
+    peer: *mut c_void,
+) {
+    // SAFETY: `peer` was created by `Box::into_raw` in `DartCObject::external` and dart invokes
+    // the finalizer exactly once.
+    let _ = Box::from_raw(peer as *mut Bytes);
+}
+
 impl Drop for DartCObject {
     fn drop(&mut self) {
         match self.type_ {
@@ -85,6 +141,17 @@ impl Drop for DartCObject {
                     }
                 }
             }
+            DartCObjectType::ExternalTypedData => {
+                // SAFETY: When `type_` is `ExternalTypedData` then `value` is a
+                // `DartExternalTypedData` whose `peer` is a boxed `Bytes`. We only get here when
+                // the object was not posted, so the finalizer is never going to run.
+                unsafe {
+                    finalize_external_typed_data(
+                        std::ptr::null_mut(),
+                        self.value.as_external_typed_data.peer,
+                    );
+                }
+            }
         }
     }
 }
@@ -100,7 +167,7 @@ pub(crate) enum DartCObjectType {
     // String = 5,
     // Array = 6,
     TypedData = 7,
-    // ExternalTypedData = 8,
+    ExternalTypedData = 8,
     // SendPort = 9,
     // Capability = 10,
     // NativePointer = 11,
@@ -119,7 +186,7 @@ pub(crate) union DartCObjectValue {
     // as_capability: DartCapability,
     // as_array: DartArray,
     as_typed_data: DartTypedData,
-    // as_external_typed_data: DartExternalTypedData,
+    as_external_typed_data: DartExternalTypedData,
     // as_native_pointer: DartPointer,
     _align: [u64; 5usize],
 }
@@ -168,14 +235,15 @@ pub(crate) enum DartTypedDataType {
     // Invalid = 13,
 }
 
-// #[repr(C)]
-// struct DartExternalTypedData {
-//     ty: DartTypedDataType,
-//     length: isize, // in elements, not bytes
-//     data: *mut u8,
-//     peer: *mut c_void,
-//     callback: DartHandleFinalizer,
-// }
+#[repr(C)]
+#[derive(Copy, Clone)]
+pub(crate) struct DartExternalTypedData {
+    pub type_: DartTypedDataType,
+    pub length: isize, // in elements, not bytes
+    pub data: *mut u8,
+    pub peer: *mut c_void,
+    pub callback: DartHandleFinalizer,
+}
 
 // #[repr(C)]
 // struct DartPointer {
@@ -184,5 +252,5 @@ pub(crate) enum DartTypedDataType {
 //     callback: DartHandleFinalizer,
 // }
 
-// type DartHandleFinalizer =
-//     unsafe extern "C" fn(isolate_callback_data: *mut c_void, peer: *mut c_void);
+pub(crate) type DartHandleFinalizer =
+    unsafe extern "C" fn(isolate_callback_data: *mut c_void, peer: *mut c_void);
@@ -15,7 +15,7 @@ use serde::{Deserialize, Serialize};
 use std::{io, iter};
 use thiserror::Error;
 
-#[derive(Debug, Error, Serialize, Deserialize)]
+#[derive(Eq, PartialEq, Debug, Error, Serialize, Deserialize)]
 #[error("{message}")]
 pub struct Error {
     pub code: ErrorCode,
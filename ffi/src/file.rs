@@ -1,8 +1,13 @@
-use crate::{error::Error, registry::Handle, repository::RepositoryHandle, state::State};
+use crate::{
+    error::Error, registry::Handle, repository::RepositoryHandle, sender::Sender, state::State,
+};
+use bytes::{BufMut, Bytes, BytesMut};
 use camino::Utf8PathBuf;
 use deadlock::AsyncMutex;
 use ouisync_lib::{Branch, File};
+use scoped_task::ScopedJoinHandle;
 use std::{io::SeekFrom, sync::Arc};
+use tokio::sync::{mpsc, Semaphore};
 
 pub struct FileHolder {
     pub(crate) file: AsyncMutex<File>,
@@ -154,3 +159,171 @@ pub(crate) async fn progress(state: &State, handle: FileHandle) -> Result<u64, E
 
     Ok(progress)
 }
+
+/// Tags of the messages posted by file streams. Every message starts with one of these.
+pub(crate) mod stream_tag {
+    /// Chunk of the file content (read stream) or acknowledgement of a written chunk (write
+    /// stream). Each acknowledgement returns one credit to the guest.
+    pub const CHUNK: u8 = 0;
+    /// End of file reached (read stream) or all chunks written and flushed (write stream).
+    pub const END: u8 = 1;
+    /// The stream failed. Followed by the error code (big endian u16) and the error message.
+    pub const ERROR: u8 = 2;
+}
+
+/// Stream of chunks flowing between a file and the guest language, bypassing the per-call
+/// request/response protocol.
+pub(crate) enum FileStream {
+    Reader {
+        credits: Arc<Semaphore>,
+        _task: ScopedJoinHandle<()>,
+    },
+    Writer {
+        chunk_tx: mpsc::UnboundedSender<Bytes>,
+    },
+}
+
+pub(crate) type FileStreamHandle = Handle<Arc<FileStream>>;
+
+impl FileStream {
+    /// Allows the read stream to push `credits` more chunks. Does nothing on write streams whose
+    /// credits are returned by acknowledging the written chunks instead.
+    pub fn grant(&self, credits: u64) {
+        match self {
+            Self::Reader { credits: sem, .. } => {
+                sem.add_permits(clamp_credits(credits, sem.available_permits()))
+            }
+            Self::Writer { .. } => (),
+        }
+    }
+
+    /// Enqueues a chunk to be written by the write stream.
+    pub fn write(&self, chunk: Bytes) -> Result<(), Error> {
+        match self {
+            Self::Reader { .. } => Err(ouisync_lib::Error::OperationNotSupported.into()),
+            Self::Writer { chunk_tx } => {
+                // If the writer is gone it has already reported the error to the guest.
+                chunk_tx.send(chunk).ok();
+                Ok(())
+            }
+        }
+    }
+}
+
+/// Max size of the chunks pushed by a read stream. Bigger chunk sizes requested by the guest are
+/// clamped to it so the chunk buffer allocation stays bounded.
+pub(crate) const MAX_STREAM_CHUNK_SIZE: usize = 1024 * 1024;
+
+/// Clamps the chunk size requested by the guest to `MAX_STREAM_CHUNK_SIZE`.
+pub(crate) fn clamp_chunk_size(chunk_size: u64) -> usize {
+    usize::try_from(chunk_size)
+        .unwrap_or(usize::MAX)
+        .min(MAX_STREAM_CHUNK_SIZE)
+}
+
+/// Clamps the credits granted by the guest so that together with the `available` ones they don't
+/// exceed `Semaphore::MAX_PERMITS` (the semaphore panics otherwise).
+pub(crate) fn clamp_credits(credits: u64, available: usize) -> usize {
+    let max = Semaphore::MAX_PERMITS.saturating_sub(available);
+    usize::try_from(credits).unwrap_or(usize::MAX).min(max)
+}
+
+/// Pushes the file content starting at `offset` to `sender` in chunks of at most `chunk_size`
+/// bytes. Every chunk consumes one credit and the stream pauses when there are none left. Ends
+/// with `END` on EOF or `ERROR` on failure.
+pub(crate) async fn stream_read(
+    holder: Arc<FileHolder>,
+    offset: u64,
+    chunk_size: usize,
+    credits: Arc<Semaphore>,
+    sender: impl Sender,
+) {
+    match stream_read_chunks(&holder, offset, chunk_size, &credits, &sender).await {
+        Ok(()) => sender.send(Bytes::from_static(&[stream_tag::END])),
+        Err(error) => sender.send(encode_stream_error(&error)),
+    }
+}
+
+async fn stream_read_chunks(
+    holder: &FileHolder,
+    mut offset: u64,
+    chunk_size: usize,
+    credits: &Semaphore,
+    sender: &impl Sender,
+) -> Result<(), Error> {
+    loop {
+        let Ok(permit) = credits.acquire().await else {
+            return Ok(());
+        };
+        permit.forget();
+
+        // Reserve the first byte for the tag so the chunk can be sent without copying.
+        let mut chunk = BytesMut::zeroed(1 + chunk_size);
+        chunk[0] = stream_tag::CHUNK;
+
+        let len = {
+            let mut file = holder.file.lock().await;
+            file.seek(SeekFrom::Start(offset));
+            file.read_all(&mut chunk[1..]).await?
+        };
+
+        if len == 0 {
+            return Ok(());
+        }
+
+        offset += len as u64;
+        chunk.truncate(1 + len);
+        sender.send(chunk.freeze());
+    }
+}
+
+/// Writes the chunks received from `chunk_rx` into the file starting at `offset` and acknowledges
+/// each one with `CHUNK`. Once `chunk_rx` is closed, flushes the file and sends `END` (or `ERROR`
+/// on failure).
+pub(crate) async fn stream_write(
+    holder: Arc<FileHolder>,
+    offset: u64,
+    chunk_rx: mpsc::UnboundedReceiver<Bytes>,
+    sender: impl Sender,
+) {
+    match stream_write_chunks(&holder, offset, chunk_rx, &sender).await {
+        Ok(()) => sender.send(Bytes::from_static(&[stream_tag::END])),
+        Err(error) => sender.send(encode_stream_error(&error)),
+    }
+}
+
+async fn stream_write_chunks(
+    holder: &FileHolder,
+    mut offset: u64,
+    mut chunk_rx: mpsc::UnboundedReceiver<Bytes>,
+    sender: &impl Sender,
+) -> Result<(), Error> {
+    let local_branch = holder
+        .local_branch
+        .as_ref()
+        .ok_or(ouisync_lib::Error::PermissionDenied)?;
+
+    while let Some(chunk) = chunk_rx.recv().await {
+        {
+            let mut file = holder.file.lock().await;
+            file.seek(SeekFrom::Start(offset));
+            file.fork(local_branch.clone()).await?;
+            file.write_all(&chunk).await?;
+        }
+
+        offset += chunk.len() as u64;
+        sender.send(Bytes::from_static(&[stream_tag::CHUNK]));
+    }
+
+    holder.file.lock().await.flush().await?;
+
+    Ok(())
+}
+
+pub(crate) fn encode_stream_error(error: &Error) -> Bytes {
+    let mut buffer = BytesMut::new();
+    buffer.put_u8(stream_tag::ERROR);
+    buffer.put_u16(error.code as u16);
+    buffer.put_slice(error.message.as_bytes());
+    buffer.freeze()
+}
@@ -1,8 +1,8 @@
 use crate::{
     directory,
-    error::Error,
+    error::{Error, ErrorCode},
     file, network,
-    protocol::{Request, Response},
+    protocol::{BatchResult, Request, Response},
     repository, share_token,
     state::State,
     state_monitor,
@@ -21,21 +21,29 @@ impl Handler {
     pub fn new(state: Arc<State>) -> Self {
         Self { state }
     }
-}
 
-#[async_trait]
-impl ouisync_bridge::transport::Handler for Handler {
-    type Request = Request;
-    type Response = Response;
-    type Error = Error;
-
-    async fn handle(
+    async fn handle_batch(
         &self,
-        request: Self::Request,
+        requests: Vec<(u64, Request)>,
         context: &SessionContext,
-    ) -> Result<Self::Response, Self::Error> {
-        tracing::trace!(?request);
+    ) -> Response {
+        // Handle the requests one by one in the order they were sent, so a request can depend on
+        // the effects of the ones before it (e.g. write then flush).
+        let mut results = Vec::with_capacity(requests.len());
+
+        for (id, request) in requests {
+            let result = self.handle_single(request, context).await;
+            results.push((id, BatchResult::from(result)));
+        }
+
+        Response::Batch(results)
+    }
 
+    async fn handle_single(
+        &self,
+        request: Request,
+        context: &SessionContext,
+    ) -> Result<Response, Error> {
         let response = match request {
             Request::RepositoryCreate {
                 path,
@@ -416,8 +424,34 @@ impl ouisync_bridge::transport::Handler for Handler {
                 .as_array()
                 .to_vec()
                 .into(),
+            Request::Batch(_) => {
+                return Err(Error {
+                    code: ErrorCode::InvalidArgument,
+                    message: "nested batch requests are not supported".to_owned(),
+                })
+            }
         };
 
         Ok(response)
     }
 }
+
+#[async_trait]
+impl ouisync_bridge::transport::Handler for Handler {
+    type Request = Request;
+    type Response = Response;
+    type Error = Error;
+
+    async fn handle(
+        &self,
+        request: Self::Request,
+        context: &SessionContext,
+    ) -> Result<Self::Response, Self::Error> {
+        tracing::trace!(?request);
+
+        match request {
+            Request::Batch(requests) => Ok(self.handle_batch(requests, context).await),
+            request => self.handle_single(request, context).await,
+        }
+    }
+}
@@ -25,7 +25,7 @@ use crate::{
     c::{Callback, CallbackSender},
     dart::{Port, PortSender, PostDartCObjectFn},
     error::Error,
-    file::FileHandle,
+    file::{FileHandle, FileStream, FileStreamHandle},
     log::LogLevel,
     sender::Sender,
     session::{SessionCreateResult, SessionHandle},
@@ -35,6 +35,7 @@ use std::{
     ffi::CString,
     os::raw::{c_char, c_int},
     slice,
+    sync::Arc,
 };
 
 /// Creates a ouisync session (common C-like API)
@@ -221,6 +222,170 @@ pub unsafe extern "C" fn file_copy_to_raw_fd_dart(
     ))
 }
 
+/// Opens a stream that pushes the file contents, starting at `offset`, to the given port in chunks
+/// of at most `chunk_size` bytes (dart-specific API).
+///
+/// Each message starts with a one byte tag: `0` - chunk of data follows, `1` - end of file, `2` -
+/// error (followed by the error code and message). The stream sends at most `credits` chunks and
+/// then pauses until more are granted with `file_stream_grant`. Credits above the supported
+/// maximum are clamped to it. A zero `chunk_size` is rejected with `InvalidArgument` and one
+/// above 1 MiB is clamped to 1 MiB. Returns a handle to the stream which must be eventually
+/// closed with `file_stream_close`. On failure returns the null handle and posts the error to
+/// the port.
+///
+/// # Safety
+///
+/// - `session` must be a valid session handle
+/// - `handle` must be a valid file holder handle
+/// - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+/// - `port` must be a valid dart native port
+#[no_mangle]
+pub unsafe extern "C" fn file_read_stream_open_dart(
+    session: SessionHandle,
+    handle: FileHandle,
+    offset: u64,
+    chunk_size: u64,
+    credits: u64,
+    post_c_object_fn: PostDartCObjectFn,
+    port: Port,
+) -> FileStreamHandle {
+    let session = session.get();
+    let sender = PortSender::new(post_c_object_fn, port);
+
+    // Empty chunks would never advance the stream.
+    if chunk_size == 0 {
+        sender.send(file::encode_stream_error(
+            &ouisync_lib::Error::InvalidArgument.into(),
+        ));
+        return FileStreamHandle::from_id(0);
+    }
+
+    let holder = match session.shared.state.files.get(handle) {
+        Ok(holder) => holder,
+        Err(error) => {
+            sender.send(file::encode_stream_error(&error.into()));
+            return FileStreamHandle::from_id(0);
+        }
+    };
+
+    let credits = Arc::new(tokio::sync::Semaphore::new(file::clamp_credits(credits, 0)));
+    let task = session.shared.runtime.spawn(file::stream_read(
+        holder,
+        offset,
+        file::clamp_chunk_size(chunk_size),
+        credits.clone(),
+        sender,
+    ));
+
+    session
+        .shared
+        .state
+        .file_streams
+        .insert(Arc::new(FileStream::Reader {
+            credits,
+            _task: scoped_task::ScopedJoinHandle(task),
+        }))
+}
+
+/// Opens a stream that writes chunks passed to `file_stream_write` into the file, starting at
+/// `offset` (dart-specific API).
+///
+/// Every written chunk is acknowledged by posting a message with the tag `0` to the given port so
+/// the caller can limit the number of chunks in flight. After `file_stream_close` the remaining
+/// chunks are written, the file is flushed and `1` is posted. Errors are posted with the tag `2`
+/// followed by the error code and message. On failure returns the null handle and posts the error
+/// to the port.
+///
+/// # Safety
+///
+/// - `session` must be a valid session handle
+/// - `handle` must be a valid file holder handle
+/// - `post_c_object_fn` must be a pointer to the dart's `NativeApi.postCObject` function
+/// - `port` must be a valid dart native port
+#[no_mangle]
+pub unsafe extern "C" fn file_write_stream_open_dart(
+    session: SessionHandle,
+    handle: FileHandle,
+    offset: u64,
+    post_c_object_fn: PostDartCObjectFn,
+    port: Port,
+) -> FileStreamHandle {
+    let session = session.get();
+    let sender = PortSender::new(post_c_object_fn, port);
+
+    let holder = match session.shared.state.files.get(handle) {
+        Ok(holder) => holder,
+        Err(error) => {
+            sender.send(file::encode_stream_error(&error.into()));
+            return FileStreamHandle::from_id(0);
+        }
+    };
+
+    let (chunk_tx, chunk_rx) = tokio::sync::mpsc::unbounded_channel();
+    session
+        .shared
+        .runtime
+        .spawn(file::stream_write(holder, offset, chunk_rx, sender));
+
+    session
+        .shared
+        .state
+        .file_streams
+        .insert(Arc::new(FileStream::Writer { chunk_tx }))
+}
+
+/// Allows a read stream to push `credits` more chunks (clamped so the total stays within the
+/// supported maximum). Does nothing for write streams or invalid handles.
+///
+/// # Safety
+///
+/// `session` must be a valid session handle.
+#[no_mangle]
+pub unsafe extern "C" fn file_stream_grant(
+    session: SessionHandle,
+    stream: FileStreamHandle,
+    credits: u64,
+) {
+    if let Ok(stream) = session.get().shared.state.file_streams.get(stream) {
+        stream.grant(credits);
+    }
+}
+
+/// Enqueues a chunk to be written by a write stream. Returns `false` if the handle is invalid or
+/// doesn't refer to a write stream.
+///
+/// # Safety
+///
+/// `session` must be a valid session handle, `chunk_ptr` must be a pointer to a byte buffer whose
+/// length is at least `chunk_len` bytes.
+#[no_mangle]
+pub unsafe extern "C" fn file_stream_write(
+    session: SessionHandle,
+    stream: FileStreamHandle,
+    chunk_ptr: *const u8,
+    chunk_len: u64,
+) -> bool {
+    let Ok(stream) = session.get().shared.state.file_streams.get(stream) else {
+        return false;
+    };
+
+    let chunk = slice::from_raw_parts(chunk_ptr, chunk_len as usize);
+    let chunk = bytes::Bytes::copy_from_slice(chunk);
+
+    stream.write(chunk).is_ok()
+}
+
+/// Closes a file stream. Read streams stop immediately, write streams finish writing the pending
+/// chunks and flush the file first.
+///
+/// # Safety
+///
+/// `session` must be a valid session handle.
+#[no_mangle]
+pub unsafe extern "C" fn file_stream_close(session: SessionHandle, stream: FileStreamHandle) {
+    session.get().shared.state.file_streams.remove(stream);
+}
+
 fn encode_error(error: &Error) -> bytes::Bytes {
     use bytes::{BufMut, BytesMut};
 
@@ -1,5 +1,6 @@
 use crate::{
     directory::Directory,
+    error::Error,
     file::FileHandle,
     registry::Handle,
     repository::{MetadataEdit, RepositoryHandle},
@@ -204,6 +205,11 @@ pub(crate) enum Request {
     },
     GetReadPasswordSalt(RepositoryHandle),
     GetWritePasswordSalt(RepositoryHandle),
+    /// Multiple requests sent in a single frame, each tagged with its own message id. They are
+    /// handled sequentially in order and all their results are sent back in a single
+    /// `Response::Batch`.
+    /// Batches can't be nested.
+    Batch(Vec<(u64, Request)>),
 }
 
 #[derive(Eq, PartialEq, Serialize, Deserialize)]
@@ -224,6 +230,24 @@ pub(crate) enum Response {
     PeerInfos(Vec<PeerInfo>),
     PeerAddrs(#[serde(with = "as_vec_str")] Vec<PeerAddr>),
     TrafficStats(TrafficStats),
+    Batch(Vec<(u64, BatchResult)>),
+}
+
+/// Result of a single request inside `Request::Batch`.
+#[derive(Eq, PartialEq, Debug, Serialize, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub(crate) enum BatchResult {
+    Success(Response),
+    Failure(Error),
+}
+
+impl From<Result<Response, Error>> for BatchResult {
+    fn from(result: Result<Response, Error>) -> Self {
+        match result {
+            Ok(response) => Self::Success(response),
+            Err(error) => Self::Failure(error),
+        }
+    }
 }
 
 impl<T> From<Option<T>> for Response
@@ -447,6 +471,7 @@ impl fmt::Debug for Response {
                 .finish(),
             Self::PeerAddrs(value) => f.debug_tuple("PeerAddrs").field(value).finish(),
             Self::TrafficStats(value) => f.debug_tuple("TrafficStats").field(value).finish(),
+            Self::Batch(value) => f.debug_struct("Batch").field("len", &value.len()).finish(),
         }
     }
 }
@@ -586,6 +611,7 @@ impl fmt::Debug for Bytes {
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::error::ErrorCode;
     use ouisync_lib::{
         network::{PeerSource, PeerState},
         AccessSecrets, Credentials, PeerInfo, SecretRuntimeId,
@@ -607,6 +633,10 @@ mod tests {
                 repository: Handle::from_id(1),
                 credentials: credentials.encode().into(),
             },
+            Request::Batch(vec![
+                (1, Request::RepositoryClose(Handle::from_id(1))),
+                (2, Request::FileLen(Handle::from_id(2))),
+            ]),
         ];
 
         for orig in origs {
@@ -651,6 +681,16 @@ mod tests {
                 },
             ]),
             Response::PeerAddrs(vec![PeerAddr::Tcp(([192, 168, 1, 234], 45678).into())]),
+            Response::Batch(vec![
+                (1, BatchResult::Success(Response::U64(42))),
+                (
+                    2,
+                    BatchResult::Failure(Error {
+                        code: ErrorCode::InvalidHandle,
+                        message: "invalid handle".to_owned(),
+                    }),
+                ),
+            ]),
         ];
 
         for orig in origs {
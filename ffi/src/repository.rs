@@ -52,6 +52,7 @@ pub(crate) async fn create(
         share_token,
         &state.config,
         &state.repos_monitor,
+        None,
     )
     .await?;
 
@@ -97,6 +98,7 @@ pub(crate) async fn open(
         local_secret,
         &state.config,
         &state.repos_monitor,
+        None,
     )
     .await?;
 
@@ -1,5 +1,5 @@
 use crate::{
-    file::FileHolder,
+    file::{FileHolder, FileStream},
     mounter::Mounter,
     registry::{Handle, SharedRegistry},
     repository::Repositories,
@@ -19,6 +19,7 @@ use tokio::sync::{oneshot, OnceCell};
 pub(crate) struct State {
     pub config: ConfigStore,
     pub files: SharedRegistry<Arc<FileHolder>>,
+    pub file_streams: SharedRegistry<Arc<FileStream>>,
     pub mounter: Mounter,
     pub network: Network,
     pub remote_client_config: OnceCell<Arc<rustls::ClientConfig>>,
@@ -42,6 +43,7 @@ impl State {
         Self {
             config,
             files: SharedRegistry::new(),
+            file_streams: SharedRegistry::new(),
             mounter: Mounter::new(),
             network,
             remote_client_config: OnceCell::new(),
@@ -26,7 +26,7 @@ fn write_file(c: &mut Criterion) {
         group.bench_function(BenchmarkId::from_parameter(format!("{m} MiB")), |b| {
             b.iter_batched_ref(
                 || {
-                    let mut rng = StdRng::from_entropy();
+                    let mut rng = StdRng::seed_from_u64(0);
                     let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
                     let repo = runtime.block_on(utils::create_repo(
                         &mut rng,
@@ -70,7 +70,7 @@ fn read_file(c: &mut Criterion) {
 
             b.iter_batched_ref(
                 || {
-                    let mut rng = StdRng::from_entropy();
+                    let mut rng = StdRng::seed_from_u64(0);
                     let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
 
                     let repo = runtime.block_on(async {
@@ -121,7 +121,7 @@ fn sync(c: &mut Criterion) {
 
             b.iter_batched_ref(
                 || {
-                    let mut rng = StdRng::from_entropy();
+                    let mut rng = StdRng::seed_from_u64(0);
                     let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
 
                     let (reader, writer) = runtime.block_on(async {
@@ -0,0 +1,325 @@
+//! Benchmarks of the repository operations whose cost depends on the shape of the repository
+//! (number and size of files, directory depth, number of branches, ...) rather than on the amount
+//! of data.
+//!
+//! All the inputs are generated from fixed seeds so the results are comparable across commits.
+//! Use criterion baselines for that, e.g.:
+//!
+//!     cargo bench --bench bench_repo -- --save-baseline before
+//!     (apply the change)
+//!     cargo bench --bench bench_repo -- --baseline before
+
+mod utils;
+
+use camino::{Utf8Path, Utf8PathBuf};
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+use futures_util::future;
+use rand::{rngs::StdRng, SeedableRng};
+use state_monitor::StateMonitor;
+use tempfile::TempDir;
+use tokio::runtime::Runtime;
+use utils::Actor;
+
+criterion_group!(
+    default,
+    write_files,
+    open_deep_file,
+    open_large_directory,
+    open_conflicting_directory,
+    collect_garbage,
+    sync_files
+);
+criterion_main!(default);
+
+const SEED: u64 = 0;
+
+// (file count, file size) pairs.
+const FILE_SETS: &[(usize, usize)] = &[(64, 1024), (64, 64 * 1024), (512, 1024)];
+
+fn write_files(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("lib/write_files");
+    group.sample_size(10);
+
+    for &(count, size) in FILE_SETS {
+        group.throughput(Throughput::Elements(count as u64));
+        group.bench_function(BenchmarkId::from_parameter(file_set_id(count, size)), |b| {
+            b.iter_batched_ref(
+                || {
+                    let mut rng = StdRng::seed_from_u64(SEED);
+                    let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+                    let repo = runtime.block_on(utils::create_repo(
+                        &mut rng,
+                        &base_dir.path().join("repo.db"),
+                        0,
+                        StateMonitor::make_root(),
+                    ));
+                    (rng, base_dir, repo)
+                },
+                |(rng, _base_dir, repo)| {
+                    runtime.block_on(utils::write_files(
+                        rng,
+                        repo,
+                        Utf8Path::new("files"),
+                        count,
+                        size,
+                    ))
+                },
+                BatchSize::LargeInput,
+            );
+        });
+    }
+
+    group.finish();
+}
+
+/// Open a file at the bottom of a chain of nested directories. After the first iteration all the
+/// directories are in the caches, so this mostly measures the cache lookups and the decoding of
+/// the directory contents.
+fn open_deep_file(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("lib/open_deep_file");
+
+    for depth in [1, 8, 32] {
+        let mut rng = StdRng::seed_from_u64(SEED);
+        let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+
+        let (repo, path) = runtime.block_on(async {
+            let repo = utils::create_repo(
+                &mut rng,
+                &base_dir.path().join("repo.db"),
+                0,
+                StateMonitor::make_root(),
+            )
+            .await;
+
+            let mut path = Utf8PathBuf::new();
+
+            for i in 0..depth {
+                path.push(format!("dir-{i}"));
+                repo.create_directory(&path).await.unwrap();
+            }
+
+            path.push("file.dat");
+            utils::write_file(&mut rng, &repo, &path, 1024, 1024, false).await;
+
+            (repo, path)
+        });
+
+        group.bench_function(BenchmarkId::from_parameter(depth), |b| {
+            b.iter(|| {
+                runtime.block_on(async {
+                    repo.open_file(&path).await.unwrap();
+                })
+            });
+        });
+
+        drop(repo);
+    }
+
+    group.finish();
+}
+
+/// Open a directory with many entries. Measures mostly loading and decoding of the directory
+/// content.
+fn open_large_directory(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("lib/open_large_directory");
+
+    for count in [16, 256, 2048] {
+        let mut rng = StdRng::seed_from_u64(SEED);
+        let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+
+        let repo = runtime.block_on(async {
+            let repo = utils::create_repo(
+                &mut rng,
+                &base_dir.path().join("repo.db"),
+                0,
+                StateMonitor::make_root(),
+            )
+            .await;
+
+            utils::write_files(&mut rng, &repo, Utf8Path::new("files"), count, 0).await;
+
+            repo
+        });
+
+        group.throughput(Throughput::Elements(count as u64));
+        group.bench_function(BenchmarkId::from_parameter(count), |b| {
+            b.iter(|| {
+                runtime.block_on(async {
+                    repo.open_directory("files").await.unwrap();
+                })
+            });
+        });
+
+        drop(repo);
+    }
+
+    group.finish();
+}
+
+/// Open a directory that exists in two concurrent branches with the same file names in both, so
+/// every entry is in conflict. Measures the merging of the directory versions.
+fn open_conflicting_directory(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("lib/open_conflicting_directory");
+    group.sample_size(10);
+
+    for count in [16, 256] {
+        let mut rng = StdRng::seed_from_u64(SEED);
+        let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+
+        let (a, b) = runtime.block_on(async {
+            let a = Actor::new(&mut rng, &base_dir.path().join("a")).await;
+            let b = Actor::new(&mut rng, &base_dir.path().join("b")).await;
+
+            let dir = Utf8Path::new("files");
+            utils::write_files(&mut rng, &a.repo, dir, count, 1024).await;
+            utils::write_files(&mut rng, &b.repo, dir, count, 1024).await;
+
+            a.connect_to(&b);
+            utils::wait_for_sync(&a.repo, &b.repo).await;
+
+            (a, b)
+        });
+
+        group.throughput(Throughput::Elements(count as u64));
+        group.bench_function(BenchmarkId::from_parameter(count), |bencher| {
+            bencher.iter(|| {
+                runtime.block_on(async {
+                    a.repo.open_directory("files").await.unwrap();
+                })
+            });
+        });
+
+        drop(a);
+        drop(b);
+    }
+
+    group.finish();
+}
+
+/// Remove a directory with many files and wait until the garbage collector removes their blocks.
+fn collect_garbage(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("lib/collect_garbage");
+    group.sample_size(10);
+
+    for &(count, size) in FILE_SETS {
+        group.throughput(Throughput::Elements(count as u64));
+        group.bench_function(BenchmarkId::from_parameter(file_set_id(count, size)), |b| {
+            b.iter_batched_ref(
+                || {
+                    let mut rng = StdRng::seed_from_u64(SEED);
+                    let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+
+                    let (repo, block_count) = runtime.block_on(async {
+                        let repo = utils::create_repo(
+                            &mut rng,
+                            &base_dir.path().join("repo.db"),
+                            0,
+                            StateMonitor::make_root(),
+                        )
+                        .await;
+
+                        // Only the root directory remains after the removal.
+                        repo.create_directory("files").await.unwrap();
+                        let block_count = repo.count_blocks().await.unwrap() - 1;
+
+                        utils::write_files(&mut rng, &repo, Utf8Path::new("files"), count, size)
+                            .await;
+
+                        (repo, block_count)
+                    });
+
+                    (base_dir, repo, block_count)
+                },
+                |(_base_dir, repo, block_count)| {
+                    runtime.block_on(async {
+                        repo.remove_entry_recursively("files").await.unwrap();
+                        utils::wait_for_block_count(repo, *block_count).await;
+                    })
+                },
+                BatchSize::LargeInput,
+            );
+        });
+    }
+
+    group.finish();
+}
+
+/// Sync many small files from one writer to the given number of readers.
+fn sync_files(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("lib/sync_files");
+    group.sample_size(10);
+
+    let (count, size) = FILE_SETS[0];
+
+    for num_readers in [1, 2, 4] {
+        group.throughput(Throughput::Elements(count as u64));
+        group.bench_function(BenchmarkId::from_parameter(num_readers), |b| {
+            b.iter_batched_ref(
+                || {
+                    let mut rng = StdRng::seed_from_u64(SEED);
+                    let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
+
+                    let (writer, readers) = runtime.block_on(async {
+                        let writer = Actor::new(&mut rng, &base_dir.path().join("writer")).await;
+
+                        let mut readers = Vec::with_capacity(num_readers);
+                        for i in 0..num_readers {
+                            let reader =
+                                Actor::new(&mut rng, &base_dir.path().join(format!("reader-{i}")))
+                                    .await;
+                            readers.push(reader);
+                        }
+
+                        utils::write_files(
+                            &mut rng,
+                            &writer.repo,
+                            Utf8Path::new("files"),
+                            count,
+                            size,
+                        )
+                        .await;
+
+                        (writer, readers)
+                    });
+
+                    (base_dir, writer, readers)
+                },
+                |(_base_dir, writer, readers)| {
+                    runtime.block_on(async {
+                        // Connect inside the timed part so the connection setup is measured too and
+                        // no syncing happens before the timer starts.
+                        for reader in readers.iter() {
+                            reader.connect_to(writer);
+                        }
+
+                        future::join_all(
+                            readers
+                                .iter()
+                                .map(|reader| utils::wait_for_sync(&reader.repo, &writer.repo)),
+                        )
+                        .await;
+                    });
+                },
+                BatchSize::LargeInput,
+            );
+        });
+    }
+
+    group.finish();
+}
+
+fn file_set_id(count: usize, size: usize) -> String {
+    format!("{count} x {} KiB", size / 1024)
+}
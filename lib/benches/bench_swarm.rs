@@ -9,7 +9,12 @@ use clap::Parser;
 use common::{actor, sync_watch, Env, Proto, DEFAULT_REPO};
 use ouisync::{AccessMode, File};
 use rand::{distributions::Standard, rngs::StdRng, Rng, SeedableRng};
-use std::{fmt, process::ExitCode, sync::Arc, time::Instant};
+use std::{
+    fmt,
+    process::ExitCode,
+    sync::Arc,
+    time::{Duration, Instant},
+};
 use tokio::sync::Barrier;
 
 fn main() -> ExitCode {
@@ -19,14 +24,52 @@ fn main() -> ExitCode {
         return ExitCode::FAILURE;
     }
 
-    let file_size = options.file_size;
+    if options
+        .max_file_size
+        .is_some_and(|max| max < options.file_size)
+    {
+        eprintln!("error: max file size must not be less than file size");
+        return ExitCode::FAILURE;
+    }
+
+    if options
+        .link_fail_rate
+        .is_some_and(|rate| !(0.0..=1.0).contains(&rate))
+    {
+        eprintln!("error: link fail rate must be between 0 and 1");
+        return ExitCode::FAILURE;
+    }
+
+    #[cfg(not(feature = "simulation"))]
+    if options.latency.is_some() || options.link_fail_rate.is_some() {
+        eprintln!("error: latency and link fail rate require the `simulation` feature");
+        return ExitCode::FAILURE;
+    }
+
+    // Size of each file is picked from the range using the file index as the seed, so all the
+    // actors (and all the runs) agree on it.
+    let file_sizes: Vec<_> = (0..options.file_count)
+        .map(|i| match options.max_file_size {
+            Some(max) => StdRng::seed_from_u64(i).gen_range(options.file_size..=max),
+            None => options.file_size,
+        })
+        .collect();
+    let file_sizes = Arc::new(file_sizes);
     let actors: Vec<_> = (0..options.num_writers)
         .map(|i| ActorId(AccessMode::Write, i))
         .chain((0..options.num_readers).map(|i| ActorId(AccessMode::Read, i)))
         .collect();
     let proto = options.protocol;
 
+    #[cfg(not(feature = "simulation"))]
     let mut env = Env::new();
+    #[cfg(feature = "simulation")]
+    let mut env = match (options.latency, options.link_fail_rate) {
+        (None, None) => Env::new(),
+        (latency, fail_rate) => {
+            Env::with_link(latency.unwrap_or_default(), fail_rate.unwrap_or_default())
+        }
+    };
 
     // Wait until everyone is fully synced.
     let (watch_tx, watch_rx) = sync_watch::channel();
@@ -36,9 +79,6 @@ fn main() -> ExitCode {
     // remain online for other actors to sync from.
     let barrier = Arc::new(Barrier::new(actors.len()));
 
-    let file_name = "file.dat";
-    let file_seed = 0;
-
     for actor in &actors {
         let other_actors: Vec<_> = actors
             .iter()
@@ -53,6 +93,7 @@ fn main() -> ExitCode {
             .flatten();
         let watch_rx = watch_rx.clone();
         let barrier = barrier.clone();
+        let file_sizes = file_sizes.clone();
 
         env.actor(&actor.to_string(), async move {
             let network = actor::create_network(proto).await;
@@ -70,15 +111,19 @@ fn main() -> ExitCode {
             if let Some(watch_tx) = watch_tx {
                 drop(watch_rx);
 
-                let mut file = repo.create_file(file_name).await.unwrap();
-                write_random_file(&mut file, file_seed, file_size).await;
+                for (seed, size) in file_sizes.iter().copied().enumerate() {
+                    let mut file = repo.create_file(file_name(seed)).await.unwrap();
+                    write_random_file(&mut file, seed as u64, size).await;
+                }
 
                 watch_tx.run(&repo).await;
             } else {
                 watch_rx.run(&repo).await;
 
-                let mut file = repo.open_file(file_name).await.unwrap();
-                check_random_file(&mut file, file_seed, file_size).await;
+                for (seed, size) in file_sizes.iter().copied().enumerate() {
+                    let mut file = repo.open_file(file_name(seed)).await.unwrap();
+                    check_random_file(&mut file, seed as u64, size).await;
+                }
             }
 
             info!("done");
@@ -107,6 +152,14 @@ struct Options {
     #[arg(short = 's', long, value_parser = parse_size, default_value_t = 1024 * 1024)]
     pub file_size: u64,
 
+    /// If set, the size of each file is picked randomly between `file_size` and this value.
+    #[arg(short = 'S', long, value_parser = parse_size)]
+    pub max_file_size: Option<u64>,
+
+    /// Number of files to share.
+    #[arg(short = 'n', long, default_value_t = 1)]
+    pub file_count: u64,
+
     /// Number of replicas with write access. Must be at least 1.
     #[arg(short = 'w', long, default_value_t = 2)]
     pub num_writers: usize,
@@ -119,6 +172,18 @@ struct Options {
     #[arg(short, long, value_parser, default_value_t = Proto::Quic)]
     pub protocol: Proto,
 
+    /// Max latency of the simulated network links. Can use time suffixes (ms, s, ...). Requires
+    /// the `simulation` feature.
+    #[arg(long, value_parser = parse_duration)]
+    pub latency: Option<Duration>,
+
+    /// Probability that a simulated network link fails in each simulation step (between 0 and 1).
+    /// This is turmoil's `fail_rate`: a failed link drops everything sent over it until it's
+    /// repaired, so it models partitions rather than independent packet loss. Requires the
+    /// `simulation` feature.
+    #[arg(long)]
+    pub link_fail_rate: Option<f64>,
+
     // `cargo bench` passes the `--bench` flag down to the bench binary so we need to accept it even
     // if we don't use it.
     #[arg(
@@ -152,6 +217,26 @@ fn parse_size(input: &str) -> Result<u64, parse_size::Error> {
     parse_size::parse_size(input)
 }
 
+fn parse_duration(input: &str) -> Result<Duration, String> {
+    let (value, unit) = input
+        .find(|c: char| !c.is_ascii_digit())
+        .map(|index| input.split_at(index))
+        .unwrap_or((input, "ms"));
+    let value: u64 = value
+        .parse()
+        .map_err(|_| format!("invalid duration: {input}"))?;
+
+    match unit.trim() {
+        "ms" => Ok(Duration::from_millis(value)),
+        "s" => Ok(Duration::from_secs(value)),
+        _ => Err(format!("invalid duration unit: {unit}")),
+    }
+}
+
+fn file_name(index: usize) -> String {
+    format!("file-{index}.dat")
+}
+
 async fn write_random_file(file: &mut File, seed: u64, size: u64) {
     let mut chunk = Vec::new();
     let mut gen = RandomChunks::new(seed, size);
@@ -95,6 +95,38 @@ pub async fn write_file(
     file.flush().await.unwrap();
 }
 
+/// Write `count` files of `size` random bytes each into the directory at `dir` (which is created
+/// if it doesn't exist). The files are named `0.dat`, `1.dat`, ...
+#[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+pub async fn write_files(
+    rng: &mut StdRng,
+    repo: &Repository,
+    dir: &Utf8Path,
+    count: usize,
+    size: usize,
+) {
+    if repo.lookup_type(dir).await.is_err() {
+        repo.create_directory(dir).await.unwrap();
+    }
+
+    for i in 0..count {
+        write_file(rng, repo, &dir.join(format!("{i}.dat")), size, 4096, false).await;
+    }
+}
+
+/// Wait until the repository contains at most `count` blocks (e.g., after removing some entries
+/// and letting the garbage collector run).
+#[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+pub async fn wait_for_block_count(repo: &Repository, count: u64) {
+    time::timeout(EVENT_TIMEOUT, async {
+        while repo.count_blocks().await.unwrap() > count {
+            time::sleep(Duration::from_millis(10)).await;
+        }
+    })
+    .await
+    .expect("timeout waiting for block count")
+}
+
 /// Read the whole content of the file at `path` in `buffer_size` bytes at a time. Returns the
 /// total size of the content.
 pub async fn read_file(repo: &Repository, path: &Utf8Path, buffer_size: usize) -> usize {
@@ -12,7 +12,7 @@ pub(crate) use self::{block_ids::BlockIds, id::BlobId};
 use self::position::Position;
 use crate::{
     branch::Branch,
-    collections::{hash_map::Entry, HashMap},
+    collections::HashMap,
     crypto::{
         cipher::{self, Nonce, SecretKey},
         sign::{Keypair, PublicKey},
@@ -25,8 +25,10 @@ use crate::{
     },
     store::{self, Changeset, ReadTransaction},
 };
-use std::{io::SeekFrom, iter, mem};
+use either::Either;
+use std::{io::SeekFrom, iter, mem, panic, thread};
 use thiserror::Error;
+use tokio::task;
 
 /// Size of the blob header in bytes.
 // Using u64 instead of usize because HEADER_SIZE must be the same irrespective of whether we're on
@@ -37,6 +39,14 @@ pub const HEADER_SIZE: usize = mem::size_of::<u64>();
 // during writes but increases the coplexity of the individual flushes.
 const CACHE_CAPACITY: usize = 2048; // 64 MiB
 
+// Max number of missing blocks, starting at the one being read, whose download is prioritized
+// when a read hits a block that's not been downloaded yet.
+const PRIORITIZED_BLOCKS: u32 = 32;
+
+// Max number of blocks loaded ahead of the current position when the blob is being read
+// sequentially.
+const READAHEAD_MAX: u32 = 16; // 512 KiB
+
 #[derive(Debug, Error)]
 pub(crate) enum ReadWriteError {
     #[error("block not found in the cache")]
@@ -52,6 +62,7 @@ pub(crate) struct Blob {
     len_original: u64,
     len_modified: u64,
     position: Position,
+    readahead: Readahead,
 }
 
 impl Blob {
@@ -84,9 +95,24 @@ impl Blob {
             len_original: len,
             len_modified: len,
             position,
+            readahead: Readahead::new(),
         })
     }
 
+    /// Opens an existing blob whose length is already known without loading any of its blocks.
+    /// The blocks are loaded on demand, as with a clone.
+    pub fn open_with_len(branch: Branch, id: BlobId, len: u64) -> Self {
+        Self {
+            branch,
+            id,
+            cache: HashMap::default(),
+            len_original: len,
+            len_modified: len,
+            position: Position::ZERO,
+            readahead: Readahead::new(),
+        }
+    }
+
     /// Creates a new blob.
     pub fn create(branch: Branch, id: BlobId) -> Self {
         let cached_block = CachedBlock::new().with_dirty(true);
@@ -99,6 +125,7 @@ impl Blob {
             len_original: 0,
             len_modified: 0,
             position: Position::ZERO,
+            readahead: Readahead::new(),
         }
     }
 
@@ -342,19 +369,90 @@ impl Blob {
         Ok(())
     }
 
-    /// Load the current block at the given snapshot into the cache.
+    /// Load the current block at the given snapshot into the cache. If the blob is being read
+    /// sequentially, also prefetches the following blocks.
     pub async fn warmup_at(
         &mut self,
         tx: &mut ReadTransaction,
         root_node: &RootNode,
     ) -> Result<()> {
-        match self.cache.entry(self.position.block) {
-            Entry::Occupied(_) => (),
-            Entry::Vacant(entry) => {
-                let locator = Locator::head(self.id).nth(self.position.block);
-                let (_, buffer) =
-                    read_block(tx, root_node, &locator, self.branch.keys().read()).await?;
-                entry.insert(CachedBlock::from(buffer));
+        let first = self.position.block;
+
+        if self.cache.contains_key(&first) {
+            return Ok(());
+        }
+
+        let end = first
+            .saturating_add(self.readahead.advise(first))
+            .min(self.block_count())
+            .max(first.saturating_add(1));
+        let read_key = self.branch.keys().read().clone();
+        let mut blocks = Vec::new();
+
+        // The db lookups have to be done one after another because they share the transaction,
+        // but the decryption of the loaded blocks runs concurrently.
+        for number in first..end {
+            if number > first
+                && (self.cache.contains_key(&number)
+                    || self.cache.len() + blocks.len() >= CACHE_CAPACITY)
+            {
+                break;
+            }
+
+            let locator = Locator::head(self.id).nth(number);
+
+            match load_block(tx, root_node, &locator, &read_key).await {
+                Ok((_, block)) => blocks.push((number, block)),
+                // Someone is waiting for this block so fetch it (and the ones after it) ahead of
+                // the others.
+                Err(error @ Error::Store(store::Error::BlockNotFound)) if number == first => {
+                    self.prioritize_missing(tx, root_node).await?;
+                    return Err(error);
+                }
+                // Only the current block is required, the prefetched ones are optional. This also
+                // stops the prefetch on the first block that's not been downloaded yet.
+                Err(error) if number == first => return Err(error),
+                Err(_) => break,
+            }
+        }
+
+        self.readahead
+            .loaded(first.saturating_add(blocks.len() as u32));
+
+        for (number, id, content) in decrypt_blocks(&read_key, blocks).await {
+            if let Some(id) = id {
+                tx.cache_block(id, content.clone());
+            }
+
+            self.cache.insert(number, CachedBlock::from(content));
+        }
+
+        Ok(())
+    }
+
+    // Prioritizes the download of the missing blocks starting at the current one. Only a limited
+    // window is prioritized, it moves forward as the reader advances.
+    async fn prioritize_missing(
+        &self,
+        tx: &mut ReadTransaction,
+        root_node: &RootNode,
+    ) -> Result<()> {
+        let first = self.position.block;
+        let end = first
+            .saturating_add(PRIORITIZED_BLOCKS)
+            .min(self.block_count());
+        let locator = Locator::head(self.id);
+
+        for number in first..end {
+            let encoded_locator = locator.nth(number).encode(self.branch.keys().read());
+
+            // The index might not be fully synced yet.
+            let Ok(block_id) = tx.find_block_at(root_node, &encoded_locator).await else {
+                break;
+            };
+
+            if !tx.block_exists(&block_id).await? {
+                self.branch.block_tracker().prioritize(block_id);
             }
         }
 
@@ -389,7 +487,7 @@ impl Blob {
         changeset: &mut Changeset,
     ) -> Result<()> {
         self.write_len(tx, changeset).await?;
-        self.write_blocks(changeset);
+        self.write_blocks(changeset).await;
 
         Ok(())
     }
@@ -454,21 +552,38 @@ impl Blob {
         Ok(())
     }
 
-    fn write_blocks(&mut self, changeset: &mut Changeset) {
-        // Poor man's `drain_filter`.
-        let cache = mem::take(&mut self.cache);
-        let (dirty, clean): (HashMap<_, _>, _) =
-            cache.into_iter().partition(|(_, block)| block.dirty);
-        self.cache = clean;
+    async fn write_blocks(&mut self, changeset: &mut Changeset) {
+        let mut dirty: Vec<_> = self
+            .cache
+            .iter()
+            .filter(|(_, block)| block.dirty)
+            .map(|(number, _)| *number)
+            .collect();
 
-        for (number, block) in dirty {
-            let locator = Locator::head(self.id).nth(number);
-            write_block(
-                changeset,
-                &locator,
-                block.content,
-                self.branch.keys().read(),
-            );
+        // Sort the blocks so they end up in the changeset always in the same order.
+        dirty.sort_unstable();
+
+        // Encrypt copies of the blocks and remove the originals from the cache only after that's
+        // done so they are not lost if this future is cancelled.
+        let blocks = dirty
+            .iter()
+            .map(|number| {
+                (
+                    Locator::head(self.id).nth(*number),
+                    self.cache[number].content.clone(),
+                )
+            })
+            .collect();
+
+        let read_key = self.branch.keys().read();
+        let blocks = encrypt_blocks(read_key, blocks).await;
+
+        for number in dirty {
+            self.cache.remove(&number);
+        }
+
+        for (locator, block) in blocks {
+            link_block(changeset, &locator, block, read_key);
         }
     }
 }
@@ -483,10 +598,45 @@ impl Clone for Blob {
             len_original: self.len_original,
             len_modified: self.len_original,
             position: self.position,
+            readahead: Readahead::new(),
         }
     }
 }
 
+/// Detects sequential reads and decides how many blocks to load on a cache miss. The number of
+/// prefetched blocks doubles with each consecutive sequential miss, up to `READAHEAD_MAX`, and
+/// resets on the first non-sequential one.
+#[derive(Clone, Copy)]
+struct Readahead {
+    // Block expected to miss next if the reads are sequential.
+    next: u32,
+    // Number of blocks to prefetch in addition to the missed one.
+    window: u32,
+}
+
+impl Readahead {
+    fn new() -> Self {
+        // Block zero is loaded when the blob is opened.
+        Self { next: 1, window: 0 }
+    }
+
+    /// Returns the number of blocks (at least one) to load starting at the missed block `number`.
+    fn advise(&mut self, number: u32) -> u32 {
+        if number == self.next {
+            self.window = (self.window * 2).clamp(1, READAHEAD_MAX);
+        } else {
+            self.window = 0;
+        }
+
+        1 + self.window
+    }
+
+    /// Records that the blocks up to (but not including) `end` have been loaded.
+    fn loaded(&mut self, end: u32) {
+        self.next = end;
+    }
+}
+
 #[derive(Default)]
 struct CachedBlock {
     content: BlockContent,
@@ -646,34 +796,191 @@ async fn load_block_count_hint(
     }
 }
 
-async fn read_block(
+/// Block loaded from the store, possibly not yet decrypted.
+enum LoadedBlock {
+    Decrypted(BlockContent),
+    Encrypted(BlockId, BlockNonce, BlockContent),
+}
+
+async fn load_block(
     tx: &mut ReadTransaction,
     root_node: &RootNode,
     locator: &Locator,
     read_key: &cipher::SecretKey,
-) -> Result<(BlockId, BlockContent)> {
+) -> Result<(BlockId, LoadedBlock)> {
     let id = tx
         .find_block_at(root_node, &locator.encode(read_key))
         .await?;
 
+    if let Some(content) = tx.get_cached_block(&id) {
+        return Ok((id, LoadedBlock::Decrypted(content)));
+    }
+
     let mut content = BlockContent::new();
     let nonce = tx.read_block(&id, &mut content).await?;
 
-    decrypt_block(read_key, &nonce, &mut content);
+    Ok((id, LoadedBlock::Encrypted(id, nonce, content)))
+}
+
+async fn read_block(
+    tx: &mut ReadTransaction,
+    root_node: &RootNode,
+    locator: &Locator,
+    read_key: &cipher::SecretKey,
+) -> Result<(BlockId, BlockContent)> {
+    let (id, block) = load_block(tx, root_node, locator, read_key).await?;
+
+    let content = match block {
+        LoadedBlock::Decrypted(content) => content,
+        LoadedBlock::Encrypted(id, nonce, mut content) => {
+            decrypt_block(read_key, &nonce, &mut content);
+            tx.cache_block(id, content.clone());
+            content
+        }
+    };
 
     Ok((id, content))
 }
 
+/// Decrypts the loaded blocks. The first block is decrypted on the current task, the others
+/// concurrently on the blocking thread pool. Returns the block numbers and contents, together with
+/// the block ids of those blocks that were newly decrypted (and so should be cached). Prefetched
+/// blocks whose decryption got cancelled (because the runtime is shutting down) are omitted.
+async fn decrypt_blocks(
+    read_key: &cipher::SecretKey,
+    blocks: Vec<(u32, LoadedBlock)>,
+) -> Vec<(u32, Option<BlockId>, BlockContent)> {
+    let mut blocks = blocks.into_iter();
+    let first = blocks.next();
+
+    // Start decrypting the rest before decrypting the first block.
+    let rest: Vec<_> = blocks
+        .map(|(number, block)| {
+            let task = match block {
+                LoadedBlock::Decrypted(content) => Either::Left(content),
+                LoadedBlock::Encrypted(id, nonce, mut content) => {
+                    let read_key = read_key.clone();
+
+                    Either::Right((
+                        id,
+                        task::spawn_blocking(move || {
+                            decrypt_block(&read_key, &nonce, &mut content);
+                            content
+                        }),
+                    ))
+                }
+            };
+
+            (number, task)
+        })
+        .collect();
+
+    let mut output = Vec::with_capacity(rest.len() + 1);
+
+    match first {
+        Some((number, LoadedBlock::Decrypted(content))) => output.push((number, None, content)),
+        Some((number, LoadedBlock::Encrypted(id, nonce, mut content))) => {
+            decrypt_block(read_key, &nonce, &mut content);
+            output.push((number, Some(id), content));
+        }
+        None => (),
+    }
+
+    for (number, task) in rest {
+        let (id, content) = match task {
+            Either::Left(content) => (None, content),
+            Either::Right((id, task)) => match task.await {
+                Ok(content) => (Some(id), content),
+                Err(error) => match error.try_into_panic() {
+                    Ok(payload) => panic::resume_unwind(payload),
+                    Err(_) => continue,
+                },
+            },
+        };
+
+        output.push((number, id, content));
+    }
+
+    output
+}
+
 fn write_block(
     changeset: &mut Changeset,
     locator: &Locator,
-    mut content: BlockContent,
+    content: BlockContent,
     read_key: &cipher::SecretKey,
 ) -> BlockId {
+    let block = seal_block(locator, content, read_key);
+    link_block(changeset, locator, block, read_key)
+}
+
+/// Encrypts the blocks and computes their ids. The work is split between at most as many blocking
+/// tasks as there are available cores. The order of the blocks is preserved.
+async fn encrypt_blocks(
+    read_key: &cipher::SecretKey,
+    blocks: Vec<(Locator, BlockContent)>,
+) -> Vec<(Locator, Block)> {
+    let workers = thread::available_parallelism()
+        .map(|n| n.get())
+        .unwrap_or(1);
+
+    if blocks.len() < 2 || workers < 2 {
+        return blocks
+            .into_iter()
+            .map(|(locator, content)| (locator, seal_block(&locator, content, read_key)))
+            .collect();
+    }
+
+    let len = blocks.len();
+    let chunk_size = len.div_ceil(workers);
+    let mut blocks = blocks.into_iter();
+    let mut tasks = Vec::with_capacity(workers);
+
+    loop {
+        let chunk: Vec<_> = blocks.by_ref().take(chunk_size).collect();
+
+        if chunk.is_empty() {
+            break;
+        }
+
+        let read_key = read_key.clone();
+
+        tasks.push(task::spawn_blocking(move || {
+            chunk
+                .into_iter()
+                .map(|(locator, content)| (locator, seal_block(&locator, content, &read_key)))
+                .collect::<Vec<_>>()
+        }));
+    }
+
+    let mut output = Vec::with_capacity(len);
+
+    for task in tasks {
+        match task.await {
+            Ok(chunk) => output.extend(chunk),
+            // Blocking tasks are only cancelled when the runtime is shutting down in which case
+            // this future is not going to be polled anymore anyway.
+            Err(error) => panic::resume_unwind(error.into_panic()),
+        }
+    }
+
+    output
+}
+
+/// Encrypts the block content and computes the block id.
+fn seal_block(locator: &Locator, mut content: BlockContent, read_key: &cipher::SecretKey) -> Block {
     let nonce = make_block_nonce(locator, &content, read_key);
     encrypt_block(read_key, &nonce, &mut content);
 
-    let block = Block::new(content, nonce);
+    Block::new(content, nonce)
+}
+
+fn link_block(
+    changeset: &mut Changeset,
+    locator: &Locator,
+    block: Block,
+    read_key: &cipher::SecretKey,
+) -> BlockId {
     let block_id = block.id;
 
     changeset.link_block(
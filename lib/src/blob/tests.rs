@@ -1,6 +1,7 @@
 use super::*;
 use crate::{
     access_control::{AccessKeys, WriteSecrets},
+    block_tracker::{BlockTracker, OfferState},
     branch::BranchShared,
     crypto::sign::PublicKey,
     db,
@@ -10,6 +11,7 @@ use crate::{
     store::Store,
     test_utils,
 };
+use assert_matches::assert_matches;
 use proptest::collection::vec;
 use rand::{distributions::Standard, prelude::*};
 use tempfile::TempDir;
@@ -524,6 +526,56 @@ async fn write_reopen_and_read() {
     store.close().await.unwrap();
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn sequential_read_prefetches_blocks() {
+    let (rng, _base_dir, store, [branch]) = setup(0).await;
+    let mut tx = store.begin_write().await.unwrap();
+    let mut changeset = Changeset::new();
+
+    let content = random_bytes(rng, 8 * BLOCK_SIZE);
+
+    let mut blob = Blob::create(branch.clone(), BlobId::ROOT);
+    blob.write_all(&mut tx, &mut changeset, &content)
+        .await
+        .unwrap();
+    blob.flush(&mut tx, &mut changeset).await.unwrap();
+    changeset
+        .apply(&mut tx, branch.id(), branch.keys().write().unwrap())
+        .await
+        .unwrap();
+
+    let mut blob = Blob::open(&mut tx, branch.clone(), BlobId::ROOT)
+        .await
+        .unwrap();
+
+    // The first miss is sequential (block zero is loaded on open) so the next block is
+    // prefetched as well.
+    blob.seek(SeekFrom::Start(BLOCK_SIZE as u64));
+    blob.warmup(&mut tx).await.unwrap();
+    assert!(blob.cache.contains_key(&1));
+    assert!(blob.cache.contains_key(&2));
+    assert!(!blob.cache.contains_key(&3));
+
+    // The prefetch window grows with each sequential miss.
+    blob.seek(SeekFrom::Start(3 * BLOCK_SIZE as u64));
+    blob.warmup(&mut tx).await.unwrap();
+    assert!((3..6).all(|number| blob.cache.contains_key(&number)));
+
+    // Random access doesn't prefetch.
+    let mut blob = Blob::open(&mut tx, branch, BlobId::ROOT).await.unwrap();
+    blob.seek(SeekFrom::Start(5 * BLOCK_SIZE as u64));
+    blob.warmup(&mut tx).await.unwrap();
+    assert!(blob.cache.contains_key(&5));
+    assert!(!blob.cache.contains_key(&6));
+
+    // The content is not affected.
+    blob.seek(SeekFrom::Start(0));
+    assert_eq!(blob.read_to_end(&mut tx).await.unwrap(), content);
+
+    drop(tx);
+    store.close().await.unwrap();
+}
+
 #[proptest]
 fn fork_and_write(
     #[strategy(0..2 * BLOCK_SIZE)] src_len: usize,
@@ -858,6 +910,77 @@ async fn block_ids_of_identical_blocks_in_the_same_blob() {
     assert_ne!(block_ids[1], block_ids[2]);
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn read_missing_block_prioritizes_it() {
+    let (mut rng, _base_dir, store, [branch]) = setup(0).await;
+    let blob_id = rng.gen();
+
+    let mut tx = store.begin_write().await.unwrap();
+    let mut changeset = Changeset::new();
+
+    let content = random_bytes(&mut rng, 3 * BLOCK_SIZE);
+    let mut blob = Blob::create(branch.clone(), blob_id);
+    blob.write_all(&mut tx, &mut changeset, &content)
+        .await
+        .unwrap();
+    blob.flush(&mut tx, &mut changeset).await.unwrap();
+    changeset
+        .apply(&mut tx, branch.id(), branch.keys().write().unwrap())
+        .await
+        .unwrap();
+    tx.commit().await.unwrap();
+
+    let block_ids: Vec<_> = BlockIds::open(branch.clone(), blob_id)
+        .await
+        .unwrap()
+        .try_collect()
+        .await
+        .unwrap();
+    assert_eq!(block_ids.len(), 4);
+
+    // Simulate blocks that haven't been downloaded yet.
+    let mut tx = store.begin_write().await.unwrap();
+    tx.remove_block(&block_ids[1]).await.unwrap();
+    tx.remove_block(&block_ids[3]).await.unwrap();
+    tx.commit().await.unwrap();
+
+    let client = branch.block_tracker().client();
+    for block_id in &block_ids {
+        client.register(*block_id, OfferState::Approved);
+    }
+
+    // Nothing is required yet.
+    assert!(client.offers().try_next().is_none());
+
+    let mut tx = store.begin_read().await.unwrap();
+    let mut blob = Blob::open(&mut tx, branch.clone(), blob_id).await.unwrap();
+    let mut buffer = vec![0; 3 * BLOCK_SIZE];
+
+    assert_matches!(
+        blob.read_all(&mut tx, &mut buffer).await,
+        Err(Error::Store(store::Error::BlockNotFound))
+    );
+
+    // The missing blocks from the read position onwards are now requested.
+    let offers = client.offers();
+    let mut offered: Vec<_> = iter::from_fn(|| offers.try_next()).collect();
+    offered.sort_by_key(|offer| *offer.block_id());
+
+    let mut expected = vec![block_ids[1], block_ids[3]];
+    expected.sort();
+
+    assert_eq!(
+        offered
+            .iter()
+            .map(|offer| *offer.block_id())
+            .collect::<Vec<_>>(),
+        expected
+    );
+
+    drop(tx);
+    store.close().await.unwrap();
+}
+
 async fn setup<const N: usize>(rng_seed: u64) -> (StdRng, TempDir, Store, [Branch; N]) {
     let mut rng = StdRng::seed_from_u64(rng_seed);
     let keys: AccessKeys = WriteSecrets::generate(&mut rng).into();
@@ -865,7 +988,7 @@ async fn setup<const N: usize>(rng_seed: u64) -> (StdRng, TempDir, Store, [Branc
     let store = Store::new(pool);
 
     let event_tx = EventSender::new(1);
-    let shared = BranchShared::new();
+    let shared = BranchShared::new(BlockTracker::new());
 
     let branches = [(); N].map(|_| {
         let id = PublicKey::random();
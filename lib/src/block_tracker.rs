@@ -2,11 +2,38 @@ use crate::{
     collections::{HashMap, HashSet},
     protocol::BlockId,
 };
-use deadlock::BlockingMutex;
-use slab::Slab;
-use std::{collections::hash_map::Entry, sync::Arc};
+use deadlock::{BlockingMutex, BlockingMutexGuard};
+use metrics::Histogram;
+use std::{
+    array,
+    cmp::Reverse,
+    collections::{hash_map::Entry, BinaryHeap},
+    mem,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Arc,
+    },
+    time::Instant,
+};
 use tokio::sync::watch;
 
+// Number of shards the missing blocks are split into. Each shard has its own lock so operations on
+// different blocks rarely contend with each other.
+const SHARD_COUNT: usize = 16;
+
+/// Order in which the required blocks are offered to each client. Regardless of the policy,
+/// blocks marked with `BlockTracker::prioritize` are always offered first.
+#[derive(Clone, Copy, Eq, PartialEq, Debug, Default)]
+pub enum SchedulingPolicy {
+    /// In the order they became available.
+    #[default]
+    Fifo,
+    /// Blocks offered by the fewest clients first. This spreads the requests so that the blocks
+    /// only few peers have are fetched while those peers are still around and the common ones can
+    /// then be fetched from anyone.
+    RarestFirst,
+}
+
 /// Helper for tracking required missing blocks.
 #[derive(Clone)]
 pub(crate) struct BlockTracker {
@@ -15,33 +42,26 @@ pub(crate) struct BlockTracker {
 
 impl BlockTracker {
     pub fn new() -> Self {
-        let (notify_tx, _) = watch::channel(());
+        Self::with_policy(SchedulingPolicy::default(), Histogram::noop())
+    }
 
+    /// Creates the tracker with the given scheduling policy. `wait_time` records the time from
+    /// marking a block as required until its request completes.
+    pub fn with_policy(policy: SchedulingPolicy, wait_time: Histogram) -> Self {
         Self {
             shared: Arc::new(Shared {
-                inner: BlockingMutex::new(Inner {
-                    missing_blocks: HashMap::default(),
-                    offering_clients: Slab::new(),
-                }),
-                notify_tx,
+                shards: array::from_fn(|_| BlockingMutex::new(HashMap::default())),
+                next_client_id: AtomicUsize::new(0),
+                policy,
+                wait_time,
             }),
         }
     }
 
     /// Mark the block with the given id as required.
     pub fn require(&self, block_id: BlockId) {
-        let mut inner = self.shared.inner.lock().unwrap();
-
-        let missing_block = inner
-            .missing_blocks
-            .entry(block_id)
-            .or_insert_with(|| MissingBlock {
-                offers: HashMap::default(),
-                state: State::Idle {
-                    required: false,
-                    approved: false,
-                },
-            });
+        let mut shard = self.shared.lock_shard(&block_id);
+        let missing_block = shard.entry(block_id).or_insert_with(MissingBlock::new);
 
         match &mut missing_block.state {
             State::Idle { required: true, .. } | State::Accepted(_) => return,
@@ -50,49 +70,75 @@ impl BlockTracker {
             }
         }
 
-        if !missing_block.offers.is_empty() {
-            self.shared.notify();
+        missing_block.required_at = Some(Instant::now());
+
+        if missing_block.is_ready() {
+            missing_block.notify_offers(&block_id, self.shared.policy);
+        }
+    }
+
+    /// Mark the block with the given id as required and offer it ahead of the non-prioritized
+    /// ones. Use this for blocks the user is waiting for (e.g., of a currently open file).
+    pub fn prioritize(&self, block_id: BlockId) {
+        let mut shard = self.shared.lock_shard(&block_id);
+        let missing_block = shard.entry(block_id).or_insert_with(MissingBlock::new);
+
+        let required = match &mut missing_block.state {
+            State::Idle { required, .. } => !mem::replace(required, true),
+            State::Accepted(_) => false,
+        };
+
+        if required {
+            missing_block.required_at = Some(Instant::now());
+        }
+
+        let urgent = !mem::replace(&mut missing_block.urgent, true);
+
+        // Already queued with the new priority if it was already urgent and required.
+        if (required || urgent) && missing_block.is_ready() {
+            missing_block.notify_offers(&block_id, self.shared.policy);
         }
     }
 
     /// Approve the block request if offered. This is called when `quota` is not `None`, otherwise
     /// blocks are pre-approved from `TrackerClient::register(block_id, OfferState::Approved)`.
     pub fn approve(&self, block_id: BlockId) {
-        let mut inner = self.shared.inner.lock().unwrap();
+        let mut shard = self.shared.lock_shard(&block_id);
 
-        let Some(missing_block) = inner.missing_blocks.get_mut(&block_id) else {
+        let Some(missing_block) = shard.get_mut(&block_id) else {
             return;
         };
 
-        let required = match &mut missing_block.state {
+        match &mut missing_block.state {
             State::Idle { approved: true, .. } | State::Accepted(_) => return,
-            State::Idle { approved, required } => {
+            State::Idle { approved, .. } => {
                 *approved = true;
-                *required
             }
-        };
+        }
 
         // If required and offered, notify the waiting acceptors.
-        if required && !missing_block.offers.is_empty() {
-            self.shared.notify();
+        if missing_block.is_ready() {
+            missing_block.notify_offers(&block_id, self.shared.policy);
         }
     }
 
     pub fn client(&self) -> TrackerClient {
-        let client_id = self
-            .shared
-            .inner
-            .lock()
-            .unwrap()
-            .offering_clients
-            .insert(HashSet::default());
+        let (notify_tx, _) = watch::channel(());
 
-        let notify_rx = self.shared.notify_tx.subscribe();
+        let client = Arc::new(Client {
+            id: self.shared.next_client_id.fetch_add(1, Ordering::Relaxed),
+            state: BlockingMutex::new(ClientState {
+                offered: HashSet::default(),
+                ready: BinaryHeap::new(),
+                queued: HashMap::default(),
+                next_seq: 0,
+            }),
+            notify_tx,
+        });
 
         TrackerClient {
             shared: self.shared.clone(),
-            client_id,
-            notify_rx,
+            client,
         }
     }
 }
@@ -105,8 +151,7 @@ pub(crate) enum OfferState {
 
 pub(crate) struct TrackerClient {
     shared: Arc<Shared>,
-    client_id: ClientId,
-    notify_rx: watch::Receiver<()>,
+    client: Arc<Client>,
 }
 
 impl TrackerClient {
@@ -114,8 +159,8 @@ impl TrackerClient {
     pub fn offers(&self) -> BlockOffers {
         BlockOffers {
             shared: self.shared.clone(),
-            client_id: self.client_id,
-            notify_rx: self.notify_rx.clone(),
+            client: self.client.clone(),
+            notify_rx: self.client.notify_tx.subscribe(),
         }
     }
 
@@ -123,42 +168,39 @@ impl TrackerClient {
     /// Returns `true` if this block was offered for the first time (by any client) or `false` if
     /// it's already been offered but not yet accepted or cancelled.
     pub fn register(&self, block_id: BlockId, state: OfferState) -> bool {
-        let mut inner = self.shared.inner.lock().unwrap();
+        let mut shard = self.shared.lock_shard(&block_id);
+        let missing_block = shard.entry(block_id).or_insert_with(MissingBlock::new);
 
-        if !inner.offering_clients[self.client_id].insert(block_id) {
+        let Entry::Vacant(entry) = missing_block.offers.entry(self.client.id) else {
             // Already offered
             return false;
-        }
+        };
 
-        let missing_block = inner
-            .missing_blocks
-            .entry(block_id)
-            .or_insert_with(|| MissingBlock {
-                offers: HashMap::default(),
-                state: State::Idle {
-                    required: false,
-                    approved: false,
-                },
-            });
+        entry.insert(ClientOffer {
+            client: self.client.clone(),
+            offer: Offer::Available,
+        });
 
-        missing_block
-            .offers
-            .insert(self.client_id, Offer::Available);
+        self.client.state.lock().unwrap().offered.insert(block_id);
 
-        match &mut missing_block.state {
-            State::Idle { approved, .. } => {
-                match state {
-                    OfferState::Approved => {
-                        *approved = true;
-                    }
-                    OfferState::Pending => (),
-                }
+        let newly_approved = match &mut missing_block.state {
+            State::Idle { approved, .. } => match state {
+                OfferState::Approved => !mem::replace(approved, true),
+                OfferState::Pending => false,
+            },
+            State::Accepted(_) => false,
+        };
 
-                if *approved {
-                    self.shared.notify();
-                }
+        if missing_block.is_ready() {
+            if newly_approved {
+                // Approval makes the block available to the other offering clients as well.
+                missing_block.notify_offers(&block_id, self.shared.policy);
+            } else {
+                // NOTE: The other offering clients have this block queued with a now outdated
+                // (higher) rarity priority. That is corrected lazily in `BlockOffers::try_next`.
+                self.client
+                    .push_ready(block_id, missing_block.priority(self.shared.policy));
             }
-            State::Accepted(_) => (),
         }
 
         true
@@ -167,33 +209,34 @@ impl TrackerClient {
 
 impl Drop for TrackerClient {
     fn drop(&mut self) {
-        let mut inner = self.shared.inner.lock().unwrap();
-        let block_ids = inner.offering_clients.remove(self.client_id);
-        let mut notify = false;
+        let block_ids = mem::take(&mut self.client.state.lock().unwrap().offered);
 
         for block_id in block_ids {
-            // unwrap is ok because of the invariant in `Inner`
-            let missing_block = inner.missing_blocks.get_mut(&block_id).unwrap();
+            let mut shard = self.shared.lock_shard(&block_id);
+
+            let Some(missing_block) = shard.get_mut(&block_id) else {
+                continue;
+            };
 
-            missing_block.offers.remove(&self.client_id);
+            missing_block.offers.remove(&self.client.id);
 
-            if missing_block.unaccept_by(self.client_id) {
-                notify = true;
+            // Only the blocks this client accepted need to be requeued, the other ones are already
+            // queued to the remaining clients. Their rarity priority is now outdated (lower than it
+            // should be) but requeueing all of them to all the clients on every disconnect would
+            // be too expensive.
+            if missing_block.unaccept_by(self.client.id) {
+                missing_block.notify_offers(&block_id, self.shared.policy);
             }
 
             // TODO: if the block hasn't other offers and isn't required, remove it
         }
-
-        if notify {
-            self.shared.notify()
-        }
     }
 }
 
 /// Stream of offers for required blocks.
 pub(crate) struct BlockOffers {
     shared: Arc<Shared>,
-    client_id: ClientId,
+    client: Arc<Client>,
     notify_rx: watch::Receiver<()>,
 }
 
@@ -205,53 +248,61 @@ impl BlockOffers {
                 return offer;
             }
 
-            // unwrap is ok because the sender exists in self.shared.
+            // unwrap is ok because the sender exists in self.client.
             self.notify_rx.changed().await.unwrap();
         }
     }
 
     /// Returns the next offer or `None` if none exists currently.
     pub fn try_next(&self) -> Option<BlockOffer> {
-        let mut inner = self.shared.inner.lock().unwrap();
-        let inner = &mut *inner;
+        loop {
+            // The ready queue can contain stale entries (e.g., blocks that have been accepted by
+            // other clients in the meantime) so each one needs to be checked again.
+            let ready = self.client.state.lock().unwrap().pop_ready()?;
+            let block_id = ready.block_id;
 
-        // TODO: OPTIMIZE (but profile first) this linear lookup
-        for block_id in &inner.offering_clients[self.client_id] {
-            // unwrap is ok because of the invariant in `Inner`
-            let missing_block = inner.missing_blocks.get_mut(block_id).unwrap();
+            let mut shard = self.shared.lock_shard(&block_id);
 
-            match missing_block.state {
-                State::Idle {
-                    required: true,
-                    approved: true,
-                } => (),
-                State::Idle { .. } | State::Accepted(_) => continue,
+            let Some(missing_block) = shard.get_mut(&block_id) else {
+                continue;
+            };
+
+            if !missing_block.is_ready() {
+                continue;
             }
 
-            // unwrap is ok because of the invariant.
-            let offer = missing_block.offers.get_mut(&self.client_id).unwrap();
-            match offer {
-                Offer::Available => {
-                    *offer = Offer::Proposed;
-                }
-                Offer::Proposed | Offer::Accepted => continue,
+            let priority = missing_block.priority(self.shared.policy);
+
+            let Some(offer) = missing_block.offers.get_mut(&self.client.id) else {
+                continue;
+            };
+
+            if !matches!(offer.offer, Offer::Available) {
+                continue;
             }
 
+            // The priority decreased since the block was queued, requeue it so the blocks with
+            // higher priority go first.
+            if priority < ready.priority {
+                self.client.push_ready(block_id, priority);
+                continue;
+            }
+
+            offer.offer = Offer::Proposed;
+
             return Some(BlockOffer {
                 shared: self.shared.clone(),
-                client_id: self.client_id,
-                block_id: *block_id,
+                client: self.client.clone(),
+                block_id,
             });
         }
-
-        None
     }
 }
 
 /// Offer for a required block.
 pub(crate) struct BlockOffer {
     shared: Arc<Shared>,
-    client_id: ClientId,
+    client: Arc<Client>,
     block_id: BlockId,
 }
 
@@ -265,22 +316,18 @@ impl BlockOffer {
     /// peer) but only one returns `Some` here. The returned `BlockPromise` is a commitment to send
     /// the block request through this client.
     pub fn accept(self) -> Option<BlockPromise> {
-        let mut inner = self.shared.inner.lock().unwrap();
+        let mut shard = self.shared.lock_shard(&self.block_id);
 
-        let missing_block = inner.missing_blocks.get_mut(&self.block_id)?;
+        let missing_block = shard.get_mut(&self.block_id)?;
 
-        match missing_block.state {
-            State::Idle {
-                required: true,
-                approved: true,
-            } => (),
-            State::Idle { .. } | State::Accepted(_) => return None,
+        if !missing_block.is_ready() {
+            return None;
         }
 
-        missing_block.state = State::Accepted(self.client_id);
-        missing_block.offers.insert(self.client_id, Offer::Accepted);
+        missing_block.offers.get_mut(&self.client.id)?.offer = Offer::Accepted;
+        missing_block.state = State::Accepted(self.client.id);
 
-        drop(inner);
+        drop(shard);
 
         Some(BlockPromise(self))
     }
@@ -288,33 +335,42 @@ impl BlockOffer {
 
 impl Drop for BlockOffer {
     fn drop(&mut self) {
-        let mut inner = self.shared.inner.lock().unwrap();
-        let inner = &mut *inner;
+        let mut shard = self.shared.lock_shard(&self.block_id);
 
-        let Some(missing_block) = inner.missing_blocks.get_mut(&self.block_id) else {
+        let Some(missing_block) = shard.get_mut(&self.block_id) else {
             return;
         };
 
-        let Entry::Occupied(mut entry) = missing_block.offers.entry(self.client_id) else {
+        let Entry::Occupied(mut entry) = missing_block.offers.entry(self.client.id) else {
             return;
         };
 
-        match entry.get() {
+        let released = match entry.get().offer {
             Offer::Proposed => {
-                entry.insert(Offer::Available);
+                entry.get_mut().offer = Offer::Available;
+                true
             }
             Offer::Accepted => {
                 // Dropping an accepted offer means the request either failed or timeouted so it's
                 // safe to remove it. If the peer sends us another leaf node response with the same
                 // block id, we register the offer again.
                 entry.remove();
-                inner.offering_clients[self.client_id].remove(&self.block_id);
+                self.client
+                    .state
+                    .lock()
+                    .unwrap()
+                    .offered
+                    .remove(&self.block_id);
+                false
             }
             Offer::Available => unreachable!(),
-        }
+        };
 
-        if missing_block.unaccept_by(self.client_id) {
-            self.shared.notify();
+        if missing_block.unaccept_by(self.client.id) {
+            missing_block.notify_offers(&self.block_id, self.shared.policy);
+        } else if released && missing_block.is_ready() {
+            self.client
+                .push_ready(self.block_id, missing_block.priority(self.shared.policy));
         }
     }
 }
@@ -329,53 +385,199 @@ impl BlockPromise {
 
     /// Mark the block request as successfully completed.
     pub fn complete(self) {
-        let mut inner = self.0.shared.inner.lock().unwrap();
+        let mut shard = self.0.shared.lock_shard(&self.0.block_id);
 
-        let Some(missing_block) = inner.missing_blocks.remove(&self.0.block_id) else {
+        let Some(missing_block) = shard.remove(&self.0.block_id) else {
             return;
         };
 
-        for (client_id, _) in missing_block.offers {
-            if let Some(block_ids) = inner.offering_clients.get_mut(client_id) {
-                block_ids.remove(&self.0.block_id);
-            }
+        if let Some(required_at) = missing_block.required_at {
+            self.0.shared.wait_time.record(required_at.elapsed());
+        }
+
+        for offer in missing_block.offers.into_values() {
+            offer
+                .client
+                .state
+                .lock()
+                .unwrap()
+                .offered
+                .remove(&self.0.block_id);
         }
     }
 }
 
 struct Shared {
-    inner: BlockingMutex<Inner>,
-    notify_tx: watch::Sender<()>,
+    shards: [BlockingMutex<HashMap<BlockId, MissingBlock>>; SHARD_COUNT],
+    next_client_id: AtomicUsize,
+    policy: SchedulingPolicy,
+    wait_time: Histogram,
 }
 
 impl Shared {
-    fn notify(&self) {
-        self.notify_tx.send(()).unwrap_or(())
+    #[track_caller]
+    fn lock_shard(
+        &self,
+        block_id: &BlockId,
+    ) -> BlockingMutexGuard<'_, HashMap<BlockId, MissingBlock>> {
+        // Block ids are hashes so any of their bytes is uniformly distributed.
+        let index = block_id.as_ref()[0] as usize % SHARD_COUNT;
+        self.shards[index].lock().unwrap()
     }
 }
 
+// Lock order: a shard lock is always acquired before a client lock, never the other way around.
+//
 // Invariant: for all `block_id` and `client_id` such that
 //
-//     missing_blocks[block_id].offering_clients.contains(client_id)
+//     missing_blocks[block_id].offers.contains_key(client_id)
 //
 // it must hold that
 //
-//     offering_clients[client_id].contains(block_id)
+//     clients[client_id].offered.contains(block_id)
 //
-// and vice-versa.
-struct Inner {
-    missing_blocks: HashMap<BlockId, MissingBlock>,
-    offering_clients: Slab<HashSet<BlockId>>,
+// and vice-versa (except transiently while the client is being dropped).
+struct Client {
+    id: ClientId,
+    state: BlockingMutex<ClientState>,
+    // Wakes up the `BlockOffers` of this client only.
+    notify_tx: watch::Sender<()>,
+}
+
+impl Client {
+    // Queue the block as ready to be offered to this client.
+    fn push_ready(&self, block_id: BlockId, priority: Priority) {
+        let mut state = self.state.lock().unwrap();
+
+        // If already queued with at least this priority, keep the existing entry (if its priority
+        // is outdated, it's corrected in `BlockOffers::try_next`). Otherwise the new entry
+        // supersedes it.
+        if state
+            .queued
+            .get(&block_id)
+            .is_some_and(|(queued_priority, _)| *queued_priority >= priority)
+        {
+            return;
+        }
+
+        let notify = state.ready.is_empty();
+        let seq = state.next_seq;
+        state.next_seq = state.next_seq.wrapping_add(1);
+        state.ready.push(ReadyBlock {
+            priority,
+            seq: Reverse(seq),
+            block_id,
+        });
+        state.queued.insert(block_id, (priority, seq));
+        drop(state);
+
+        // If the queue wasn't empty, the waiters are already going to find this block when they
+        // drain it.
+        if notify {
+            self.notify_tx.send_replace(());
+        }
+    }
+}
+
+struct ClientState {
+    // Blocks offered by this client.
+    offered: HashSet<BlockId>,
+    // Blocks that became ready to be proposed to this client, highest priority first.
+    ready: BinaryHeap<ReadyBlock>,
+    // Priority and sequence number of the latest entry of each block in `ready`. The other entries
+    // of the same block are superseded and skipped.
+    queued: HashMap<BlockId, (Priority, u64)>,
+    next_seq: u64,
+}
+
+impl ClientState {
+    // Pops the highest priority block from the ready queue, skipping the superseded entries.
+    fn pop_ready(&mut self) -> Option<ReadyBlock> {
+        while let Some(ready) = self.ready.pop() {
+            if let Entry::Occupied(entry) = self.queued.entry(ready.block_id) {
+                if entry.get().1 == ready.seq.0 {
+                    entry.remove();
+                    return Some(ready);
+                }
+            }
+        }
+
+        None
+    }
+}
+
+// Entry in the client's ready queue. Ordered by priority, then in the order of insertion.
+#[derive(Eq, PartialEq, Ord, PartialOrd)]
+struct ReadyBlock {
+    priority: Priority,
+    seq: Reverse<u64>,
+    block_id: BlockId,
+}
+
+#[derive(Clone, Copy, Eq, PartialEq, Ord, PartialOrd, Debug)]
+struct Priority {
+    // Prioritized blocks go first...
+    urgent: bool,
+    // ...then the ones offered by fewer clients (if the policy is `RarestFirst`).
+    rarity: Reverse<usize>,
 }
 
-#[derive(Debug)]
 struct MissingBlock {
     // Clients that offered this block.
-    offers: HashMap<ClientId, Offer>,
+    offers: HashMap<ClientId, ClientOffer>,
     state: State,
+    urgent: bool,
+    // When the block became required.
+    required_at: Option<Instant>,
 }
 
 impl MissingBlock {
+    fn new() -> Self {
+        Self {
+            offers: HashMap::default(),
+            state: State::Idle {
+                required: false,
+                approved: false,
+            },
+            urgent: false,
+            required_at: None,
+        }
+    }
+
+    fn priority(&self, policy: SchedulingPolicy) -> Priority {
+        let rarity = match policy {
+            SchedulingPolicy::Fifo => 0,
+            SchedulingPolicy::RarestFirst => self.offers.len(),
+        };
+
+        Priority {
+            urgent: self.urgent,
+            rarity: Reverse(rarity),
+        }
+    }
+
+    // Is this block required, approved and not yet accepted?
+    fn is_ready(&self) -> bool {
+        matches!(
+            self.state,
+            State::Idle {
+                required: true,
+                approved: true
+            }
+        )
+    }
+
+    // Queue this block to all the clients that have an available offer for it.
+    fn notify_offers(&self, block_id: &BlockId, policy: SchedulingPolicy) {
+        let priority = self.priority(policy);
+
+        for offer in self.offers.values() {
+            if matches!(offer.offer, Offer::Available) {
+                offer.client.push_ready(*block_id, priority);
+            }
+        }
+    }
+
     fn unaccept_by(&mut self, client_id: ClientId) -> bool {
         match self.state {
             State::Accepted(other_client_id) if other_client_id == client_id => {
@@ -390,6 +592,11 @@ impl MissingBlock {
     }
 }
 
+struct ClientOffer {
+    client: Arc<Client>,
+    offer: Offer,
+}
+
 #[derive(Debug)]
 enum State {
     Idle { required: bool, approved: bool },
@@ -408,7 +615,7 @@ type ClientId = usize;
 #[cfg(test)]
 mod tests {
     use super::*;
-    use crate::{collections::HashSet, protocol::Block, test_utils};
+    use crate::{protocol::Block, test_utils};
     use futures_util::future;
     use rand::{distributions::Standard, rngs::StdRng, seq::SliceRandom, Rng, SeedableRng};
     use std::{pin::pin, time::Duration};
@@ -634,6 +841,119 @@ mod tests {
         );
     }
 
+    #[test]
+    fn rarest_first() {
+        let tracker = BlockTracker::with_policy(SchedulingPolicy::RarestFirst, Histogram::noop());
+        let client0 = tracker.client();
+        let client1 = tracker.client();
+
+        let block0: Block = rand::random();
+        let block1: Block = rand::random();
+
+        tracker.require(block0.id);
+        tracker.require(block1.id);
+
+        // block0 is offered by both clients, block1 only by client0.
+        client0.register(block0.id, OfferState::Approved);
+        client1.register(block0.id, OfferState::Approved);
+        client0.register(block1.id, OfferState::Approved);
+
+        // Keep the offers alive, dropping them would requeue the blocks.
+        let offers = client0.offers();
+        let offer0 = offers.try_next().unwrap();
+        let offer1 = offers.try_next().unwrap();
+
+        assert_eq!(offer0.block_id(), &block1.id);
+        assert_eq!(offer1.block_id(), &block0.id);
+    }
+
+    #[test]
+    fn client_drop_requeues_only_accepted_blocks() {
+        let tracker = BlockTracker::with_policy(SchedulingPolicy::RarestFirst, Histogram::noop());
+        let client0 = tracker.client();
+        let client1 = tracker.client();
+
+        let block0: Block = rand::random();
+        let block1: Block = rand::random();
+
+        tracker.require(block0.id);
+        tracker.require(block1.id);
+
+        for block_id in [block0.id, block1.id] {
+            client0.register(block_id, OfferState::Approved);
+            client1.register(block_id, OfferState::Approved);
+        }
+
+        let promise = client0.offers().try_next().and_then(BlockOffer::accept);
+        let accepted_id = *promise.as_ref().unwrap().block_id();
+
+        drop(client0);
+
+        // Each block is queued exactly once.
+        assert_eq!(client1.client.state.lock().unwrap().queued.len(), 2);
+
+        let offers = client1.offers();
+        let offer0 = offers.try_next().unwrap();
+        let offer1 = offers.try_next().unwrap();
+
+        let mut offered_ids = vec![*offer0.block_id(), *offer1.block_id()];
+        offered_ids.sort();
+
+        let mut expected_ids = vec![block0.id, block1.id];
+        expected_ids.sort();
+
+        assert_eq!(offered_ids, expected_ids);
+        assert!(offered_ids.contains(&accepted_id));
+        assert!(offers.try_next().is_none());
+    }
+
+    #[test]
+    fn fifo() {
+        let tracker = BlockTracker::with_policy(SchedulingPolicy::Fifo, Histogram::noop());
+        let client0 = tracker.client();
+        let client1 = tracker.client();
+
+        let block0: Block = rand::random();
+        let block1: Block = rand::random();
+
+        tracker.require(block0.id);
+        tracker.require(block1.id);
+
+        client0.register(block0.id, OfferState::Approved);
+        client1.register(block0.id, OfferState::Approved);
+        client0.register(block1.id, OfferState::Approved);
+
+        let offers = client0.offers();
+        let offer0 = offers.try_next().unwrap();
+        let offer1 = offers.try_next().unwrap();
+
+        assert_eq!(offer0.block_id(), &block0.id);
+        assert_eq!(offer1.block_id(), &block1.id);
+    }
+
+    #[test]
+    fn prioritize() {
+        let tracker = BlockTracker::new();
+        let client = tracker.client();
+
+        let block0: Block = rand::random();
+        let block1: Block = rand::random();
+
+        tracker.require(block0.id);
+        client.register(block0.id, OfferState::Approved);
+        client.register(block1.id, OfferState::Approved);
+
+        // Prioritizing also requires the block.
+        tracker.prioritize(block1.id);
+
+        let offers = client.offers();
+        let offer0 = offers.try_next().unwrap();
+        let offer1 = offers.try_next().unwrap();
+
+        assert_eq!(offer0.block_id(), &block1.id);
+        assert_eq!(offer1.block_id(), &block0.id);
+    }
+
     #[test]
     fn multiple_offers_from_different_clients() {
         let tracker = BlockTracker::new();
@@ -719,32 +1039,59 @@ mod tests {
         assert_eq!(block_ids.next(), None);
     }
 
+    #[test]
+    fn notify_only_offering_clients() {
+        let tracker = BlockTracker::new();
+        let client0 = tracker.client();
+        let client1 = tracker.client();
+
+        let offers0 = client0.offers();
+        let offers1 = client1.offers();
+
+        let block: Block = rand::random();
+        client0.register(block.id, OfferState::Approved);
+        tracker.require(block.id);
+
+        assert!(offers0.notify_rx.has_changed().unwrap());
+        assert!(!offers1.notify_rx.has_changed().unwrap());
+    }
+
     #[proptest]
     fn stress(
         #[strategy(1usize..100)] num_blocks: usize,
+        #[strategy(1usize..8)] num_clients: usize,
         #[strategy(test_utils::rng_seed_strategy())] rng_seed: u64,
     ) {
-        stress_case(num_blocks, rng_seed)
+        stress_case(num_blocks, num_clients, rng_seed)
     }
 
-    fn stress_case(num_blocks: usize, rng_seed: u64) {
+    fn stress_case(num_blocks: usize, num_clients: usize, rng_seed: u64) {
         let mut rng = StdRng::seed_from_u64(rng_seed);
 
         let tracker = BlockTracker::new();
-        let client = tracker.client();
+        let clients: Vec<_> = (0..num_clients).map(|_| tracker.client()).collect();
 
         let block_ids: Vec<BlockId> = (&mut rng).sample_iter(Standard).take(num_blocks).collect();
 
         enum Op {
             Require,
-            Register,
+            Register(usize),
         }
 
+        // Every block is required and offered by at least one client, some by more.
         let mut ops: Vec<_> = block_ids
             .iter()
             .map(|block_id| (Op::Require, *block_id))
-            .chain(block_ids.iter().map(|block_id| (Op::Register, *block_id)))
             .collect();
+
+        for block_id in &block_ids {
+            ops.push((Op::Register(rng.gen_range(0..num_clients)), *block_id));
+
+            if rng.gen() {
+                ops.push((Op::Register(rng.gen_range(0..num_clients)), *block_id));
+            }
+        }
+
         ops.shuffle(&mut rng);
 
         for (op, block_id) in ops {
@@ -752,28 +1099,43 @@ mod tests {
                 Op::Require => {
                     tracker.require(block_id);
                 }
-                Op::Register => {
-                    client.register(block_id, OfferState::Approved);
+                Op::Register(client_index) => {
+                    clients[client_index].register(block_id, OfferState::Approved);
                 }
             }
         }
 
-        let mut block_promise = HashSet::with_capacity(block_ids.len());
+        let mut block_promises = HashMap::default();
 
-        while let Some(block_id) = client
-            .offers()
-            .try_next()
-            .and_then(BlockOffer::accept)
-            .as_ref()
-            .map(BlockPromise::block_id)
-        {
-            block_promise.insert(*block_id);
+        loop {
+            let mut progress = false;
+
+            for client in &clients {
+                if let Some(promise) = client.offers().try_next().and_then(BlockOffer::accept) {
+                    assert!(block_promises
+                        .insert(*promise.block_id(), promise)
+                        .is_none());
+                    progress = true;
+                }
+            }
+
+            if !progress {
+                break;
+            }
         }
 
-        assert_eq!(block_promise.len(), block_ids.len());
+        assert_eq!(block_promises.len(), block_ids.len());
 
         for block_id in &block_ids {
-            assert!(block_promise.contains(block_id));
+            assert!(block_promises.contains_key(block_id));
+        }
+
+        for promise in block_promises.into_values() {
+            promise.complete();
+        }
+
+        for client in &clients {
+            assert!(client.offers().try_next().is_none());
         }
     }
 }
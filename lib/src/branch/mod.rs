@@ -1,9 +1,10 @@
 use crate::{
     access_control::AccessKeys,
     blob::lock::{BranchLocker, Locker},
+    block_tracker::BlockTracker,
     crypto::sign::PublicKey,
     debug::DebugPrinter,
-    directory::{Directory, DirectoryFallback, DirectoryLocking, EntryRef},
+    directory::{Directory, DirectoryCache, DirectoryFallback, DirectoryLocking, EntryRef},
     error::{Error, Result},
     event::{EventScope, EventSender, Payload},
     file::{File, FileProgressCache},
@@ -157,6 +158,14 @@ impl Branch {
         &self.shared.file_progress_cache
     }
 
+    pub(crate) fn directory_cache(&self) -> &DirectoryCache {
+        &self.shared.directory_cache
+    }
+
+    pub(crate) fn block_tracker(&self) -> &BlockTracker {
+        &self.shared.block_tracker
+    }
+
     pub(crate) fn notify(&self) -> BranchEventSender {
         BranchEventSender {
             event_tx: self.event_tx.clone(),
@@ -213,13 +222,17 @@ impl Branch {
 pub(crate) struct BranchShared {
     pub locker: Locker,
     pub file_progress_cache: FileProgressCache,
+    pub directory_cache: DirectoryCache,
+    pub block_tracker: BlockTracker,
 }
 
 impl BranchShared {
-    pub fn new() -> Self {
+    pub fn new(block_tracker: BlockTracker) -> Self {
         Self {
             locker: Locker::new(),
             file_progress_cache: FileProgressCache::new(),
+            directory_cache: DirectoryCache::new(),
+            block_tracker,
         }
     }
 }
@@ -311,7 +324,7 @@ mod tests {
         let event_tx = EventSender::new(1);
 
         let store = Store::new(pool);
-        let shared = BranchShared::new();
+        let shared = BranchShared::new(BlockTracker::new());
         let branch = Branch::new(writer_id, store, secrets.into(), shared, event_tx);
 
         (base_dir, branch)
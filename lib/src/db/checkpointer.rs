@@ -0,0 +1,70 @@
+use scoped_task::ScopedJoinHandle;
+use sqlx::{sqlite::SqliteConnectOptions, Connection, Row, SqliteConnection};
+use std::{sync::Arc, time::Duration};
+use tokio::{sync::Mutex, time};
+use tracing::{Instrument, Span};
+
+/// Background task that periodically checkpoints the WAL using its own connection.
+///
+/// The checkpoints are passive, so they never wait for readers or writers and never block them.
+/// This takes the cost of checkpointing off the commits.
+pub(super) struct Checkpointer {
+    conn: Arc<Mutex<Option<SqliteConnection>>>,
+    _task: ScopedJoinHandle<()>,
+}
+
+impl Checkpointer {
+    pub async fn start(options: SqliteConnectOptions, interval: Duration) -> sqlx::Result<Self> {
+        let conn = SqliteConnection::connect_with(&options).await?;
+        let conn = Arc::new(Mutex::new(Some(conn)));
+
+        let task = scoped_task::spawn(run(conn.clone(), interval).instrument(Span::current()));
+
+        Ok(Self { conn, _task: task })
+    }
+
+    /// Stops the checkpointing and closes the connection.
+    pub async fn close(&self) {
+        let Some(conn) = self.conn.lock().await.take() else {
+            return;
+        };
+
+        if let Err(error) = conn.close().await {
+            tracing::error!(?error, "Failed to close checkpointer connection");
+        }
+    }
+}
+
+async fn run(conn: Arc<Mutex<Option<SqliteConnection>>>, interval: Duration) {
+    let mut interval = time::interval(interval);
+    interval.set_missed_tick_behavior(time::MissedTickBehavior::Delay);
+
+    loop {
+        interval.tick().await;
+
+        let mut conn = conn.lock().await;
+        let Some(conn) = conn.as_mut() else {
+            break;
+        };
+
+        match checkpoint(conn).await {
+            Ok((log, checkpointed)) => {
+                if checkpointed > 0 {
+                    tracing::trace!(log, checkpointed, "WAL checkpointed");
+                }
+            }
+            Err(error) => {
+                tracing::error!(?error, "Failed to checkpoint WAL");
+            }
+        }
+    }
+}
+
+// Returns the number of frames in the WAL and the number of those that have been checkpointed.
+async fn checkpoint(conn: &mut SqliteConnection) -> sqlx::Result<(i64, i64)> {
+    let row = sqlx::query("PRAGMA wal_checkpoint(PASSIVE)")
+        .fetch_one(conn)
+        .await?;
+
+    Ok((row.get(1), row.get(2)))
+}
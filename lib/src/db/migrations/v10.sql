@@ -0,0 +1,54 @@
+--------------------------------------------------------------------------------
+--
+-- Maintain the set of missing blocks (blocks referenced from at least one leaf node whose
+-- block_presence is `missing`) so they can be found without traversing the whole index.
+--
+--------------------------------------------------------------------------------
+
+CREATE TABLE missing_blocks (
+    block_id BLOB NOT NULL PRIMARY KEY,
+
+    -- Number of leaf nodes referencing this block as missing
+    refs     INTEGER NOT NULL
+) WITHOUT ROWID;
+
+-- Populate from the existing leaf nodes (block_presence 0 = missing)
+INSERT INTO missing_blocks (block_id, refs)
+    SELECT block_id, COUNT(*)
+    FROM snapshot_leaf_nodes
+    WHERE block_presence = 0
+    GROUP BY block_id;
+
+CREATE TRIGGER missing_blocks_add_on_leaf_node_inserted
+AFTER INSERT ON snapshot_leaf_nodes
+WHEN new.block_presence = 0
+BEGIN
+    INSERT OR IGNORE INTO missing_blocks (block_id, refs) VALUES (new.block_id, 0);
+    UPDATE missing_blocks SET refs = refs + 1 WHERE block_id = new.block_id;
+END;
+
+CREATE TRIGGER missing_blocks_remove_on_leaf_node_deleted
+AFTER DELETE ON snapshot_leaf_nodes
+WHEN old.block_presence = 0
+BEGIN
+    UPDATE missing_blocks SET refs = refs - 1 WHERE block_id = old.block_id;
+    DELETE FROM missing_blocks WHERE block_id = old.block_id AND refs <= 0;
+END;
+
+-- Updates are handled as a delete of the old row followed by an insert of the new one, which
+-- covers changes of both block_presence and block_id.
+CREATE TRIGGER missing_blocks_remove_on_leaf_node_updated
+AFTER UPDATE ON snapshot_leaf_nodes
+WHEN old.block_presence = 0
+BEGIN
+    UPDATE missing_blocks SET refs = refs - 1 WHERE block_id = old.block_id;
+    DELETE FROM missing_blocks WHERE block_id = old.block_id AND refs <= 0;
+END;
+
+CREATE TRIGGER missing_blocks_add_on_leaf_node_updated
+AFTER UPDATE ON snapshot_leaf_nodes
+WHEN new.block_presence = 0
+BEGIN
+    INSERT OR IGNORE INTO missing_blocks (block_id, refs) VALUES (new.block_id, 0);
+    UPDATE missing_blocks SET refs = refs + 1 WHERE block_id = new.block_id;
+END;
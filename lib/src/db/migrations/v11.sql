@@ -0,0 +1,37 @@
+--------------------------------------------------------------------------------
+--
+-- Epoch marks for the garbage collector.
+--
+-- Kept in a separate table instead of as a column of `blocks` because updating a row of `blocks`
+-- would rewrite the whole block content.
+--
+--------------------------------------------------------------------------------
+
+CREATE TABLE block_marks (
+    block_id BLOB NOT NULL PRIMARY KEY,
+
+    -- The GC epoch since which the block is eligible for collection. NULL for blocks written since
+    -- the start of the current epoch (they are never collected in the epoch they were written in).
+    epoch    INTEGER
+) WITHOUT ROWID;
+
+CREATE INDEX index_block_marks_on_epoch ON block_marks (epoch);
+
+INSERT INTO block_marks (block_id, epoch) SELECT id, NULL FROM blocks;
+
+CREATE TRIGGER block_marks_insert_on_block_inserted
+AFTER INSERT ON blocks
+BEGIN
+    INSERT OR REPLACE INTO block_marks (block_id, epoch) VALUES (new.id, NULL);
+END;
+
+CREATE TRIGGER block_marks_delete_on_block_deleted
+AFTER DELETE ON blocks
+BEGIN
+    DELETE FROM block_marks WHERE block_id = old.id;
+END;
+
+-- Blocks removed by the garbage collector because they were unreachable. They stay in
+-- `missing_blocks` (the leaf nodes still reference them) but are not requested again unless the
+-- collector later finds them reachable.
+ALTER TABLE missing_blocks ADD COLUMN collected INTEGER NOT NULL DEFAULT 0;
@@ -0,0 +1,4 @@
+-- The receive filter is now kept in memory.
+DROP TRIGGER received_inner_nodes_delete_on_snapshot_deleted;
+DROP TRIGGER received_inner_nodes_delete_on_no_blocks_missing_after_insert;
+DROP TABLE received_nodes;
@@ -1,27 +1,29 @@
 #[macro_use]
 mod macros;
 
+mod checkpointer;
 mod connection;
 mod id;
 mod migrations;
 mod mutex;
+mod profile;
 mod transaction;
 
 pub use id::DatabaseId;
 pub use migrations::SCHEMA_VERSION;
+pub use profile::{StorageProfile, Synchronous};
 
 use tracing::Span;
 
 use self::{
+    checkpointer::Checkpointer,
     mutex::{CommittedMutexTransaction, ConnectionMutex},
     transaction::TransactionWrapper,
 };
 use deadlock::ExpectShortLifetime;
 use ref_cast::RefCast;
 use sqlx::{
-    sqlite::{
-        Sqlite, SqliteConnectOptions, SqliteJournalMode, SqlitePoolOptions, SqliteSynchronous,
-    },
+    sqlite::{Sqlite, SqliteConnectOptions, SqliteJournalMode, SqlitePoolOptions},
     Row, SqlitePool,
 };
 use std::{
@@ -31,6 +33,7 @@ use std::{
     ops::{Deref, DerefMut},
     panic::Location,
     path::Path,
+    sync::Arc,
     time::Duration,
 };
 #[cfg(test)]
@@ -40,6 +43,10 @@ use tokio::{fs, task};
 
 const WARN_AFTER_TRANSACTION_LIFETIME: Duration = Duration::from_secs(3);
 
+/// Max number of bound variables in a single statement. This is the lowest limit any sqlite
+/// version uses by default. Multi-row inserts need to be split into batches that stay within it.
+pub(crate) const MAX_VARIABLES: usize = 999;
+
 pub(crate) use self::connection::Connection;
 
 /// Database connection pool.
@@ -49,27 +56,48 @@ pub(crate) struct Pool {
     reads: SqlitePool,
     // Single writable connection.
     write: ConnectionMutex,
+    // Optional background WAL checkpointer.
+    checkpointer: Option<Arc<Checkpointer>>,
 }
 
 impl Pool {
-    async fn create(connect_options: SqliteConnectOptions) -> Result<Self, sqlx::Error> {
-        let common_options = connect_options
+    async fn create(
+        connect_options: SqliteConnectOptions,
+        profile: &StorageProfile,
+    ) -> Result<Self, sqlx::Error> {
+        let common_options = profile
+            .apply(connect_options)
             .journal_mode(SqliteJournalMode::Wal)
-            .synchronous(SqliteSynchronous::Normal)
             .pragma("recursive_triggers", "ON")
             .optimize_on_close(true, Some(1000));
 
-        let write_options = common_options.clone();
+        let write_options = common_options.clone().pragma(
+            "wal_autocheckpoint",
+            profile.wal_autocheckpoint().to_string(),
+        );
         let write = ConnectionMutex::connect(write_options).await?;
 
+        let checkpointer = if let Some(interval) = profile.checkpoint_interval {
+            // The checkpointer needs a writable connection but it doesn't need to optimize on
+            // close - that is done by the write connection.
+            let options = common_options.clone().optimize_on_close(false, None);
+            Some(Arc::new(Checkpointer::start(options, interval).await?))
+        } else {
+            None
+        };
+
         let read_options = common_options.read_only(true);
         let reads = SqlitePoolOptions::new()
-            .max_connections(8)
+            .max_connections(profile.reader_pool_size.max(1))
             .test_before_acquire(false)
             .connect_with(read_options)
             .await?;
 
-        Ok(Self { reads, write })
+        Ok(Self {
+            reads,
+            write,
+            checkpointer,
+        })
     }
 
     /// Acquire a read-only database connection.
@@ -129,10 +157,15 @@ impl Pool {
     }
 
     pub(crate) async fn close(&self) -> Result<(), sqlx::Error> {
-        // Make sure to first close `reads` and only then `write`. That way when closing the write
-        // connection it is the last remaining connection and so it performs a WAL checkpoint and
-        // removes the auxiliary db files (*-wal and *-shm).
+        // Make sure to first close `reads` (and the checkpointer) and only then `write`. That way
+        // when closing the write connection it is the last remaining connection and so it
+        // performs a WAL checkpoint and removes the auxiliary db files (*-wal and *-shm).
         self.reads.close().await;
+
+        if let Some(checkpointer) = &self.checkpointer {
+            checkpointer.close().await;
+        }
+
         self.write.close().await;
 
         Ok(())
@@ -305,7 +338,10 @@ impl std::fmt::Debug for WriteTransaction {
 impl_executor_by_deref!(WriteTransaction);
 
 /// Creates a new database and opens a connection to it.
-pub(crate) async fn create(path: impl AsRef<Path>) -> Result<Pool, Error> {
+pub(crate) async fn create(
+    path: impl AsRef<Path>,
+    profile: &StorageProfile,
+) -> Result<Pool, Error> {
     let path = path.as_ref();
 
     if fs::metadata(path).await.is_ok() {
@@ -318,7 +354,9 @@ pub(crate) async fn create(path: impl AsRef<Path>) -> Result<Pool, Error> {
         .filename(path)
         .create_if_missing(true);
 
-    let pool = Pool::create(connect_options).await.map_err(Error::Open)?;
+    let pool = Pool::create(connect_options, profile)
+        .await
+        .map_err(Error::Open)?;
 
     migrations::run(&pool).await?;
 
@@ -329,15 +367,17 @@ pub(crate) async fn create(path: impl AsRef<Path>) -> Result<Pool, Error> {
 #[cfg(test)]
 pub(crate) async fn create_temp() -> Result<(TempDir, Pool), Error> {
     let temp_dir = TempDir::new().map_err(Error::CreateDirectory)?;
-    let pool = create(temp_dir.path().join("temp.db")).await?;
+    let pool = create(temp_dir.path().join("temp.db"), &StorageProfile::default()).await?;
 
     Ok((temp_dir, pool))
 }
 
 /// Opens a connection to the specified database. Fails if the db doesn't exist.
-pub(crate) async fn open(path: impl AsRef<Path>) -> Result<Pool, Error> {
+pub(crate) async fn open(path: impl AsRef<Path>, profile: &StorageProfile) -> Result<Pool, Error> {
     let connect_options = SqliteConnectOptions::new().filename(path);
-    let pool = Pool::create(connect_options).await.map_err(Error::Open)?;
+    let pool = Pool::create(connect_options, profile)
+        .await
+        .map_err(Error::Open)?;
 
     migrations::run(&pool).await?;
 
@@ -397,6 +437,8 @@ async fn set_pragma(conn: &mut Connection, name: &str, value: u32) -> Result<(),
 #[cfg(test)]
 mod tests {
     use super::*;
+    use crate::storage_size::StorageSize;
+    use tokio::time;
 
     // Check the casts are lossless
 
@@ -420,4 +462,66 @@ mod tests {
         assert_eq!(encode_u64(u64::MAX / 2 + 1), i64::MIN);
         assert_eq!(encode_u64(u64::MAX), -1);
     }
+
+    #[tokio::test]
+    async fn storage_profile() {
+        let temp_dir = TempDir::new().unwrap();
+        let profile = StorageProfile {
+            cache_size: StorageSize::from_bytes(8 * 1024 * 1024),
+            synchronous: Synchronous::Off,
+            page_size: 8192,
+            checkpoint_interval: Some(Duration::from_millis(10)),
+            ..StorageProfile::default()
+        };
+
+        let path = temp_dir.path().join("temp.db");
+        let pool = create(&path, &profile).await.unwrap();
+
+        // Well below `wal_autocheckpoint` pages, so only the checkpointer moves this into the db
+        // file.
+        let value_size = 1024 * 1024;
+
+        let mut tx = pool.begin_write().await.unwrap();
+        sqlx::query("CREATE TABLE test (value BLOB)")
+            .execute(&mut tx)
+            .await
+            .unwrap();
+        sqlx::query("INSERT INTO test (value) VALUES (zeroblob(?))")
+            .bind(value_size as i64)
+            .execute(&mut tx)
+            .await
+            .unwrap();
+        tx.commit().await.unwrap();
+
+        let mut conn = pool.acquire().await.unwrap();
+
+        let cache_size: i64 = sqlx::query("PRAGMA cache_size")
+            .fetch_one(&mut *conn)
+            .await
+            .unwrap()
+            .get(0);
+        assert_eq!(cache_size, -8 * 1024);
+
+        let synchronous: i64 = sqlx::query("PRAGMA synchronous")
+            .fetch_one(&mut *conn)
+            .await
+            .unwrap()
+            .get(0);
+        assert_eq!(synchronous, 0);
+
+        assert_eq!(get_pragma(&mut conn, "page_size").await.unwrap(), 8192);
+
+        drop(conn);
+
+        // The row only reaches the db file once the WAL is checkpointed.
+        time::timeout(Duration::from_secs(5), async {
+            while std::fs::metadata(&path).unwrap().len() < value_size {
+                time::sleep(Duration::from_millis(10)).await;
+            }
+        })
+        .await
+        .expect("WAL not checkpointed");
+
+        pool.close().await.unwrap();
+    }
 }
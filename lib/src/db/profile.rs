@@ -0,0 +1,92 @@
+use crate::storage_size::StorageSize;
+use sqlx::sqlite::{SqliteConnectOptions, SqliteSynchronous};
+use std::time::Duration;
+
+/// Tuning of the database storage. The default is a conservative profile suitable for devices
+/// with limited memory. Server deployments can use larger caches and trade durability for
+/// throughput by relaxing `synchronous`.
+#[derive(Clone, Copy, Debug)]
+pub struct StorageProfile {
+    /// Max number of read-only connections. Writes always go through a single connection.
+    pub reader_pool_size: u32,
+    /// Max size of the database file mapped into memory (sqlite `mmap_size`). Zero disables
+    /// memory mapping.
+    pub mmap_size: StorageSize,
+    /// Size of the page cache of each connection (sqlite `cache_size`).
+    pub cache_size: StorageSize,
+    /// How often and how thoroughly the data is synced to the disk (sqlite `synchronous`).
+    pub synchronous: Synchronous,
+    /// Size of the WAL (in pages) after which it gets checkpointed (sqlite `wal_autocheckpoint`).
+    /// When `checkpoint_interval` is set, the WAL is checkpointed at this size only if the
+    /// regular checkpoint can't keep up.
+    pub wal_autocheckpoint: u32,
+    /// Size of the database page in bytes. Must be a power of two between 512 and 65536. Has
+    /// effect only when creating a new database.
+    pub page_size: u32,
+    /// If set, the WAL is checkpointed periodically by a dedicated background task instead of by
+    /// the commit that happens to grow it past `wal_autocheckpoint`. This keeps large checkpoints
+    /// from stalling commits.
+    pub checkpoint_interval: Option<Duration>,
+}
+
+impl StorageProfile {
+    pub(super) fn apply(&self, options: SqliteConnectOptions) -> SqliteConnectOptions {
+        options
+            .synchronous(self.synchronous.into())
+            .page_size(self.page_size)
+            .pragma("mmap_size", self.mmap_size.to_bytes().to_string())
+            // Negative value means kibibytes instead of pages.
+            .pragma(
+                "cache_size",
+                format!("-{}", self.cache_size.to_bytes().div_ceil(1024)),
+            )
+    }
+
+    pub(super) fn wal_autocheckpoint(&self) -> u32 {
+        if self.checkpoint_interval.is_some() {
+            // Leave the regular checkpoints to the checkpointer but still keep the WAL bounded in
+            // case it can't keep up (e.g., because there are always some readers).
+            self.wal_autocheckpoint.saturating_mul(4)
+        } else {
+            self.wal_autocheckpoint
+        }
+    }
+}
+
+impl Default for StorageProfile {
+    fn default() -> Self {
+        Self {
+            reader_pool_size: 8,
+            mmap_size: StorageSize::from_bytes(0),
+            // Same as the sqlite default (`-2000`, i.e. 2000 KiB).
+            cache_size: StorageSize::from_bytes(2000 * 1024),
+            synchronous: Synchronous::Normal,
+            wal_autocheckpoint: 1000,
+            page_size: 4096,
+            checkpoint_interval: None,
+        }
+    }
+}
+
+/// Level of durability of the committed transactions. See the sqlite documentation of the
+/// `synchronous` pragma for details.
+#[derive(Clone, Copy, Eq, PartialEq, Debug)]
+pub enum Synchronous {
+    /// Never sync. Fastest, but the database can get corrupted on power loss or OS crash.
+    Off,
+    /// Sync only at the critical moments. The most recent transactions might be lost on power
+    /// loss but the database stays consistent.
+    Normal,
+    /// Sync on every commit.
+    Full,
+}
+
+impl From<Synchronous> for SqliteSynchronous {
+    fn from(value: Synchronous) -> Self {
+        match value {
+            Synchronous::Off => Self::Off,
+            Synchronous::Normal => Self::Normal,
+            Synchronous::Full => Self::Full,
+        }
+    }
+}
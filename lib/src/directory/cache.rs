@@ -0,0 +1,77 @@
+use super::content::Content;
+use crate::{blob::BlobId, crypto::sign::PublicKey, crypto::Hash};
+use deadlock::BlockingMutex;
+use lru::LruCache;
+use std::{num::NonZeroUsize, sync::Arc};
+
+// Max number of directory versions kept in the cache.
+const CAPACITY: usize = 256;
+
+/// Cache of the decoded content of the recently opened directories. Shared among all branches of
+/// a repository.
+///
+/// An entry is valid only for the snapshot it was loaded from (identified by the root hash of the
+/// branch), so a branch that got changed misses the cache and gets reloaded while the unchanged
+/// branches keep hitting it. This makes repeated lookups of the same path in a repository with
+/// many branches cost only a reload of the branches that changed since the last lookup.
+#[derive(Clone)]
+pub(crate) struct DirectoryCache {
+    entries: Arc<BlockingMutex<LruCache<(PublicKey, BlobId), Entry>>>,
+}
+
+impl DirectoryCache {
+    pub fn new() -> Self {
+        Self {
+            entries: Arc::new(BlockingMutex::new(LruCache::new(
+                NonZeroUsize::new(CAPACITY).unwrap(),
+            ))),
+        }
+    }
+
+    /// Returns the length of the directory blob and its content, if it's cached for the given
+    /// snapshot.
+    pub(super) fn get(
+        &self,
+        branch_id: &PublicKey,
+        blob_id: &BlobId,
+        snapshot: &Hash,
+    ) -> Option<(u64, Content)> {
+        let mut entries = self.entries.lock().unwrap();
+        let key = (*branch_id, *blob_id);
+
+        match entries.get(&key) {
+            Some(entry) if entry.snapshot == *snapshot => Some((entry.len, entry.content.clone())),
+            Some(_) => {
+                entries.pop(&key);
+                None
+            }
+            None => None,
+        }
+    }
+
+    pub(super) fn insert(
+        &self,
+        branch_id: PublicKey,
+        blob_id: BlobId,
+        snapshot: Hash,
+        len: u64,
+        content: Content,
+    ) {
+        self.entries.lock().unwrap().put(
+            (branch_id, blob_id),
+            Entry {
+                snapshot,
+                len,
+                content,
+            },
+        );
+    }
+}
+
+// NOTE: Only the content and the length are kept, not the whole `Blob`, because the blob holds the
+// `Branch` which in turn holds this cache.
+struct Entry {
+    snapshot: Hash,
+    len: u64,
+    content: Content,
+}
@@ -7,97 +7,153 @@ use crate::{
     protocol::Bump,
     version_vector::VersionVector,
 };
+use either::Either;
 use serde::Deserialize;
 use std::{
     cmp::Ordering,
-    collections::{
-        btree_map::{self, Entry},
-        BTreeMap,
-    },
+    collections::{btree_map, BTreeMap},
+    iter::Peekable,
+    sync::Arc,
 };
 
 /// Version of the Directory serialization format.
-pub const VERSION: u64 = 2;
+pub const VERSION: u64 = 3;
 
+/// Entries of a directory.
+///
+/// The entries loaded from the store are kept in their serialized form and decoded only when
+/// accessed. Entries inserted or modified afterwards are kept on top of them. The loaded entries
+/// are shared between clones, so cloning is cheap even for large directories.
 #[derive(Clone, Debug)]
 pub(super) struct Content {
-    entries: v2::Entries,
+    // Entries as loaded from the store.
+    base: Arc<v3::Entries>,
+    // Entries inserted or modified since loading. They take precedence over the ones in `base`.
+    changes: BTreeMap<String, EntryData>,
 }
 
 impl Content {
     pub fn empty() -> Self {
         Self {
-            entries: BTreeMap::new(),
+            base: Arc::new(v3::Entries::empty()),
+            changes: BTreeMap::new(),
         }
     }
 
     pub fn deserialize(mut input: &[u8]) -> Result<Self> {
         let version = vint64::decode(&mut input).map_err(|_| Error::MalformedDirectory)?;
-        let entries = match version {
-            VERSION => deserialize_entries(input),
-            1 => Ok(v2::from_v1(deserialize_entries(input)?)),
-            0 => Ok(v2::from_v1(v1::from_v0(deserialize_entries(input)?))),
-            _ => Err(Error::StorageVersionMismatch),
+        let (base, changes) = match version {
+            VERSION => (v3::Entries::deserialize(input)?, BTreeMap::new()),
+            2 => (
+                v3::Entries::empty(),
+                deserialize_entries::<v2::Entries>(input)?,
+            ),
+            1 => (
+                v3::Entries::empty(),
+                v2::from_v1(deserialize_entries(input)?),
+            ),
+            0 => (
+                v3::Entries::empty(),
+                v2::from_v1(v1::from_v0(deserialize_entries(input)?)),
+            ),
+            _ => return Err(Error::StorageVersionMismatch),
         };
 
-        Ok(Self { entries: entries? })
+        Ok(Self {
+            base: Arc::new(base),
+            changes,
+        })
     }
 
+    /// Serializes the content. Unchanged entries are copied in their serialized form without
+    /// being decoded.
     pub fn serialize(&self) -> Vec<u8> {
         let mut output = Vec::new();
         output.extend_from_slice(vint64::encode(VERSION).as_ref());
-        bincode::serialize_into(&mut output, &self.entries)
-            .expect("failed to serialize directory content");
+
+        let mut writer = v3::Writer::new(&mut output);
+
+        for item in self.merged() {
+            match item {
+                Either::Left(index) => writer.push_raw(self.base.raw(index)),
+                Either::Right((name, data)) => writer.push(name, data),
+            }
+        }
+
+        writer.finish();
         output
     }
 
-    pub fn iter(&self) -> btree_map::Iter<String, EntryData> {
-        self.entries.iter()
+    /// Returns iterator over the entries in the order of their names. Iterating visits every entry
+    /// so all the loaded entries are decoded upfront. This fails if any of them is malformed.
+    pub fn iter(&self) -> Result<Iter<'_>> {
+        self.base.decode_all()?;
+
+        Ok(Iter {
+            base: &self.base,
+            merged: self.merged(),
+        })
     }
 
-    pub fn get_key_value(&self, name: &str) -> Option<(&String, &EntryData)> {
-        self.entries.get_key_value(name)
+    pub fn get_key_value(&self, name: &str) -> Result<Option<(&str, &EntryData)>> {
+        if let Some((name, data)) = self.changes.get_key_value(name) {
+            return Ok(Some((name.as_str(), data)));
+        }
+
+        self.base
+            .find(name)
+            .map(|index| self.base.get(index))
+            .transpose()
     }
 
-    pub fn get_mut(&mut self, name: &str) -> Option<&mut EntryData> {
-        self.entries.get_mut(name)
+    pub fn get_mut(&mut self, name: &str) -> Result<Option<&mut EntryData>> {
+        if !self.changes.contains_key(name) {
+            let Some(data) = self.get(name)?.cloned() else {
+                return Ok(None);
+            };
+
+            self.changes.insert(name.to_owned(), data);
+        }
+
+        Ok(self.changes.get_mut(name))
     }
 
     /// Inserts an entry into this directory. Returns the difference between the new and the old
-    /// version vectors.
+    /// version vectors. The outer error is returned when the existing entry is malformed.
     pub fn insert(
         &mut self,
         name: String,
         new_data: EntryData,
-    ) -> Result<VersionVector, EntryExists> {
-        match self.entries.entry(name) {
-            Entry::Vacant(entry) => {
-                let diff = new_data.version_vector().clone();
-                entry.insert(new_data);
-                Ok(diff)
-            }
-            Entry::Occupied(mut entry) => {
-                check_replace(entry.get(), &new_data)?;
-                let diff = new_data
-                    .version_vector()
-                    .saturating_sub(entry.get().version_vector());
-                entry.insert(new_data);
-                Ok(diff)
+    ) -> Result<Result<VersionVector, EntryExists>> {
+        let diff = if let Some(old_data) = self.get(&name)? {
+            if let Err(error) = check_replace(old_data, &new_data) {
+                return Ok(Err(error));
             }
-        }
+
+            new_data
+                .version_vector()
+                .saturating_sub(old_data.version_vector())
+        } else {
+            new_data.version_vector().clone()
+        };
+
+        self.changes.insert(name, new_data);
+
+        Ok(Ok(diff))
     }
 
     /// Checks whether an entry can be inserted into this directory without actually inserting it.
-    /// If so, returns the blob_id of the existing entry (if any).
+    /// If so, returns the blob_id of the existing entry (if any). The outer error is returned when
+    /// the existing entry is malformed.
     pub fn check_insert(
         &self,
         name: &str,
         new_data: &EntryData,
-    ) -> Result<Option<BlobId>, EntryExists> {
-        if let Some(old_data) = self.entries.get(name) {
-            check_replace(old_data, new_data)
+    ) -> Result<Result<Option<BlobId>, EntryExists>> {
+        if let Some(old_data) = self.get(name)? {
+            Ok(check_replace(old_data, new_data))
         } else {
-            Ok(None)
+            Ok(Ok(None))
         }
     }
 
@@ -105,19 +161,32 @@ impl Content {
     /// the new version vectors.
     pub fn bump(&mut self, name: &str, bump: Bump) -> Result<VersionVector> {
         Ok(bump.apply(
-            self.entries
-                .get_mut(name)
+            self.get_mut(name)?
                 .ok_or(Error::EntryNotFound)?
                 .version_vector_mut(),
         ))
     }
 
     /// Initial version vector for a new entry to be inserted.
-    pub fn initial_version_vector(&self, name: &str) -> VersionVector {
-        if let Some(EntryData::Tombstone(entry)) = self.entries.get(name) {
-            entry.version_vector.clone()
+    pub fn initial_version_vector(&self, name: &str) -> Result<VersionVector> {
+        if let Some(EntryData::Tombstone(entry)) = self.get(name)? {
+            Ok(entry.version_vector.clone())
         } else {
-            VersionVector::new()
+            Ok(VersionVector::new())
+        }
+    }
+
+    fn get(&self, name: &str) -> Result<Option<&EntryData>> {
+        Ok(self.get_key_value(name)?.map(|(_, data)| data))
+    }
+
+    // Iterates the loaded entries (by index, without decoding them) merged with the changed ones
+    // (decoded), in the order of their names.
+    fn merged(&self) -> Merged<'_> {
+        Merged {
+            base: &self.base,
+            index: 0,
+            changes: self.changes.iter().peekable(),
         }
     }
 }
@@ -137,12 +206,56 @@ impl From<EntryExists> for Error {
     }
 }
 
-impl<'a> IntoIterator for &'a Content {
-    type Item = <Self::IntoIter as Iterator>::Item;
-    type IntoIter = btree_map::Iter<'a, String, EntryData>;
+/// Iterator over the entries of a `Content`.
+#[derive(Clone)]
+pub(super) struct Iter<'a> {
+    base: &'a v3::Entries,
+    merged: Merged<'a>,
+}
+
+impl<'a> Iterator for Iter<'a> {
+    type Item = (&'a str, &'a EntryData);
+
+    fn next(&mut self) -> Option<Self::Item> {
+        match self.merged.next()? {
+            // Unwrap OK because all the loaded entries were decoded in `Content::iter`.
+            Either::Left(index) => Some(self.base.get(index).unwrap()),
+            Either::Right((name, data)) => Some((name.as_str(), data)),
+        }
+    }
+}
+
+#[derive(Clone)]
+struct Merged<'a> {
+    base: &'a v3::Entries,
+    index: usize,
+    changes: Peekable<btree_map::Iter<'a, String, EntryData>>,
+}
+
+impl<'a> Iterator for Merged<'a> {
+    type Item = Either<usize, (&'a String, &'a EntryData)>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        let base_name = (self.index < self.base.len()).then(|| self.base.name(self.index));
+
+        let ordering = match (base_name, self.changes.peek()) {
+            (Some(base_name), Some((changed_name, _))) => base_name.cmp(changed_name.as_str()),
+            (Some(_), None) => Ordering::Less,
+            (None, _) => Ordering::Greater,
+        };
 
-    fn into_iter(self) -> Self::IntoIter {
-        self.iter()
+        match ordering {
+            Ordering::Less => {
+                self.index += 1;
+                Some(Either::Left(self.index - 1))
+            }
+            Ordering::Equal => {
+                // The changed entry replaces the loaded one.
+                self.index += 1;
+                self.changes.next().map(Either::Right)
+            }
+            Ordering::Greater => self.changes.next().map(Either::Right),
+        }
     }
 }
 
@@ -183,6 +296,241 @@ fn check_replace(old: &EntryData, new: &EntryData) -> Result<Option<BlobId>, Ent
     }
 }
 
+mod v3 {
+    use super::super::entry_data::EntryData;
+    use crate::error::{Error, Result};
+    use std::{fmt, str, sync::OnceLock};
+
+    // Serialized layout (following the version number):
+    //
+    //     record* offset* count
+    //
+    // Each record consists of the length of the entry name (vint64), the name (utf8) and the
+    // bincode encoded `EntryData`. The records are sorted by name. `offset` (u32, little endian)
+    // is the position of the corresponding record relative to the first one and `count` (u32,
+    // little endian) is the number of records. The offsets allow binary search by name without
+    // decoding the records. They are stored after the records so that a change to an entry
+    // doesn't shift the serialized bytes of the entries preceding it.
+
+    /// Serialized entries, decoded lazily.
+    pub(super) struct Entries {
+        buffer: Box<[u8]>,
+        records: Vec<Record>,
+        decoded: Vec<OnceLock<Option<EntryData>>>,
+    }
+
+    // Location of a record in the buffer.
+    struct Record {
+        start: u32,
+        name_start: u32,
+        name_end: u32,
+        end: u32,
+    }
+
+    impl Entries {
+        pub fn empty() -> Self {
+            Self {
+                buffer: Box::default(),
+                records: Vec::new(),
+                decoded: Vec::new(),
+            }
+        }
+
+        /// Validates the layout and the entry names. The entry data are not decoded until
+        /// accessed.
+        pub fn deserialize(input: &[u8]) -> Result<Self> {
+            let (input, count) = split_u32(input)?;
+            let count = count as usize;
+
+            let index_len = count.checked_mul(4).ok_or(Error::MalformedDirectory)?;
+            let records_len = input
+                .len()
+                .checked_sub(index_len)
+                .ok_or(Error::MalformedDirectory)?;
+            let (buffer, index) = input.split_at(records_len);
+
+            if u32::try_from(buffer.len()).is_err() {
+                return Err(Error::MalformedDirectory);
+            }
+
+            let offsets: Vec<_> = index
+                .chunks_exact(4)
+                .map(|chunk| u32::from_le_bytes(chunk.try_into().unwrap()) as usize)
+                .collect();
+
+            // The records must exactly cover the buffer: the first one starts at the beginning,
+            // each next one where the previous one ends and the last one ends at the end of the
+            // buffer (the end of each record is implied by the start of the next one). In
+            // particular, an empty directory must have no records.
+            if offsets.first().copied().unwrap_or(buffer.len()) != 0 {
+                return Err(Error::MalformedDirectory);
+            }
+
+            let mut records = Vec::with_capacity(count);
+            let mut prev_name = None;
+
+            for (i, start) in offsets.iter().copied().enumerate() {
+                let end = offsets.get(i + 1).copied().unwrap_or(buffer.len());
+
+                // The offsets must be strictly increasing.
+                if start >= end {
+                    return Err(Error::MalformedDirectory);
+                }
+
+                let mut record = buffer.get(start..end).ok_or(Error::MalformedDirectory)?;
+
+                let name_len =
+                    vint64::decode(&mut record).map_err(|_| Error::MalformedDirectory)? as usize;
+                let name_start = end - record.len();
+                let name_end = name_start
+                    .checked_add(name_len)
+                    .filter(|name_end| *name_end <= end)
+                    .ok_or(Error::MalformedDirectory)?;
+
+                let name = str::from_utf8(&buffer[name_start..name_end])
+                    .map_err(|_| Error::MalformedDirectory)?;
+
+                // The names must be unique and sorted.
+                if prev_name.is_some_and(|prev_name| prev_name >= name) {
+                    return Err(Error::MalformedDirectory);
+                }
+
+                prev_name = Some(name);
+
+                records.push(Record {
+                    start: start as u32,
+                    name_start: name_start as u32,
+                    name_end: name_end as u32,
+                    end: end as u32,
+                });
+            }
+
+            Ok(Self {
+                buffer: buffer.into(),
+                decoded: (0..records.len()).map(|_| OnceLock::new()).collect(),
+                records,
+            })
+        }
+
+        pub fn len(&self) -> usize {
+            self.records.len()
+        }
+
+        /// Finds the index of the entry with the given name.
+        pub fn find(&self, name: &str) -> Option<usize> {
+            self.records
+                .binary_search_by(|record| self.record_name(record).cmp(name))
+                .ok()
+        }
+
+        pub fn name(&self, index: usize) -> &str {
+            self.record_name(&self.records[index])
+        }
+
+        /// Returns the name and the data of the entry at the given index, decoding the data if not
+        /// decoded yet.
+        pub fn get(&self, index: usize) -> Result<(&str, &EntryData)> {
+            let record = &self.records[index];
+            let data = self.decoded[index]
+                .get_or_init(|| {
+                    let input = &self.buffer[record.name_end as usize..record.end as usize];
+                    bincode::deserialize(input).ok()
+                })
+                .as_ref()
+                .ok_or(Error::MalformedDirectory)?;
+
+            Ok((self.record_name(record), data))
+        }
+
+        /// Decodes the data of all the entries not decoded yet.
+        pub fn decode_all(&self) -> Result<()> {
+            (0..self.len()).try_for_each(|index| self.get(index).map(|_| ()))
+        }
+
+        /// Returns the serialized record of the entry at the given index.
+        pub fn raw(&self, index: usize) -> &[u8] {
+            let record = &self.records[index];
+            &self.buffer[record.start as usize..record.end as usize]
+        }
+
+        fn record_name(&self, record: &Record) -> &str {
+            // Unwrap OK because the names were validated in `deserialize`.
+            str::from_utf8(&self.buffer[record.name_start as usize..record.name_end as usize])
+                .unwrap()
+        }
+    }
+
+    impl fmt::Debug for Entries {
+        fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+            f.debug_struct("Entries")
+                .field("len", &self.records.len())
+                .finish_non_exhaustive()
+        }
+    }
+
+    /// Serializes entries in the v3 format. The entries must be pushed in the order of their
+    /// names.
+    pub(super) struct Writer<'a> {
+        output: &'a mut Vec<u8>,
+        start: usize,
+        offsets: Vec<u32>,
+    }
+
+    impl<'a> Writer<'a> {
+        pub fn new(output: &'a mut Vec<u8>) -> Self {
+            let start = output.len();
+
+            Self {
+                output,
+                start,
+                offsets: Vec::new(),
+            }
+        }
+
+        pub fn push(&mut self, name: &str, data: &EntryData) {
+            self.begin_record();
+            self.output
+                .extend_from_slice(vint64::encode(name.len() as u64).as_ref());
+            self.output.extend_from_slice(name.as_bytes());
+            bincode::serialize_into(&mut *self.output, data)
+                .expect("failed to serialize directory entry");
+        }
+
+        /// Pushes an already serialized record.
+        pub fn push_raw(&mut self, record: &[u8]) {
+            self.begin_record();
+            self.output.extend_from_slice(record);
+        }
+
+        pub fn finish(self) {
+            for offset in &self.offsets {
+                self.output.extend_from_slice(&offset.to_le_bytes());
+            }
+
+            let count = self.offsets.len() as u32;
+            self.output.extend_from_slice(&count.to_le_bytes());
+        }
+
+        fn begin_record(&mut self) {
+            let offset =
+                u32::try_from(self.output.len() - self.start).expect("directory content too large");
+            self.offsets.push(offset);
+        }
+    }
+
+    // Splits the trailing u32 off the input.
+    fn split_u32(input: &[u8]) -> Result<(&[u8], u32)> {
+        let len = input
+            .len()
+            .checked_sub(4)
+            .ok_or(Error::MalformedDirectory)?;
+        let (input, tail) = input.split_at(len);
+
+        // Unwrap OK because `tail` is exactly 4 bytes long.
+        Ok((input, u32::from_le_bytes(tail.try_into().unwrap())))
+    }
+}
+
 mod v2 {
     use super::{
         super::entry_data::{EntryData, EntryTombstoneData, TombstoneCause},
@@ -263,3 +611,161 @@ mod v0 {
         pub version_vector: VersionVector,
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::crypto::sign::PublicKey;
+
+    #[test]
+    fn serialize_and_deserialize() {
+        let content = make_content(["b", "a", "c"]);
+        let loaded = Content::deserialize(&content.serialize()).unwrap();
+
+        assert_eq!(names(&loaded), ["a", "b", "c"]);
+        assert_eq!(entries(&loaded), entries(&content));
+
+        for (name, data) in content.iter().unwrap() {
+            assert_eq!(loaded.get_key_value(name).unwrap(), Some((name, data)));
+        }
+
+        assert_eq!(loaded.get_key_value("d").unwrap(), None);
+    }
+
+    #[test]
+    fn deserialize_v2() {
+        let content = make_content(["a", "b"]);
+        let entries: v2::Entries = content
+            .iter()
+            .unwrap()
+            .map(|(name, data)| (name.to_owned(), data.clone()))
+            .collect();
+
+        let mut input = Vec::new();
+        input.extend_from_slice(vint64::encode(2).as_ref());
+        bincode::serialize_into(&mut input, &entries).unwrap();
+
+        let loaded = Content::deserialize(&input).unwrap();
+        assert_eq!(entries(&loaded), entries(&content));
+
+        // Saved in the current version
+        let mut output = &loaded.serialize()[..];
+        assert_eq!(vint64::decode(&mut output).unwrap(), VERSION);
+    }
+
+    #[test]
+    fn modify_loaded() {
+        let mut content = Content::deserialize(&make_content(["a", "c"]).serialize()).unwrap();
+
+        content
+            .insert(
+                "b".to_owned(),
+                EntryData::file(rand::random(), VersionVector::new()),
+            )
+            .unwrap()
+            .unwrap();
+        content
+            .bump("c", Bump::increment(PublicKey::random()))
+            .unwrap();
+
+        assert_eq!(names(&content), ["a", "b", "c"]);
+        assert!(!content
+            .get_key_value("c")
+            .unwrap()
+            .unwrap()
+            .1
+            .version_vector()
+            .is_empty());
+
+        let loaded = Content::deserialize(&content.serialize()).unwrap();
+        assert_eq!(entries(&loaded), entries(&content));
+    }
+
+    #[test]
+    fn modify_loaded_preserves_preceding_bytes() {
+        let original = make_content(["a", "b", "c", "d"]).serialize();
+        let mut content = Content::deserialize(&original).unwrap();
+
+        // Serialized length of the version and the entries preceding "d".
+        let prefix_len = vint64::encode(VERSION).as_ref().len()
+            + (0..3)
+                .map(|index| content.base.raw(index).len())
+                .sum::<usize>();
+
+        content
+            .bump("d", Bump::increment(PublicKey::random()))
+            .unwrap();
+
+        let modified = content.serialize();
+
+        assert_ne!(modified, original);
+        assert_eq!(modified[..prefix_len], original[..prefix_len]);
+    }
+
+    #[test]
+    fn deserialize_malformed() {
+        let input = make_content(["a", "b"]).serialize();
+
+        for len in 0..input.len() {
+            assert!(Content::deserialize(&input[..len]).is_err());
+        }
+    }
+
+    #[test]
+    fn deserialize_records_without_index() {
+        // Records not covered by the index must not be silently ignored. Appending a zero count to
+        // the first record (which itself ends with zero bytes) must not parse as empty directory.
+        let input = make_content(["a"]).serialize();
+        let index_len = 4 + 4; // one offset + count
+        let mut input = input[..input.len() - index_len].to_vec();
+        input.extend_from_slice(&0u32.to_le_bytes());
+
+        assert!(matches!(
+            Content::deserialize(&input),
+            Err(Error::MalformedDirectory)
+        ));
+    }
+
+    #[test]
+    fn malformed_entry_data() {
+        let mut input = make_content(["a", "b"]).serialize();
+
+        // Corrupt the variant tag of the first entry data which follows the version and the name
+        // length and the name of the first record.
+        input[3] = 0xff;
+
+        // The entry data is decoded lazily so loading still succeeds.
+        let content = Content::deserialize(&input).unwrap();
+
+        assert!(matches!(
+            content.get_key_value("a"),
+            Err(Error::MalformedDirectory)
+        ));
+        assert!(content.get_key_value("b").unwrap().is_some());
+        assert!(matches!(content.iter(), Err(Error::MalformedDirectory)));
+    }
+
+    fn make_content<const N: usize>(names: [&str; N]) -> Content {
+        let mut content = Content::empty();
+
+        for name in names {
+            content
+                .insert(
+                    name.to_owned(),
+                    EntryData::file(rand::random(), VersionVector::new()),
+                )
+                .unwrap()
+                .unwrap();
+        }
+
+        content
+    }
+
+    fn entries(content: &Content) -> Vec<(&str, &EntryData)> {
+        content.iter().unwrap().collect()
+    }
+
+    fn names(content: &Content) -> Vec<&str> {
+        content.iter().unwrap().map(|(name, _)| name).collect()
+    }
+}
@@ -1,3 +1,4 @@
+mod cache;
 mod content;
 mod entry;
 mod entry_data;
@@ -6,15 +7,16 @@ mod parent_context;
 #[cfg(test)]
 mod tests;
 
+pub(crate) use self::{
+    cache::DirectoryCache,
+    entry_data::{EntryData, EntryTombstoneData, TombstoneCause},
+    parent_context::ParentContext,
+};
 pub use self::{
     content::VERSION as DIRECTORY_VERSION,
     entry::{DirectoryRef, EntryRef, FileRef},
     entry_type::EntryType,
 };
-pub(crate) use self::{
-    entry_data::{EntryData, EntryTombstoneData, TombstoneCause},
-    parent_context::ParentContext,
-};
 
 use self::content::Content;
 use crate::{
@@ -112,16 +114,18 @@ impl Directory {
     /// Lookup an entry of this directory by name.
     pub fn lookup(&self, name: &'_ str) -> Result<EntryRef> {
         self.content
-            .get_key_value(name)
+            .get_key_value(name)?
             .map(|(name, data)| EntryRef::new(self, name, data))
             .ok_or(Error::EntryNotFound)
     }
 
-    /// Returns iterator over the entries of this directory.
-    pub fn entries(&self) -> impl DoubleEndedIterator<Item = EntryRef> + Clone {
-        self.content
-            .iter()
-            .map(move |(name, data)| EntryRef::new(self, name, data))
+    /// Returns iterator over the entries of this directory. Fails if any of the entries is
+    /// malformed.
+    pub fn entries(&self) -> Result<impl Iterator<Item = EntryRef> + Clone> {
+        Ok(self
+            .content
+            .iter()?
+            .map(move |(name, data)| EntryRef::new(self, name, data)))
     }
 
     /// Creates a new file inside this directory.
@@ -134,7 +138,7 @@ impl Directory {
         let blob_id = rand::random();
         let version_vector = self
             .content
-            .initial_version_vector(&name)
+            .initial_version_vector(&name)?
             .incremented(*self.branch().id());
         let data = EntryData::file(blob_id, version_vector);
         let parent = self.create_parent_context(name.clone());
@@ -142,7 +146,7 @@ impl Directory {
         let mut file = File::create(self.branch().clone(), Locator::head(blob_id), parent);
         let mut content = self.content.clone();
 
-        let diff = content.insert(name, data)?;
+        let diff = content.insert(name, data)??;
 
         file.save(&mut tx, &mut changeset).await?;
         self.save(&mut tx, &mut changeset, &content).await?;
@@ -203,7 +207,7 @@ impl Directory {
         blob_id: BlobId,
         merge: &VersionVector,
     ) -> Result<(Self, Content)> {
-        let mut version_vector = self.content.initial_version_vector(&name);
+        let mut version_vector = self.content.initial_version_vector(&name)?;
 
         if merge.is_empty() {
             version_vector.increment(*self.branch().id())
@@ -217,7 +221,7 @@ impl Directory {
         let mut dir = Directory::create(lock, self.branch().clone(), blob_id, Some(parent));
         let mut content = self.content.clone();
 
-        let diff = content.insert(name, data)?;
+        let diff = content.insert(name, data)??;
 
         dir.save(tx, changeset, &Content::empty()).await?;
         self.save(tx, changeset, &content).await?;
@@ -587,7 +591,7 @@ impl Directory {
 
         let mut self_content = self.content.clone();
 
-        let entry = match self_content.get_mut(name) {
+        let entry = match self_content.get_mut(name)? {
             Some(EntryData::Directory(entry)) => entry,
             Some(EntryData::File(_) | EntryData::Tombstone(_)) | None => unreachable!(),
         };
@@ -701,7 +705,15 @@ impl Directory {
 
     #[async_recursion]
     pub async fn debug_print(&self, print: DebugPrinter) {
-        for (name, entry_data) in &self.content {
+        let entries = match self.content.iter() {
+            Ok(entries) => entries,
+            Err(e) => {
+                print.display(&format!("Failed to read entries {:?}", e));
+                return;
+            }
+        };
+
+        for (name, entry_data) in entries {
             print.display(&format_args!("{:?}: {:?}", name, entry_data));
 
             match entry_data {
@@ -853,7 +865,7 @@ impl Directory {
         self.refresh_in(tx).await?;
 
         let mut content = self.content.clone();
-        let diff = content.insert(name, data)?;
+        let diff = content.insert(name, data)??;
         self.save(tx, changeset, &content).await?;
         self.bump(tx, changeset, Bump::Add(diff)).await?;
 
@@ -975,10 +987,31 @@ async fn load(
     fallback: DirectoryFallback,
 ) -> Result<(Blob, Content)> {
     let mut root_node = tx.load_root_node(branch.id(), RootNodeFilter::Any).await?;
+    let cache = branch.directory_cache().clone();
+
+    if let Some((len, content)) = cache.get(branch.id(), &blob_id, &root_node.proof.hash) {
+        return Ok((Blob::open_with_len(branch, blob_id, len), content));
+    }
+
+    let mut head = true;
 
     loop {
         let error = match load_at(tx, &root_node, branch.clone(), blob_id).await {
-            Ok((blob, content)) => return Ok((blob, content)),
+            Ok((blob, content)) => {
+                // Cache only the latest version, the fallback ones are going to be superseded once
+                // the missing blocks arrive.
+                if head {
+                    cache.insert(
+                        *branch.id(),
+                        blob_id,
+                        root_node.proof.hash,
+                        blob.len(),
+                        content.clone(),
+                    );
+                }
+
+                return Ok((blob, content));
+            }
             Err(error @ Error::Store(store::Error::BlockNotFound)) => error,
             Err(error) => return Err(error),
         };
@@ -990,6 +1023,7 @@ async fn load(
 
         if let Some(prev) = tx.load_prev_root_node(&root_node).await? {
             root_node = prev;
+            head = false;
         } else {
             return Err(error);
         }
@@ -94,7 +94,7 @@ impl ParentContext {
         // Check whether the fork is allowed, to avoid the hard work in case it isn't.
         let old_blob_id = match directory
             .content
-            .check_insert(self.entry_name(), &src_entry_data)
+            .check_insert(self.entry_name(), &src_entry_data)?
         {
             Ok(id) => id,
             Err(EntryExists::Same) => {
@@ -126,7 +126,7 @@ impl ParentContext {
 
         match directory
             .content
-            .check_insert(self.entry_name(), &src_entry_data)
+            .check_insert(self.entry_name(), &src_entry_data)?
         {
             Ok(_) => {
                 // TODO: what if the old_blob_id changed since the first `check_insert`?
@@ -158,7 +158,7 @@ impl ParentContext {
 
         let mut content = directory.content.clone();
 
-        match content.insert(self.entry_name.clone(), src_entry_data) {
+        match content.insert(self.entry_name.clone(), src_entry_data)? {
             Ok(diff) => {
                 directory.save(&mut tx, &mut changeset, &content).await?;
                 directory
@@ -1,6 +1,7 @@
 use super::*;
 use crate::{
     access_control::{AccessKeys, WriteSecrets},
+    block_tracker::BlockTracker,
     branch::BranchShared,
     db,
     event::EventSender,
@@ -34,7 +35,7 @@ async fn create_and_list_entries() {
         .unwrap();
 
     let expected_names: BTreeSet<_> = ["dog.txt", "cat.txt"].into_iter().collect();
-    let actual_names: BTreeSet<_> = dir.entries().map(|entry| entry.name()).collect();
+    let actual_names: BTreeSet<_> = dir.entries().unwrap().map(|entry| entry.name()).collect();
     assert_eq!(actual_names, expected_names);
 
     for &(file_name, expected_content) in &[("dog.txt", b"woof"), ("cat.txt", b"meow")] {
@@ -107,7 +108,7 @@ async fn remove_file() {
         .unwrap();
 
     assert_matches!(parent_dir.lookup(name), Ok(EntryRef::Tombstone(_)));
-    assert_eq!(parent_dir.entries().count(), 1);
+    assert_eq!(parent_dir.entries().unwrap().count(), 1);
 
     // Try re-creating the file again
     let mut parent_dir = branch
@@ -436,7 +437,7 @@ async fn fork_sanity_check() {
         .await
         .unwrap();
 
-    assert_eq!(dir.entries().count(), 0);
+    assert_eq!(dir.entries().unwrap().count(), 0);
 
     // Reopen forked dir and verify it contains the new file
     let dir = branch1
@@ -452,7 +453,7 @@ async fn fork_sanity_check() {
         .unwrap();
 
     assert_eq!(
-        dir.entries().map(|entry| entry.name()).next(),
+        dir.entries().unwrap().map(|entry| entry.name()).next(),
         Some("dog.jpg")
     );
 }
@@ -713,6 +714,65 @@ async fn create_tombstone_is_idempotent() {
     assert_eq!(proof2, proof1);
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn open_cached() {
+    let (_base_dir, branch) = setup().await;
+
+    let mut dir = branch.open_or_create_root().await.unwrap();
+    dir.create_file("one.txt".into()).await.unwrap();
+
+    let open = || async {
+        branch
+            .open_root(DirectoryLocking::Enabled, DirectoryFallback::Disabled)
+            .await
+            .unwrap()
+    };
+    let cached = || async {
+        let root_node = branch
+            .store()
+            .begin_read()
+            .await
+            .unwrap()
+            .load_root_node(branch.id(), RootNodeFilter::Any)
+            .await
+            .unwrap();
+
+        branch
+            .directory_cache()
+            .get(branch.id(), dir.blob_id(), &root_node.proof.hash)
+            .is_some()
+    };
+
+    // Opening the directory caches it for the current snapshot.
+    open().await;
+    assert!(cached().await);
+
+    // Opening it again is served from the cache.
+    let dir = open().await;
+    assert_eq!(
+        dir.entries()
+            .unwrap()
+            .map(|entry| entry.name())
+            .collect::<Vec<_>>(),
+        ["one.txt"]
+    );
+
+    // Modifying the directory creates a new snapshot for which nothing is cached yet.
+    let mut dir = open().await;
+    dir.create_file("two.txt".into()).await.unwrap();
+    assert!(!cached().await);
+
+    let dir = open().await;
+    assert_eq!(
+        dir.entries()
+            .unwrap()
+            .map(|entry| entry.name())
+            .collect::<Vec<_>>(),
+        ["one.txt", "two.txt"]
+    );
+    assert!(cached().await);
+}
+
 async fn setup() -> (TempDir, Branch) {
     let (base_dir, [branch]) = setup_multiple().await;
     (base_dir, branch)
@@ -729,7 +789,7 @@ async fn setup_multiple<const N: usize>() -> (TempDir, [Branch; N]) {
 fn create_branch(pool: db::Pool, keys: AccessKeys) -> Branch {
     let store = Store::new(pool);
     let id = PublicKey::random();
-    let shared = BranchShared::new();
+    let shared = BranchShared::new(BlockTracker::new());
     let event_tx = EventSender::new(1);
     Branch::new(id, store, keys, shared, event_tx)
 }
@@ -7,7 +7,7 @@ use crate::{
     branch::Branch,
     directory::{Directory, ParentContext},
     error::{Error, Result},
-    protocol::{Bump, Locator, BLOCK_SIZE},
+    protocol::{Bump, Locator, RootNodeFilter, BLOCK_SIZE},
     store::{Changeset, ReadTransaction},
     version_vector::VersionVector,
 };
@@ -87,12 +87,13 @@ impl File {
             let permit = branch.file_progress_cache().acquire().await;
 
             let mut tx = branch.store().begin_read().await?;
-            let mut entry = permit.get(*locator.blob_id());
+            let root_node = tx.load_root_node(branch.id(), RootNodeFilter::Any).await?;
+            let mut entry = permit.get(*locator.blob_id(), root_node.proof.hash);
             let mut count = *entry;
 
             for index in *entry..block_count {
                 let encoded_locator = locator.nth(index).encode(branch.keys().read());
-                let block_id = tx.find_block(branch.id(), &encoded_locator).await?;
+                let block_id = tx.find_block_at(&root_node, &encoded_locator).await?;
 
                 if tx.block_exists(&block_id).await? {
                     count = count.saturating_add(1);
@@ -312,6 +313,7 @@ mod tests {
     use super::*;
     use crate::{
         access_control::{AccessKeys, WriteSecrets},
+        block_tracker::BlockTracker,
         branch::BranchShared,
         crypto::sign::PublicKey,
         db,
@@ -465,7 +467,7 @@ mod tests {
         let store = Store::new(pool);
         let keys = AccessKeys::from(WriteSecrets::random());
         let event_tx = EventSender::new(1);
-        let shared = BranchShared::new();
+        let shared = BranchShared::new(BlockTracker::new());
 
         let branches = [(); N].map(|_| {
             create_branch(
@@ -1,4 +1,4 @@
-use crate::{blob::BlobId, collections::HashMap};
+use crate::{blob::BlobId, collections::HashMap, crypto::Hash};
 use deadlock::BlockingMutex;
 use std::{
     ops::{Deref, DerefMut},
@@ -39,17 +39,20 @@ impl FileProgressCache {
             permit,
         }
     }
-
-    pub fn reset(&self, blob_id: &BlobId, new_count: u32) {
-        if let Some((count, _)) = self.shared.block_counts.lock().unwrap().get_mut(blob_id) {
-            *count = new_count;
-        }
-    }
 }
 
 struct Shared {
     semaphore: Semaphore,
-    block_counts: BlockingMutex<HashMap<BlobId, (u32, Instant)>>,
+    block_counts: BlockingMutex<HashMap<BlobId, CachedCount>>,
+}
+
+// Number of the leading blocks of a blob which are present locally. It's valid only for the
+// snapshot it was computed in, because a new snapshot can replace the blob's blocks with ones
+// that are missing.
+struct CachedCount {
+    value: u32,
+    snapshot: Hash,
+    timestamp: Instant,
 }
 
 pub(crate) struct Permit<'a> {
@@ -58,19 +61,23 @@ pub(crate) struct Permit<'a> {
 }
 
 impl<'a> Permit<'a> {
-    pub fn get(self, blob_id: BlobId) -> Entry<'a> {
+    /// Gets the cached block count of the given blob in the given snapshot (identified by its
+    /// root hash).
+    pub fn get(self, blob_id: BlobId, snapshot: Hash) -> Entry<'a> {
         let mut block_counts = self.shared.block_counts.lock().unwrap();
 
-        block_counts.retain(|_, (_, timestamp)| timestamp.elapsed() < EXPIRY);
+        block_counts.retain(|_, count| count.timestamp.elapsed() < EXPIRY);
 
         let value = block_counts
             .get(&blob_id)
-            .map(|(value, _)| *value)
+            .filter(|count| count.snapshot == snapshot)
+            .map(|count| count.value)
             .unwrap_or(0);
 
         Entry {
             shared: self.shared,
             blob_id,
+            snapshot,
             value,
             _permit: self.permit,
         }
@@ -80,6 +87,7 @@ impl<'a> Permit<'a> {
 pub(crate) struct Entry<'a> {
     shared: &'a Shared,
     blob_id: BlobId,
+    snapshot: Hash,
     value: u32,
     _permit: SemaphorePermit<'a>,
 }
@@ -105,12 +113,20 @@ impl Drop for Entry<'_> {
             .lock()
             .unwrap()
             .entry(self.blob_id)
-            .and_modify(|(value, timestamp)| {
-                if self.value > *value {
-                    *value = self.value;
-                    *timestamp = Instant::now();
+            .and_modify(|count| {
+                if count.snapshot != self.snapshot {
+                    count.value = self.value;
+                    count.snapshot = self.snapshot;
+                    count.timestamp = Instant::now();
+                } else if self.value > count.value {
+                    count.value = self.value;
+                    count.timestamp = Instant::now();
                 }
             })
-            .or_insert_with(|| (0, Instant::now()));
+            .or_insert_with(|| CachedCount {
+                value: 0,
+                snapshot: self.snapshot,
+                timestamp: Instant::now(),
+            });
     }
 }
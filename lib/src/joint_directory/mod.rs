@@ -77,7 +77,11 @@ impl JointDirectory {
     }
 
     fn merge_entries(&self) -> impl Iterator<Item = (&str, Merge)> {
-        let entries = self.versions.values().map(|directory| directory.entries());
+        // Versions with malformed entries are skipped, the same as in `lookup`.
+        let entries = self
+            .versions
+            .values()
+            .filter_map(|directory| directory.entries().ok());
         let entries = SortedUnion::new(entries, |entry| entry.name());
         let entries = Accumulate::new(entries, |entry| entry.name());
         entries.map(|(name, entries)| {
@@ -1,6 +1,7 @@
 use super::*;
 use crate::{
     access_control::WriteSecrets,
+    block_tracker::BlockTracker,
     branch::{Branch, BranchShared},
     crypto::{sign::PublicKey, Hash},
     db,
@@ -1176,7 +1177,7 @@ async fn setup_with_rng<const N: usize>(mut rng: StdRng) -> (TempDir, [Branch; N
     let store = Store::new(pool);
     let event_tx = EventSender::new(1);
     let secrets = WriteSecrets::generate(&mut rng);
-    let shared = BranchShared::new();
+    let shared = BranchShared::new(BlockTracker::new());
 
     let branches = [(); N].map(|_| {
         let id = PublicKey::generate(&mut rng);
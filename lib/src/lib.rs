@@ -47,8 +47,9 @@ pub use self::{
         ShareToken, WriteSecrets,
     },
     blob::HEADER_SIZE as BLOB_HEADER_SIZE,
+    block_tracker::SchedulingPolicy as BlockSchedulingPolicy,
     branch::Branch,
-    db::SCHEMA_VERSION,
+    db::{StorageProfile, Synchronous as StorageSynchronous, SCHEMA_VERSION},
     debug::DebugPrinter,
     device_id::DeviceId,
     directory::{Directory, EntryRef, EntryType, DIRECTORY_VERSION},
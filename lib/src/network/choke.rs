@@ -1,3 +1,5 @@
+use super::traffic_tracker::{TrafficStats, TrafficTracker};
+use rand::Rng;
 use std::{
     collections::HashMap,
     sync::{
@@ -10,33 +12,106 @@ use tokio::{
     time::{self, Duration, Instant},
 };
 
-const MAX_UNCHOKED_COUNT: usize = 3;
+const DEFAULT_UNCHOKE_SLOTS: usize = 3;
 const PERMIT_DURATION_TIMEOUT: Duration = Duration::from_secs(30);
 const PERMIT_INACTIVITY_TIMEOUT: Duration = Duration::from_secs(3);
+// Minimal interval over which the per peer transfer rates are measured.
+const RATE_INTERVAL: Duration = Duration::from_secs(5);
+// How long the optimistically unchoked peer is exempt from eviction. It starts with no measured
+// rate so without this it would be the first one evicted.
+const OPTIMISTIC_UNCHOKE_DURATION: Duration = PERMIT_DURATION_TIMEOUT;
+
+/// Configuration of how many and which peers are served concurrently (per repository). The other
+/// peers are "choked" - their requests are queued until they get unchoked.
+#[derive(Clone, Copy, Eq, PartialEq, Debug)]
+pub struct ChokeConfig {
+    pub slots: UnchokeSlots,
+    pub selection: UnchokeSelection,
+}
+
+impl Default for ChokeConfig {
+    fn default() -> Self {
+        Self {
+            slots: UnchokeSlots::Fixed(DEFAULT_UNCHOKE_SLOTS),
+            selection: UnchokeSelection::Random,
+        }
+    }
+}
+
+/// Number of peers that can be unchoked at the same time.
+#[derive(Clone, Copy, Eq, PartialEq, Debug)]
+pub enum UnchokeSlots {
+    /// Fixed number of slots.
+    Fixed(usize),
+    /// Scale the number of slots with the measured upload throughput: Start with `min` slots and
+    /// open another one whenever the unchoked peers download from us at least `bytes_per_slot`
+    /// bytes per second each on average. Close one when they no longer saturate the remaining
+    /// slots. Never go above `max`.
+    Auto {
+        min: usize,
+        max: usize,
+        bytes_per_slot: u64,
+    },
+}
+
+impl UnchokeSlots {
+    fn initial(&self) -> usize {
+        match self {
+            Self::Fixed(count) => (*count).max(1),
+            Self::Auto { min, max, .. } => auto_bounds(*min, *max).0,
+        }
+    }
+}
+
+// Normalized `(min, max)` of `UnchokeSlots::Auto`: at least one slot and `max` not below `min`.
+fn auto_bounds(min: usize, max: usize) -> (usize, usize) {
+    let lo = min.max(1);
+    let hi = max.max(lo);
+    (lo, hi)
+}
+
+/// Strategy for selecting which peers to unchoke.
+#[derive(Clone, Copy, Eq, PartialEq, Debug)]
+pub enum UnchokeSelection {
+    /// Unchoke random interested peers.
+    Random,
+    /// Tit-for-tat: Unchoke the interested peers that upload to us the fastest, except for one
+    /// slot which is given to a random peer ("optimistic unchoke") so that the new peers get a
+    /// chance to start reciprocating.
+    TitForTat,
+}
 
-pub(crate) struct Manager {
+pub(super) struct Manager {
     inner: Arc<Mutex<ManagerInner>>,
 }
 
 impl Manager {
-    pub fn new() -> Self {
+    pub fn new(config: ChokeConfig) -> Self {
         Self {
             inner: Arc::new(Mutex::new(ManagerInner {
                 next_choker_id: AtomicUsize::new(0),
                 choked: Default::default(),
                 unchoked: Default::default(),
+                traffic: Default::default(),
                 notify: Arc::new(Notify::new()),
+                config,
+                slots: config.slots.initial(),
+                optimistic: None,
+                last_sample: Instant::now(),
             })),
         }
     }
 
-    /// Creates a new choker which is initially choked.
-    pub fn new_choker(&self) -> Choker {
+    /// Creates a new choker which is initially choked. `tracker` should track the traffic
+    /// exchanged with the peer the choker is for. It's used to rank the peers when the selection
+    /// strategy is `TitForTat` and to measure the upload throughput when the slots are `Auto`.
+    pub fn new_choker(&self, tracker: TrafficTracker) -> Choker {
         let mut inner = self.inner.lock().unwrap();
 
         let id = inner.next_choker_id.fetch_add(1, Ordering::Relaxed);
 
         inner.choked.insert(id, ChokedState::Uninterested);
+        inner.traffic.insert(id, PeerTraffic::new(tracker));
 
         Choker {
             inner: Arc::new(ChokerInner {
@@ -47,6 +122,21 @@ impl Manager {
             choked: true,
         }
     }
+
+    pub fn set_config(&self, config: ChokeConfig) {
+        let mut inner = self.inner.lock().unwrap();
+
+        inner.slots = match config.slots {
+            UnchokeSlots::Fixed(count) => count.max(1),
+            UnchokeSlots::Auto { min, max, .. } => {
+                let (lo, hi) = auto_bounds(min, max);
+                inner.slots.clamp(lo, hi)
+            }
+        };
+        inner.config = config;
+
+        inner.notify.notify_waiters();
+    }
 }
 
 #[derive(Eq, PartialEq)]
@@ -62,10 +152,6 @@ struct UnchokedState {
 }
 
 impl UnchokedState {
-    fn is_evictable(&self) -> bool {
-        Instant::now() >= self.evictable_at()
-    }
-
     fn evictable_at(&self) -> Instant {
         let i1 = self.unchoke_started + PERMIT_DURATION_TIMEOUT;
         let i2 = self.time_of_last_permit + PERMIT_INACTIVITY_TIMEOUT;
@@ -87,11 +173,49 @@ impl Default for UnchokedState {
     }
 }
 
+struct PeerTraffic {
+    tracker: TrafficTracker,
+    last: TrafficStats,
+    // Bytes per second received from the peer.
+    recv_rate: f64,
+    // Bytes per second sent to the peer.
+    send_rate: f64,
+}
+
+impl PeerTraffic {
+    fn new(tracker: TrafficTracker) -> Self {
+        let last = tracker.get();
+
+        Self {
+            tracker,
+            last,
+            recv_rate: 0.0,
+            send_rate: 0.0,
+        }
+    }
+
+    fn sample(&mut self, elapsed: Duration) {
+        let stats = self.tracker.get();
+        let secs = elapsed.as_secs_f64();
+
+        self.recv_rate = stats.recv.saturating_sub(self.last.recv) as f64 / secs;
+        self.send_rate = stats.send.saturating_sub(self.last.send) as f64 / secs;
+        self.last = stats;
+    }
+}
+
 struct ManagerInner {
     next_choker_id: AtomicUsize,
     choked: HashMap<usize, ChokedState>,
     unchoked: HashMap<usize, UnchokedState>,
+    traffic: HashMap<usize, PeerTraffic>,
     notify: Arc<Notify>,
+    config: ChokeConfig,
+    // Current number of unchoke slots.
+    slots: usize,
+    // The optimistically unchoked choker (only with `UnchokeSelection::TitForTat`).
+    optimistic: Option<usize>,
+    last_sample: Instant,
 }
 
 #[derive(Debug)]
@@ -111,6 +235,8 @@ impl ManagerInner {
     /// * we calculate when the soonest unchoked choker is evictable and `choker_id` will
     ///   need to recheck at that time.
     fn get_permit(&mut self, choker_id: usize) -> GetPermitResult {
+        self.sample();
+
         if let Some(state) = self.unchoked.get_mut(&choker_id) {
             // It's unchoked, update permit and return.
             state.time_of_last_permit = Instant::now();
@@ -120,9 +246,9 @@ impl ManagerInner {
         self.choked.insert(choker_id, ChokedState::Interested);
 
         // It's choked, check if we can unchoke something.
-        if self.unchoked.len() < MAX_UNCHOKED_COUNT || self.try_evict_from_unchoked() {
+        if self.unchoked.len() < self.slots || self.try_evict_from_unchoked() {
             // Unwrap OK because we know `choked` is not empty (`choker_id` is in it).
-            let to_unchoke = self.random_choked_and_interested().unwrap();
+            let to_unchoke = self.select_to_unchoke().unwrap();
 
             assert!(self.choked.remove(&to_unchoke).is_some());
             self.unchoked.insert(to_unchoke, UnchokedState::default());
@@ -134,74 +260,182 @@ impl ManagerInner {
                 GetPermitResult::Granted
             } else {
                 // Unwrap OK because we know `unchoked` is not empty.
-                let until = self.soonest_evictable().unwrap().1.evictable_at();
+                let until = self.soonest_evictable_at().unwrap();
                 GetPermitResult::AwaitUntil(until)
             }
         } else {
             // Unwrap OK because we know `unchoked` is not empty.
-            let until = self.soonest_evictable().unwrap().1.evictable_at();
+            let until = self.soonest_evictable_at().unwrap();
             GetPermitResult::AwaitUntil(until)
         }
     }
 
+    // Update the transfer rates and, if `UnchokeSlots::Auto`, the number of slots.
+    fn sample(&mut self) {
+        let now = Instant::now();
+        let elapsed = now.saturating_duration_since(self.last_sample);
+
+        if elapsed < RATE_INTERVAL {
+            return;
+        }
+
+        self.last_sample = now;
+
+        for traffic in self.traffic.values_mut() {
+            traffic.sample(elapsed);
+        }
+
+        let UnchokeSlots::Auto {
+            min,
+            max,
+            bytes_per_slot,
+        } = self.config.slots
+        else {
+            return;
+        };
+
+        let upload: f64 = self
+            .unchoked
+            .keys()
+            .filter_map(|id| self.traffic.get(id))
+            .map(|traffic| traffic.send_rate)
+            .sum();
+
+        let bytes_per_slot = bytes_per_slot as f64;
+        let (lo, hi) = auto_bounds(min, max);
+
+        if self.slots < hi && upload >= self.slots as f64 * bytes_per_slot {
+            self.slots += 1;
+            // Let the choked chokers know there is a new free slot.
+            self.notify.notify_waiters();
+        } else if self.slots > lo && upload < (self.slots - 1) as f64 * bytes_per_slot {
+            self.slots -= 1;
+        }
+    }
+
     // Return true if some choker was evicted from `unchoked` and inserted into `choked`.
     fn try_evict_from_unchoked(&mut self) -> bool {
-        let to_evict = if let Some((id, state)) = self.soonest_evictable() {
-            if state.is_evictable() {
-                Some(id)
-            } else {
-                None
-            }
-        } else {
-            None
+        let to_evict = match self.config.selection {
+            UnchokeSelection::Random => self
+                .soonest_evictable()
+                .filter(|(id, state)| self.is_evictable(*id, state))
+                .map(|(id, _)| id),
+            // Evict the peer that uploads to us the least.
+            UnchokeSelection::TitForTat => self
+                .unchoked
+                .iter()
+                .filter(|(id, state)| self.is_evictable(**id, state))
+                .map(|(id, _)| *id)
+                .min_by(|a, b| self.recv_rate(*a).total_cmp(&self.recv_rate(*b))),
         };
 
         if let Some(to_evict) = to_evict {
             self.unchoked.remove(&to_evict);
             self.choked.insert(to_evict, ChokedState::Uninterested);
+
+            if self.optimistic == Some(to_evict) {
+                self.optimistic = None;
+            }
+
             true
         } else {
             false
         }
     }
 
-    fn soonest_evictable(&self) -> Option<(usize, UnchokedState)> {
-        let mut soonest: Option<(usize, UnchokedState)> = None;
-        for (id, state) in &self.unchoked {
-            let evictable_at = state.evictable_at();
-            if let Some(old_soonest) = soonest {
-                if evictable_at < old_soonest.1.evictable_at() {
-                    soonest = Some((*id, *state));
+    fn select_to_unchoke(&mut self) -> Option<usize> {
+        match self.config.selection {
+            UnchokeSelection::Random => self.random_choked_and_interested(),
+            UnchokeSelection::TitForTat => {
+                if self.optimistic.is_none() {
+                    let id = self.random_choked_and_interested()?;
+                    self.optimistic = Some(id);
+                    Some(id)
+                } else {
+                    self.fastest_choked_and_interested()
                 }
-            } else {
-                soonest = Some((*id, *state));
             }
         }
-        soonest
     }
 
-    fn random_choked_and_interested(&self) -> Option<usize> {
-        use rand::Rng;
+    fn soonest_evictable_at(&self) -> Option<Instant> {
+        self.soonest_evictable()
+            .map(|(id, state)| self.evictable_at(id, &state))
+    }
+
+    fn is_evictable(&self, choker_id: usize, state: &UnchokedState) -> bool {
+        Instant::now() >= self.evictable_at(choker_id, state)
+    }
+
+    // The optimistically unchoked choker is not evictable until its optimistic interval expires,
+    // even when it's inactive or when the others are already evictable.
+    fn evictable_at(&self, choker_id: usize, state: &UnchokedState) -> Instant {
+        let evictable_at = state.evictable_at();
 
-        let mut interested = self
-            .choked
+        if self.optimistic == Some(choker_id) {
+            evictable_at.max(state.unchoke_started + OPTIMISTIC_UNCHOKE_DURATION)
+        } else {
+            evictable_at
+        }
+    }
+
+    fn soonest_evictable(&self) -> Option<(usize, UnchokedState)> {
+        self.unchoked
             .iter()
-            .filter(|(_, state)| **state == ChokedState::Interested);
+            .min_by_key(|(id, state)| self.evictable_at(**id, state))
+            .map(|(id, state)| (*id, *state))
+    }
 
+    fn random_choked_and_interested(&self) -> Option<usize> {
+        let mut interested = self.choked_and_interested();
         let count = interested.clone().count();
 
         if count == 0 {
             return None;
         }
 
-        interested
-            .nth(rand::thread_rng().gen_range(0..count))
+        interested.nth(rand::thread_rng().gen_range(0..count))
+    }
+
+    // Returns the choked and interested choker whose peer uploads to us the fastest. Ties are
+    // broken randomly.
+    fn fastest_choked_and_interested(&self) -> Option<usize> {
+        let max_rate = self
+            .choked_and_interested()
+            .map(|id| self.recv_rate(id))
+            .max_by(f64::total_cmp)?;
+
+        let mut fastest = self
+            .choked_and_interested()
+            .filter(|id| self.recv_rate(*id) >= max_rate);
+        let count = fastest.clone().count();
+
+        fastest.nth(rand::thread_rng().gen_range(0..count))
+    }
+
+    fn choked_and_interested(&self) -> impl Iterator<Item = usize> + Clone + '_ {
+        self.choked
+            .iter()
+            .filter(|(_, state)| **state == ChokedState::Interested)
             .map(|(id, _)| *id)
     }
 
+    fn recv_rate(&self, choker_id: usize) -> f64 {
+        self.traffic
+            .get(&choker_id)
+            .map(|traffic| traffic.recv_rate)
+            .unwrap_or(0.0)
+    }
+
     fn remove_choker(&mut self, choker_id: usize) {
         self.choked.remove(&choker_id);
         self.unchoked.remove(&choker_id);
+        self.traffic.remove(&choker_id);
+
+        if self.optimistic == Some(choker_id) {
+            self.optimistic = None;
+        }
+
         self.notify.notify_waiters();
     }
 }
@@ -271,26 +505,29 @@ mod tests {
     // use simulated time (`start_paused`) to avoid having to wait for the timeout in the real time.
     #[tokio::test(start_paused = true)]
     async fn sanity() {
-        let manager = Manager::new();
+        let manager = Manager::new(ChokeConfig::default());
 
-        let mut chokers: Vec<_> = iter::repeat_with(|| manager.new_choker())
-            .take(MAX_UNCHOKED_COUNT + 1)
+        let mut chokers: Vec<_> = iter::repeat_with(|| manager.new_choker(TrafficTracker::new()))
+            .take(DEFAULT_UNCHOKE_SLOTS + 1)
             .collect();
 
         // All but one get unchoked immediatelly.
-        for choker in &mut chokers[..MAX_UNCHOKED_COUNT] {
+        for choker in &mut chokers[..DEFAULT_UNCHOKE_SLOTS] {
             assert_eq!(choker.changed().now_or_never(), Some(false));
         }
 
         // One gets unchoked after the timeout.
-        assert_eq!(chokers[MAX_UNCHOKED_COUNT].changed().now_or_never(), None);
+        assert_eq!(
+            chokers[DEFAULT_UNCHOKE_SLOTS].changed().now_or_never(),
+            None
+        );
 
-        assert!(!chokers[MAX_UNCHOKED_COUNT].changed().await);
+        assert!(!chokers[DEFAULT_UNCHOKE_SLOTS].changed().await);
 
         // And another one gets choked instead.
         let mut num_choked = 0;
 
-        for choker in &mut chokers[..MAX_UNCHOKED_COUNT] {
+        for choker in &mut chokers[..DEFAULT_UNCHOKE_SLOTS] {
             if let Some(choked) = choker.changed().now_or_never() {
                 assert!(choked);
                 num_choked += 1;
@@ -299,4 +536,151 @@ mod tests {
 
         assert_eq!(num_choked, 1);
     }
+
+    #[tokio::test(start_paused = true)]
+    async fn tit_for_tat() {
+        let manager = Manager::new(ChokeConfig {
+            slots: UnchokeSlots::Fixed(2),
+            selection: UnchokeSelection::TitForTat,
+        });
+
+        let trackers: Vec<_> = iter::repeat_with(TrafficTracker::new).take(4).collect();
+        let mut chokers: Vec<_> = trackers
+            .iter()
+            .map(|tracker| manager.new_choker(tracker.clone()))
+            .collect();
+
+        // The first one gets the optimistic slot, the second one the regular slot.
+        assert_eq!(chokers[0].changed().now_or_never(), Some(false));
+        assert_eq!(chokers[1].changed().now_or_never(), Some(false));
+
+        // The others are interested but have to wait.
+        assert_eq!(chokers[2].changed().now_or_never(), None);
+        assert_eq!(chokers[3].changed().now_or_never(), None);
+
+        // Peers 0 and 3 upload to us, peers 1 and 2 don't.
+        trackers[0].record_recv(1024 * 1024);
+        trackers[3].record_recv(1024 * 1024);
+
+        time::sleep(PERMIT_DURATION_TIMEOUT).await;
+
+        // Peer 1 is evicted because it uploads the least and peer 3 takes its place because it
+        // uploads the most.
+        assert_eq!(chokers[2].changed().now_or_never(), None);
+
+        assert_eq!(unchoked(&manager), [0, 3]);
+
+        assert_eq!(chokers[3].changed().now_or_never(), Some(false));
+    }
+
+    #[tokio::test(start_paused = true)]
+    async fn tit_for_tat_keeps_optimistic() {
+        let manager = Manager::new(ChokeConfig {
+            slots: UnchokeSlots::Fixed(2),
+            selection: UnchokeSelection::TitForTat,
+        });
+
+        let trackers: Vec<_> = iter::repeat_with(TrafficTracker::new).take(3).collect();
+        let mut chokers: Vec<_> = trackers
+            .iter()
+            .map(|tracker| manager.new_choker(tracker.clone()))
+            .collect();
+
+        // Peer 0 gets the optimistic slot, peer 1 the regular slot.
+        assert_eq!(chokers[0].changed().now_or_never(), Some(false));
+        assert_eq!(chokers[1].changed().now_or_never(), Some(false));
+        assert_eq!(chokers[2].changed().now_or_never(), None);
+
+        // Peer 1 uploads to us, the optimistic peer 0 doesn't (yet).
+        trackers[1].record_recv(1024 * 1024);
+
+        // Both become inactive but only peer 1 can be evicted because peer 0 is still within its
+        // optimistic interval.
+        time::sleep(RATE_INTERVAL).await;
+
+        assert_eq!(chokers[2].changed().now_or_never(), Some(false));
+        assert_eq!(unchoked(&manager), [0, 2]);
+
+        // Once the interval expires, peer 0 is evicted for not reciprocating and the optimistic
+        // slot goes to someone else.
+        trackers[2].record_recv(1024 * 1024);
+        time::sleep(OPTIMISTIC_UNCHOKE_DURATION).await;
+
+        assert_eq!(chokers[1].changed().now_or_never(), None);
+        assert_eq!(unchoked(&manager), [1, 2]);
+        assert_eq!(manager.inner.lock().unwrap().optimistic, Some(1));
+    }
+
+    #[tokio::test(start_paused = true)]
+    async fn auto_slots() {
+        let bytes_per_slot = 1024;
+        let manager = Manager::new(ChokeConfig {
+            slots: UnchokeSlots::Auto {
+                min: 1,
+                max: 4,
+                bytes_per_slot,
+            },
+            selection: UnchokeSelection::Random,
+        });
+
+        let trackers: Vec<_> = iter::repeat_with(TrafficTracker::new).take(2).collect();
+        let mut chokers: Vec<_> = trackers
+            .iter()
+            .map(|tracker| manager.new_choker(tracker.clone()))
+            .collect();
+
+        assert_eq!(chokers[0].changed().now_or_never(), Some(false));
+        assert_eq!(chokers[1].changed().now_or_never(), None);
+
+        // The unchoked peer saturates its slot so another one is opened.
+        trackers[0].record_send(bytes_per_slot * RATE_INTERVAL.as_secs());
+        time::advance(RATE_INTERVAL).await;
+
+        assert_eq!(chokers[1].changed().now_or_never(), Some(false));
+    }
+
+    #[tokio::test(start_paused = true)]
+    async fn auto_slots_zero_bounds() {
+        let config = ChokeConfig {
+            slots: UnchokeSlots::Auto {
+                min: 0,
+                max: 0,
+                bytes_per_slot: 1024,
+            },
+            selection: UnchokeSelection::Random,
+        };
+
+        let manager = Manager::new(config);
+        manager.set_config(config);
+
+        let trackers: Vec<_> = iter::repeat_with(TrafficTracker::new).take(2).collect();
+        let mut chokers: Vec<_> = trackers
+            .iter()
+            .map(|tracker| manager.new_choker(tracker.clone()))
+            .collect();
+
+        // Still one slot, which is never scaled up.
+        assert_eq!(chokers[0].changed().now_or_never(), Some(false));
+        assert_eq!(chokers[1].changed().now_or_never(), None);
+
+        trackers[0].record_send(1024 * 1024);
+        time::advance(RATE_INTERVAL).await;
+
+        let _ = chokers[1].changed().now_or_never();
+        assert_eq!(manager.inner.lock().unwrap().slots, 1);
+        assert_eq!(unchoked(&manager).len(), 1);
+    }
+
+    fn unchoked(manager: &Manager) -> Vec<usize> {
+        let mut unchoked: Vec<_> = manager
+            .inner
+            .lock()
+            .unwrap()
+            .unchoked
+            .keys()
+            .copied()
+            .collect();
+        unchoked.sort();
+        unchoked
+    }
 }
@@ -1,12 +1,19 @@
 use super::{
-    constants::MAX_PENDING_REQUESTS_PER_CLIENT,
-    debug_payload::{DebugResponse, PendingDebugRequest},
-    message::{Content, Response, ResponseDisambiguator},
+    constants::{
+        MAX_BLOCKS_PER_REQUEST, MAX_PENDING_REQUESTS_PER_CLIENT, MAX_SUBTREE_DEPTH, REQUEST_TIMEOUT,
+    },
+    content_queue::ContentSender,
+    debug_payload::{DebugRequest, DebugResponse, PendingDebugRequest},
+    message::{Content, Request, Response, ResponseDisambiguator},
+    node_filter::NodeFilter,
     pending::{PendingRequest, PendingRequests, PendingResponse, ProcessedResponse},
+    request_window::RequestWindow,
 };
 use crate::{
     block_tracker::{BlockPromise, OfferState, TrackerClient},
-    crypto::{sign::PublicKey, CacheHash, Hashable},
+    collections::HashMap,
+    crypto::{sign::PublicKey, CacheHash, Hash, Hashable},
+    deadlock::BlockingMutex,
     error::{Error, Result},
     protocol::{
         Block, BlockId, InnerNodes, LeafNodes, MultiBlockPresence, RootNodeFilter, UntrustedProof,
@@ -17,7 +24,11 @@ use crate::{
 use std::{pin::pin, sync::Arc, time::Instant};
 use tokio::{
     select,
-    sync::{mpsc, Semaphore},
+    sync::{
+        mpsc::{self, error::TryRecvError},
+        Semaphore,
+    },
+    time,
 };
 use tracing::{instrument, Level};
 
@@ -31,9 +42,9 @@ pub(super) struct Client {
 impl Client {
     pub fn new(
         vault: Vault,
-        tx: mpsc::Sender<Content>,
+        tx: ContentSender,
         rx: mpsc::Receiver<Response>,
-        peer_request_limiter: Arc<Semaphore>,
+        peer_request_window: Arc<RequestWindow>,
     ) -> Self {
         let pending_requests = PendingRequests::new(vault.monitor.clone());
         let receive_filter = vault.store().receive_filter();
@@ -51,9 +62,10 @@ impl Client {
         let inner = Inner {
             vault,
             pending_requests,
-            peer_request_limiter,
+            peer_request_window,
             receive_filter,
             block_tracker,
+            pushes: BlockingMutex::new(HashMap::default()),
             tx,
             send_queue_tx,
             recv_queue_tx,
@@ -84,10 +96,12 @@ impl Client {
 struct Inner {
     vault: Vault,
     pending_requests: PendingRequests,
-    peer_request_limiter: Arc<Semaphore>,
+    peer_request_window: Arc<RequestWindow>,
     receive_filter: ReceiveFilter,
     block_tracker: TrackerClient,
-    tx: mpsc::Sender<Content>,
+    // Nodes whose children we expect the peer to push to us as part of a `Subtree` request.
+    pushes: BlockingMutex<HashMap<Hash, ExpectedPush>>,
+    tx: ContentSender,
     send_queue_tx: mpsc::UnboundedSender<(PendingRequest, Instant)>,
     recv_queue_tx: mpsc::Sender<(PendingResponse, Instant)>,
 }
@@ -99,7 +113,8 @@ impl Inner {
         send_queue_rx: &mut mpsc::UnboundedReceiver<(PendingRequest, Instant)>,
         recv_queue_rx: &mut mpsc::Receiver<(PendingResponse, Instant)>,
     ) -> Result<()> {
-        self.receive_filter.reset().await?;
+        self.receive_filter.reset();
+        self.pushes.lock().unwrap().clear();
 
         let mut reload_index_rx = self.vault.store().client_reload_index_tx.subscribe();
         let mut block_offers = self.block_tracker.offers();
@@ -114,6 +129,8 @@ impl Inner {
         let mut enqueue_responses = pin!(self.enqueue_responses(rx));
         let mut handle_responses = pin!(self.handle_responses(recv_queue_rx));
 
+        let mut expire_pushes = time::interval(REQUEST_TIMEOUT / 2);
+
         loop {
             select! {
                 block_offer = block_offers.next() => {
@@ -129,6 +146,7 @@ impl Inner {
                 result = reload_index_rx.changed(), if !reload_index_rx.is_closed() => {
                     self.refresh_branches(result.ok().into_iter().flatten());
                 }
+                _ = expire_pushes.tick() => self.expire_pushes(),
             }
         }
 
@@ -146,24 +164,44 @@ impl Inner {
         // Limits requests per link (peer + repo)
         let link_request_limiter = Arc::new(Semaphore::new(MAX_PENDING_REQUESTS_PER_CLIENT));
 
+        // Block requests that are queued up at the same time are sent together in a single
+        // `Request::Blocks`. The batch is flushed whenever we would otherwise have to wait.
+        let mut block_batch = Vec::new();
+
         loop {
-            let Some((request, timestamp)) = send_queue_rx.recv().await else {
-                break;
+            let (request, timestamp) = match send_queue_rx.try_recv() {
+                Ok(item) => item,
+                Err(TryRecvError::Empty) => {
+                    self.send_block_batch(&mut block_batch).await;
+
+                    match send_queue_rx.recv().await {
+                        Some(item) => item,
+                        None => break,
+                    }
+                }
+                Err(TryRecvError::Disconnected) => break,
             };
 
-            // Unwraps OK because we never `close()` the semaphores.
+            // Unwrap OK because we never `close()` the semaphore.
             //
             // NOTE that the order here is important, we don't want to block the other clients
             // on this peer if we have too many responses queued up (which is what the
             // `link_permit` is responsible for limiting)..
-            let link_permit = link_request_limiter.clone().acquire_owned().await.unwrap();
+            let link_permit = match link_request_limiter.clone().try_acquire_owned() {
+                Ok(permit) => permit,
+                Err(_) => {
+                    self.send_block_batch(&mut block_batch).await;
+                    link_request_limiter.clone().acquire_owned().await.unwrap()
+                }
+            };
 
-            let peer_permit = self
-                .peer_request_limiter
-                .clone()
-                .acquire_owned()
-                .await
-                .unwrap();
+            let peer_permit = match self.peer_request_window.try_acquire() {
+                Some(permit) => permit,
+                None => {
+                    self.send_block_batch(&mut block_batch).await;
+                    self.peer_request_window.acquire().await
+                }
+            };
 
             self.vault
                 .monitor
@@ -178,10 +216,41 @@ impl Inner {
                 continue;
             };
 
-            self.tx.send(Content::Request(request)).await.unwrap_or(());
+            match request {
+                Request::Block(block_id, debug) => {
+                    block_batch.push((block_id, debug));
+
+                    if block_batch.len() >= MAX_BLOCKS_PER_REQUEST {
+                        self.send_block_batch(&mut block_batch).await;
+                    }
+                }
+                request => self.send_request(request).await,
+            }
         }
     }
 
+    async fn send_block_batch(&self, batch: &mut Vec<(BlockId, DebugRequest)>) {
+        let request = match batch.len() {
+            0 => return,
+            1 => {
+                // Unwrap OK because the batch is not empty.
+                let (block_id, debug) = batch.pop().unwrap();
+                Request::Block(block_id, debug)
+            }
+            _ => {
+                let debug = batch[0].1.clone();
+                let block_ids = batch.drain(..).map(|(block_id, _)| block_id).collect();
+                Request::Blocks(block_ids, debug)
+            }
+        };
+
+        self.send_request(request).await;
+    }
+
+    async fn send_request(&self, request: Request) {
+        self.tx.send(Content::Request(request)).await.unwrap_or(());
+    }
+
     async fn enqueue_responses(&self, rx: &mut mpsc::Receiver<Response>) {
         loop {
             let Some(response) = rx.recv().await else {
@@ -220,12 +289,24 @@ impl Inner {
                         .response_queue_time
                         .record(timestamp.elapsed());
 
+                    let times = &self.vault.monitor.response_handle_times;
+                    let time = match &response.response {
+                        ProcessedResponse::RootNode(..) => &times.root_node,
+                        ProcessedResponse::InnerNodes(..) => &times.inner_nodes,
+                        ProcessedResponse::LeafNodes(..) => &times.leaf_nodes,
+                        ProcessedResponse::BlockOffer(..) => &times.block_offer,
+                        ProcessedResponse::Block(..) => &times.block,
+                        ProcessedResponse::RootNodeError(..)
+                        | ProcessedResponse::ChildNodesError(..)
+                        | ProcessedResponse::BlockError(..) => &times.error,
+                    };
+
                     let start = Instant::now();
                     self.handle_response(response).await?;
-                    self.vault
-                        .monitor
-                        .response_handle_time
-                        .record(start.elapsed());
+                    let elapsed = start.elapsed();
+
+                    self.vault.monitor.response_handle_time.record(elapsed);
+                    time.record(elapsed);
                 }
                 None => return Ok(()),
             };
@@ -254,7 +335,11 @@ impl Inner {
             ProcessedResponse::BlockError(block_id, debug) => {
                 self.handle_block_not_found(block_id, debug).await
             }
-            ProcessedResponse::RootNodeError(..) | ProcessedResponse::ChildNodesError(..) => Ok(()),
+            ProcessedResponse::ChildNodesError(hash, ..) => {
+                self.pushes.lock().unwrap().remove(&hash);
+                Ok(())
+            }
+            ProcessedResponse::RootNodeError(..) => Ok(()),
         }
     }
 
@@ -276,14 +361,28 @@ impl Inner {
         debug_payload: DebugResponse,
     ) -> Result<()> {
         let hash = proof.hash;
+        let writer_id = proof.writer_id;
         let status = self.vault.receive_root_node(proof, block_presence).await?;
 
         if status.request_children {
-            self.enqueue_request(PendingRequest::ChildNodes(
-                hash,
-                ResponseDisambiguator::new(block_presence),
-                debug_payload.follow_up(),
-            ));
+            let disambiguator = ResponseDisambiguator::new(block_presence);
+            let debug = debug_payload.follow_up();
+
+            // If only the block presence changed we already have all the nodes of this snapshot
+            // and there is nothing to push.
+            let filter = if status.new_snapshot {
+                self.load_node_filter(&writer_id, &hash).await?
+            } else {
+                None
+            };
+
+            if let Some(filter) = filter {
+                // We already have an older snapshot of this branch. Let the peer push us the
+                // nodes that changed since then instead of requesting them one layer at a time.
+                self.request_subtree(hash, block_presence, Arc::new(filter), debug);
+            } else {
+                self.enqueue_request(PendingRequest::ChildNodes(hash, disambiguator, debug));
+            }
         }
 
         if status.new_snapshot {
@@ -306,6 +405,33 @@ impl Inner {
         debug_payload: DebugResponse,
     ) -> Result<()> {
         let total = nodes.len();
+        let push = self.pushes.lock().unwrap().remove(&nodes.hash());
+
+        // If these nodes are being pushed to us, the peer is going to push also those of their
+        // children that are not in the filter (using the same criteria as the peer), unless the
+        // push is already at its maximum depth. Collect them before `nodes` is consumed but
+        // register them only after the nodes have been stored.
+        let expected: Vec<_> = push
+            .as_ref()
+            .filter(|push| push.depth < MAX_SUBTREE_DEPTH)
+            .map(|push| {
+                nodes
+                    .iter()
+                    .map(|(_, node)| node)
+                    .filter(|node| !node.is_empty() && !push.filter.contains(&node.hash))
+                    .map(|node| {
+                        (
+                            node.hash,
+                            ExpectedPush::new(
+                                push.filter.clone(),
+                                node.summary.block_presence,
+                                push.depth + 1,
+                            ),
+                        )
+                    })
+                    .collect()
+            })
+            .unwrap_or_default();
 
         let quota = self.vault.quota().await?.map(Into::into);
         let status = self
@@ -313,6 +439,8 @@ impl Inner {
             .receive_inner_nodes(nodes, &self.receive_filter, quota)
             .await?;
 
+        self.pushes.lock().unwrap().extend(expected);
+
         let debug = debug_payload.follow_up();
 
         tracing::trace!(
@@ -327,6 +455,24 @@ impl Inner {
         );
 
         for node in status.request_children {
+            if self.pushes.lock().unwrap().contains_key(&node.hash) {
+                continue;
+            }
+
+            // The peer stopped pushing at this depth. Continue with a follow-up push of the
+            // subtree under this node.
+            if let Some(push) = &push {
+                if !push.filter.contains(&node.hash) {
+                    self.request_subtree(
+                        node.hash,
+                        node.summary.block_presence,
+                        push.filter.clone(),
+                        debug.clone(),
+                    );
+                    continue;
+                }
+            }
+
             self.enqueue_request(PendingRequest::ChildNodes(
                 node.hash,
                 ResponseDisambiguator::new(node.summary.block_presence),
@@ -353,6 +499,8 @@ impl Inner {
         debug_payload: DebugResponse,
     ) -> Result<()> {
         let total = nodes.len();
+        self.pushes.lock().unwrap().remove(&nodes.hash());
+
         let quota = self.vault.quota().await?.map(Into::into);
         let status = self.vault.receive_leaf_nodes(nodes, quota).await?;
 
@@ -482,6 +630,80 @@ impl Inner {
         }
     }
 
+    /// Requests the peer to push the subtree under the given node except the subtrees in `filter`.
+    fn request_subtree(
+        &self,
+        hash: Hash,
+        block_presence: MultiBlockPresence,
+        filter: Arc<NodeFilter>,
+        debug: PendingDebugRequest,
+    ) {
+        self.pushes
+            .lock()
+            .unwrap()
+            .insert(hash, ExpectedPush::new(filter.clone(), block_presence, 1));
+        self.enqueue_request(PendingRequest::Subtree(
+            hash,
+            ResponseDisambiguator::new(block_presence),
+            (*filter).clone(),
+            debug,
+        ));
+    }
+
+    /// Builds a filter of the inner nodes of the snapshot of the given branch that precedes the
+    /// just received one with the given hash. Returns `None` if there is no such snapshot or if it
+    /// is too big for the filter to be useful.
+    async fn load_node_filter(
+        &self,
+        writer_id: &PublicKey,
+        received_hash: &Hash,
+    ) -> Result<Option<NodeFilter>> {
+        let mut reader = self.vault.store().acquire_read().await?;
+
+        let mut root_node = match reader.load_root_node(writer_id, RootNodeFilter::Any).await {
+            Ok(root_node) => root_node,
+            Err(store::Error::BranchNotFound) => return Ok(None),
+            Err(error) => return Err(error.into()),
+        };
+
+        if root_node.proof.hash == *received_hash {
+            root_node = match reader.load_prev_root_node(&root_node).await? {
+                Some(root_node) => root_node,
+                None => return Ok(None),
+            };
+        }
+
+        let hashes = reader.load_inner_node_hashes(&root_node.proof.hash).await?;
+
+        Ok(NodeFilter::new(&hashes))
+    }
+
+    // Requests the children of the nodes whose push didn't arrive in time, e.g. because it failed on
+    // the peer's side.
+    fn expire_pushes(&self) {
+        let now = Instant::now();
+        let mut expired = Vec::new();
+
+        self.pushes.lock().unwrap().retain(|hash, push| {
+            if push.deadline > now {
+                true
+            } else {
+                expired.push((*hash, push.block_presence));
+                false
+            }
+        });
+
+        for (hash, block_presence) in expired {
+            tracing::debug!(?hash, "Push expired");
+
+            self.enqueue_request(PendingRequest::ChildNodes(
+                hash,
+                ResponseDisambiguator::new(block_presence),
+                PendingDebugRequest::start(),
+            ));
+        }
+    }
+
     /// Log new approved snapshots
     async fn log_approved(&self, branches: &[PublicKey]) {
         if !tracing::enabled!(Level::DEBUG) {
@@ -519,3 +741,25 @@ impl Inner {
         }
     }
 }
+
+struct ExpectedPush {
+    // Filter the `Subtree` request was sent with.
+    filter: Arc<NodeFilter>,
+    // Block presence of the node, for requesting its children if the push doesn't arrive.
+    block_presence: MultiBlockPresence,
+    // Layer of the node's children relative to the node the `Subtree` request was sent for. The
+    // peer doesn't push deeper than `MAX_SUBTREE_DEPTH`.
+    depth: usize,
+    deadline: Instant,
+}
+
+impl ExpectedPush {
+    fn new(filter: Arc<NodeFilter>, block_presence: MultiBlockPresence, depth: usize) -> Self {
+        Self {
+            filter,
+            block_presence,
+            depth,
+            deadline: Instant::now() + REQUEST_TIMEOUT,
+        }
+    }
+}
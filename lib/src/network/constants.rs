@@ -4,15 +4,26 @@ use std::time::Duration;
 /// triggered.
 pub(super) const REQUEST_TIMEOUT: Duration = Duration::from_secs(30);
 
-/// Maximum number of requests that have been sent to a given peer but for which we haven't received
-/// a response yet. Higher values give better performance but too high risks congesting the
-/// network. There is also a point of diminishing returns. 32 seems to be the sweet spot based on a
-/// simple experiment.
+/// Bounds and the initial value of the window limiting the number of requests that have been sent
+/// to a given peer but for which we haven't received a response yet. The window adapts to the
+/// measured round-trip times (see `RequestWindow`). Too high values risk congesting the network,
+/// too low ones leave the bandwidth of links with high latency unused.
 /// NOTE: This limit is protecting the peer against being overhelmed by too many requests from us.
-// TODO: run more precise benchmarks to find the actual optimum.
-pub(super) const MAX_IN_FLIGHT_REQUESTS_PER_PEER: usize = 32;
+pub(super) const MIN_REQUEST_WINDOW: usize = 4;
+pub(super) const INITIAL_REQUEST_WINDOW: usize = 32;
+pub(super) const MAX_REQUEST_WINDOW: usize = 128;
 
 /// Maximum number of requests that have been sent on a given `Client` but for which the response
 /// hasn't yet been processed (although it may have been received).
 /// NOTE: This limit is protecting us against being overhelmed by too many responses from the peer.
-pub(super) const MAX_PENDING_REQUESTS_PER_CLIENT: usize = 2 * MAX_IN_FLIGHT_REQUESTS_PER_PEER;
+pub(super) const MAX_PENDING_REQUESTS_PER_CLIENT: usize = 2 * MAX_REQUEST_WINDOW;
+
+/// Maximum number of blocks requested in a single `Request::Blocks`. Block requests that are
+/// queued up at the same time are batched up to this size to reduce the per-message overhead.
+pub(super) const MAX_BLOCKS_PER_REQUEST: usize = 32;
+
+/// Maximum number of index layers pushed in response to a single `Request::Subtree`. This bounds the
+/// response to one message for the first layer plus one for each of the (at most 256) nodes of the
+/// second one, no matter how little of the subtree the filter covers. The client requests the
+/// deeper layers with follow-up `Subtree` requests.
+pub(super) const MAX_SUBTREE_DEPTH: usize = 2;
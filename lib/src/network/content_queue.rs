@@ -0,0 +1,123 @@
+//! Queue of the outgoing messages of a single link.
+
+use super::message::{Content, Response};
+use tokio::{
+    select,
+    sync::mpsc::{self, error::SendError},
+};
+
+/// Creates a new outgoing message queue.
+///
+/// The messages are split into two classes, each with its own queue: blocks and everything else
+/// (index nodes, root node announcements, requests, PEX). The receiver always drains the second
+/// one first, so a root node announcement or an index response never waits behind the blocks
+/// queued before it. Only the order within each class is preserved. All the messages of the link
+/// share one encrypted stream, so this can't be done further down (by the dispatcher or the
+/// transport) without breaking the order of the nonces.
+pub(super) fn channel() -> (ContentSender, ContentReceiver) {
+    let (index_tx, index_rx) = mpsc::channel(1);
+    let (block_tx, block_rx) = mpsc::channel(1);
+
+    (
+        ContentSender { index_tx, block_tx },
+        ContentReceiver { index_rx, block_rx },
+    )
+}
+
+#[derive(Clone)]
+pub(super) struct ContentSender {
+    index_tx: mpsc::Sender<Content>,
+    block_tx: mpsc::Sender<Content>,
+}
+
+impl ContentSender {
+    pub async fn send(&self, content: Content) -> Result<(), SendError<Content>> {
+        if is_block(&content) {
+            self.block_tx.send(content).await
+        } else {
+            self.index_tx.send(content).await
+        }
+    }
+}
+
+pub(super) struct ContentReceiver {
+    index_rx: mpsc::Receiver<Content>,
+    block_rx: mpsc::Receiver<Content>,
+}
+
+impl ContentReceiver {
+    /// Receives the next message, preferring the non-block ones. Returns `None` when all the
+    /// senders are dropped and both queues are empty.
+    pub async fn recv(&mut self) -> Option<Content> {
+        select! {
+            biased;
+            Some(content) = self.index_rx.recv() => Some(content),
+            Some(content) = self.block_rx.recv() => Some(content),
+            else => None,
+        }
+    }
+}
+
+fn is_block(content: &Content) -> bool {
+    matches!(content, Content::Response(Response::Block(..)))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{
+        crypto::sign::PublicKey, network::debug_payload::DebugResponse, protocol::BlockContent,
+    };
+    use assert_matches::assert_matches;
+    use tokio::task;
+
+    #[tokio::test]
+    async fn index_before_blocks() {
+        let (tx, mut rx) = channel();
+
+        // Fill the block queue and leave more blocks waiting to be queued.
+        let block_count = 8;
+        let senders: Vec<_> = (0..block_count)
+            .map(|_| {
+                let tx = tx.clone();
+                task::spawn(async move {
+                    tx.send(Content::Response(Response::Block(
+                        BlockContent::new(),
+                        [0; 32],
+                        DebugResponse::unsolicited(),
+                    )))
+                    .await
+                    .unwrap()
+                })
+            })
+            .collect();
+
+        task::yield_now().await;
+
+        tx.send(Content::Response(Response::RootNodeError(
+            PublicKey::random(),
+            DebugResponse::unsolicited(),
+        )))
+        .await
+        .unwrap();
+
+        assert_matches!(
+            rx.recv().await,
+            Some(Content::Response(Response::RootNodeError(..)))
+        );
+
+        for _ in 0..block_count {
+            assert_matches!(
+                rx.recv().await,
+                Some(Content::Response(Response::Block(..)))
+            );
+        }
+
+        for sender in senders {
+            sender.await.unwrap();
+        }
+
+        drop(tx);
+        assert_matches!(rx.recv().await, None);
+    }
+}
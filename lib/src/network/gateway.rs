@@ -23,6 +23,7 @@ use tracing::{field, Instrument, Span};
 pub(super) struct Gateway {
     stacks: AtomicSlot<Stacks>,
     incoming_tx: mpsc::Sender<(raw::Stream, PeerAddr)>,
+    quic_config: Mutex<quic::Config>,
 }
 
 impl Gateway {
@@ -36,9 +37,19 @@ impl Gateway {
         Self {
             stacks,
             incoming_tx,
+            quic_config: Mutex::new(quic::Config::default()),
         }
     }
 
+    /// Sets the config of the QUIC stacks. Applies only to the stacks bound after this call.
+    pub fn set_quic_config(&self, config: quic::Config) {
+        *self.quic_config.lock().unwrap() = config;
+    }
+
+    pub fn quic_config(&self) -> quic::Config {
+        *self.quic_config.lock().unwrap()
+    }
+
     pub fn listener_local_addrs(&self) -> Vec<PeerAddr> {
         let stacks = self.stacks.read();
         [
@@ -73,7 +84,7 @@ impl Gateway {
         Option<quic::SideChannelMaker>,
     ) {
         let (next, side_channel_maker_v4, side_channel_maker_v6) =
-            Stacks::bind(bind, self.incoming_tx.clone()).await;
+            Stacks::bind(bind, self.quic_config(), self.incoming_tx.clone()).await;
 
         let prev = self.stacks.swap(next);
         let next = self.stacks.read();
@@ -202,6 +213,7 @@ impl Stacks {
 
     async fn bind(
         bind: &StackAddresses,
+        quic_config: quic::Config,
         incoming_tx: mpsc::Sender<(raw::Stream, PeerAddr)>,
     ) -> (
         Self,
@@ -209,7 +221,7 @@ impl Stacks {
         Option<quic::SideChannelMaker>,
     ) {
         let (quic_v4, side_channel_maker_v4) = if let Some(addr) = bind.quic_v4 {
-            QuicStack::new(addr, incoming_tx.clone())
+            QuicStack::new(addr, quic_config, incoming_tx.clone())
                 .await
                 .map(|(stack, side_channel)| (Some(stack), Some(side_channel)))
                 .unwrap_or((None, None))
@@ -218,7 +230,7 @@ impl Stacks {
         };
 
         let (quic_v6, side_channel_maker_v6) = if let Some(addr) = bind.quic_v6 {
-            QuicStack::new(addr, incoming_tx.clone())
+            QuicStack::new(addr, quic_config, incoming_tx.clone())
                 .await
                 .map(|(stack, side_channel)| (Some(stack), Some(side_channel)))
                 .unwrap_or((None, None))
@@ -379,30 +391,32 @@ struct QuicStack {
 impl QuicStack {
     async fn new(
         bind_addr: SocketAddr,
+        config: quic::Config,
         incoming_tx: mpsc::Sender<(raw::Stream, PeerAddr)>,
     ) -> Option<(Self, quic::SideChannelMaker)> {
         let span = tracing::info_span!("listener", addr = field::Empty);
 
-        let (connector, listener, side_channel_maker) = match quic::configure(bind_addr).await {
-            Ok((connector, listener, side_channel_maker)) => {
-                span.record(
-                    "addr",
-                    field::display(PeerAddr::Quic(*listener.local_addr())),
-                );
-                tracing::info!(parent: &span, "Listener started");
+        let (connector, listener, side_channel_maker) =
+            match quic::configure(bind_addr, config).await {
+                Ok((connector, listener, side_channel_maker)) => {
+                    span.record(
+                        "addr",
+                        field::display(PeerAddr::Quic(*listener.local_addr())),
+                    );
+                    tracing::info!(parent: &span, "Listener started");
 
-                (connector, listener, side_channel_maker)
-            }
-            Err(error) => {
-                tracing::warn!(
-                    parent: &span,
-                    bind_addr = %PeerAddr::Quic(bind_addr),
-                    ?error,
-                    "Failed to start listener"
-                );
-                return None;
-            }
-        };
+                    (connector, listener, side_channel_maker)
+                }
+                Err(error) => {
+                    tracing::warn!(
+                        parent: &span,
+                        bind_addr = %PeerAddr::Quic(bind_addr),
+                        ?error,
+                        "Failed to start listener"
+                    );
+                    return None;
+                }
+            };
 
         let listener_local_addr = *listener.local_addr();
         let listener_task =
@@ -1,10 +1,11 @@
 use super::{
-    message::Message,
+    message::{Message, MessageChannelId},
     message_io::{MessageSink, MessageStream, SendError},
 };
+use crate::collections::HashMap;
 use futures_util::{ready, FutureExt, Sink, SinkExt, Stream, StreamExt};
 use std::{
-    io,
+    io, iter,
     marker::PhantomData,
     pin::Pin,
     task::{Context, Poll},
@@ -68,11 +69,17 @@ where
     }
 }
 
+// Max number of messages sent in a single batch.
+const MAX_BATCH: usize = 32;
+
 /// Adapter for `MessageSink` which periodically sends keep-alive messages if no regular messages
 /// are sent in a while.
 ///
 /// Note: to obtain the result of a send, `flush` needs to be called afterwards. If `flush` is not
 /// called and another item is sent, the result of the previous send is lost.
+///
+/// The first failed write tears the sink down: the messages still queued fail as well and every
+/// subsequent operation returns an error, so the owner can switch to another sink.
 pub(super) struct KeepAliveSink<W> {
     command_tx: PollSender<SinkCommand>,
     result_rx: Option<oneshot::Receiver<Result<(), SendError>>>,
@@ -84,7 +91,7 @@ where
     W: AsyncWrite + Unpin + Send + 'static,
 {
     pub fn new(inner: MessageSink<W>, interval: Duration) -> Self {
-        let (command_tx, command_rx) = mpsc::channel(1);
+        let (command_tx, command_rx) = mpsc::channel(MAX_BATCH);
 
         task::spawn(sink_worker(inner, interval, command_rx));
 
@@ -133,7 +140,12 @@ where
         }
 
         if let Some(result_rx) = &mut self.result_rx {
-            let result = ready!(result_rx.poll_unpin(cx)).unwrap_or(Ok(()));
+            let result = ready!(result_rx.poll_unpin(cx)).unwrap_or_else(|_| {
+                Err(SendError {
+                    source: sink_closed_error(),
+                    message: Message::new_keep_alive(),
+                })
+            });
             self.result_rx = None;
             Poll::Ready(result)
         } else {
@@ -165,11 +177,10 @@ async fn sink_worker<W>(
     W: AsyncWrite + Unpin,
 {
     loop {
-        select! {
+        let result = select! {
             command = command_rx.recv() => {
                 if let Some(command) = command {
-                    let result = inner.send(command.message).await;
-                    command.result_tx.send(result).unwrap_or(());
+                    send_batch(&mut inner, command, &mut command_rx).await
                 } else {
                     inner.close().await.unwrap_or(());
                     break;
@@ -180,12 +191,125 @@ async fn sink_worker<W>(
                 inner
                     .send(Message::new_keep_alive())
                     .await
-                    .unwrap_or(());
+                    .map_err(|error| (error, Vec::new()))
             }
+        };
+
+        if let Err((error, result_txs)) = result {
+            // The connection is broken. Stop accepting new messages and fail the already queued
+            // ones, so their senders don't wait for them in vain.
+            command_rx.close();
+
+            let queued =
+                iter::from_fn(|| command_rx.try_recv().ok()).map(|command| command.result_tx);
+            fail_all(result_txs.into_iter().chain(queued), error);
+
+            break;
         }
     }
 }
 
+type BatchError = (SendError, Vec<oneshot::Sender<Result<(), SendError>>>);
+
+// Sends the given message together with any other messages that are already queued (up to
+// `MAX_BATCH`) and flushes them all at once. This lets the underlying `MessageSink` coalesce them
+// into a few large writes. On failure stops and returns the error together with the result
+// senders of the whole batch (the messages buffered so far are discarded and the rest is not sent).
+async fn send_batch<W>(
+    inner: &mut MessageSink<W>,
+    command: SinkCommand,
+    command_rx: &mut mpsc::Receiver<SinkCommand>,
+) -> Result<(), BatchError>
+where
+    W: AsyncWrite + Unpin,
+{
+    let mut commands = vec![command];
+    let mut yielded = false;
+
+    while commands.len() < MAX_BATCH {
+        if let Ok(command) = command_rx.try_recv() {
+            commands.push(command);
+            continue;
+        }
+
+        // Nothing else queued. Give the senders one chance to catch up before flushing (similar
+        // to Nagle's algorithm but the delay is only a single scheduler round).
+        if yielded {
+            break;
+        }
+
+        yielded = true;
+        task::yield_now().await;
+    }
+
+    let mut result_txs = Vec::with_capacity(commands.len());
+    let mut commands = interleave_channels(commands).into_iter();
+
+    while let Some(command) = commands.next() {
+        result_txs.push(command.result_tx);
+
+        if let Err(error) = inner.feed(command.message).await {
+            result_txs.extend(commands.map(|command| command.result_tx));
+            return Err((error, result_txs));
+        }
+    }
+
+    if let Err(error) = inner.flush().await {
+        return Err((error, result_txs));
+    }
+
+    for result_tx in result_txs {
+        result_tx.send(Ok(())).unwrap_or(());
+    }
+
+    Ok(())
+}
+
+// Reorders the commands so that the channels take turns (round robin) while the order within each
+// channel is preserved. All channels share one underlying stream, so without this a channel
+// sending a lot of large messages (blocks) would hold back the small latency sensitive ones (root
+// nodes) of every other channel queued behind it.
+fn interleave_channels(commands: Vec<SinkCommand>) -> Vec<SinkCommand> {
+    // channel -> (index of its first command, number of its commands so far)
+    let mut channels: HashMap<MessageChannelId, (usize, usize)> = HashMap::default();
+
+    let mut commands: Vec<_> = commands
+        .into_iter()
+        .enumerate()
+        .map(|(index, command)| {
+            let (first, count) = channels
+                .entry(command.message.channel)
+                .or_insert((index, 0));
+            let key = (*count, *first);
+            *count += 1;
+
+            (key, command)
+        })
+        .collect();
+
+    commands.sort_by_key(|(key, _)| *key);
+    commands.into_iter().map(|(_, command)| command).collect()
+}
+
+// Reports the error to all the given senders. Only the first one gets the original error (with the
+// unsent message), the others get a copy of its kind.
+fn fail_all(
+    result_txs: impl Iterator<Item = oneshot::Sender<Result<(), SendError>>>,
+    error: SendError,
+) {
+    let kind = error.source.kind();
+    let mut error = Some(error);
+
+    for result_tx in result_txs {
+        let error = error.take().unwrap_or_else(|| SendError {
+            source: kind.into(),
+            message: Message::new_keep_alive(),
+        });
+
+        result_tx.send(Err(error)).unwrap_or(());
+    }
+}
+
 fn make_send_error(command_tx_error: PollSendError<SinkCommand>, source: io::Error) -> SendError {
     SendError {
         source,
@@ -251,6 +375,62 @@ mod tests {
         assert_eq!(error.kind(), io::ErrorKind::UnexpectedEof);
     }
 
+    #[tokio::test]
+    async fn sink_closed_after_send_error() {
+        let (client, server) = create_connected_sockets().await;
+        drop(server);
+
+        let mut sink = KeepAliveSink::new(MessageSink::new(client), Duration::from_secs(60));
+
+        let message = Message {
+            tag: Type::Content,
+            channel: MessageChannelId::random(),
+            content: b"hello".to_vec(),
+        };
+
+        // Writing to a socket whose peer is gone fails after a while.
+        for _ in 0..100 {
+            if sink.send(message.clone()).await.is_err() {
+                break;
+            }
+
+            time::sleep(Duration::from_millis(10)).await;
+        }
+
+        // The failure tears the sink down so any further send fails immediately.
+        let error = sink.send(message).await.unwrap_err();
+        assert_eq!(error.source.to_string(), sink_closed_error().to_string());
+    }
+
+    #[test]
+    fn interleave_channels_round_robin() {
+        let a = MessageChannelId::random();
+        let b = MessageChannelId::random();
+        let c = MessageChannelId::random();
+
+        let commands = [(a, 0), (a, 1), (a, 2), (b, 0), (a, 3), (c, 0), (b, 1)]
+            .into_iter()
+            .map(|(channel, index)| SinkCommand {
+                message: Message {
+                    tag: Type::Content,
+                    channel,
+                    content: vec![index],
+                },
+                result_tx: oneshot::channel().0,
+            })
+            .collect();
+
+        let actual: Vec<_> = interleave_channels(commands)
+            .into_iter()
+            .map(|command| (command.message.channel, command.message.content[0]))
+            .collect();
+
+        assert_eq!(
+            actual,
+            [(a, 0), (b, 0), (c, 0), (a, 1), (b, 1), (a, 2), (a, 3)]
+        );
+    }
+
     #[tokio::test]
     async fn stream_timeout_if_no_recv() {
         let (_client, server) = create_connected_sockets().await;
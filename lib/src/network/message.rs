@@ -1,6 +1,7 @@
 use super::{
     crypto::Role,
     debug_payload::{DebugRequest, DebugResponse},
+    node_filter::NodeFilter,
     peer_exchange::PexPayload,
     runtime_id::PublicRuntimeId,
 };
@@ -20,6 +21,16 @@ pub(crate) enum Request {
     RootNode(PublicKey, DebugRequest),
     ChildNodes(Hash, ResponseDisambiguator, DebugRequest),
     Block(BlockId, DebugRequest),
+    /// Request multiple blocks at once. The server replies with a separate `Response::Block` or
+    /// `Response::BlockError` for each of them.
+    Blocks(Vec<BlockId>, DebugRequest),
+    /// Request the subtree under the given node except the subtrees whose root is in the filter
+    /// (the nodes the client already has). The server replies with the same responses as to
+    /// `ChildNodes` of the given node, followed by unsolicited ones for each of its descendants
+    /// not in the filter, parents always before their children, down to `MAX_SUBTREE_DEPTH`
+    /// layers below the given node. This retrieves a small change in a few round trips instead
+    /// of one per tree layer.
+    Subtree(Hash, ResponseDisambiguator, NodeFilter, DebugRequest),
 }
 
 /// ResponseDisambiguator is used to uniquelly assign a response to a request.
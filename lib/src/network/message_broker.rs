@@ -3,12 +3,13 @@ use super::{
     choke,
     client::Client,
     connection::ConnectionPermit,
-    constants::MAX_IN_FLIGHT_REQUESTS_PER_PEER,
+    content_queue::{self, ContentReceiver, ContentSender},
     crypto::{self, DecryptingStream, EncryptingSink, EstablishError, RecvError, Role, SendError},
     message::{Content, MessageChannelId, Request, Response},
     message_dispatcher::{ContentSink, ContentStream, MessageDispatcher},
     peer_exchange::{PexPeer, PexReceiver, PexRepository, PexSender},
     raw,
+    request_window::RequestWindow,
     runtime_id::PublicRuntimeId,
     server::Server,
     traffic_tracker::TrafficTracker,
@@ -23,7 +24,7 @@ use state_monitor::StateMonitor;
 use std::{future, sync::Arc};
 use tokio::{
     select,
-    sync::{mpsc, oneshot, Semaphore},
+    sync::{mpsc, oneshot},
     task,
     time::Duration,
 };
@@ -43,7 +44,7 @@ pub(super) struct MessageBroker {
     that_runtime_id: PublicRuntimeId,
     dispatcher: MessageDispatcher,
     links: HashMap<LocalId, oneshot::Sender<()>>,
-    request_limiter: Arc<Semaphore>,
+    request_window: Arc<RequestWindow>,
     pex_peer: PexPeer,
     monitor: StateMonitor,
     tracker: TrafficTracker,
@@ -72,7 +73,7 @@ impl MessageBroker {
             that_runtime_id,
             dispatcher: MessageDispatcher::new(),
             links: HashMap::default(),
-            request_limiter: Arc::new(Semaphore::new(MAX_IN_FLIGHT_REQUESTS_PER_PEER)),
+            request_window: RequestWindow::new(&monitor),
             pex_peer,
             monitor,
             tracker,
@@ -143,17 +144,20 @@ impl MessageBroker {
 
         let (pex_tx, pex_rx) = self.pex_peer.new_link(pex_repo);
 
+        // Track the traffic of this link separately so the choker can rank the peers by it.
+        let tracker = self.tracker.new_child();
+
         let mut link = Link {
             role,
             stream: self.dispatcher.open_recv(channel_id),
             sink: self.dispatcher.open_send(channel_id),
             vault,
-            request_limiter: self.request_limiter.clone(),
+            request_window: self.request_window.clone(),
             pex_tx,
             pex_rx,
-            choker: choke_manager.new_choker(),
+            choker: choke_manager.new_choker(tracker.clone()),
             monitor,
-            tracker: self.tracker.clone(),
+            tracker,
         };
 
         drop(span_enter);
@@ -191,7 +195,7 @@ struct Link {
     stream: ContentStream,
     sink: ContentSink,
     vault: Vault,
-    request_limiter: Arc<Semaphore>,
+    request_window: Arc<RequestWindow>,
     pex_tx: PexSender,
     pex_rx: PexReceiver,
     choker: choke::Choker,
@@ -262,7 +266,7 @@ impl Link {
                 crypto_stream,
                 crypto_sink,
                 &self.vault,
-                self.request_limiter.clone(),
+                self.request_window.clone(),
                 &mut self.pex_tx,
                 &mut self.pex_rx,
                 self.choker.clone(),
@@ -300,7 +304,7 @@ async fn run_link(
     stream: DecryptingStream<'_>,
     sink: EncryptingSink<'_>,
     repo: &Vault,
-    request_limiter: Arc<Semaphore>,
+    request_window: Arc<RequestWindow>,
     pex_tx: &mut PexSender,
     pex_rx: &mut PexReceiver,
     choker: choke::Choker,
@@ -310,13 +314,13 @@ async fn run_link(
     // accomodate any such requests.
     let (request_tx, request_rx) = mpsc::channel(MAX_PENDING_REQUESTS_PER_CLIENT);
     let (response_tx, response_rx) = mpsc::channel(1);
-    let (content_tx, content_rx) = mpsc::channel(1);
+    let (content_tx, content_rx) = content_queue::channel();
 
     tracing::info!("Link opened");
 
     // Run everything in parallel:
     let flow = select! {
-        flow = run_client(repo.clone(), content_tx.clone(), response_rx, request_limiter) => flow,
+        flow = run_client(repo.clone(), content_tx.clone(), response_rx, request_window) => flow,
         flow = run_server(repo.clone(), content_tx.clone(), request_rx, choker) => flow,
         flow = recv_messages(stream, request_tx, response_tx, pex_rx) => flow,
         flow = send_messages(content_rx, sink) => flow,
@@ -374,7 +378,7 @@ async fn recv_messages(
 
 // Handle outgoing messages
 async fn send_messages(
-    mut content_rx: mpsc::Receiver<Content>,
+    mut content_rx: ContentReceiver,
     mut sink: EncryptingSink<'_>,
 ) -> ControlFlow {
     loop {
@@ -405,11 +409,11 @@ async fn send_messages(
 // Create and run client. Returns only on error.
 async fn run_client(
     repo: Vault,
-    content_tx: mpsc::Sender<Content>,
+    content_tx: ContentSender,
     response_rx: mpsc::Receiver<Response>,
-    request_limiter: Arc<Semaphore>,
+    request_window: Arc<RequestWindow>,
 ) -> ControlFlow {
-    let mut client = Client::new(repo, content_tx, response_rx, request_limiter);
+    let mut client = Client::new(repo, content_tx, response_rx, request_window);
     let result = client.run().await;
 
     tracing::debug!("Client stopped running with result {:?}", result);
@@ -423,7 +427,7 @@ async fn run_client(
 // Create and run server. Returns only on error.
 async fn run_server(
     repo: Vault,
-    content_tx: mpsc::Sender<Content>,
+    content_tx: ContentSender,
     request_rx: mpsc::Receiver<Request>,
     choker: choke::Choker,
 ) -> ControlFlow {
@@ -1,7 +1,10 @@
 use super::message::{Header, Message};
 use futures_util::{ready, Sink, Stream};
 use std::{
-    fmt, io, mem,
+    collections::VecDeque,
+    fmt,
+    io::{self, IoSlice},
+    mem,
     pin::Pin,
     task::{Context, Poll},
 };
@@ -77,35 +80,21 @@ where
     }
 
     fn poll_flush(mut self: Pin<&mut Self>, cx: &mut Context<'_>) -> Poll<Result<(), Self::Error>> {
-        ready!(self.as_mut().poll_ready(cx))?;
-
-        match &self.encoder.state {
-            EncodeState::Idle => Poll::Ready(Ok(())),
-            EncodeState::Sending {
-                phase: SendingPhase::Done,
-                ..
-            } => {
-                let result = ready!(Pin::new(&mut self.write).poll_flush(cx));
-                self.encoder.switch_to_idle(result)
-            }
-            EncodeState::Sending { .. } => unreachable!(),
-        }
+        let this = &mut *self;
+        let mut write = Pin::new(&mut this.write);
+
+        ready!(this.encoder.poll_write_all(write.as_mut(), cx))?;
+        let result = ready!(write.poll_flush(cx));
+        Poll::Ready(this.encoder.check(result))
     }
 
     fn poll_close(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<Result<(), Self::Error>> {
-        ready!(self.as_mut().poll_ready(cx))?;
-
-        match &self.encoder.state {
-            EncodeState::Idle
-            | EncodeState::Sending {
-                phase: SendingPhase::Done,
-                ..
-            } => {
-                let result = ready!(Pin::new(&mut self.write).poll_shutdown(cx));
-                self.encoder.switch_to_idle(result)
-            }
-            EncodeState::Sending { .. } => unreachable!(),
-        }
+        let this = &mut *self;
+        let mut write = Pin::new(&mut this.write);
+
+        ready!(this.encoder.poll_write_all(write.as_mut(), cx))?;
+        let result = ready!(write.poll_shutdown(cx));
+        Poll::Ready(this.encoder.check(result))
     }
 }
 
@@ -128,53 +117,60 @@ impl fmt::Debug for SendError {
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // Encoder
 
+// Size of the frame prefix (header + len).
+const PREFIX_SIZE: usize = Header::SIZE + 2;
+
+// Messages are buffered until their total size reaches this, or until flush, and then written
+// with as few (vectored) writes as possible. This way a burst of small messages costs a syscall
+// or two instead of three per message.
+const MAX_BUFFERED: usize = 64 * 1024;
+
+// Max number of buffers passed to a single vectored write.
+const MAX_SLICES: usize = 64;
+
+#[derive(Default)]
 struct Encoder {
-    state: EncodeState,
+    frames: VecDeque<Frame>,
+    // Total size of the not yet written part of `frames`.
+    buffered: usize,
+    // Number of bytes of the first frame that have already been written.
     offset: usize,
 }
 
-enum EncodeState {
-    Idle,
-    Sending {
-        message: Message,
-        phase: SendingPhase,
-    },
+struct Frame {
+    prefix: [u8; PREFIX_SIZE],
+    message: Message,
 }
 
-enum SendingPhase {
-    Header,
-    Len,
-    Content,
-    Done,
-}
+impl Frame {
+    fn new(message: Message) -> Self {
+        let mut prefix = [0; PREFIX_SIZE];
+        prefix[..Header::SIZE].copy_from_slice(&message.header().serialize());
+        prefix[Header::SIZE..].copy_from_slice(&(message.content.len() as u16).to_be_bytes());
 
-impl Default for Encoder {
-    fn default() -> Self {
-        Self {
-            state: EncodeState::Idle,
-            offset: 0,
-        }
+        Self { prefix, message }
     }
-}
 
-impl Encoder {
-    fn is_sending(&self) -> bool {
-        match &self.state {
-            EncodeState::Idle => false,
-            EncodeState::Sending {
-                phase: SendingPhase::Done,
-                ..
-            } => false,
-            EncodeState::Sending { .. } => true,
+    fn len(&self) -> usize {
+        PREFIX_SIZE + self.message.content.len()
+    }
+
+    // Pushes the parts of this frame starting at `offset` into `slices`.
+    fn slices<'a>(&'a self, offset: usize, slices: &mut Vec<IoSlice<'a>>) {
+        if offset < PREFIX_SIZE {
+            slices.push(IoSlice::new(&self.prefix[offset..]));
+        }
+
+        let offset = offset.saturating_sub(PREFIX_SIZE);
+
+        if offset < self.message.content.len() {
+            slices.push(IoSlice::new(&self.message.content[offset..]));
         }
     }
+}
 
+impl Encoder {
     fn start(&mut self, message: Message) -> Result<(), SendError> {
-        assert!(
-            !self.is_sending(),
-            "start_send called while already sending"
-        );
-
         if message.content.len() > MAX_MESSAGE_SIZE as usize {
             return Err(SendError {
                 source: io::Error::new(io::ErrorKind::InvalidInput, LengthError),
@@ -182,15 +178,14 @@ impl Encoder {
             });
         }
 
-        self.state = EncodeState::Sending {
-            message,
-            phase: SendingPhase::Header,
-        };
-        self.offset = 0;
+        let frame = Frame::new(message);
+        self.buffered += frame.len();
+        self.frames.push_back(frame);
 
         Ok(())
     }
 
+    // Makes room for the next message by writing out the buffered ones if there are too many.
     fn poll_ready<W>(
         &mut self,
         mut io: Pin<&mut W>,
@@ -199,100 +194,95 @@ impl Encoder {
     where
         W: AsyncWrite,
     {
-        loop {
-            match &mut self.state {
-                EncodeState::Idle => return Poll::Ready(Ok(())),
-                EncodeState::Sending { message, phase } => match phase {
-                    SendingPhase::Header => {
-                        match ready!(poll_write_all(
-                            io.as_mut(),
-                            cx,
-                            &message.header().serialize(),
-                            &mut self.offset
-                        )) {
-                            Ok(true) => {
-                                *phase = SendingPhase::Len;
-                                self.offset = 0;
-                            }
-                            Ok(false) => (),
-                            Err(error) => return self.switch_to_idle_on_error(error),
-                        }
-                    }
-                    SendingPhase::Len => {
-                        let buffer = (message.content.len() as u16).to_be_bytes();
-
-                        match ready!(poll_write_all(io.as_mut(), cx, &buffer, &mut self.offset)) {
-                            Ok(true) => {
-                                if message.content.is_empty() {
-                                    *phase = SendingPhase::Done;
-                                } else {
-                                    *phase = SendingPhase::Content;
-                                }
-                                self.offset = 0;
-                            }
-                            Ok(false) => (),
-                            Err(error) => return self.switch_to_idle_on_error(error),
-                        }
-                    }
-                    SendingPhase::Content => {
-                        match ready!(poll_write_all(
-                            io.as_mut(),
-                            cx,
-                            &message.content,
-                            &mut self.offset
-                        )) {
-                            Ok(true) => {
-                                *phase = SendingPhase::Done;
-                                self.offset = 0;
-                            }
-                            Ok(false) => (),
-                            Err(error) => return self.switch_to_idle_on_error(error),
-                        }
-                    }
-                    SendingPhase::Done => return Poll::Ready(Ok(())),
-                },
-            }
+        while self.buffered >= MAX_BUFFERED {
+            ready!(self.poll_write_some(io.as_mut(), cx))?;
         }
+
+        Poll::Ready(Ok(()))
     }
 
-    fn switch_to_idle_on_error(&mut self, source: io::Error) -> Poll<Result<(), SendError>> {
-        let message = match mem::replace(&mut self.state, EncodeState::Idle) {
-            EncodeState::Idle => Message::new_keep_alive(),
-            EncodeState::Sending { message, .. } => message,
-        };
+    fn poll_write_all<W>(
+        &mut self,
+        mut io: Pin<&mut W>,
+        cx: &mut Context,
+    ) -> Poll<Result<(), SendError>>
+    where
+        W: AsyncWrite,
+    {
+        while !self.frames.is_empty() {
+            ready!(self.poll_write_some(io.as_mut(), cx))?;
+        }
 
-        Poll::Ready(Err(SendError { source, message }))
+        Poll::Ready(Ok(()))
     }
 
-    fn switch_to_idle(&mut self, result: io::Result<()>) -> Poll<Result<(), SendError>> {
-        match result {
-            Ok(()) => {
-                self.state = EncodeState::Idle;
-                Poll::Ready(Ok(()))
+    fn poll_write_some<W>(
+        &mut self,
+        io: Pin<&mut W>,
+        cx: &mut Context,
+    ) -> Poll<Result<(), SendError>>
+    where
+        W: AsyncWrite,
+    {
+        let mut slices = Vec::with_capacity(MAX_SLICES);
+        let mut offset = self.offset;
+
+        for frame in &self.frames {
+            if slices.len() + 2 > MAX_SLICES {
+                break;
             }
-            Err(error) => self.switch_to_idle_on_error(error),
+
+            frame.slices(offset, &mut slices);
+            offset = 0;
         }
+
+        let len = match ready!(io.poll_write_vectored(cx, &slices)) {
+            Ok(0) => return Poll::Ready(self.fail(io::ErrorKind::WriteZero.into())),
+            Ok(len) => len,
+            Err(error) => return Poll::Ready(self.fail(error)),
+        };
+
+        self.advance(len);
+
+        Poll::Ready(Ok(()))
     }
-}
 
-fn poll_write_all<W>(
-    io: Pin<&mut W>,
-    cx: &mut Context,
-    buffer: &[u8],
-    offset: &mut usize,
-) -> Poll<io::Result<bool>>
-where
-    W: AsyncWrite,
-{
-    let len = ready!(io.poll_write(cx, &buffer[*offset..]))?;
+    // Discards the first `len` buffered bytes (because they've been written).
+    fn advance(&mut self, mut len: usize) {
+        self.buffered -= len;
+
+        while let Some(frame) = self.frames.front() {
+            let remaining = frame.len() - self.offset;
 
-    if len == 0 {
-        return Poll::Ready(Err(io::ErrorKind::WriteZero.into()));
+            if len < remaining {
+                self.offset += len;
+                break;
+            }
+
+            len -= remaining;
+            self.offset = 0;
+            self.frames.pop_front();
+        }
+    }
+
+    fn check(&mut self, result: io::Result<()>) -> Result<(), SendError> {
+        result.or_else(|error| self.fail(error))
     }
 
-    *offset += len;
+    // Discards all buffered messages and returns the error together with the first of them.
+    fn fail(&mut self, source: io::Error) -> Result<(), SendError> {
+        let message = self
+            .frames
+            .pop_front()
+            .map(|frame| frame.message)
+            .unwrap_or_else(Message::new_keep_alive);
 
-    Poll::Ready(Ok(*offset >= buffer.len()))
+        self.frames.clear();
+        self.buffered = 0;
+        self.offset = 0;
+
+        Err(SendError { source, message })
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
@@ -422,3 +412,49 @@ struct LengthError;
 #[derive(Debug, Error)]
 #[error("bad header")]
 struct BadHeader;
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::network::message::{MessageChannelId, Type};
+    use futures_util::{SinkExt, StreamExt};
+
+    #[tokio::test]
+    async fn coalesced_send() {
+        // Small buffer to force partial writes.
+        let (client, server) = tokio::io::duplex(100);
+
+        let mut sink = MessageSink::new(client);
+        let mut stream = MessageStream::new(server);
+
+        let channel = MessageChannelId::random();
+        let messages: Vec<_> = (0..100u32)
+            .map(|i| Message {
+                tag: Type::Content,
+                channel,
+                content: vec![i as u8; i as usize * 7],
+            })
+            .collect();
+
+        let send = async {
+            for message in &messages {
+                sink.feed(message.clone()).await.unwrap();
+            }
+
+            sink.flush().await.unwrap();
+        };
+
+        let recv = async {
+            let mut received = Vec::new();
+
+            for _ in 0..messages.len() {
+                received.push(stream.next().await.unwrap().unwrap());
+            }
+
+            received
+        };
+
+        let ((), received) = futures_util::future::join(send, recv).await;
+        assert_eq!(received, messages);
+    }
+}
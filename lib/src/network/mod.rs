@@ -7,6 +7,7 @@ mod client;
 mod connection;
 mod connection_monitor;
 mod constants;
+mod content_queue;
 mod crypto;
 mod debug_payload;
 mod gateway;
@@ -18,6 +19,7 @@ mod message;
 mod message_broker;
 mod message_dispatcher;
 mod message_io;
+mod node_filter;
 mod peer_exchange; // TODO: replace with v2
 mod peer_info;
 mod peer_source;
@@ -25,6 +27,7 @@ mod peer_state;
 mod pending;
 mod protocol;
 mod raw;
+mod request_window;
 mod runtime_id;
 mod seen_peers;
 mod server;
@@ -36,6 +39,7 @@ mod traffic_tracker;
 mod upnp;
 
 pub use self::{
+    choke::{ChokeConfig, UnchokeSelection, UnchokeSlots},
     connection::PeerInfoCollector,
     peer_info::PeerInfo,
     peer_source::PeerSource,
@@ -43,7 +47,7 @@ pub use self::{
     runtime_id::{PublicRuntimeId, SecretRuntimeId},
     traffic_tracker::TrafficStats,
 };
-pub use net::stun::NatBehavior;
+pub use net::{quic::Config as QuicConfig, stun::NatBehavior};
 
 use self::{
     connection::{ConnectionDeduplicator, ConnectionPermit, ReserveResult},
@@ -142,6 +146,7 @@ impl Network {
             state: BlockingMutex::new(State {
                 message_brokers: Some(HashMap::default()),
                 registry: Slab::new(),
+                choke_config: ChokeConfig::default(),
             }),
             port_forwarder,
             port_forwarder_state: BlockingMutex::new(ComponentState::disabled(
@@ -277,6 +282,32 @@ impl Network {
         self.inner.connection_deduplicator.get_peer_info(addr)
     }
 
+    /// Configures how many and which peers are served concurrently by each repository. Applies
+    /// to both the currently registered repositories and the ones registered later.
+    pub fn set_choke_config(&self, config: ChokeConfig) {
+        let mut state = self.inner.state.lock().unwrap();
+
+        state.choke_config = config;
+
+        for (_, holder) in &state.registry {
+            holder.choke_manager.set_config(config);
+        }
+    }
+
+    pub fn choke_config(&self) -> ChokeConfig {
+        self.inner.state.lock().unwrap().choke_config
+    }
+
+    /// Configures the QUIC transport. Applies only to the QUIC stacks bound after this call, so
+    /// call it before `bind` (or unbind and bind again to apply it to the current stacks).
+    pub fn set_quic_config(&self, config: QuicConfig) {
+        self.inner.gateway.set_quic_config(config);
+    }
+
+    pub fn quic_config(&self) -> QuicConfig {
+        self.inner.gateway.quic_config()
+    }
+
     pub fn current_protocol_version(&self) -> u32 {
         VERSION.into()
     }
@@ -331,10 +362,10 @@ impl Network {
         let pex = self.inner.pex_discovery.new_repository();
         pex.set_enabled(pex_enabled);
 
-        let choke_manager = choke::Manager::new();
-
         let mut network_state = self.inner.state.lock().unwrap();
 
+        let choke_manager = choke::Manager::new(network_state.choke_config);
+
         network_state.create_link(handle.vault.clone(), &pex, &choke_manager);
 
         let key = network_state.registry.insert(RegistrationHolder {
@@ -474,6 +505,7 @@ struct State {
     // This is None once the network calls shutdown.
     message_brokers: Option<HashMap<PublicRuntimeId, MessageBroker>>,
     registry: Slab<RegistrationHolder>,
+    choke_config: ChokeConfig,
 }
 
 impl State {
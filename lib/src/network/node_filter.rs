@@ -0,0 +1,125 @@
+//! Compact approximate set of index node hashes used to avoid resending the nodes a peer already
+//! has (see `Request::Subtree`).
+
+use crate::crypto::Hash;
+use serde::{Deserialize, Serialize};
+use std::fmt;
+
+// Number of bits per element. Together with `HASH_COUNT` gives a false positive rate under 1%.
+const BITS_PER_ELEMENT: usize = 10;
+// Number of bits set per element. Each one is derived from a different 4-byte slice of the node
+// hash (which is already uniformly distributed), so at most `Hash::SIZE / 4`.
+const HASH_COUNT: usize = 7;
+/// Max size of the filter (in bytes) so the request carrying it fits into a single message. Bigger
+/// sets would either not fit or, if the filter was capped, get a false positive rate so high that
+/// the filter would be pure overhead, so no filter is built for them. The server rejects requests
+/// with bigger filters.
+pub(super) const MAX_SIZE: usize = 60 * 1024;
+
+/// Bloom filter of node hashes.
+///
+/// A false positive makes the sender skip a subtree the receiver doesn't actually have, so the
+/// receiver then has to request it the usual way. The filter therefore never causes data to be
+/// missed, only (rarely) an extra round trip.
+#[derive(Clone, Eq, PartialEq, Serialize, Deserialize)]
+pub(crate) struct NodeFilter {
+    #[serde(with = "serde_bytes")]
+    bits: Vec<u8>,
+}
+
+impl NodeFilter {
+    /// Builds a filter of the given hashes. Returns `None` if there are too many of them for the
+    /// filter to stay under `MAX_SIZE` with the target false positive rate.
+    pub fn new(hashes: &[Hash]) -> Option<Self> {
+        let size = (hashes.len() * BITS_PER_ELEMENT).div_ceil(8);
+        if size > MAX_SIZE {
+            return None;
+        }
+
+        let mut filter = Self {
+            bits: vec![0; size],
+        };
+
+        for hash in hashes {
+            for index in filter.indices(hash) {
+                filter.bits[index / 8] |= 1 << (index % 8);
+            }
+        }
+
+        Some(filter)
+    }
+
+    /// Size of the filter in bytes.
+    pub fn size(&self) -> usize {
+        self.bits.len()
+    }
+
+    pub fn contains(&self, hash: &Hash) -> bool {
+        // `all` would be vacuously true for an empty filter.
+        if self.bits.is_empty() {
+            return false;
+        }
+
+        self.indices(hash)
+            .all(|index| self.bits[index / 8] & (1 << (index % 8)) != 0)
+    }
+
+    // Must not be called on an empty filter.
+    fn indices<'a>(&'a self, hash: &'a Hash) -> impl Iterator<Item = usize> + 'a {
+        let len = self.bits.len() * 8;
+
+        hash.as_ref()
+            .chunks_exact(4)
+            .take(HASH_COUNT)
+            .map(move |chunk| u32::from_le_bytes(chunk.try_into().unwrap()) as usize % len)
+    }
+}
+
+impl fmt::Debug for NodeFilter {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("NodeFilter")
+            .field("size", &self.bits.len())
+            .finish()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use rand::{distributions::Standard, Rng};
+
+    #[test]
+    fn contains() {
+        let mut rng = rand::thread_rng();
+
+        let inserted: Vec<Hash> = (&mut rng).sample_iter(Standard).take(1000).collect();
+        let filter = NodeFilter::new(&inserted).unwrap();
+
+        assert!(inserted.iter().all(|hash| filter.contains(hash)));
+
+        let false_positives = (&mut rng)
+            .sample_iter::<Hash, _>(Standard)
+            .take(10000)
+            .filter(|hash| filter.contains(hash))
+            .count();
+        assert!(false_positives < 300, "false_positives: {false_positives}");
+    }
+
+    #[test]
+    fn empty() {
+        let filter = NodeFilter::new(&[]).unwrap();
+        assert!(!filter.contains(&rand::random()));
+    }
+
+    #[test]
+    fn too_many_hashes() {
+        let max = MAX_SIZE * 8 / BITS_PER_ELEMENT;
+        let hashes: Vec<Hash> = rand::thread_rng()
+            .sample_iter(Standard)
+            .take(max + 1)
+            .collect();
+
+        assert!(NodeFilter::new(&hashes[..max]).is_some());
+        assert!(NodeFilter::new(&hashes).is_none());
+    }
+}
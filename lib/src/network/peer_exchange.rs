@@ -3,6 +3,7 @@
 
 use super::{
     connection::ConnectionDirection,
+    content_queue::ContentSender,
     ip,
     message::Content,
     peer_addr::PeerAddr,
@@ -199,7 +200,7 @@ pub(crate) struct PexSender {
 impl PexSender {
     /// While this method is running, it periodically sends contacts of other peers that share the
     /// same repo to this peer and makes the contacts of this peer aailable to them.
-    pub async fn run(&mut self, content_tx: mpsc::Sender<Content>) {
+    pub async fn run(&mut self, content_tx: ContentSender) {
         let Some(collector) = self.enable() else {
             // Another collector for this link already exists.
             return;
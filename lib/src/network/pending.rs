@@ -2,6 +2,8 @@ use super::{
     constants::REQUEST_TIMEOUT,
     debug_payload::{DebugResponse, PendingDebugRequest},
     message::{Request, Response, ResponseDisambiguator},
+    node_filter::NodeFilter,
+    request_window::RequestPermit,
 };
 use crate::{
     block_tracker::{BlockOffer, BlockPromise},
@@ -18,6 +20,8 @@ use tokio::{sync::OwnedSemaphorePermit, task};
 pub(crate) enum PendingRequest {
     RootNode(PublicKey, PendingDebugRequest),
     ChildNodes(Hash, ResponseDisambiguator, PendingDebugRequest),
+    // Resolved by the response to the children of the subtree root, same as `ChildNodes`.
+    Subtree(Hash, ResponseDisambiguator, NodeFilter, PendingDebugRequest),
     Block(BlockOffer, PendingDebugRequest),
 }
 
@@ -109,7 +113,7 @@ impl PendingRequests {
         &self,
         pending_request: PendingRequest,
         link_permit: OwnedSemaphorePermit,
-        peer_permit: OwnedSemaphorePermit,
+        peer_permit: RequestPermit,
     ) -> Option<Request> {
         let (key, block_promise, request) = match pending_request {
             PendingRequest::RootNode(public_key, debug) => (
@@ -122,6 +126,11 @@ impl PendingRequests {
                 None,
                 Request::ChildNodes(hash, disambiguator, debug.send()),
             ),
+            PendingRequest::Subtree(hash, disambiguator, filter, debug) => (
+                Key::ChildNodes(hash, disambiguator),
+                None,
+                Request::Subtree(hash, disambiguator, filter, debug.send()),
+            ),
             PendingRequest::Block(offer, debug) => {
                 let promise = offer.accept()?;
                 let block_id = *promise.block_id();
@@ -141,7 +150,7 @@ impl PendingRequests {
                 timestamp: Instant::now(),
                 block_promise,
                 link_permit,
-                _peer_permit: peer_permit,
+                peer_permit,
             },
             REQUEST_TIMEOUT,
         );
@@ -168,11 +177,10 @@ impl PendingRequests {
             if let Some(request_data) = self.map.lock().unwrap().remove(&key) {
                 request_removed(&self.monitor, &key);
 
-                self.monitor
-                    .request_latency
-                    .record(request_data.timestamp.elapsed());
+                let latency = request_data.timestamp.elapsed();
+                self.monitor.request_latency.record(latency);
 
-                // We `drop` the `peer_permit` here but the `Client` will need the `client_permit` and
+                // We release the `peer_permit` here but the `Client` will need the `client_permit` and
                 // only `drop` it once the request is processed.
                 let client_permit = Some(ClientPermit {
                     _link_permit: request_data.link_permit,
@@ -180,6 +188,8 @@ impl PendingRequests {
                 });
                 let block_promise = request_data.block_promise;
 
+                request_data.peer_permit.complete(latency);
+
                 (client_permit, block_promise)
             } else {
                 (None, None)
@@ -221,9 +231,10 @@ async fn run_expiration_tracker(
     monitor: Arc<RepositoryMonitor>,
     request_map: Arc<BlockingMutex<DelayMap<Key, RequestData>>>,
 ) {
-    while let Some((key, _)) = expired(&request_map).await {
+    while let Some((key, data)) = expired(&request_map).await {
         monitor.request_timeouts.increment(1);
         request_removed(&monitor, &key);
+        data.peer_permit.timeout();
     }
 }
 
@@ -245,7 +256,7 @@ struct RequestData {
     timestamp: Instant,
     block_promise: Option<BlockPromise>,
     link_permit: OwnedSemaphorePermit,
-    _peer_permit: OwnedSemaphorePermit,
+    peer_permit: RequestPermit,
 }
 
 pub(super) struct ClientPermit {
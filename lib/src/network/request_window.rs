@@ -0,0 +1,287 @@
+use super::constants::{INITIAL_REQUEST_WINDOW, MAX_REQUEST_WINDOW, MIN_REQUEST_WINDOW};
+use deadlock::BlockingMutex;
+use state_monitor::{MonitoredValue, StateMonitor};
+use std::{sync::Arc, time::Duration};
+use tokio::sync::{OwnedSemaphorePermit, Semaphore};
+
+// If fewer than this many of our requests are estimated to be queued, the window grows.
+const ALPHA: f64 = 2.0;
+// If more than this many of our requests are estimated to be queued, the window shrinks.
+const BETA: f64 = 4.0;
+
+/// Adaptive limit on the number of requests that have been sent to a given peer but for which we
+/// haven't received a response yet.
+///
+/// The window is adjusted once per round-trip using a delay based congestion control similar to
+/// TCP Vegas: The expected throughput (window / minimal RTT) is compared with the actual one
+/// (window / measured RTT). Their difference, multiplied by the minimal RTT, estimates how many of
+/// our requests are currently queued somewhere (in the network or at the peer). If it's below
+/// `ALPHA` the window grows by one, if it's above `BETA` it shrinks by one. Initially the window
+/// doubles each round-trip until the first sign of queuing. Request timeouts halve the window.
+pub(super) struct RequestWindow {
+    semaphore: Arc<Semaphore>,
+    state: BlockingMutex<State>,
+    monitor: MonitoredValue<usize>,
+}
+
+impl RequestWindow {
+    pub fn new(monitor: &StateMonitor) -> Arc<Self> {
+        Arc::new(Self {
+            semaphore: Arc::new(Semaphore::new(INITIAL_REQUEST_WINDOW)),
+            state: BlockingMutex::new(State::new()),
+            monitor: monitor.make_value("request window", INITIAL_REQUEST_WINDOW),
+        })
+    }
+
+    /// Waits until there is a room in the window for one more request.
+    pub async fn acquire(self: &Arc<Self>) -> RequestPermit {
+        loop {
+            // Unwrap OK because we never `close()` the semaphore.
+            let permit = self.semaphore.clone().acquire_owned().await.unwrap();
+
+            if let Some(permit) = self.admit(permit) {
+                return permit;
+            }
+        }
+    }
+
+    /// Like `acquire` but returns `None` instead of waiting when the window is full.
+    pub fn try_acquire(self: &Arc<Self>) -> Option<RequestPermit> {
+        loop {
+            let permit = self.semaphore.clone().try_acquire_owned().ok()?;
+
+            if let Some(permit) = self.admit(permit) {
+                return Some(permit);
+            }
+        }
+    }
+
+    // If the window shrunk, retire the permits that are now over the limit.
+    fn admit(self: &Arc<Self>, permit: OwnedSemaphorePermit) -> Option<RequestPermit> {
+        let mut state = self.state.lock().unwrap();
+
+        if state.excess > 0 {
+            state.excess -= 1;
+            permit.forget();
+            None
+        } else {
+            Some(RequestPermit {
+                _permit: permit,
+                window: self.clone(),
+            })
+        }
+    }
+
+    /// Current size of the window.
+    #[cfg(test)]
+    pub fn size(&self) -> usize {
+        self.state.lock().unwrap().size
+    }
+
+    fn on_response(&self, rtt: Duration) {
+        let mut state = self.state.lock().unwrap();
+
+        state.round_responses += 1;
+        state.round_rtt_sum += rtt;
+        state.round_min_rtt = state.round_min_rtt.min(rtt);
+
+        if state.round_responses < state.size {
+            return;
+        }
+
+        let rtt = state.round_rtt_sum / state.round_responses as u32;
+
+        // Let the minimal RTT slowly drift up so that changes in the network path are eventually
+        // picked up.
+        let base_rtt = state
+            .base_rtt
+            .map(|base_rtt| base_rtt + base_rtt / 64)
+            .unwrap_or(Duration::MAX)
+            .min(state.round_min_rtt);
+
+        state.base_rtt = Some(base_rtt);
+        state.reset_round();
+
+        let queued = if rtt.is_zero() {
+            0.0
+        } else {
+            state.size as f64 * (1.0 - base_rtt.as_secs_f64() / rtt.as_secs_f64())
+        };
+
+        let size = if state.slow_start {
+            if queued > BETA {
+                state.slow_start = false;
+                state.size - 1
+            } else {
+                state.size * 2
+            }
+        } else if queued < ALPHA {
+            state.size + 1
+        } else if queued > BETA {
+            state.size - 1
+        } else {
+            state.size
+        };
+
+        self.resize(&mut state, size);
+    }
+
+    fn on_timeout(&self) {
+        let mut state = self.state.lock().unwrap();
+
+        state.slow_start = false;
+        state.reset_round();
+
+        let size = state.size / 2;
+        self.resize(&mut state, size);
+    }
+
+    fn resize(&self, state: &mut State, size: usize) {
+        let size = size.clamp(MIN_REQUEST_WINDOW, MAX_REQUEST_WINDOW);
+
+        if size > state.size {
+            let grow = size - state.size;
+            let repaid = grow.min(state.excess);
+
+            state.excess -= repaid;
+            self.semaphore.add_permits(grow - repaid);
+        } else {
+            state.excess += state.size - size;
+        }
+
+        state.size = size;
+        *self.monitor.get() = size;
+    }
+}
+
+/// Occupies one slot in the `RequestWindow`. Release it by calling `complete` when the response
+/// arrives, or `timeout` when it doesn't. Dropping it releases the slot without affecting the
+/// window size.
+pub(super) struct RequestPermit {
+    _permit: OwnedSemaphorePermit,
+    window: Arc<RequestWindow>,
+}
+
+impl RequestPermit {
+    pub fn complete(self, rtt: Duration) {
+        self.window.on_response(rtt);
+    }
+
+    pub fn timeout(self) {
+        self.window.on_timeout();
+    }
+}
+
+struct State {
+    size: usize,
+    // Number of permits to retire after the window shrunk.
+    excess: usize,
+    slow_start: bool,
+    base_rtt: Option<Duration>,
+    round_responses: usize,
+    round_rtt_sum: Duration,
+    round_min_rtt: Duration,
+}
+
+impl State {
+    fn new() -> Self {
+        Self {
+            size: INITIAL_REQUEST_WINDOW,
+            excess: 0,
+            slow_start: true,
+            base_rtt: None,
+            round_responses: 0,
+            round_rtt_sum: Duration::ZERO,
+            round_min_rtt: Duration::MAX,
+        }
+    }
+
+    fn reset_round(&mut self) {
+        self.round_responses = 0;
+        self.round_rtt_sum = Duration::ZERO;
+        self.round_min_rtt = Duration::MAX;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[tokio::test]
+    async fn grows_without_queuing() {
+        let window = RequestWindow::new(&StateMonitor::make_root());
+
+        let rtt = Duration::from_millis(100);
+        run_round(&window, rtt).await;
+        assert_eq!(window.size(), 2 * INITIAL_REQUEST_WINDOW);
+
+        run_round(&window, rtt).await;
+        assert_eq!(window.size(), MAX_REQUEST_WINDOW);
+
+        // The extra permits are available.
+        let permits = acquire(&window, MAX_REQUEST_WINDOW).await;
+        assert_eq!(window.semaphore.available_permits(), 0);
+        drop(permits);
+    }
+
+    #[tokio::test]
+    async fn shrinks_on_queuing() {
+        let window = RequestWindow::new(&StateMonitor::make_root());
+
+        run_round(&window, Duration::from_millis(100)).await;
+        let size = window.size();
+
+        // RTT doubled - half of the requests are estimated to be queued.
+        run_round(&window, Duration::from_millis(200)).await;
+        assert_eq!(window.size(), size - 1);
+
+        // Congestion avoidance from now on.
+        run_round(&window, Duration::from_millis(100)).await;
+        assert_eq!(window.size(), size);
+    }
+
+    #[tokio::test]
+    async fn halves_on_timeout() {
+        let window = RequestWindow::new(&StateMonitor::make_root());
+
+        let mut permits = acquire(&window, INITIAL_REQUEST_WINDOW).await;
+        permits.pop().unwrap().timeout();
+        assert_eq!(window.size(), INITIAL_REQUEST_WINDOW / 2);
+
+        // The window is now over-occupied, so there is room for another request only after the
+        // number of requests in flight drops below the new size.
+        for permit in permits.drain(..INITIAL_REQUEST_WINDOW / 2) {
+            drop(permit);
+        }
+
+        let permit = window.acquire().await;
+        assert!(window.try_acquire().is_none());
+        assert_eq!(window.state.lock().unwrap().excess, 0);
+        assert_eq!(window.semaphore.available_permits(), 0);
+
+        drop(permit);
+        drop(permits);
+
+        for _ in 0..10 {
+            window.acquire().await.timeout();
+        }
+
+        assert_eq!(window.size(), MIN_REQUEST_WINDOW);
+    }
+
+    async fn run_round(window: &Arc<RequestWindow>, rtt: Duration) {
+        for permit in acquire(window, window.size()).await {
+            permit.complete(rtt);
+        }
+    }
+
+    async fn acquire(window: &Arc<RequestWindow>, count: usize) -> Vec<RequestPermit> {
+        let mut permits = Vec::with_capacity(count);
+
+        for _ in 0..count {
+            permits.push(window.acquire().await);
+        }
+
+        permits
+    }
+}
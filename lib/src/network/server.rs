@@ -1,13 +1,16 @@
 use super::{
     choke::Choker,
-    debug_payload::{DebugRequest, DebugResponse},
+    constants::{MAX_BLOCKS_PER_REQUEST, MAX_SUBTREE_DEPTH},
+    content_queue::ContentSender,
+    debug_payload::{DebugRequest, DebugResponse, PendingDebugResponse},
     message::{Content, Request, Response, ResponseDisambiguator},
+    node_filter::{self, NodeFilter},
 };
 use crate::{
     crypto::{sign::PublicKey, Hash},
     error::{Error, Result},
     event,
-    protocol::{BlockContent, BlockId, RootNode, RootNodeFilter},
+    protocol::{BlockContent, BlockId, InnerNodes, RootNode, RootNodeFilter},
     repository::Vault,
     store,
 };
@@ -15,7 +18,11 @@ use futures_util::{
     stream::{self, FuturesUnordered},
     Stream, StreamExt, TryStreamExt,
 };
-use std::{collections::HashSet, pin::pin};
+use std::{
+    collections::{HashSet, VecDeque},
+    pin::pin,
+    sync::atomic::{AtomicBool, Ordering},
+};
 use tokio::{
     select,
     sync::{
@@ -34,12 +41,16 @@ pub(crate) struct Server {
 impl Server {
     pub fn new(
         vault: Vault,
-        tx: mpsc::Sender<Content>,
+        tx: ContentSender,
         rx: mpsc::Receiver<Request>,
         choker: Choker,
     ) -> Self {
         Self {
-            inner: Inner { vault, tx },
+            inner: Inner {
+                vault,
+                tx,
+                choked: AtomicBool::new(true),
+            },
             rx,
             choker,
         }
@@ -54,7 +65,10 @@ impl Server {
 
 struct Inner {
     vault: Vault,
-    tx: mpsc::Sender<Content>,
+    tx: ContentSender,
+    // Whether we are currently choking the peer. Lets the long running request handlers (e.g.
+    // `handle_subtree`) stop early.
+    choked: AtomicBool,
 }
 
 impl Inner {
@@ -70,6 +84,7 @@ impl Inner {
         // multiple events per particular branch.
         let mut accumulator = EventAccumulator::default();
         let mut choked = true;
+        self.choked.store(choked, Ordering::Relaxed);
 
         // This is to handle multiple requests / events at once.
         // TODO: Do we need to limit the number of concurrent request handlers? We have a limit on
@@ -105,6 +120,7 @@ impl Inner {
                 },
                 new_choked = choker.changed() => {
                     choked = new_choked;
+                    self.choked.store(choked, Ordering::Relaxed);
 
                     if choked {
                         continue;
@@ -131,6 +147,11 @@ impl Inner {
                 self.handle_child_nodes(hash, disambiguator, debug).await
             }
             Request::Block(block_id, debug) => self.handle_block(block_id, debug).await,
+            Request::Blocks(block_ids, debug) => self.handle_blocks(block_ids, debug).await,
+            Request::Subtree(hash, disambiguator, filter, debug) => {
+                self.handle_subtree(hash, disambiguator, filter, debug)
+                    .await
+            }
         }
     }
 
@@ -179,9 +200,85 @@ impl Inner {
         parent_hash: Hash,
         disambiguator: ResponseDisambiguator,
         debug: DebugRequest,
+    ) -> Result<()> {
+        self.send_child_nodes(parent_hash, disambiguator, debug.begin_reply())
+            .await?;
+        Ok(())
+    }
+
+    #[instrument(skip(self, filter, debug), fields(?filter), err(Debug))]
+    async fn handle_subtree(
+        &self,
+        root_hash: Hash,
+        disambiguator: ResponseDisambiguator,
+        filter: NodeFilter,
+        debug: DebugRequest,
     ) -> Result<()> {
         let debug = debug.begin_reply();
 
+        // The client never sends a filter bigger than this so the request is bogus.
+        if filter.size() > node_filter::MAX_SIZE {
+            tracing::warn!(
+                size = filter.size(),
+                limit = node_filter::MAX_SIZE,
+                "node filter too big"
+            );
+            self.send_response(Response::ChildNodesError(
+                root_hash,
+                disambiguator,
+                debug.send(),
+            ))
+            .await;
+            return Ok(());
+        }
+
+        // The nodes are paired with the layer (relative to the requested node) of their children.
+        let mut queue = VecDeque::from([(root_hash, disambiguator, debug, 1)]);
+
+        // Breadth first, so the client always receives the parents before their children.
+        while let Some((parent_hash, disambiguator, debug, depth)) = queue.pop_front() {
+            // Don't keep pushing to a peer we've choked in the meantime. It requests the rest the
+            // usual way once its pushes expire.
+            if depth > 1 && self.choked.load(Ordering::Relaxed) {
+                tracing::trace!("choked, subtree push stopped");
+                break;
+            }
+
+            let inner_nodes = self
+                .send_child_nodes(parent_hash, disambiguator, debug.clone())
+                .await?;
+
+            // The layers below the limit are left to follow-up requests from the client.
+            if depth >= MAX_SUBTREE_DEPTH {
+                continue;
+            }
+
+            queue.extend(
+                inner_nodes
+                    .iter()
+                    .map(|(_, node)| node)
+                    .filter(|node| !node.is_empty() && !filter.contains(&node.hash))
+                    .map(|node| {
+                        (
+                            node.hash,
+                            ResponseDisambiguator::new(node.summary.block_presence),
+                            debug.clone(),
+                            depth + 1,
+                        )
+                    }),
+            );
+        }
+
+        Ok(())
+    }
+
+    // Sends the children of the given node and returns the inner ones.
+    async fn send_child_nodes(
+        &self,
+        parent_hash: Hash,
+        disambiguator: ResponseDisambiguator,
+        debug: PendingDebugResponse,
+    ) -> Result<InnerNodes> {
         let mut reader = self.vault.store().acquire_read().await?;
 
         // At most one of these will be non-empty.
@@ -192,9 +289,9 @@ impl Inner {
 
         if !inner_nodes.is_empty() || !leaf_nodes.is_empty() {
             if !inner_nodes.is_empty() {
-                tracing::trace!("inner nodes found");
+                tracing::trace!(?parent_hash, "inner nodes found");
                 self.send_response(Response::InnerNodes(
-                    inner_nodes,
+                    inner_nodes.clone(),
                     disambiguator,
                     debug.clone().send(),
                 ))
@@ -202,12 +299,12 @@ impl Inner {
             }
 
             if !leaf_nodes.is_empty() {
-                tracing::trace!("leaf nodes found");
+                tracing::trace!(?parent_hash, "leaf nodes found");
                 self.send_response(Response::LeafNodes(leaf_nodes, disambiguator, debug.send()))
                     .await;
             }
         } else {
-            tracing::trace!("child nodes not found");
+            tracing::trace!(?parent_hash, "child nodes not found");
             self.send_response(Response::ChildNodesError(
                 parent_hash,
                 disambiguator,
@@ -216,7 +313,7 @@ impl Inner {
             .await;
         }
 
-        Ok(())
+        Ok(inner_nodes)
     }
 
     #[instrument(skip(self, debug), err(Debug))]
@@ -252,6 +349,77 @@ impl Inner {
         }
     }
 
+    #[instrument(skip_all, fields(count = block_ids.len()), err(Debug))]
+    async fn handle_blocks(&self, mut block_ids: Vec<BlockId>, debug: DebugRequest) -> Result<()> {
+        // Serve only up to the limit and fail the rest, so every requested block still gets a
+        // response and the client can request them elsewhere.
+        let rejected = if block_ids.len() > MAX_BLOCKS_PER_REQUEST {
+            tracing::warn!(
+                count = block_ids.len(),
+                limit = MAX_BLOCKS_PER_REQUEST,
+                "too many blocks requested"
+            );
+            block_ids.split_off(MAX_BLOCKS_PER_REQUEST)
+        } else {
+            Vec::new()
+        };
+
+        // Read all the blocks using a single db connection but release it before sending the
+        // responses so it's not held while waiting for the send channel.
+        let mut reader = self.vault.store().acquire_read().await?;
+        let mut results = Vec::with_capacity(block_ids.len());
+
+        for block_id in block_ids {
+            let mut content = BlockContent::new();
+
+            match reader.read_block(&block_id, &mut content).await {
+                Ok(nonce) => results.push((block_id, Ok((content, nonce)))),
+                Err(store::Error::BlockNotFound) => {
+                    results.push((block_id, Err(store::Error::BlockNotFound)))
+                }
+                Err(error) => {
+                    // No point reading the rest, the error is going to terminate the server.
+                    results.push((block_id, Err(error)));
+                    break;
+                }
+            }
+        }
+
+        drop(reader);
+
+        for (block_id, result) in results {
+            let debug = debug.clone().begin_reply();
+
+            match result {
+                Ok((content, nonce)) => {
+                    tracing::trace!(?block_id, "block found");
+                    self.send_response(Response::Block(content, nonce, debug.send()))
+                        .await;
+                }
+                Err(store::Error::BlockNotFound) => {
+                    tracing::trace!(?block_id, "block not found");
+                    self.send_response(Response::BlockError(block_id, debug.send()))
+                        .await;
+                }
+                Err(error) => {
+                    self.send_response(Response::BlockError(block_id, debug.send()))
+                        .await;
+                    return Err(error.into());
+                }
+            }
+        }
+
+        for block_id in rejected {
+            self.send_response(Response::BlockError(
+                block_id,
+                debug.clone().begin_reply().send(),
+            ))
+            .await;
+        }
+
+        Ok(())
+    }
+
     async fn handle_event(&self, event: Event) -> Result<()> {
         match event {
             Event::BranchChanged(branch_id) => self.handle_branch_changed_event(branch_id).await,
@@ -1,21 +1,26 @@
 use super::{
-    choke,
+    choke::{self, ChokeConfig},
     client::Client,
-    constants::MAX_IN_FLIGHT_REQUESTS_PER_PEER,
-    message::{Content, Request, Response},
+    constants::{MAX_BLOCKS_PER_REQUEST, MAX_SUBTREE_DEPTH},
+    content_queue::{self, ContentReceiver},
+    debug_payload::PendingDebugRequest,
+    message::{Content, Request, Response, ResponseDisambiguator},
+    node_filter::NodeFilter,
+    request_window::RequestWindow,
     server::Server,
+    traffic_tracker::TrafficTracker,
 };
 use crate::{
-    block_tracker::OfferState,
+    block_tracker::{OfferState, SchedulingPolicy},
     crypto::sign::{Keypair, PublicKey},
     db,
     event::{Event, EventSender, Payload},
     protocol::{
         test_utils::{receive_blocks, receive_nodes, Snapshot},
-        Block, BlockId, Bump, RootNode, SingleBlockPresence,
+        Block, BlockId, Bump, RootNode, SingleBlockPresence, INNER_LAYER_COUNT,
     },
     repository::{BlockRequestMode, RepositoryId, RepositoryMonitor, Vault},
-    store::Changeset,
+    store::{CacheCapacity, Changeset},
     test_utils,
     version_vector::VersionVector,
 };
@@ -23,14 +28,14 @@ use futures_util::{future, TryStreamExt};
 use metrics::NoopRecorder;
 use rand::prelude::*;
 use state_monitor::StateMonitor;
-use std::{fmt, future::Future, sync::Arc};
+use std::{cell::Cell, fmt, future::Future, sync::Arc};
 use tempfile::TempDir;
 use test_strategy::proptest;
 use tokio::{
     pin, select,
     sync::{
         broadcast::{self, error::RecvError},
-        mpsc, Semaphore,
+        mpsc, Notify,
     },
     time::{self, Duration},
 };
@@ -392,6 +397,279 @@ async fn failed_block_other_peer() {
     }
 }
 
+// Request multiple blocks, some of them missing, at once and check the server responds to each of
+// them individually.
+#[tokio::test]
+async fn serve_blocks_request() {
+    let mut rng = StdRng::seed_from_u64(0);
+
+    let write_keys = Keypair::generate(&mut rng);
+    let (_base_dir, vault, choker, writer_id) = create_repository(&mut rng, &write_keys).await;
+
+    let snapshot = Snapshot::generate(&mut rng, 3);
+    save_snapshot(&vault, writer_id, &write_keys, &snapshot).await;
+    receive_blocks(&vault, &snapshot).await;
+
+    let missing_snapshot = Snapshot::generate(&mut rng, 1);
+    let missing_id = *missing_snapshot.blocks().keys().next().unwrap();
+
+    let mut block_ids: Vec<_> = snapshot.blocks().keys().copied().collect();
+    block_ids.push(missing_id);
+
+    let (mut server, mut send_rx, recv_tx) = create_server(vault.clone(), &choker);
+
+    recv_tx
+        .send(Request::Blocks(
+            block_ids.clone(),
+            PendingDebugRequest::start().send(),
+        ))
+        .await
+        .unwrap();
+
+    let receive = async {
+        let mut found = Vec::new();
+        let mut not_found = Vec::new();
+
+        while found.len() + not_found.len() < block_ids.len() {
+            match Response::from(send_rx.recv().await.unwrap()) {
+                Response::Block(content, nonce, _) => found.push(BlockId::new(&content, &nonce)),
+                Response::BlockError(block_id, _) => not_found.push(block_id),
+                _ => (),
+            }
+        }
+
+        (found, not_found)
+    };
+
+    let (mut found, not_found) = select! {
+        result = server.run() => panic!("server terminated prematurely: {:?}", result),
+        result = receive => result,
+    };
+
+    let mut expected: Vec<_> = snapshot.blocks().keys().copied().collect();
+    expected.sort();
+    found.sort();
+
+    assert_eq!(found, expected);
+    assert_eq!(not_found, [missing_id]);
+}
+
+// Request more blocks than the server serves in one request and check it still responds to each of
+// them, failing those over the limit.
+#[tokio::test]
+async fn serve_blocks_request_over_limit() {
+    let mut rng = StdRng::seed_from_u64(0);
+
+    let write_keys = Keypair::generate(&mut rng);
+    let (_base_dir, vault, choker, writer_id) = create_repository(&mut rng, &write_keys).await;
+
+    let snapshot = Snapshot::generate(&mut rng, MAX_BLOCKS_PER_REQUEST + 1);
+    save_snapshot(&vault, writer_id, &write_keys, &snapshot).await;
+    receive_blocks(&vault, &snapshot).await;
+
+    let block_ids: Vec<_> = snapshot.blocks().keys().copied().collect();
+
+    let (mut server, mut send_rx, recv_tx) = create_server(vault.clone(), &choker);
+
+    recv_tx
+        .send(Request::Blocks(
+            block_ids.clone(),
+            PendingDebugRequest::start().send(),
+        ))
+        .await
+        .unwrap();
+
+    let receive = async {
+        let mut found = Vec::new();
+        let mut not_found = Vec::new();
+
+        while found.len() + not_found.len() < block_ids.len() {
+            match Response::from(send_rx.recv().await.unwrap()) {
+                Response::Block(content, nonce, _) => found.push(BlockId::new(&content, &nonce)),
+                Response::BlockError(block_id, _) => not_found.push(block_id),
+                _ => (),
+            }
+        }
+
+        (found, not_found)
+    };
+
+    let (found, not_found) = select! {
+        result = server.run() => panic!("server terminated prematurely: {:?}", result),
+        result = receive => result,
+    };
+
+    assert_eq!(found, block_ids[..MAX_BLOCKS_PER_REQUEST]);
+    assert_eq!(not_found, block_ids[MAX_BLOCKS_PER_REQUEST..]);
+}
+
+// Request a subtree with a filter that covers nothing and check the server pushes only the layers up
+// to the limit.
+#[tokio::test]
+async fn serve_subtree_up_to_max_depth() {
+    let mut rng = StdRng::seed_from_u64(0);
+
+    let write_keys = Keypair::generate(&mut rng);
+    let (_base_dir, vault, choker, writer_id) = create_repository(&mut rng, &write_keys).await;
+
+    let snapshot = Snapshot::generate(&mut rng, 64);
+    save_snapshot(&vault, writer_id, &write_keys, &snapshot).await;
+
+    let root_node = load_latest_root_node(&vault, &writer_id).await.unwrap();
+
+    let (mut server, mut send_rx, recv_tx) = create_server(vault.clone(), &choker);
+
+    recv_tx
+        .send(Request::Subtree(
+            root_node.proof.hash,
+            ResponseDisambiguator::new(root_node.summary.block_presence),
+            NodeFilter::new(&[]).unwrap(),
+            PendingDebugRequest::start().send(),
+        ))
+        .await
+        .unwrap();
+
+    let expected: usize = snapshot
+        .inner_layers()
+        .take(MAX_SUBTREE_DEPTH)
+        .map(|layer| layer.inner_maps().count())
+        .sum();
+
+    let receive = async {
+        for _ in 0..expected {
+            let response = Response::from(send_rx.recv().await.unwrap());
+            assert!(matches!(response, Response::InnerNodes(..)), "{response:?}");
+        }
+
+        // Nothing below the limit is pushed.
+        assert!(time::timeout(Duration::from_millis(100), send_rx.recv())
+            .await
+            .is_err());
+    };
+
+    select! {
+        result = server.run() => panic!("server terminated prematurely: {:?}", result),
+        _ = receive => (),
+    }
+}
+
+// Check that a client which already has an older snapshot of a branch gets pushed only the nodes
+// that changed since then and that it completes the sync even if the push gets interrupted.
+#[tokio::test]
+async fn sync_changed_subtree() {
+    let mut rng = StdRng::seed_from_u64(0);
+
+    let write_keys = Keypair::generate(&mut rng);
+    let (_a_base_dir, a_vault, a_choker, a_id) = create_repository(&mut rng, &write_keys).await;
+    let (_b_base_dir, b_vault, _, _) = create_repository(&mut rng, &write_keys).await;
+
+    let snapshot = Snapshot::generate(&mut rng, 64);
+    save_snapshot(&a_vault, a_id, &write_keys, &snapshot).await;
+    receive_blocks(&a_vault, &snapshot).await;
+
+    // Initial sync. The client has no snapshot of the branch yet so it requests the nodes one
+    // layer at a time. Wait also for the blocks so the unchanged nodes don't differ in block
+    // presence later.
+    let initial_responses = Cell::new(0);
+    run_until(
+        simulate_connection_filtered(
+            &mut create_server(a_vault.clone(), &a_choker),
+            &mut create_client(b_vault.clone()),
+            |_| true,
+            |response| {
+                if is_node_response(response) {
+                    initial_responses.set(initial_responses.get() + 1);
+                }
+                true
+            },
+        ),
+        async {
+            wait_until_snapshots_in_sync(&a_vault, a_id, &b_vault).await;
+
+            for block_id in snapshot.blocks().keys() {
+                wait_until_block_exists(&b_vault, block_id).await;
+            }
+        },
+    )
+    .await;
+
+    // Change a single leaf. Only the nodes on its path from the root are sent.
+    create_changeset(&mut rng, &a_vault, &a_id, &write_keys, 1).await;
+
+    let subtree_requests = Cell::new(0);
+    let responses = Cell::new(0);
+    run_until(
+        simulate_connection_filtered(
+            &mut create_server(a_vault.clone(), &a_choker),
+            &mut create_client(b_vault.clone()),
+            |request| {
+                if matches!(request, Request::Subtree(..)) {
+                    subtree_requests.set(subtree_requests.get() + 1);
+                }
+                true
+            },
+            |response| {
+                if is_node_response(response) {
+                    responses.set(responses.get() + 1);
+                }
+                true
+            },
+        ),
+        wait_until_snapshots_in_sync(&a_vault, a_id, &b_vault),
+    )
+    .await;
+
+    // One request plus a follow-up for each `MAX_SUBTREE_DEPTH` layers below the first one.
+    assert_eq!(
+        subtree_requests.get(),
+        (INNER_LAYER_COUNT + 1).div_ceil(MAX_SUBTREE_DEPTH)
+    );
+    assert!(responses.get() <= INNER_LAYER_COUNT + 1);
+    assert!(responses.get() < initial_responses.get());
+
+    // Change another leaf but this time disconnect after the first pushed response.
+    create_changeset(&mut rng, &a_vault, &a_id, &write_keys, 1).await;
+
+    let responses = Cell::new(0);
+    let interrupted = Notify::new();
+    run_until(
+        simulate_connection_filtered(
+            &mut create_server(a_vault.clone(), &a_choker),
+            &mut create_client(b_vault.clone()),
+            |_| true,
+            |response| {
+                if !is_node_response(response) {
+                    return true;
+                }
+
+                responses.set(responses.get() + 1);
+
+                if responses.get() > 1 {
+                    interrupted.notify_one();
+                    false
+                } else {
+                    true
+                }
+            },
+        ),
+        interrupted.notified(),
+    )
+    .await;
+
+    let server_root = load_latest_root_node(&a_vault, &a_id).await.unwrap();
+    let client_root = load_latest_root_node(&b_vault, &a_id).await.unwrap();
+    assert_eq!(client_root.proof.hash, server_root.proof.hash);
+    assert!(!client_root.summary.state.is_approved());
+
+    // Reconnect. The client requests the rest of the incomplete snapshot.
+    simulate_connection_until(
+        &mut create_server(a_vault.clone(), &a_choker),
+        &mut create_client(b_vault.clone()),
+        wait_until_snapshots_in_sync(&a_vault, a_id, &b_vault),
+    )
+    .await;
+}
+
 async fn create_repository<R: Rng + CryptoRng>(
     rng: &mut R,
     write_keys: &Keypair,
@@ -406,10 +684,12 @@ async fn create_repository<R: Rng + CryptoRng>(
         event_tx,
         db,
         BlockRequestMode::Greedy,
+        CacheCapacity::default(),
+        SchedulingPolicy::default(),
         RepositoryMonitor::new(StateMonitor::make_root(), &NoopRecorder),
     );
 
-    let choke_manager = choke::Manager::new();
+    let choke_manager = choke::Manager::new(ChokeConfig::default());
 
     (base_dir, state, choke_manager, writer_id)
 }
@@ -559,6 +839,20 @@ where
 
 // Simulate connection forever.
 async fn simulate_connection(server: &mut ServerData, client: &mut ClientData) {
+    simulate_connection_filtered(server, client, |_| true, |_| true).await
+}
+
+// Simulate connection forever, dropping the requests and responses for which the corresponding
+// filter returns `false`.
+async fn simulate_connection_filtered<F, G>(
+    server: &mut ServerData,
+    client: &mut ClientData,
+    request_filter: F,
+    response_filter: G,
+) where
+    F: FnMut(&Request) -> bool,
+    G: FnMut(&Response) -> bool,
+{
     let (server, server_send_rx, server_recv_tx) = server;
     let (client, client_send_rx, client_recv_tx) = client;
 
@@ -580,11 +874,15 @@ async fn simulate_connection(server: &mut ServerData, client: &mut ClientData) {
 
         result = server_run => result.unwrap(),
         result = client_run => result.unwrap(),
-        _ = server_conn.run() => panic!("connection closed prematurely"),
-        _ = client_conn.run() => panic!("connection closed prematurely"),
+        _ = server_conn.run(response_filter) => panic!("connection closed prematurely"),
+        _ = client_conn.run(request_filter) => panic!("connection closed prematurely"),
     }
 }
 
+fn is_node_response(response: &Response) -> bool {
+    matches!(response, Response::InnerNodes(..) | Response::LeafNodes(..))
+}
+
 // Runs `task` until `until` completes. Panics if `until` doesn't complete before `TIMEOUT` or if
 // `task` completes before `until`.
 async fn run_until<F, U>(task: F, until: U)
@@ -600,25 +898,30 @@ where
     }
 }
 
-type ServerData = (Server, mpsc::Receiver<Content>, mpsc::Sender<Request>);
-type ClientData = (Client, mpsc::Receiver<Content>, mpsc::Sender<Response>);
+type ServerData = (Server, ContentReceiver, mpsc::Sender<Request>);
+type ClientData = (Client, ContentReceiver, mpsc::Sender<Response>);
 
 fn create_server(repo: Vault, choke_manager: &choke::Manager) -> ServerData {
-    let (send_tx, send_rx) = mpsc::channel(1);
+    let (send_tx, send_rx) = content_queue::channel();
     let (recv_tx, recv_rx) = mpsc::channel(CAPACITY);
-    let server = Server::new(repo, send_tx, recv_rx, choke_manager.new_choker());
+    let server = Server::new(
+        repo,
+        send_tx,
+        recv_rx,
+        choke_manager.new_choker(TrafficTracker::new()),
+    );
 
     (server, send_rx, recv_tx)
 }
 
 fn create_client(repo: Vault) -> ClientData {
-    let (send_tx, send_rx) = mpsc::channel(1);
+    let (send_tx, send_rx) = content_queue::channel();
     let (recv_tx, recv_rx) = mpsc::channel(CAPACITY);
     let client = Client::new(
         repo,
         send_tx,
         recv_rx,
-        Arc::new(Semaphore::new(MAX_IN_FLIGHT_REQUESTS_PER_PEER)),
+        RequestWindow::new(&StateMonitor::make_root()),
     );
 
     (client, send_rx, recv_tx)
@@ -626,7 +929,7 @@ fn create_client(repo: Vault) -> ClientData {
 
 // Simulated connection between a server and a client.
 struct Connection<'a, T> {
-    send_rx: &'a mut mpsc::Receiver<Content>,
+    send_rx: &'a mut ContentReceiver,
     recv_tx: &'a mut mpsc::Sender<T>,
 }
 
@@ -634,9 +937,16 @@ impl<T> Connection<'_, T>
 where
     T: From<Content> + fmt::Debug,
 {
-    async fn run(&mut self) {
+    async fn run<F>(&mut self, mut filter: F)
+    where
+        F: FnMut(&T) -> bool,
+    {
         while let Some(content) = self.send_rx.recv().await {
-            self.recv_tx.send(content.into()).await.unwrap();
+            let message: T = content.into();
+
+            if filter(&message) {
+                self.recv_tx.send(message).await.unwrap();
+            }
         }
     }
 }
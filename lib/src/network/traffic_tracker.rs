@@ -15,12 +15,33 @@ impl TrafficTracker {
         Self::default()
     }
 
+    /// Creates a tracker whose traffic is tracked separately but is also recorded into this
+    /// tracker.
+    pub fn new_child(&self) -> Self {
+        Self {
+            counters: Arc::new(Counters {
+                parent: Some(self.counters.clone()),
+                ..Counters::default()
+            }),
+        }
+    }
+
     pub fn record_send(&self, bytes: u64) {
-        self.counters.send.fetch_add(bytes, Ordering::Release);
+        let mut counters = Some(&self.counters);
+
+        while let Some(current) = counters {
+            current.send.fetch_add(bytes, Ordering::Release);
+            counters = current.parent.as_ref();
+        }
     }
 
     pub fn record_recv(&self, bytes: u64) {
-        self.counters.recv.fetch_add(bytes, Ordering::Release);
+        let mut counters = Some(&self.counters);
+
+        while let Some(current) = counters {
+            current.recv.fetch_add(bytes, Ordering::Release);
+            counters = current.parent.as_ref();
+        }
     }
 
     pub fn get(&self) -> TrafficStats {
@@ -44,4 +65,5 @@ pub struct TrafficStats {
 struct Counters {
     send: AtomicU64,
     recv: AtomicU64,
+    parent: Option<Arc<Counters>>,
 }
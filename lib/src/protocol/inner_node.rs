@@ -38,7 +38,6 @@ impl InnerNodes {
         self.0.is_empty()
     }
 
-    #[allow(unused)]
     pub fn len(&self) -> usize {
         self.0.len()
     }
@@ -54,7 +54,6 @@ impl LeafNodes {
         self.0.is_empty()
     }
 
-    #[allow(unused)]
     pub fn len(&self) -> usize {
         self.0.len()
     }
@@ -22,7 +22,7 @@ pub(crate) use self::{
     leaf_node::{LeafNode, LeafNodes, EMPTY_LEAF_HASH},
     locator::Locator,
     proof::{Proof, ProofError, UntrustedProof},
-    root_node::{RootNode, RootNodeFilter, RootNodeKind},
+    root_node::{RootNode, RootNodeFilter, RootNodeKind, SnapshotId},
     summary::{MultiBlockPresence, NodeState, SingleBlockPresence, Summary},
 };
 
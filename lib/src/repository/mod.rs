@@ -24,6 +24,7 @@ pub(crate) use self::{
 
 use crate::{
     access_control::{Access, AccessChange, AccessKeys, AccessMode, AccessSecrets, LocalSecret},
+    block_tracker::SchedulingPolicy,
     branch::{Branch, BranchShared},
     crypto::{sign::PublicKey, PasswordSalt},
     db::{self, DatabaseId},
@@ -37,7 +38,7 @@ use crate::{
     progress::Progress,
     protocol::{RootNodeFilter, BLOCK_SIZE},
     storage_size::StorageSize,
-    store,
+    store::{self, CacheCapacity},
     sync::stream::Throttle,
     version_vector::VersionVector,
 };
@@ -108,7 +109,14 @@ impl Repository {
             writer_id,
         };
 
-        Self::new(pool, credentials, monitor).await
+        Self::new(
+            pool,
+            credentials,
+            params.cache_capacity(),
+            params.block_scheduling(),
+            monitor,
+        )
+        .await
     }
 
     /// Opens an existing repository.
@@ -153,12 +161,21 @@ impl Repository {
 
         let credentials = Credentials { secrets, writer_id };
 
-        Self::new(pool, credentials, monitor).await
+        Self::new(
+            pool,
+            credentials,
+            params.cache_capacity(),
+            params.block_scheduling(),
+            monitor,
+        )
+        .await
     }
 
     async fn new(
         pool: db::Pool,
         credentials: Credentials,
+        cache_capacity: CacheCapacity,
+        block_scheduling: SchedulingPolicy,
         monitor: RepositoryMonitor,
     ) -> Result<Self> {
         let event_tx = EventSender::new(EVENT_CHANNEL_CAPACITY);
@@ -174,6 +191,8 @@ impl Repository {
             event_tx,
             pool,
             block_request_mode,
+            cache_capacity,
+            block_scheduling,
             monitor,
         );
 
@@ -202,10 +221,12 @@ impl Repository {
             "Repository opened"
         );
 
+        let branch_shared = BranchShared::new(vault.block_tracker.clone());
+
         let shared = Arc::new(Shared {
             vault,
             credentials: BlockingRwLock::new(credentials),
-            branch_shared: BranchShared::new(),
+            branch_shared,
         });
 
         let worker_handle = spawn_worker(shared.clone());
@@ -680,7 +701,7 @@ impl Repository {
                 if old_entry
                     .open(DirectoryFallback::Disabled)
                     .await?
-                    .entries()
+                    .entries()?
                     .all(|entry| entry.is_tombstone())
                 {
                     old_entry.version_vector().clone()
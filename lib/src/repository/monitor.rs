@@ -48,6 +48,28 @@ pub(crate) struct RepositoryMonitor {
     pub response_queue_time: Histogram,
     // Time to handle a response.
     pub response_handle_time: Histogram,
+    // Time to handle a response, by the response type.
+    pub response_handle_times: ResponseHandleTimes,
+
+    // Total number of index node cache lookups that found the nodes in the cache.
+    pub index_cache_hits: Counter,
+    // Total number of index node cache lookups that had to load the nodes from the db.
+    pub index_cache_misses: Counter,
+    // Total number of block reads that found the decrypted block in the cache.
+    pub block_cache_hits: Counter,
+    // Total number of block reads that had to load and decrypt the block.
+    pub block_cache_misses: Counter,
+
+    // Time to read a block from the db.
+    pub block_read_time: Histogram,
+    // Time to commit a write transaction.
+    pub commit_time: Histogram,
+    // Time waiting for a read connection to the db.
+    pub db_acquire_time: Histogram,
+    // Time waiting for a write transaction to begin.
+    pub db_begin_write_time: Histogram,
+    // Time from marking a missing block as required until it's received.
+    pub block_wait_time: Histogram,
 
     pub scan_job: JobMonitor,
     pub merge_job: JobMonitor,
@@ -85,6 +107,18 @@ impl RepositoryMonitor {
         let response_queue_time = create_histogram(recorder, "response queue time", Unit::Seconds);
         let response_handle_time =
             create_histogram(recorder, "response handle time", Unit::Seconds);
+        let response_handle_times = ResponseHandleTimes::new(recorder);
+
+        let index_cache_hits = create_counter(recorder, "index cache hits", Unit::Count);
+        let index_cache_misses = create_counter(recorder, "index cache misses", Unit::Count);
+        let block_cache_hits = create_counter(recorder, "block cache hits", Unit::Count);
+        let block_cache_misses = create_counter(recorder, "block cache misses", Unit::Count);
+
+        let block_read_time = create_histogram(recorder, "block read time", Unit::Seconds);
+        let commit_time = create_histogram(recorder, "commit time", Unit::Seconds);
+        let db_acquire_time = create_histogram(recorder, "db acquire time", Unit::Seconds);
+        let db_begin_write_time = create_histogram(recorder, "db begin write time", Unit::Seconds);
+        let block_wait_time = create_histogram(recorder, "block wait time", Unit::Seconds);
 
         let scan_job = JobMonitor::new(&node, recorder, "scan");
         let merge_job = JobMonitor::new(&node, recorder, "merge");
@@ -108,6 +142,18 @@ impl RepositoryMonitor {
             responses_received,
             response_queue_time,
             response_handle_time,
+            response_handle_times,
+
+            index_cache_hits,
+            index_cache_misses,
+            block_cache_hits,
+            block_cache_misses,
+
+            block_read_time,
+            commit_time,
+            db_acquire_time,
+            db_begin_write_time,
+            block_wait_time,
 
             scan_job,
             merge_job,
@@ -132,6 +178,34 @@ impl RepositoryMonitor {
     }
 }
 
+pub(crate) struct ResponseHandleTimes {
+    pub root_node: Histogram,
+    pub inner_nodes: Histogram,
+    pub leaf_nodes: Histogram,
+    pub block_offer: Histogram,
+    pub block: Histogram,
+    pub error: Histogram,
+}
+
+impl ResponseHandleTimes {
+    fn new<R>(recorder: &R) -> Self
+    where
+        R: Recorder + ?Sized,
+    {
+        let create =
+            |name| create_histogram(recorder, format!("{name} handle time"), Unit::Seconds);
+
+        Self {
+            root_node: create("root node"),
+            inner_nodes: create("inner nodes"),
+            leaf_nodes: create("leaf nodes"),
+            block_offer: create("block offer"),
+            block: create("block"),
+            error: create("error response"),
+        }
+    }
+}
+
 pub(crate) struct JobMonitor {
     name: String,
     count_running_tx: watch::Sender<usize>,
@@ -1,6 +1,10 @@
 use super::RepositoryMonitor;
-use crate::{db, device_id::DeviceId, error::Result};
+use crate::{
+    block_tracker::SchedulingPolicy, db, device_id::DeviceId, error::Result,
+    storage_size::StorageSize, store::CacheCapacity,
+};
 use metrics::{NoopRecorder, Recorder};
+use metrics_ext::{Borrowed, Pair};
 use state_monitor::{metrics::MetricsRecorder, StateMonitor};
 use std::{
     borrow::Cow,
@@ -12,6 +16,9 @@ pub struct RepositoryParams<R> {
     device_id: DeviceId,
     parent_monitor: Option<StateMonitor>,
     recorder: Option<R>,
+    cache_capacity: CacheCapacity,
+    block_scheduling: SchedulingPolicy,
+    storage_profile: db::StorageProfile,
 }
 
 impl<R> RepositoryParams<R> {
@@ -32,12 +39,56 @@ impl<R> RepositoryParams<R> {
             device_id: self.device_id,
             parent_monitor: self.parent_monitor,
             recorder: Some(recorder),
+            cache_capacity: self.cache_capacity,
+            block_scheduling: self.block_scheduling,
+            storage_profile: self.storage_profile,
+        }
+    }
+
+    /// Sets the approximate maximum amount of memory used to cache the index nodes. Larger values
+    /// speed up syncing of large repositories at the cost of memory.
+    pub fn with_index_cache_capacity(self, index_cache_capacity: StorageSize) -> Self {
+        Self {
+            cache_capacity: CacheCapacity {
+                index: index_cache_capacity,
+                ..self.cache_capacity
+            },
+            ..self
+        }
+    }
+
+    /// Sets the approximate maximum amount of memory used to cache decrypted blocks. The cache is
+    /// shared by all open files of the repository and speeds up repeated reads of the same data.
+    pub fn with_block_cache_capacity(self, block_cache_capacity: StorageSize) -> Self {
+        Self {
+            cache_capacity: CacheCapacity {
+                block: block_cache_capacity,
+                ..self.cache_capacity
+            },
+            ..self
+        }
+    }
+
+    /// Sets the order in which the missing blocks are requested from the peers.
+    pub fn with_block_scheduling(self, block_scheduling: SchedulingPolicy) -> Self {
+        Self {
+            block_scheduling,
+            ..self
+        }
+    }
+
+    /// Sets the tuning of the database storage (connection pool size, caches, durability, WAL
+    /// checkpointing).
+    pub fn with_storage_profile(self, storage_profile: db::StorageProfile) -> Self {
+        Self {
+            storage_profile,
+            ..self
         }
     }
 
     pub(super) async fn create(&self) -> Result<db::Pool, db::Error> {
         match &self.store {
-            Store::Path(path) => db::create(path).await,
+            Store::Path(path) => db::create(path, &self.storage_profile).await,
             #[cfg(test)]
             Store::Pool { pool, .. } => Ok(pool.clone()),
         }
@@ -45,7 +96,7 @@ impl<R> RepositoryParams<R> {
 
     pub(super) async fn open(&self) -> Result<db::Pool, db::Error> {
         match &self.store {
-            Store::Path(path) => db::open(path).await,
+            Store::Path(path) => db::open(path, &self.storage_profile).await,
             #[cfg(test)]
             Store::Pool { pool, .. } => Ok(pool.clone()),
         }
@@ -54,6 +105,14 @@ impl<R> RepositoryParams<R> {
     pub(super) fn device_id(&self) -> DeviceId {
         self.device_id
     }
+
+    pub(super) fn cache_capacity(&self) -> CacheCapacity {
+        self.cache_capacity
+    }
+
+    pub(super) fn block_scheduling(&self) -> SchedulingPolicy {
+        self.block_scheduling
+    }
 }
 
 impl<R> RepositoryParams<R>
@@ -69,8 +128,12 @@ where
             StateMonitor::make_root()
         };
 
+        // The metrics always go to the state monitor and, if set, also to the recorder.
         if let Some(recorder) = &self.recorder {
-            RepositoryMonitor::new(monitor, recorder)
+            RepositoryMonitor::new(
+                monitor.clone(),
+                &Pair(MetricsRecorder::new(monitor), Borrowed(recorder)),
+            )
         } else {
             RepositoryMonitor::new(monitor.clone(), &MetricsRecorder::new(monitor))
         }
@@ -96,6 +159,9 @@ impl RepositoryParams<NoopRecorder> {
             device_id: rand::random(),
             parent_monitor: None,
             recorder: None,
+            cache_capacity: CacheCapacity::default(),
+            block_scheduling: SchedulingPolicy::default(),
+            storage_profile: db::StorageProfile::default(),
         }
     }
 }
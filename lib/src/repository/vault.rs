@@ -2,7 +2,7 @@
 
 use super::{quota, LocalId, Metadata, RepositoryId, RepositoryMonitor};
 use crate::{
-    block_tracker::{BlockPromise, BlockTracker, OfferState},
+    block_tracker::{BlockPromise, BlockTracker, OfferState, SchedulingPolicy},
     crypto::{sign::PublicKey, CacheHash},
     db,
     debug::DebugPrinter,
@@ -14,8 +14,8 @@ use crate::{
     },
     storage_size::StorageSize,
     store::{
-        self, InnerNodeReceiveStatus, LeafNodeReceiveStatus, ReceiveFilter, RootNodeReceiveStatus,
-        Store, WriteTransaction,
+        self, CacheCapacity, CacheMetrics, InnerNodeReceiveStatus, LeafNodeReceiveStatus,
+        ReceiveFilter, RootNodeReceiveStatus, Store, StoreMetrics, WriteTransaction,
     },
 };
 use futures_util::TryStreamExt;
@@ -40,15 +40,37 @@ impl Vault {
         event_tx: EventSender,
         pool: db::Pool,
         block_request_mode: BlockRequestMode,
+        cache_capacity: CacheCapacity,
+        block_scheduling: SchedulingPolicy,
         monitor: RepositoryMonitor,
     ) -> Self {
-        let store = Store::new(pool);
+        let store = Store::with_cache(
+            pool,
+            cache_capacity,
+            CacheMetrics {
+                hits: monitor.index_cache_hits.clone(),
+                misses: monitor.index_cache_misses.clone(),
+            },
+            CacheMetrics {
+                hits: monitor.block_cache_hits.clone(),
+                misses: monitor.block_cache_misses.clone(),
+            },
+            StoreMetrics {
+                block_read_time: monitor.block_read_time.clone(),
+                commit_time: monitor.commit_time.clone(),
+                acquire_time: monitor.db_acquire_time.clone(),
+                begin_write_time: monitor.db_begin_write_time.clone(),
+            },
+        );
 
         Self {
             repository_id,
             store,
             event_tx,
-            block_tracker: BlockTracker::new(),
+            block_tracker: BlockTracker::with_policy(
+                block_scheduling,
+                monitor.block_wait_time.clone(),
+            ),
             block_request_mode,
             local_id: LocalId::new(),
             monitor: Arc::new(monitor),
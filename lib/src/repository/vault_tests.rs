@@ -1,7 +1,7 @@
 use super::{vault::*, RepositoryId, RepositoryMonitor};
 use crate::{
     access_control::WriteSecrets,
-    block_tracker::OfferState,
+    block_tracker::{OfferState, SchedulingPolicy},
     collections::HashSet,
     crypto::{
         sign::{Keypair, PublicKey},
@@ -16,7 +16,7 @@ use crate::{
         Block, BlockContent, BlockId, Locator, MultiBlockPresence, NodeState, Proof,
         RootNodeFilter, SingleBlockPresence, EMPTY_INNER_HASH,
     },
-    store::{self, Changeset, ReadTransaction},
+    store::{self, CacheCapacity, Changeset, ReadTransaction},
     test_utils,
     version_vector::VersionVector,
 };
@@ -1085,6 +1085,109 @@ async fn block_ids_pagination() {
     assert!(actual.is_empty());
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn missing_block_ids() {
+    let (_base_dir, vault, secrets) = setup().await;
+    let receive_filter = vault.store().receive_filter();
+
+    let branch_id = PublicKey::random();
+    let snapshot = Snapshot::generate(&mut rand::thread_rng(), 3);
+
+    receive_nodes(
+        &vault,
+        &secrets.write_keys,
+        branch_id,
+        VersionVector::first(branch_id),
+        &receive_filter,
+        &snapshot,
+    )
+    .await;
+
+    let mut sorted_blocks: Vec<_> = snapshot.blocks().keys().copied().collect();
+    sorted_blocks.sort();
+
+    let mut page = vault.store().missing_block_ids(2);
+    assert_eq!(page.next().await.unwrap(), sorted_blocks[..2]);
+    assert_eq!(page.next().await.unwrap(), sorted_blocks[2..]);
+    assert!(page.next().await.unwrap().is_empty());
+
+    receive_blocks(&vault, &snapshot).await;
+
+    let actual = vault
+        .store()
+        .missing_block_ids(u32::MAX)
+        .next()
+        .await
+        .unwrap();
+    assert!(actual.is_empty());
+
+    // Removing a block makes it missing again.
+    let mut tx = vault.store().begin_write().await.unwrap();
+    tx.remove_block(&sorted_blocks[0]).await.unwrap();
+    tx.commit().await.unwrap();
+
+    let actual = vault
+        .store()
+        .missing_block_ids(u32::MAX)
+        .next()
+        .await
+        .unwrap();
+    assert_eq!(actual, sorted_blocks[..1]);
+}
+
+#[tokio::test(flavor = "multi_thread")]
+async fn missing_block_ids_excludes_blocks_from_incomplete_snapshots() {
+    let (_base_dir, vault, secrets) = setup().await;
+
+    let branch_id = PublicKey::random();
+
+    // Create snapshot with two leaf nodes but receive only one of them.
+    let snapshot = loop {
+        let snapshot = Snapshot::generate(&mut rand::thread_rng(), 2);
+        if snapshot.leaf_sets().count() > 1 {
+            break snapshot;
+        }
+    };
+
+    let receive_filter = vault.store().receive_filter();
+    let version_vector = VersionVector::first(branch_id);
+    let proof = Proof::new(
+        branch_id,
+        version_vector,
+        *snapshot.root_hash(),
+        &secrets.write_keys,
+    );
+
+    vault
+        .receive_root_node(proof.into(), MultiBlockPresence::None)
+        .await
+        .unwrap();
+
+    for layer in snapshot.inner_layers() {
+        for (_, nodes) in layer.inner_maps() {
+            vault
+                .receive_inner_nodes(nodes.clone().into(), &receive_filter, None)
+                .await
+                .unwrap();
+        }
+    }
+
+    for (_, nodes) in snapshot.leaf_sets().take(1) {
+        vault
+            .receive_leaf_nodes(nodes.clone().into(), None)
+            .await
+            .unwrap();
+    }
+
+    let actual = vault
+        .store()
+        .missing_block_ids(u32::MAX)
+        .next()
+        .await
+        .unwrap();
+    assert!(actual.is_empty());
+}
+
 #[proptest]
 fn sync_progress(
     #[strategy(1usize..16)] block_count: usize,
@@ -1175,6 +1278,8 @@ async fn setup_with_rng(rng: &mut StdRng) -> (TempDir, Vault, WriteSecrets) {
         EventSender::new(1),
         pool,
         BlockRequestMode::Lazy,
+        CacheCapacity::default(),
+        SchedulingPolicy::default(),
         RepositoryMonitor::new(StateMonitor::make_root(), &NoopRecorder),
     );
 
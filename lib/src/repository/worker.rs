@@ -1,4 +1,4 @@
-use self::utils::{unlock, Command, Counter};
+use self::utils::{unlock, Command};
 use super::Shared;
 use crate::{
     blob::{BlobId, BlockIds},
@@ -9,7 +9,6 @@ use crate::{
     joint_directory::{JointDirectory, JointEntryRef, MissingVersionStrategy},
     store, versioned,
 };
-use async_recursion::async_recursion;
 use futures_util::{stream, StreamExt};
 use std::{future, sync::Arc};
 use tokio::select;
@@ -21,7 +20,6 @@ use tokio::select;
 /// - find missing blocks
 pub(super) async fn run(shared: Arc<Shared>) {
     let event_scope = EventScope::new();
-    let prune_counter = Counter::new();
 
     let local_branch = shared
         .local_branch()
@@ -32,6 +30,7 @@ pub(super) async fn run(shared: Arc<Shared>) {
     // Maintain (merge, prune and trash)
     let maintain = async {
         let (unlock_tx, unlock_rx) = unlock::channel();
+        let trash_state = trash::State::default();
 
         // - Ignore events from the same scope to prevent infinite loop
         // - On `BranchChanged` interrupt and restart the current job to avoid unnecessary work on
@@ -70,7 +69,7 @@ pub(super) async fn run(shared: Arc<Shared>) {
         let commands = stream::select(events, unlocks);
 
         utils::run(
-            || maintain(&shared, local_branch.as_ref(), &unlock_tx, &prune_counter),
+            || maintain(&shared, local_branch.as_ref(), &unlock_tx, &trash_state),
             commands,
         )
         .await;
@@ -104,7 +103,7 @@ pub(super) async fn run(shared: Arc<Shared>) {
                 })
             });
 
-        utils::run(|| scan(&shared, &prune_counter), commands).await;
+        utils::run(|| scan(&shared), commands).await;
     };
 
     // Run them in parallel so missing blocks are found as soon as possible
@@ -118,7 +117,7 @@ async fn maintain(
     shared: &Shared,
     local_branch: Option<&Branch>,
     unlock_tx: &unlock::Sender,
-    prune_counter: &Counter,
+    trash_state: &trash::State,
 ) {
     let mut success = true;
 
@@ -138,7 +137,7 @@ async fn maintain(
         .vault
         .monitor
         .prune_job
-        .run(prune::run(shared, unlock_tx, prune_counter))
+        .run(prune::run(shared, unlock_tx))
         .await;
     success = success && job_success;
 
@@ -148,7 +147,7 @@ async fn maintain(
             .vault
             .monitor
             .trash_job
-            .run(trash::run(shared, local_branch, unlock_tx))
+            .run(trash::run(shared, local_branch, unlock_tx, trash_state))
             .await;
         success = success && job_success;
     }
@@ -158,150 +157,32 @@ async fn maintain(
     }
 }
 
-async fn scan(shared: &Shared, prune_counter: &Counter) {
+async fn scan(shared: &Shared) {
     // Find missing blocks
-    shared
-        .vault
-        .monitor
-        .scan_job
-        .run(scan::run(shared, prune_counter))
-        .await;
+    shared.vault.monitor.scan_job.run(scan::run(shared)).await;
 }
 
 /// Find missing blocks and mark them as required.
 mod scan {
     use super::*;
-    use tracing::instrument;
-
-    pub(super) async fn run(shared: &Shared, prune_counter: &Counter) -> Result<()> {
-        loop {
-            let prune_count_before = prune_counter.get();
-
-            match run_once(shared).await {
-                Ok(()) => return Ok(()),
-                // `BranchNotFound` and `LocatorNotFound` might be caused by a branch being pruned
-                // concurrently as it's being scanned. Check the prune counter to confirm the prune
-                // happened and if so, restart the scan.
-                Err(Error::Store(store::Error::BranchNotFound | store::Error::LocatorNotFound))
-                    if prune_counter.get() != prune_count_before =>
-                {
-                    continue
-                }
-                Err(error) => return Err(error),
-            }
-        }
-    }
-
-    async fn run_once(shared: &Shared) -> Result<()> {
-        let branches = shared.load_branches().await?;
-        let mut versions = Vec::with_capacity(branches.len());
-
-        for branch in branches {
-            let report_error = |error| {
-                tracing::trace!(branch_id = ?branch.id(), ?error, "Failed to open root directory");
-                error
-            };
-
-            match branch
-                .open_root(DirectoryLocking::Disabled, DirectoryFallback::Disabled)
-                .await
-                .map_err(report_error)
-            {
-                Ok(dir) => {
-                    versions.push(dir);
-                }
-                Err(Error::Store(store::Error::BlockNotFound)) => {
-                    require_missing_blocks(shared, &branch, BlobId::ROOT).await?;
-                }
-                Err(error) => return Err(error),
-            }
-        }
 
-        traverse(shared, JointDirectory::new(None, versions)).await
-    }
+    // Number of missing block ids loaded into memory at a time.
+    const PAGE_SIZE: u32 = 10_000;
 
-    #[async_recursion]
-    async fn traverse(shared: &Shared, dir: JointDirectory) -> Result<()> {
-        let mut subdirs = Vec::new();
-
-        for entry in dir.entries() {
-            match entry {
-                JointEntryRef::File(entry) => {
-                    require_missing_blocks(
-                        shared,
-                        entry.inner().branch(),
-                        *entry.inner().blob_id(),
-                    )
-                    .await?;
-                }
-                JointEntryRef::Directory(entry) => {
-                    for version in entry.versions() {
-                        require_missing_blocks(shared, version.branch(), *version.blob_id())
-                            .await?;
-                    }
+    // Instead of traversing the directory tree (which requires opening every blob), the missing
+    // blocks are read directly from the store's missing blocks index.
+    pub(super) async fn run(shared: &Shared) -> Result<()> {
+        let mut page = shared.vault.store().missing_block_ids(PAGE_SIZE);
 
-                    match entry
-                        .open_with(MissingVersionStrategy::Fail, DirectoryFallback::Disabled)
-                        .await
-                    {
-                        Ok(dir) => subdirs.push(dir),
-                        Err(error) => {
-                            // Continue processing the remaining entries
-                            tracing::trace!(
-                                entry = entry.name(),
-                                ?error,
-                                "Failed to open directory"
-                            );
-                        }
-                    }
-                }
+        loop {
+            let block_ids = page.next().await?;
+            if block_ids.is_empty() {
+                break;
             }
-        }
-
-        for dir in subdirs {
-            traverse(shared, dir).await?;
-        }
 
-        Ok(())
-    }
-
-    #[instrument(skip(shared, branch), fields(branch_id = ?branch.id()))]
-    async fn require_missing_blocks(
-        shared: &Shared,
-        branch: &Branch,
-        blob_id: BlobId,
-    ) -> Result<()> {
-        let mut blob_block_ids =
-            BlockIds::open(branch.clone(), blob_id)
-                .await
-                .map_err(|error| {
-                    tracing::trace!(?error, "open failed");
-                    error
-                })?;
-        let mut block_number = 0;
-        let mut file_progress_cache_reset = false;
-
-        while let Some(block_id) = blob_block_ids.try_next().await.map_err(|error| {
-            tracing::trace!(block_number, ?error, "try_next failed");
-            error
-        })? {
-            if !shared
-                .vault
-                .store()
-                .acquire_read()
-                .await?
-                .block_exists(&block_id)
-                .await?
-            {
+            for block_id in block_ids {
                 shared.vault.block_tracker.require(block_id);
-
-                if !file_progress_cache_reset {
-                    file_progress_cache_reset = true;
-                    branch.file_progress_cache().reset(&blob_id, block_number);
-                }
             }
-
-            block_number = block_number.saturating_add(1);
         }
 
         Ok(())
@@ -352,11 +233,10 @@ mod prune {
     use super::*;
     use futures_util::TryStreamExt;
 
-    pub(super) async fn run(
-        shared: &Shared,
-        unlock_tx: &unlock::Sender,
-        prune_counter: &Counter,
-    ) -> Result<()> {
+    // Max number of branches whose outdated snapshots are being removed at the same time.
+    const PRUNE_CONCURRENCY: usize = 4;
+
+    pub(super) async fn run(shared: &Shared, unlock_tx: &unlock::Sender) -> Result<()> {
         let all: Vec<_> = shared
             .vault
             .store()
@@ -395,8 +275,6 @@ mod prune {
                 }
             };
 
-            prune_counter.increment();
-
             let mut tx = shared.vault.store().begin_write().await?;
             tx.remove_branch(&node).await?;
             tx.commit().await?;
@@ -409,75 +287,147 @@ mod prune {
             );
         }
 
-        // Remove outdated snapshots.
-        for node in uptodate {
-            shared
-                .vault
-                .store()
-                .remove_outdated_snapshots(&node)
-                .await?;
-        }
+        // Remove outdated snapshots. The branches are independent of each other so process them
+        // concurrently. Only the writes get serialized.
+        stream::iter(uptodate)
+            .map(|node| async move { shared.vault.store().remove_outdated_snapshots(&node).await })
+            .buffer_unordered(PRUNE_CONCURRENCY)
+            .try_collect::<()>()
+            .await?;
 
         Ok(())
     }
 }
 
 /// Remove unreachable blocks
+///
+/// This is a mark-and-sweep collector: Each run starts a new GC epoch, collects the reachable
+/// blocks into a compact approximate set (see `ReachableBlocks`) with a read-only traversal and
+/// then removes the blocks that were written before the epoch and are not in the set, in small
+/// batches.
+///
+/// NOTE: The traversal still visits the whole directory tree of every branch, so a run costs a
+/// read of the whole repository. The marking is not incremental: which blobs are reachable depends
+/// on the content of the directories, which the index changes don't tell us.
 mod trash {
     use super::*;
     use crate::{
         crypto::sign::PublicKey,
-        protocol::{BlockId, Bump},
-        store::{Changeset, ReadTransaction, WriteTransaction},
+        protocol::{BlockId, Bump, SnapshotId},
+        store::{Changeset, ReachableBlocks, ReadTransaction, WriteTransaction},
     };
+    use deadlock::BlockingMutex;
     use futures_util::TryStreamExt;
-    use std::{
-        collections::{BTreeSet, VecDeque},
-        iter,
-    };
+    use std::{collections::VecDeque, iter, time::Duration};
+    use tokio::time;
+
+    // Number of collection candidates loaded into memory at a time.
+    const SWEEP_PAGE_SIZE: u32 = 1024;
+
+    // Pause after each write transaction so the sync (which needs write transactions as well)
+    // is not starved while a large repository is being collected.
+    const BATCH_PAUSE: Duration = Duration::from_millis(10);
+
+    /// Snapshots of the branches as of the last run that completed without skipping anything.
+    /// If they haven't changed and no blocks have been written since then, no new blocks could
+    /// have become unreachable and the run can be skipped.
+    #[derive(Default)]
+    pub(super) struct State {
+        collected: BlockingMutex<Option<Vec<SnapshotId>>>,
+    }
 
     pub(super) async fn run(
         shared: &Shared,
         local_branch: Option<&Branch>,
         unlock_tx: &unlock::Sender,
+        state: &State,
     ) -> Result<()> {
-        // Perform the scan in multiple passes, to avoid loading too many block ids into memory.
-        const UNREACHABLE_BLOCKS_PAGE_SIZE: u32 = 1_000_000;
+        let snapshots = load_snapshots(shared).await?;
+
+        if state.collected.lock().unwrap().as_ref() == Some(&snapshots)
+            && !shared
+                .vault
+                .store()
+                .acquire_read()
+                .await?
+                .has_blocks_written_since_gc_epoch()
+                .await?
+        {
+            return Ok(());
+        }
 
-        let mut unreachable_block_ids_page =
-            shared.vault.store().block_ids(UNREACHABLE_BLOCKS_PAGE_SIZE);
+        let epoch = {
+            let mut tx = shared.vault.store().begin_write().await?;
+            let epoch = tx.begin_gc_epoch().await?;
+            tx.commit().await?;
+            epoch
+        };
 
-        loop {
-            let mut unreachable_block_ids = unreachable_block_ids_page.next().await?;
-            if unreachable_block_ids.is_empty() {
-                break;
-            }
+        let mut reachable = ReachableBlocks::new(
+            shared
+                .vault
+                .store()
+                .acquire_read()
+                .await?
+                .count_block_ids()
+                .await?,
+        );
+
+        traverse_root_in_all_branches(shared, local_branch, &mut reachable).await?;
+
+        // If `merge` started but didn't complete (e.g., due to missing blocks), some of the
+        // entries in the local branch might be outdated. We can't garbage collect their
+        // blocks yet because they might still be needed in future `merge` (e.g., when those
+        // missing blocks become available). Thus we traverse the local root again to mark
+        // all blocks that are reachable from it even if they belong to outdated entries.
+        // When future `merge` completes, any such blocks will become unreachable and will be
+        // collected during a subsequent `trash`.
+        if let Some(local_branch) = local_branch {
+            traverse_root_in_local_branch(local_branch, &mut reachable).await?;
+        }
 
-            exclude_locked_blocks(shared, &mut unreachable_block_ids, unlock_tx).await?;
+        let locked = mark_locked_blocks(shared, &mut reachable, unlock_tx).await?;
 
-            traverse_root_in_all_branches(shared, local_branch, &mut unreachable_block_ids).await?;
+        // Blocks of the snapshots that are still being downloaded are not reachable from the
+        // traversed branches yet but they will be once the snapshots get approved.
+        shared
+            .vault
+            .store()
+            .acquire_read()
+            .await?
+            .load_unapproved_blocks(&mut reachable)
+            .await?;
 
-            // If `merge` started but didn't complete (e.g., due to missing blocks), some of the
-            // entries in the local branch might be outdated. We can't garbage collect their
-            // blocks yet because they might still be needed in future `merge` (e.g., when those
-            // missing blocks become available). Thus we traverse the local root again to exclude
-            // all blocks that are reachable from it even if they belong to outdated entries.
-            // When future `merge` completes, any such blocks will become unreachable and will be
-            // collected during a subsequent `trash`.
-            if let Some(local_branch) = local_branch {
-                traverse_root_in_local_branch(local_branch, &mut unreachable_block_ids).await?;
-            }
+        uncollect_reachable_blocks(shared, &reachable).await?;
+        remove_unreachable_blocks(shared, local_branch, epoch, &reachable).await?;
 
-            remove_unreachable_blocks(shared, local_branch, unreachable_block_ids).await?;
-        }
+        // Blocks of the locked blobs were spared in this run and might need to be collected
+        // once they are unlocked.
+        *state.collected.lock().unwrap() = (!locked).then_some(snapshots);
 
         Ok(())
     }
 
+    async fn load_snapshots(shared: &Shared) -> Result<Vec<SnapshotId>> {
+        let mut snapshots: Vec<_> = shared
+            .vault
+            .store()
+            .acquire_read()
+            .await?
+            .load_root_nodes()
+            .map_ok(|node| node.snapshot_id)
+            .try_collect()
+            .await?;
+
+        snapshots.sort();
+
+        Ok(snapshots)
+    }
+
     async fn traverse_root_in_all_branches(
         shared: &Shared,
         local_branch: Option<&Branch>,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        reachable: &mut ReachableBlocks,
     ) -> Result<()> {
         let local_branch_id = local_branch.map(Branch::id);
         let branches = shared.load_branches().await?;
@@ -487,8 +437,7 @@ mod trash {
             // Local blocks are be processed in `traverse_root_in_local_branch`, avoid processing
             // them twice.
             if Some(branch.id()) != local_branch_id {
-                exclude_reachable_blocks(branch.clone(), BlobId::ROOT, unreachable_block_ids)
-                    .await?;
+                mark_reachable_blocks(branch.clone(), BlobId::ROOT, reachable).await?;
             }
 
             // TODO: enable fallback so fallback blocks are not collected
@@ -500,27 +449,27 @@ mod trash {
 
         let dir = JointDirectory::new(local_branch.cloned(), versions);
 
-        traverse(dir, local_branch_id, unreachable_block_ids).await
+        traverse(dir, local_branch_id, reachable).await
     }
 
     async fn traverse_root_in_local_branch(
         local_branch: &Branch,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        reachable: &mut ReachableBlocks,
     ) -> Result<()> {
-        exclude_reachable_blocks(local_branch.clone(), BlobId::ROOT, unreachable_block_ids).await?;
+        mark_reachable_blocks(local_branch.clone(), BlobId::ROOT, reachable).await?;
 
         let dir = local_branch
             .open_root(DirectoryLocking::Disabled, DirectoryFallback::Disabled)
             .await?;
         let dir = JointDirectory::new(Some(local_branch.clone()), iter::once(dir));
 
-        traverse(dir, None, unreachable_block_ids).await
+        traverse(dir, None, reachable).await
     }
 
     async fn traverse(
         dir: JointDirectory,
         skip_branch_id: Option<&PublicKey>,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        reachable: &mut ReachableBlocks,
     ) -> Result<()> {
         let mut queue: VecDeque<_> = iter::once(dir).collect();
 
@@ -532,10 +481,10 @@ mod trash {
                             continue;
                         }
 
-                        exclude_reachable_blocks(
+                        mark_reachable_blocks(
                             entry.inner().branch().clone(),
                             *entry.inner().blob_id(),
-                            unreachable_block_ids,
+                            reachable,
                         )
                         .await?;
                     }
@@ -545,10 +494,10 @@ mod trash {
                                 continue;
                             }
 
-                            exclude_reachable_blocks(
+                            mark_reachable_blocks(
                                 version.branch().clone(),
                                 *version.blob_id(),
-                                unreachable_block_ids,
+                                reachable,
                             )
                             .await?;
                         }
@@ -565,26 +514,26 @@ mod trash {
         Ok(())
     }
 
-    async fn exclude_reachable_blocks(
+    async fn mark_reachable_blocks(
         branch: Branch,
         blob_id: BlobId,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        reachable: &mut ReachableBlocks,
     ) -> Result<()> {
         let mut blob_block_ids = BlockIds::open(branch, blob_id).await?;
 
         while let Some(block_id) = blob_block_ids.try_next().await? {
-            unreachable_block_ids.remove(&block_id);
+            reachable.insert(&block_id);
         }
 
         Ok(())
     }
 
-    /// Exclude blocks of locked blobs from the `unreachable_block_ids` set.
-    async fn exclude_locked_blocks(
+    /// Mark blocks of locked blobs as reachable. Returns whether there were any locked blobs.
+    async fn mark_locked_blocks(
         shared: &Shared,
-        unreachable_block_ids: &mut BTreeSet<BlockId>,
+        reachable: &mut ReachableBlocks,
         unlock_tx: &unlock::Sender,
-    ) -> Result<()> {
+    ) -> Result<bool> {
         // This can sometimes include pruned branches. It happens when a branch is first loaded,
         // then pruned, then in an attempt to open the root directory, it's read lock is acquired
         // but before the open fails and the lock is dropped, we already return the lock here.
@@ -592,7 +541,7 @@ mod trash {
         // but we ignore it because it's harmless.
         let locks = shared.branch_shared.locker.all();
         if locks.is_empty() {
-            return Ok(());
+            return Ok(false);
         }
 
         for (branch_id, locks) in locks {
@@ -610,18 +559,52 @@ mod trash {
                 unlock_tx.send(notify).await;
 
                 while let Some(block_id) = blob_block_ids.try_next().await? {
-                    unreachable_block_ids.remove(&block_id);
+                    reachable.insert(&block_id);
                 }
             }
         }
 
+        Ok(true)
+    }
+
+    /// Makes the blocks that were collected before but are reachable now requestable again, a
+    /// page at a time.
+    ///
+    /// NOTE: a false positive of `reachable` makes an unreachable block requestable too. It then
+    /// gets downloaded and collected again, which is a waste but harmless.
+    async fn uncollect_reachable_blocks(
+        shared: &Shared,
+        reachable: &ReachableBlocks,
+    ) -> Result<()> {
+        let mut page = shared.vault.store().collected_block_ids(SWEEP_PAGE_SIZE);
+
+        loop {
+            let mut block_ids = page.next().await?;
+            if block_ids.is_empty() {
+                break;
+            }
+
+            block_ids.retain(|block_id| reachable.contains(block_id));
+
+            if block_ids.is_empty() {
+                continue;
+            }
+
+            let mut tx = shared.vault.store().begin_write().await?;
+            tx.uncollect_blocks(&block_ids).await?;
+            tx.commit().await?;
+
+            time::sleep(BATCH_PAUSE).await;
+        }
+
         Ok(())
     }
 
     async fn remove_unreachable_blocks(
         shared: &Shared,
         local_branch: Option<&Branch>,
-        unreachable_block_ids: BTreeSet<BlockId>,
+        epoch: u64,
+        reachable: &ReachableBlocks,
     ) -> Result<()> {
         // We need to delete the blocks and also mark them as missing (so they can be requested in
         // case they become needed again) in their corresponding leaf nodes and then update the
@@ -629,8 +612,10 @@ mod trash {
         // expensive operation which is why we do it a few blocks at a time.
         const BATCH_SIZE: usize = 32;
 
-        let mut unreachable_block_ids = unreachable_block_ids.into_iter();
-        let mut batch = Vec::with_capacity(BATCH_SIZE);
+        let mut page = shared
+            .vault
+            .store()
+            .eligible_block_ids(epoch, SWEEP_PAGE_SIZE);
         let mut total_count = 0;
 
         let local_branch_and_write_keys = local_branch
@@ -638,38 +623,42 @@ mod trash {
             .and_then(|branch| branch.keys().write().map(|keys| (branch, keys)));
 
         loop {
-            batch.clear();
-            batch.extend(unreachable_block_ids.by_ref().take(BATCH_SIZE));
-
-            if batch.is_empty() {
+            let mut block_ids = page.next().await?;
+            if block_ids.is_empty() {
                 break;
             }
 
-            let mut tx = shared.vault.store().begin_write().await?;
+            block_ids.retain(|block_id| !reachable.contains(block_id));
 
-            total_count += batch.len();
+            for batch in block_ids.chunks(BATCH_SIZE) {
+                let mut tx = shared.vault.store().begin_write().await?;
 
-            if let Some((local_branch, write_keys)) = &local_branch_and_write_keys {
-                let mut changeset = Changeset::new();
-                remove_local_nodes(&mut tx, &mut changeset, &batch).await?;
-                changeset.bump(Bump::increment(*local_branch.id()));
-                changeset
-                    .apply(&mut tx, local_branch.id(), write_keys)
-                    .await?;
-            }
+                total_count += batch.len();
 
-            remove_blocks(&mut tx, &batch).await?;
+                if let Some((local_branch, write_keys)) = &local_branch_and_write_keys {
+                    let mut changeset = Changeset::new();
+                    remove_local_nodes(&mut tx, &mut changeset, batch).await?;
+                    changeset.bump(Bump::increment(*local_branch.id()));
+                    changeset
+                        .apply(&mut tx, local_branch.id(), write_keys)
+                        .await?;
+                }
 
-            if let Some((branch, _)) = local_branch_and_write_keys {
-                // If we modified the local branch (by removing nodes from it), we need to notify,
-                // to let other replicas know about the change. Using `commit_and_then` to handle
-                // possible cancellation.
-                let event_tx = branch.notify();
-                tx.commit_and_then(move || event_tx.send()).await?
-            } else {
-                // Using regular `commit` here because if there is nothing to notify then we don't
-                // care about cancellation.
-                tx.commit().await?;
+                remove_blocks(&mut tx, batch).await?;
+
+                if let Some((branch, _)) = local_branch_and_write_keys {
+                    // If we modified the local branch (by removing nodes from it), we need to
+                    // notify, to let other replicas know about the change. Using
+                    // `commit_and_then` to handle possible cancellation.
+                    let event_tx = branch.notify();
+                    tx.commit_and_then(move || event_tx.send()).await?
+                } else {
+                    // Using regular `commit` here because if there is nothing to notify then we
+                    // don't care about cancellation.
+                    tx.commit().await?;
+                }
+
+                time::sleep(BATCH_PAUSE).await;
             }
         }
 
@@ -698,7 +687,7 @@ mod trash {
 
     async fn remove_blocks(tx: &mut WriteTransaction, block_ids: &[BlockId]) -> Result<()> {
         for block_id in block_ids {
-            tx.remove_block(block_id).await?;
+            tx.remove_unreachable_block(block_id).await?;
             tracing::trace!(?block_id, "unreachable block removed");
         }
 
@@ -708,11 +697,7 @@ mod trash {
 
 mod utils {
     use futures_util::{Stream, StreamExt};
-    use std::{
-        future::Future,
-        pin::pin,
-        sync::atomic::{AtomicU64, Ordering},
-    };
+    use std::{future::Future, pin::pin};
     use tokio::select;
 
     /// Control how the next job should run
@@ -829,21 +814,4 @@ mod utils {
             )
         }
     }
-
-    #[derive(Default)]
-    pub(super) struct Counter(AtomicU64);
-
-    impl Counter {
-        pub fn new() -> Self {
-            Self::default()
-        }
-
-        pub fn get(&self) -> u64 {
-            self.0.load(Ordering::Relaxed)
-        }
-
-        pub fn increment(&self) {
-            self.0.fetch_add(1, Ordering::Relaxed);
-        }
-    }
 }
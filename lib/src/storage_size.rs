@@ -10,7 +10,7 @@ pub struct StorageSize {
 }
 
 impl StorageSize {
-    pub fn from_bytes(value: u64) -> Self {
+    pub const fn from_bytes(value: u64) -> Self {
         Self { bytes: value }
     }
 
@@ -9,7 +9,7 @@ use crate::{
     protocol::{Block, BlockContent, BlockId, BlockNonce, BLOCK_SIZE},
 };
 use futures_util::TryStreamExt;
-use sqlx::Row;
+use sqlx::{QueryBuilder, Row};
 
 /// Write a block received from a remote replica.
 pub(super) async fn receive(
@@ -103,6 +103,42 @@ pub(super) async fn write(tx: &mut db::WriteTransaction, block: &Block) -> Resul
     Ok(())
 }
 
+/// Writes multiple blocks into the store using multi-row inserts. Blocks that already exist are
+/// skipped.
+///
+/// # Panics
+///
+/// Panics if the length of any of the blocks is not equal to [`BLOCK_SIZE`].
+pub(super) async fn write_all(
+    tx: &mut db::WriteTransaction,
+    blocks: &[Block],
+) -> Result<(), Error> {
+    // Limit the batch size by the total size of the bound content, not just by the number of
+    // variables, to avoid building huge statements.
+    const BATCH_SIZE: usize = 32;
+
+    for batch in blocks.chunks(BATCH_SIZE) {
+        let mut builder = QueryBuilder::new("INSERT INTO blocks (id, nonce, content) ");
+
+        builder.push_values(batch, |mut row, block| {
+            assert_eq!(
+                block.content.len(),
+                BLOCK_SIZE,
+                "incorrect buffer length for block write"
+            );
+
+            row.push_bind(&block.id)
+                .push_bind(&block.nonce[..])
+                .push_bind(&block.content[..]);
+        });
+
+        builder.push(" ON CONFLICT (id) DO NOTHING");
+        builder.build().execute(&mut *tx).await?;
+    }
+
+    Ok(())
+}
+
 pub(super) async fn remove(tx: &mut db::WriteTransaction, id: &BlockId) -> Result<(), Error> {
     sqlx::query("DELETE FROM blocks WHERE id = ?")
         .bind(id)
@@ -181,6 +217,30 @@ mod tests {
         write(&mut tx, &block).await.unwrap();
     }
 
+    #[tokio::test(flavor = "multi_thread")]
+    async fn write_all_and_read_blocks() {
+        let (_base_dir, pool) = setup().await;
+
+        // More than one batch, including a duplicate and an already existing block.
+        let mut blocks: Vec<Block> = (0..40).map(|_| rand::random()).collect();
+        blocks.push(blocks[0].clone());
+
+        let mut tx = pool.begin_write().await.unwrap();
+
+        write(&mut tx, &blocks[1]).await.unwrap();
+        write_all(&mut tx, &blocks).await.unwrap();
+
+        assert_eq!(count(&mut tx).await.unwrap(), 40);
+
+        for block in &blocks {
+            let mut content = BlockContent::new();
+            let nonce = read(&mut tx, &block.id, &mut content).await.unwrap();
+
+            assert_eq!(nonce, block.nonce);
+            assert_eq!(&content[..], &block.content[..]);
+        }
+    }
+
     async fn setup() -> (TempDir, db::Pool) {
         db::create_temp().await.unwrap()
     }
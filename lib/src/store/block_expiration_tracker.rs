@@ -1,6 +1,6 @@
 use super::{
     block,
-    cache::{Cache, CacheTransaction},
+    cache::{BlockCache, Cache, CacheTransaction},
     error::Error,
     index::{self, UpdateSummaryReason},
     leaf_node, root_node,
@@ -19,6 +19,7 @@ use futures_util::{StreamExt, TryStreamExt};
 use scoped_task::{self, ScopedJoinHandle};
 use sqlx::Row;
 use std::{
+    cmp,
     collections::{btree_map, BTreeMap},
     sync::Arc,
     time::{Duration, SystemTime},
@@ -53,6 +54,13 @@ use tracing::{Instrument, Span};
 ///
 /// The second case is enforced by requiring db::CommitId when invoking the "remove" operation to
 /// ensure the block has already been successfully removed from the DB.
+///
+/// The blocks are not ordered by their exact time of last use but grouped into coarse buckets
+/// (a timing wheel) which then expire as a whole, in a single db transaction. Using a block only
+/// updates its time stamp, the block is moved to the bucket matching it lazily, once its original
+/// bucket expires. Because all blocks have the same expiration time, a single level of buckets
+/// is sufficient. The bucket width is a fixed fraction of the expiration time, so changing the
+/// expiration time rebuilds the buckets.
 pub(crate) struct BlockExpirationTracker {
     shared: Arc<BlockingMutex<Shared>>,
     watch_tx: uninitialized_watch::Sender<()>,
@@ -67,12 +75,9 @@ impl BlockExpirationTracker {
         block_download_tracker: BlockDownloadTracker,
         client_reload_index_tx: broadcast_hash_set::Sender<PublicKey>,
         cache: Arc<Cache>,
+        block_cache: Arc<BlockCache>,
     ) -> Result<Self, Error> {
-        let mut shared = Shared {
-            blocks_by_id: Default::default(),
-            blocks_by_expiration: Default::default(),
-            to_missing_if_expired: Default::default(),
-        };
+        let mut shared = Shared::new(bucket_duration(expiration_time));
 
         let mut tx = pool.begin_read().await?;
 
@@ -106,6 +111,7 @@ impl BlockExpirationTracker {
                     block_download_tracker,
                     client_reload_index_tx,
                     cache,
+                    block_cache,
                 )
                 .await
                 {
@@ -151,7 +157,7 @@ impl BlockExpirationTracker {
 
     #[cfg(test)]
     pub fn has_block(&self, block: &BlockId) -> bool {
-        self.shared.lock().unwrap().blocks_by_id.contains_key(block)
+        self.shared.lock().unwrap().blocks.contains_key(block)
     }
 }
 
@@ -185,101 +191,188 @@ impl UntrackTransaction {
     }
 }
 
-// For semantics
-type TimeUpdated = SystemTime;
+// Number of buckets covering the expiration time
+const BUCKETS_PER_EXPIRATION: u32 = 16;
+const MIN_BUCKET_DURATION: Duration = Duration::from_millis(10);
+
+fn bucket_duration(expiration_time: Duration) -> Duration {
+    cmp::max(
+        expiration_time / BUCKETS_PER_EXPIRATION,
+        MIN_BUCKET_DURATION,
+    )
+}
+
+// Index of a bucket (time since the unix epoch divided by the bucket duration)
+type Tick = u64;
+
+struct Entry {
+    // Bucket the block is currently in.
+    bucket: Tick,
+    // Bucket corresponding to the last time the block was updated.
+    touched: Tick,
+}
 
 struct Shared {
-    // Invariant #1: There exists `(block, time_updated)` in `blocks_by_id` *iff*
-    // there exists `block` in `blocks_by_expiration[time_updated]`.
+    // Time period covered by a single bucket. Derived from the expiration time (see
+    // `bucket_duration`) and updated with it.
+    bucket_duration: Duration,
+
+    // Invariant #1: There exists `(block, entry)` in `blocks` *iff* there exists `block` in
+    // `buckets[entry.bucket]`.
+    //
+    // Invariant #2: `entry.bucket <= entry.touched` for every `entry` in `blocks`.
     //
-    // Invariant #2: `blocks_by_expiration[x]` is never empty for any `x`.
+    // Invariant #3: `buckets[x]` is never empty for any `x`.
     //
-    blocks_by_id: HashMap<BlockId, TimeUpdated>,
-    blocks_by_expiration: BTreeMap<TimeUpdated, HashSet<BlockId>>,
+    blocks: HashMap<BlockId, Entry>,
+    buckets: BTreeMap<Tick, HashSet<BlockId>>,
 
     to_missing_if_expired: HashSet<BlockId>,
 }
 
 impl Shared {
-    /// Add the `block` into `Self`. If it's already there, remove it and add it back with the new
-    /// time stamp.
-    fn insert_block(&mut self, block: &BlockId, ts: TimeUpdated) {
-        // Asserts and unwraps are OK due to the `Shared` invariants defined above.
-        match self.blocks_by_id.entry(*block) {
+    fn new(bucket_duration: Duration) -> Self {
+        Self {
+            bucket_duration,
+            blocks: Default::default(),
+            buckets: Default::default(),
+            to_missing_if_expired: Default::default(),
+        }
+    }
+
+    /// Add the `block` into `Self`. If it's already there, update its time stamp. The block is
+    /// moved to the corresponding bucket only once its current bucket expires.
+    fn insert_block(&mut self, block: &BlockId, ts: SystemTime) {
+        let tick = self.tick(ts);
+
+        match self.blocks.entry(*block) {
             hash_map::Entry::Occupied(mut entry) => {
-                let old_ts = *entry.get();
-                if old_ts == ts {
-                    return;
-                }
+                let entry = entry.get_mut();
+                entry.touched = cmp::max(entry.touched, tick);
+            }
+            hash_map::Entry::Vacant(entry) => {
+                // Assert OK due to the invariant #1.
+                assert!(self.buckets.entry(tick).or_default().insert(*block));
 
-                entry.insert(ts);
+                entry.insert(Entry {
+                    bucket: tick,
+                    touched: tick,
+                });
+            }
+        }
+    }
 
-                let mut entry = match self.blocks_by_expiration.entry(old_ts) {
-                    btree_map::Entry::Occupied(entry) => entry,
-                    btree_map::Entry::Vacant(_) => unreachable!(),
-                };
+    /// Changes the bucket duration and redistributes the blocks into the new buckets according to
+    /// their last update. The exact update time is not known, only its old bucket, so the end of
+    /// that bucket is used. This can delay the expiration of a block by at most one old bucket
+    /// width, but never makes it expire early.
+    fn set_bucket_duration(&mut self, bucket_duration: Duration) {
+        if bucket_duration == self.bucket_duration {
+            return;
+        }
 
-                assert!(entry.get_mut().remove(block));
+        let old_nanos = self.nanos();
+        self.bucket_duration = bucket_duration;
+        let new_nanos = self.nanos();
+        self.buckets.clear();
 
-                if entry.get().is_empty() {
-                    entry.remove();
-                }
+        for (block, entry) in &mut self.blocks {
+            let touched = ((entry.touched + 1) * old_nanos - 1) / new_nanos;
 
-                assert!(self
-                    .blocks_by_expiration
-                    .entry(ts)
-                    .or_default()
-                    .insert(*block));
-            }
-            hash_map::Entry::Vacant(entry) => {
-                assert!(self
-                    .blocks_by_expiration
-                    .entry(ts)
-                    .or_default()
-                    .insert(*block));
+            entry.bucket = touched;
+            entry.touched = touched;
 
-                entry.insert(ts);
-            }
+            self.buckets.entry(touched).or_default().insert(*block);
         }
     }
 
     fn remove_block(&mut self, block: &BlockId) {
         // Asserts and unwraps are OK due to the `Shared` invariants defined above.
-        let Some(time_updated) = self.blocks_by_id.remove(block) else {
+        let Some(entry) = self.blocks.remove(block) else {
             return;
         };
 
-        let mut entry = match self.blocks_by_expiration.entry(time_updated) {
-            btree_map::Entry::Occupied(entry) => entry,
+        let mut bucket = match self.buckets.entry(entry.bucket) {
+            btree_map::Entry::Occupied(bucket) => bucket,
             btree_map::Entry::Vacant(_) => unreachable!(),
         };
 
-        assert!(entry.get_mut().remove(block));
+        assert!(bucket.get_mut().remove(block));
+
+        if bucket.get().is_empty() {
+            bucket.remove();
+        }
+    }
+
+    /// Returns the oldest bucket and the time it expires at (given the expiration time).
+    fn oldest_bucket(&self, expiration_time: Duration) -> Option<(Tick, SystemTime)> {
+        let tick = *self.buckets.keys().next()?;
+        let end = SystemTime::UNIX_EPOCH + Duration::from_nanos((tick + 1) * self.nanos());
+
+        Some((tick, end + expiration_time))
+    }
+
+    /// Moves the blocks from the given bucket that have been updated since they were put into it
+    /// to their current buckets and returns the remaining ones. Those remain tracked until
+    /// removed with `remove_block`.
+    fn take_expired(&mut self, tick: Tick) -> Vec<BlockId> {
+        let Some(blocks) = self.buckets.remove(&tick) else {
+            return Vec::new();
+        };
+
+        let mut expired = Vec::new();
+
+        for block in blocks {
+            // Unwrap OK due to the invariant #1.
+            let entry = self.blocks.get_mut(&block).unwrap();
 
-        if entry.get().is_empty() {
-            entry.remove();
+            if entry.touched > tick {
+                entry.bucket = entry.touched;
+                self.buckets.entry(entry.touched).or_default().insert(block);
+            } else {
+                expired.push(block);
+            }
+        }
+
+        if !expired.is_empty() {
+            self.buckets.insert(tick, expired.iter().copied().collect());
         }
+
+        expired
+    }
+
+    fn tick(&self, ts: SystemTime) -> Tick {
+        let since_epoch = ts
+            .duration_since(SystemTime::UNIX_EPOCH)
+            .unwrap_or_default();
+
+        (since_epoch.as_nanos() / self.nanos() as u128) as Tick
+    }
+
+    fn nanos(&self) -> u64 {
+        self.bucket_duration.as_nanos() as u64
     }
 
     #[cfg(test)]
     fn assert_invariants(&self) {
         // #1 =>
-        for (block, ts) in self.blocks_by_id.iter() {
-            assert!(self.blocks_by_expiration.get(ts).unwrap().contains(block));
+        for (block, entry) in self.blocks.iter() {
+            assert!(self.buckets.get(&entry.bucket).unwrap().contains(block));
         }
         // #1 <=
-        for (ts, blocks) in self.blocks_by_expiration.iter() {
+        for (tick, blocks) in self.buckets.iter() {
             for block in blocks.iter() {
-                assert_eq!(self.blocks_by_id.get(block).unwrap(), ts);
+                assert_eq!(self.blocks.get(block).unwrap().bucket, *tick);
             }
         }
-        // Degenerate case
-        assert_eq!(
-            self.blocks_by_id.is_empty(),
-            self.blocks_by_expiration.is_empty()
-        );
         // #2
-        for blocks in self.blocks_by_expiration.values() {
+        for entry in self.blocks.values() {
+            assert!(entry.bucket <= entry.touched);
+        }
+        // Degenerate case
+        assert_eq!(self.blocks.is_empty(), self.buckets.is_empty());
+        // #3
+        for blocks in self.buckets.values() {
             assert!(!blocks.is_empty());
         }
     }
@@ -293,95 +386,113 @@ async fn run_task(
     block_download_tracker: BlockDownloadTracker,
     client_reload_index_tx: broadcast_hash_set::Sender<PublicKey>,
     cache: Arc<Cache>,
+    block_cache: Arc<BlockCache>,
 ) -> Result<(), Error> {
     loop {
         let expiration_time = *expiration_time_rx.borrow();
 
-        let (ts, block_id) = {
-            enum Enum {
-                OldestEntry(Option<(TimeUpdated, BlockId)>),
-                ToMissing(HashSet<BlockId>),
+        enum Action {
+            OldestBucket(Option<(Tick, SystemTime)>),
+            ToMissing(HashSet<BlockId>),
+        }
+
+        let action = {
+            let mut lock = shared.lock().unwrap();
+
+            lock.set_bucket_duration(bucket_duration(expiration_time));
+
+            if !lock.to_missing_if_expired.is_empty() {
+                Action::ToMissing(std::mem::take(&mut lock.to_missing_if_expired))
+            } else {
+                Action::OldestBucket(lock.oldest_bucket(expiration_time))
             }
+        };
 
-            let action = {
-                let mut lock = shared.lock().unwrap();
-
-                if !lock.to_missing_if_expired.is_empty() {
-                    Enum::ToMissing(std::mem::take(&mut lock.to_missing_if_expired))
-                } else {
-                    Enum::OldestEntry(
-                        lock.blocks_by_expiration
-                            .first_entry()
-                            // Unwrap OK due to the invariant #2.
-                            .map(|e| (*e.key(), *e.get().iter().next().unwrap())),
-                    )
-                }
-            };
+        let tick = match action {
+            Action::OldestBucket(Some((tick, expires_at))) => {
+                let now = SystemTime::now();
 
-            match action {
-                Enum::OldestEntry(Some((time_updated, block_id))) => (time_updated, block_id),
-                Enum::OldestEntry(None) => {
-                    if watch_rx.changed().await.is_err() {
-                        return Ok(());
+                if expires_at > now {
+                    // Unwrap OK because we just checked `expires_at` is in the future.
+                    let duration = expires_at.duration_since(now).unwrap();
+
+                    select! {
+                        _ = sleep(duration) => (),
+                        _ = expiration_time_rx.changed() => (),
+                        _ = watch_rx.changed() => (),
                     }
+
+                    // Check again, the oldest bucket might have changed in the meantime.
                     continue;
                 }
-                Enum::ToMissing(to_missing_if_expired) => {
-                    set_as_missing_if_expired(
-                        &pool,
-                        to_missing_if_expired,
-                        &block_download_tracker,
-                        &client_reload_index_tx,
-                        cache.begin(),
-                    )
-                    .await?;
-                    continue;
+
+                tick
+            }
+            Action::OldestBucket(None) => {
+                if watch_rx.changed().await.is_err() {
+                    return Ok(());
                 }
+                continue;
+            }
+            Action::ToMissing(to_missing_if_expired) => {
+                set_as_missing_if_expired(
+                    &pool,
+                    to_missing_if_expired,
+                    &block_download_tracker,
+                    &client_reload_index_tx,
+                    cache.begin(),
+                )
+                .await?;
+                continue;
             }
         };
 
-        let expires_at = ts + expiration_time;
-        let now = SystemTime::now();
+        let block_ids = shared.lock().unwrap().take_expired(tick);
+        if block_ids.is_empty() {
+            continue;
+        }
 
-        if expires_at > now {
-            if let Ok(duration) = expires_at.duration_since(now) {
-                select! {
-                    _ = sleep(duration) => (),
-                    _ = expiration_time_rx.changed() => {
-                        continue;
-                    }
-                    _ = watch_rx.changed() => {
-                        continue;
-                    }
-                }
-            }
+        expire_blocks(&pool, &block_ids, &block_cache).await?;
 
-            // Check it's still the oldest block.
+        let mut lock = shared.lock().unwrap();
 
-            let mut lock = shared.lock().unwrap();
+        for block_id in &block_ids {
+            lock.remove_block(block_id);
+        }
+    }
+}
 
-            let first_entry = match lock.blocks_by_expiration.first_entry() {
-                Some(first_entry) => first_entry,
-                None => continue,
-            };
+/// Removes the given blocks from the db and marks them as expired in the index, all in a single
+/// transaction.
+async fn expire_blocks(
+    pool: &db::Pool,
+    block_ids: &[BlockId],
+    block_cache: &Arc<BlockCache>,
+) -> Result<(), Error> {
+    let mut tx = pool.begin_write().await?;
 
-            if *first_entry.key() > ts || !first_entry.get().contains(&block_id) {
-                continue;
-            }
-        }
+    for block_id in block_ids {
+        // Remove the block even if it isn't referenced as present, to not keep untracked blocks
+        // around.
+        leaf_node::set_expired_if_present(&mut tx, block_id).await?;
+        block::remove(&mut tx, block_id).await?;
+    }
 
-        let mut tx = pool.begin_write().await?;
+    // Evict from the cache only after the commit, otherwise the blocks could be read from the db
+    // and cached again before their removal becomes visible.
+    let block_cache = block_cache.clone();
+    let evicted_blocks = block_ids.to_vec();
 
-        if !leaf_node::set_expired_if_present(&mut tx, &block_id).await? {
-            return Ok(());
+    tx.commit_and_then(move || {
+        for block_id in &evicted_blocks {
+            block_cache.remove(block_id);
         }
+    })
+    .await?;
 
-        block::remove(&mut tx, &block_id).await?;
-
-        tx.commit().await?;
+    tracing::debug!("expired blocks removed: {}", block_ids.len());
 
-        shared.lock().unwrap().remove_block(&block_id);
-    }
+    Ok(())
 }
 
 async fn set_as_missing_if_expired(
@@ -397,6 +508,10 @@ async fn set_as_missing_if_expired(
     // for these branches from peers.
     let mut branches: HashSet<PublicKey> = HashSet::default();
 
+    // Collect the parents of all the newly missing blocks first so the shared ancestors get their
+    // summaries updated only once.
+    let mut nodes = Vec::new();
+
     for block_id in &block_ids {
         let changed = leaf_node::set_missing_if_expired(&mut tx, block_id).await?;
 
@@ -406,24 +521,22 @@ async fn set_as_missing_if_expired(
 
         block_download_tracker.require(*block_id);
 
-        let nodes: Vec<_> = leaf_node::load_parent_hashes(&mut tx, block_id)
-            .try_collect()
-            .await?;
+        try_collect_into(leaf_node::load_parent_hashes(&mut tx, block_id), &mut nodes).await?;
+    }
 
-        for (hash, _state) in index::update_summaries(
-            &mut tx,
-            &mut cache,
-            nodes,
-            UpdateSummaryReason::BlockRemoved,
+    for (hash, _state) in index::update_summaries(
+        &mut tx,
+        &mut cache,
+        nodes,
+        UpdateSummaryReason::BlockRemoved,
+    )
+    .await?
+    {
+        try_collect_into(
+            root_node::load_writer_ids_by_hash(&mut tx, &hash),
+            &mut branches,
         )
-        .await?
-        {
-            try_collect_into(
-                root_node::load_writer_ids_by_hash(&mut tx, &hash),
-                &mut branches,
-            )
-            .await?;
-        }
+        .await?;
     }
 
     tx.commit().await?;
@@ -450,25 +563,22 @@ mod test {
 
     #[test]
     fn shared_state() {
-        let mut shared = Shared {
-            blocks_by_id: Default::default(),
-            blocks_by_expiration: Default::default(),
-            to_missing_if_expired: Default::default(),
-        };
+        let mut shared = Shared::new(Duration::from_secs(1));
 
         // add once
 
         let ts = SystemTime::now();
+        let tick = shared.tick(ts);
         let block: BlockId = rand::random();
 
         shared.insert_block(&block, ts);
 
-        assert_eq!(*shared.blocks_by_id.get(&block).unwrap(), ts,);
+        assert_eq!(shared.blocks.get(&block).unwrap().bucket, tick);
         shared.assert_invariants();
 
         shared.remove_block(&block);
 
-        assert!(shared.blocks_by_id.is_empty());
+        assert!(shared.blocks.is_empty());
         shared.assert_invariants();
 
         // add twice
@@ -476,13 +586,78 @@ mod test {
         shared.insert_block(&block, ts);
         shared.insert_block(&block, ts);
 
-        assert_eq!(*shared.blocks_by_id.get(&block).unwrap(), ts);
+        assert_eq!(shared.blocks.get(&block).unwrap().bucket, tick);
         shared.assert_invariants();
 
         shared.remove_block(&block);
 
-        assert!(shared.blocks_by_id.is_empty());
+        assert!(shared.blocks.is_empty());
+        shared.assert_invariants();
+    }
+
+    #[test]
+    fn shared_state_lazy_update() {
+        let mut shared = Shared::new(Duration::from_secs(1));
+
+        let ts = SystemTime::now();
+        let tick = shared.tick(ts);
+        let block0: BlockId = rand::random();
+        let block1: BlockId = rand::random();
+
+        shared.insert_block(&block0, ts);
+        shared.insert_block(&block1, ts);
+
+        // Updating the block doesn't move it yet...
+        shared.insert_block(&block1, ts + Duration::from_secs(3));
+        assert_eq!(shared.blocks.get(&block1).unwrap().bucket, tick);
+        assert_eq!(shared.buckets.len(), 1);
+        shared.assert_invariants();
+
+        // ...only once its bucket expires.
+        assert_eq!(shared.take_expired(tick), [block0]);
+        assert_eq!(shared.blocks.get(&block1).unwrap().bucket, tick + 3);
+        shared.assert_invariants();
+
+        // Expired blocks remain tracked until removed.
+        assert!(shared.blocks.contains_key(&block0));
+        shared.remove_block(&block0);
         shared.assert_invariants();
+
+        assert_eq!(shared.oldest_bucket(Duration::ZERO).unwrap().0, tick + 3);
+        assert_eq!(shared.take_expired(tick + 3), [block1]);
+        shared.remove_block(&block1);
+
+        assert!(shared.blocks.is_empty());
+        shared.assert_invariants();
+    }
+
+    #[test]
+    fn shared_state_set_bucket_duration() {
+        let mut shared = Shared::new(Duration::from_secs(60));
+
+        let ts = SystemTime::UNIX_EPOCH + Duration::from_secs(600);
+        let block0: BlockId = rand::random();
+        let block1: BlockId = rand::random();
+
+        shared.insert_block(&block0, ts);
+        shared.insert_block(&block1, ts);
+        shared.insert_block(&block1, ts + Duration::from_secs(60));
+        shared.assert_invariants();
+
+        // Shorter buckets: each block goes to the bucket at the end of its last old one.
+        shared.set_bucket_duration(Duration::from_secs(1));
+        shared.assert_invariants();
+
+        assert_eq!(shared.buckets.len(), 2);
+        assert_eq!(shared.blocks.get(&block0).unwrap().bucket, 659);
+        assert_eq!(shared.blocks.get(&block1).unwrap().bucket, 719);
+
+        // Longer buckets: the blocks are batched together again.
+        shared.set_bucket_duration(Duration::from_secs(3600));
+        shared.assert_invariants();
+
+        assert_eq!(shared.buckets.len(), 1);
+        assert_eq!(shared.take_expired(0).len(), 2);
     }
 
     async fn setup() -> (TempDir, Store) {
@@ -515,6 +690,7 @@ mod test {
             BlockDownloadTracker::new(),
             broadcast_hash_set::channel().0,
             Arc::new(Cache::new()),
+            Arc::new(BlockCache::default()),
         )
         .await
         .unwrap();
@@ -2,7 +2,7 @@ use super::error::Error;
 use crate::{
     crypto::sign::PublicKey,
     db,
-    protocol::{BlockId, NodeState, SingleBlockPresence},
+    protocol::{BlockId, NodeState, SingleBlockPresence, INNER_LAYER_COUNT},
 };
 use futures_util::{Stream, TryStreamExt};
 use sqlx::Row;
@@ -68,6 +68,78 @@ impl BlockIdsPage {
     }
 }
 
+/// Paginated list of the ids of all missing blocks, that is, blocks referenced from the latest
+/// approved snapshot of at least one branch but not present locally. Unlike `BlockIdsPage` this
+/// doesn't traverse the index downwards but reads the `missing_blocks` table which is maintained by
+/// db triggers and then checks each candidate by walking up from its leaf nodes. Blocks removed by
+/// the garbage collector are excluded until it finds them reachable again.
+pub(crate) struct MissingBlockIdsPage {
+    db: db::Pool,
+    lower_bound: Option<BlockId>,
+    page_size: u32,
+}
+
+// The query in `MissingBlockIdsPage::next` joins exactly this many inner node layers.
+const _: () = assert!(INNER_LAYER_COUNT == 3);
+
+impl MissingBlockIdsPage {
+    pub(super) fn new(db: db::Pool, page_size: u32) -> Self {
+        Self {
+            db,
+            lower_bound: None,
+            page_size,
+        }
+    }
+
+    /// Returns the next page of the results. If the returned collection is empty it means the end
+    /// of the results was reached. Calling `next` afterwards resets the page back to zero.
+    pub async fn next(&mut self) -> Result<Vec<BlockId>, Error> {
+        let mut conn = self.db.acquire().await?;
+
+        // The `missing_blocks` table also contains blocks referenced only from incomplete,
+        // unapproved or outdated snapshots. Those must not be requested so keep only the blocks
+        // with a path to the latest approved root of some branch.
+        let ids: Vec<BlockId> = sqlx::query(
+            "SELECT m.block_id
+             FROM missing_blocks AS m
+             WHERE
+                 m.collected = 0
+                 AND m.block_id > COALESCE(?, x'')
+                 AND EXISTS (
+                     SELECT 0
+                     FROM snapshot_leaf_nodes AS l
+                     INNER JOIN snapshot_inner_nodes AS i2 ON i2.hash = l.parent
+                     INNER JOIN snapshot_inner_nodes AS i1 ON i1.hash = i2.parent
+                     INNER JOIN snapshot_inner_nodes AS i0 ON i0.hash = i1.parent
+                     INNER JOIN snapshot_root_nodes AS r ON r.hash = i0.parent
+                     WHERE
+                         l.block_id = m.block_id
+                         AND l.block_presence = ?
+                         AND r.snapshot_id = (
+                             SELECT MAX(snapshot_id)
+                             FROM snapshot_root_nodes
+                             WHERE writer_id = r.writer_id AND state = ?
+                         )
+                 )
+             ORDER BY m.block_id
+             LIMIT ?",
+        )
+        .bind(self.lower_bound.as_ref())
+        .bind(SingleBlockPresence::Missing)
+        .bind(NodeState::Approved)
+        .bind(self.page_size)
+        .fetch(&mut *conn)
+        .map_ok(|row| row.get(0))
+        .err_into::<Error>()
+        .try_collect()
+        .await?;
+
+        self.lower_bound = ids.last().copied();
+
+        Ok(ids)
+    }
+}
+
 /// Yields all missing block ids referenced from the latest complete snapshot of the given branch.
 pub(super) fn missing_block_ids_in_branch<'a>(
     conn: &'a mut db::Connection,
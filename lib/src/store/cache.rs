@@ -1,40 +1,76 @@
+use super::receive_filter::{ReceiveFilterTransaction, ReceivedNodes};
 use crate::{
     collections::HashMap,
     crypto::{sign::PublicKey, Hash},
-    protocol::{InnerNodes, LeafNodes, RootNode, Summary},
+    protocol::{
+        BlockContent, BlockId, InnerNode, InnerNodes, LeafNode, LeafNodes, RootNode, Summary,
+        BLOCK_SIZE,
+    },
+    storage_size::StorageSize,
 };
 use deadlock::BlockingMutex;
 use lru::LruCache;
-use std::{num::NonZeroUsize, sync::Arc};
+use metrics::Counter;
+use std::{hash::Hash as StdHash, mem, sync::Arc};
+
+/// Memory budgets of the store caches.
+#[derive(Clone, Copy, Debug)]
+pub(crate) struct CacheCapacity {
+    /// Budget of the index node cache.
+    pub index: StorageSize,
+    /// Budget of the decrypted block cache.
+    pub block: StorageSize,
+}
+
+impl Default for CacheCapacity {
+    fn default() -> Self {
+        Self {
+            index: StorageSize::from_bytes(32 * 1024 * 1024),
+            block: StorageSize::from_bytes(32 * 1024 * 1024),
+        }
+    }
+}
 
 /// Cache for index nodes
 pub(super) struct Cache {
     roots: BlockingMutex<HashMap<PublicKey, RootNode>>,
-    inners: BlockingMutex<LruCache<Hash, InnerNodes>>,
-    leaves: BlockingMutex<LruCache<Hash, LeafNodes>>,
+    inners: ShardedLru<Hash, InnerNodes>,
+    leaves: ShardedLru<Hash, LeafNodes>,
+    received: Arc<ReceivedNodes>,
+    metrics: CacheMetrics,
 }
 
 impl Cache {
     pub fn new() -> Self {
-        const ERROR: &str = "cache capacity must be non-zero";
+        Self::with_capacity(CacheCapacity::default().index, CacheMetrics::noop())
+    }
+
+    /// Creates the cache whose inner and leaf nodes together take approximately at most
+    /// `capacity` bytes of memory. The capacity is split evenly between inner and leaf nodes.
+    pub fn with_capacity(capacity: StorageSize, metrics: CacheMetrics) -> Self {
+        let capacity = to_usize(capacity);
 
         Self {
             roots: BlockingMutex::new(HashMap::default()),
-            inners: BlockingMutex::new(LruCache::new(
-                NonZeroUsize::new(INNERS_CAPACITY).expect(ERROR),
-            )),
-            leaves: BlockingMutex::new(LruCache::new(
-                NonZeroUsize::new(LEAVES_CAPACITY).expect(ERROR),
-            )),
+            inners: ShardedLru::new(capacity / 2),
+            leaves: ShardedLru::new(capacity / 2),
+            received: Arc::new(ReceivedNodes::default()),
+            metrics,
         }
     }
 
+    pub fn received_nodes(&self) -> &Arc<ReceivedNodes> {
+        &self.received
+    }
+
     pub fn begin(self: &Arc<Self>) -> CacheTransaction {
         CacheTransaction {
             cache: self.clone(),
             roots: HashMap::default(),
             root_summaries: HashMap::default(),
             inner_summaries: HashMap::default(),
+            inner_children: HashMap::default(),
+            received: ReceiveFilterTransaction::default(),
         }
     }
 }
@@ -50,6 +86,11 @@ pub(super) struct CacheTransaction {
     roots: HashMap<PublicKey, Option<RootNode>>,
     root_summaries: HashMap<Hash, Summary>,
     inner_summaries: HashMap<Hash, HashMap<u8, Summary>>,
+    // Inner nodes loaded while updating the summaries of their parents, keyed by the parent hash.
+    // Their summaries are kept in sync with `inner_summaries` so they can be reused when the same
+    // parent is updated again in this transaction.
+    inner_children: HashMap<Hash, InnerNodes>,
+    received: ReceiveFilterTransaction,
 }
 
 impl CacheTransaction {
@@ -86,30 +127,61 @@ impl CacheTransaction {
             .entry(parent_hash)
             .or_default()
             .insert(bucket, summary);
+
+        if let Some(node) = self
+            .inner_children
+            .get_mut(&parent_hash)
+            .and_then(|nodes| nodes.get_mut(bucket))
+        {
+            node.summary = summary;
+        }
+    }
+
+    pub fn get_inner_children(&self, parent_hash: &Hash) -> Option<&InnerNodes> {
+        self.inner_children.get(parent_hash)
+    }
+
+    pub fn put_inner_children(&mut self, parent_hash: Hash, nodes: InnerNodes) {
+        self.inner_children.insert(parent_hash, nodes);
     }
 
     pub fn get_inners(&self, parent_hash: &Hash) -> Option<InnerNodes> {
-        self.cache.inners.lock().unwrap().get(parent_hash).cloned()
+        let nodes = self.cache.inners.get(parent_hash);
+        self.cache.metrics.record(nodes.is_some());
+        nodes
     }
 
     pub fn put_inners(&self, parent_hash: Hash, nodes: InnerNodes) {
         // NOTE: Writing directly to the cache because this cache entry is immutable
-        self.cache.inners.lock().unwrap().put(parent_hash, nodes);
+        self.cache.inners.put(parent_hash, nodes);
+    }
+
+    pub fn received_mut(&mut self) -> &mut ReceiveFilterTransaction {
+        &mut self.received
+    }
+
+    pub fn remove_received(&self, hash: &Hash) {
+        // NOTE: Writing directly because the receive filters are not transactional. Removing an
+        // entry is always safe, at worst the node gets processed again.
+        self.cache.received.remove(hash);
     }
 
     pub fn get_leaves(&self, parent_hash: &Hash) -> Option<LeafNodes> {
-        self.cache.leaves.lock().unwrap().get(parent_hash).cloned()
+        let nodes = self.cache.leaves.get(parent_hash);
+        self.cache.metrics.record(nodes.is_some());
+        nodes
     }
 
     pub fn put_leaves(&self, parent_hash: Hash, nodes: LeafNodes) {
         // NOTE: Writing directly to the cache because this cache entry is immutable
-        self.cache.leaves.lock().unwrap().put(parent_hash, nodes);
+        self.cache.leaves.put(parent_hash, nodes);
     }
 
     pub fn is_dirty(&self) -> bool {
         !self.roots.is_empty()
             || !self.root_summaries.is_empty()
             || !self.inner_summaries.is_empty()
+            || !self.received.is_empty()
     }
 
     pub fn commit(self) {
@@ -131,25 +203,246 @@ impl CacheTransaction {
             }
         }
 
-        {
-            let mut inners = self.cache.inners.lock().unwrap();
-
-            for (parent_hash, summaries) in self.inner_summaries {
-                if let Some(nodes) = inners.get_mut(&parent_hash) {
-                    for (bucket, summary) in summaries {
-                        if let Some(node) = nodes.get_mut(bucket) {
-                            node.summary = summary;
-                        }
+        for (parent_hash, summaries) in self.inner_summaries {
+            self.cache.inners.update(&parent_hash, |nodes| {
+                for (bucket, summary) in summaries {
+                    if let Some(node) = nodes.get_mut(bucket) {
+                        node.summary = summary;
                     }
                 }
-            }
+            });
+        }
+
+        self.received.commit(&self.cache.received);
+    }
+}
+
+/// Cache of decrypted block contents, shared by all blobs of a repository.
+///
+/// Block ids are hashes of the block ciphertext and so an id always corresponds to the same
+/// plaintext. The entries thus never need to be updated, only removed when the block itself gets
+/// removed from the store.
+pub(super) struct BlockCache {
+    entries: ShardedLru<BlockId, BlockContent>,
+    metrics: CacheMetrics,
+}
+
+impl BlockCache {
+    pub fn new(capacity: StorageSize, metrics: CacheMetrics) -> Self {
+        Self {
+            entries: ShardedLru::new(to_usize(capacity)),
+            metrics,
+        }
+    }
+
+    pub fn get(&self, id: &BlockId) -> Option<BlockContent> {
+        let content = self.entries.get(id);
+        self.metrics.record(content.is_some());
+        content
+    }
+
+    pub fn put(&self, id: BlockId, content: BlockContent) {
+        self.entries.put(id, content);
+    }
+
+    pub fn remove(&self, id: &BlockId) {
+        self.entries.remove(id);
+    }
+}
+
+impl Default for BlockCache {
+    fn default() -> Self {
+        Self::new(CacheCapacity::default().block, CacheMetrics::noop())
+    }
+}
+
+/// Cache hit/miss counters.
+#[derive(Clone)]
+pub(crate) struct CacheMetrics {
+    pub hits: Counter,
+    pub misses: Counter,
+}
+
+impl CacheMetrics {
+    pub fn noop() -> Self {
+        Self {
+            hits: Counter::noop(),
+            misses: Counter::noop(),
+        }
+    }
+
+    fn record(&self, hit: bool) {
+        if hit {
+            self.hits.increment(1);
+        } else {
+            self.misses.increment(1);
+        }
+    }
+}
+
+// Number of independently locked shards of each node cache. Entries are assigned to shards by
+// their key which is a cryptographic hash and so is uniformly distributed.
+const SHARD_COUNT: usize = 16;
+
+/// LRU cache split into shards with separate locks so concurrent accesses to different entries
+/// rarely contend. The capacity is in (approximate) bytes, not number of entries.
+struct ShardedLru<K, V> {
+    shards: Box<[BlockingMutex<Shard<K, V>>]>,
+}
+
+impl<K, V> ShardedLru<K, V>
+where
+    K: AsRef<[u8]> + Eq + StdHash,
+    V: Clone + CacheWeight,
+{
+    fn new(capacity: usize) -> Self {
+        let capacity = capacity / SHARD_COUNT;
+
+        Self {
+            shards: (0..SHARD_COUNT)
+                .map(|_| {
+                    BlockingMutex::new(Shard {
+                        entries: LruCache::unbounded(),
+                        size: 0,
+                        capacity,
+                    })
+                })
+                .collect(),
+        }
+    }
+
+    fn get(&self, key: &K) -> Option<V> {
+        self.shard(key).lock().unwrap().entries.get(key).cloned()
+    }
+
+    fn put(&self, key: K, value: V) {
+        self.shard(&key).lock().unwrap().put(key, value)
+    }
+
+    /// Modifies the entry in place if it exists. Doesn't promote it.
+    fn update(&self, key: &K, f: impl FnOnce(&mut V)) {
+        if let Some(value) = self.shard(key).lock().unwrap().entries.peek_mut(key) {
+            f(value);
+        }
+    }
+
+    fn remove(&self, key: &K) {
+        self.shard(key).lock().unwrap().remove(key)
+    }
+
+    fn shard(&self, key: &K) -> &BlockingMutex<Shard<K, V>> {
+        &self.shards[key.as_ref()[0] as usize % self.shards.len()]
+    }
+}
+
+struct Shard<K, V> {
+    entries: LruCache<K, V>,
+    // Current total weight of the entries.
+    size: usize,
+    capacity: usize,
+}
+
+impl<K, V> Shard<K, V>
+where
+    K: Eq + StdHash,
+    V: CacheWeight,
+{
+    fn put(&mut self, key: K, value: V) {
+        self.size += value.weight();
+
+        if let Some(old) = self.entries.put(key, value) {
+            self.size -= old.weight();
+        }
+
+        // Evict the least recently used entries until we fit, but always keep at least the one
+        // just inserted.
+        while self.size > self.capacity && self.entries.len() > 1 {
+            let Some((_, old)) = self.entries.pop_lru() else {
+                break;
+            };
+
+            self.size -= old.weight();
+        }
+    }
+
+    fn remove(&mut self, key: &K) {
+        if let Some(old) = self.entries.pop(key) {
+            self.size -= old.weight();
         }
     }
 }
 
-// Max number of leaf node sets in the cache.
-const LEAVES_CAPACITY: usize = 1024;
+fn to_usize(capacity: StorageSize) -> usize {
+    usize::try_from(capacity.to_bytes()).unwrap_or(usize::MAX)
+}
+
+/// Approximate memory footprint of a cache entry.
+trait CacheWeight {
+    fn weight(&self) -> usize;
+}
+
+impl CacheWeight for InnerNodes {
+    fn weight(&self) -> usize {
+        mem::size_of::<Hash>() + self.len() * mem::size_of::<(u8, InnerNode)>()
+    }
+}
+
+impl CacheWeight for LeafNodes {
+    fn weight(&self) -> usize {
+        mem::size_of::<Hash>() + self.len() * mem::size_of::<LeafNode>()
+    }
+}
+
+impl CacheWeight for BlockContent {
+    fn weight(&self) -> usize {
+        mem::size_of::<BlockId>() + BLOCK_SIZE
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[derive(Clone)]
+    struct Entry(usize);
+
+    impl CacheWeight for Entry {
+        fn weight(&self) -> usize {
+            self.0
+        }
+    }
 
-// Max number of inner node maps in the cache. Assuming nodes are uniformly distributed, there
-// should be roughly twice as many inner nodes than leaf nodes (for number of leaf nodes < 65536).
-const INNERS_CAPACITY: usize = 2 * LEAVES_CAPACITY;
+    #[test]
+    fn sharded_lru_evicts_by_weight() {
+        let key = |n: u8| Hash::from([n; Hash::SIZE]);
+
+        // Keys whose first bytes are equal modulo `SHARD_COUNT` (0, 16, 32, ...) land in the same
+        // shard.
+        let cache = ShardedLru::new(SHARD_COUNT * 100);
+
+        cache.put(key(0), Entry(40));
+        // Replacing an entry doesn't count its old weight.
+        cache.put(key(0), Entry(40));
+        cache.put(key(16), Entry(40));
+        assert!(cache.get(&key(0)).is_some());
+        assert!(cache.get(&key(16)).is_some());
+
+        // Exceeds the shard capacity, evicting the least recently used entry.
+        cache.put(key(32), Entry(40));
+        assert!(cache.get(&key(0)).is_none());
+        assert!(cache.get(&key(16)).is_some());
+        assert!(cache.get(&key(32)).is_some());
+
+        // Other shards are not affected.
+        cache.put(key(1), Entry(100));
+        assert!(cache.get(&key(1)).is_some());
+        assert!(cache.get(&key(16)).is_some());
+
+        // Removing an entry frees its weight.
+        cache.remove(&key(16));
+        assert!(cache.get(&key(16)).is_none());
+        cache.put(key(48), Entry(60));
+        assert!(cache.get(&key(32)).is_some());
+        assert!(cache.get(&key(48)).is_some());
+    }
+}
@@ -59,11 +59,13 @@ impl Changeset {
             patch.save(tx, self.bump, write_keys).await?;
         }
 
-        for block in self.blocks {
-            block::write(tx.db(), &block).await?;
+        if !self.blocks.is_empty() {
+            block::write_all(tx.db(), &self.blocks).await?;
 
             if let Some(tracker) = &tx.block_expiration_tracker {
-                tracker.handle_block_update(&block.id, false);
+                for block in &self.blocks {
+                    tracker.handle_block_update(&block.id, false);
+                }
             }
 
             changed = true;
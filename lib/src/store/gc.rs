@@ -0,0 +1,261 @@
+//! Support for the garbage collector.
+//!
+//! Each block has a mark (in the `block_marks` table) holding the GC epoch since which the block
+//! is eligible for collection. A collection starts a new epoch, which makes all the blocks written
+//! so far eligible, traverses the reachable blocks into a `ReachableBlocks` filter and then
+//! removes the eligible blocks that are not in it. Blocks written during the epoch are never
+//! collected in it.
+//!
+//! The traversal doesn't write anything to the store and the memory it needs is a couple of bytes
+//! per block, but it still visits the whole directory tree of every branch, so a run reads the
+//! whole repository. Blocks no longer referenced from any leaf node are not collected here, they
+//! are deleted by a trigger as soon as their last leaf node is removed (see the `v1` migration).
+
+use super::error::Error;
+use crate::{
+    db,
+    protocol::{BlockId, NodeState},
+};
+use futures_util::TryStreamExt;
+use sqlx::{QueryBuilder, Row, Sqlite};
+
+// Bits of the `ReachableBlocks` filter per block. Together with `HASH_COUNT` gives a false
+// positive rate of about 0.05%.
+const BITS_PER_BLOCK: usize = 16;
+// Number of bits set per block.
+const HASH_COUNT: u64 = 11;
+
+/// Approximate set (Bloom filter) of the blocks found reachable in a GC run.
+///
+/// A false positive only spares an unreachable block until a later run. Every filter uses a
+/// different random seed, so the same block is not spared in every run.
+pub(crate) struct ReachableBlocks {
+    bits: Vec<u64>,
+    seed: (u64, u64),
+}
+
+impl ReachableBlocks {
+    /// Creates a filter sized for the given number of blocks. Inserting more than that still
+    /// works but increases the false positive rate.
+    pub fn new(capacity: u64) -> Self {
+        let len = (capacity as usize * BITS_PER_BLOCK).div_ceil(64).max(1);
+
+        Self {
+            bits: vec![0; len],
+            seed: rand::random(),
+        }
+    }
+
+    pub fn insert(&mut self, block_id: &BlockId) {
+        for index in self.indices(block_id) {
+            self.bits[index / 64] |= 1 << (index % 64);
+        }
+    }
+
+    pub fn contains(&self, block_id: &BlockId) -> bool {
+        self.indices(block_id)
+            .all(|index| self.bits[index / 64] & (1 << (index % 64)) != 0)
+    }
+
+    // Double hashing. Block ids are already uniformly distributed so their first two words, mixed
+    // with the seed, serve as the two hashes.
+    fn indices(&self, block_id: &BlockId) -> impl Iterator<Item = usize> {
+        let bytes = block_id.as_ref();
+        let h1 = u64::from_le_bytes(bytes[..8].try_into().unwrap()) ^ self.seed.0;
+        let h2 = (u64::from_le_bytes(bytes[8..16].try_into().unwrap()) ^ self.seed.1) | 1;
+        let len = self.bits.len() as u64 * 64;
+
+        (0..HASH_COUNT).map(move |i| (h1.wrapping_add(i.wrapping_mul(h2)) % len) as usize)
+    }
+}
+
+/// Starts a new GC epoch and returns it. All blocks written before this call become eligible for
+/// collection in this epoch.
+pub(super) async fn begin_epoch(tx: &mut db::WriteTransaction) -> Result<u64, Error> {
+    let epoch: i64 = sqlx::query("SELECT COALESCE(MAX(epoch), 0) + 1 FROM block_marks")
+        .fetch_one(&mut *tx)
+        .await?
+        .get(0);
+
+    sqlx::query("UPDATE block_marks SET epoch = ? WHERE epoch IS NULL")
+        .bind(epoch)
+        .execute(tx)
+        .await?;
+
+    Ok(epoch as u64)
+}
+
+/// Have any blocks been written since the start of the current GC epoch?
+pub(super) async fn has_new_blocks(conn: &mut db::Connection) -> Result<bool, Error> {
+    Ok(
+        sqlx::query("SELECT EXISTS(SELECT 0 FROM block_marks WHERE epoch IS NULL)")
+            .fetch_one(conn)
+            .await?
+            .get(0),
+    )
+}
+
+/// Makes the given collected blocks requestable again because they were found reachable.
+pub(super) async fn uncollect(
+    tx: &mut db::WriteTransaction,
+    block_ids: &[BlockId],
+) -> Result<(), Error> {
+    // Keep each statement within the sqlite variable limit.
+    const BATCH_SIZE: usize = 512;
+
+    for batch in block_ids.chunks(BATCH_SIZE) {
+        let mut builder = QueryBuilder::new(
+            "UPDATE missing_blocks SET collected = 0 WHERE collected = 1 AND block_id IN ",
+        );
+        push_ids(&mut builder, batch);
+        builder.build().execute(&mut *tx).await?;
+    }
+
+    Ok(())
+}
+
+/// Records that the given (now missing) block was removed because it was unreachable, so it's
+/// not requested again.
+pub(super) async fn set_collected(
+    tx: &mut db::WriteTransaction,
+    block_id: &BlockId,
+) -> Result<(), Error> {
+    sqlx::query("UPDATE missing_blocks SET collected = 1 WHERE block_id = ?")
+        .bind(block_id)
+        .execute(tx)
+        .await?;
+
+    Ok(())
+}
+
+/// Inserts all blocks referenced from the not yet approved snapshots into `reachable`. Those
+/// snapshots are not visible to the traversal of the directory tree but their blocks are going to
+/// be needed once they get approved.
+pub(super) async fn load_unapproved(
+    conn: &mut db::Connection,
+    reachable: &mut ReachableBlocks,
+) -> Result<(), Error> {
+    let mut block_ids = sqlx::query(
+        "WITH RECURSIVE
+             inner_nodes(hash) AS (
+                 SELECT i.hash
+                    FROM snapshot_inner_nodes AS i
+                    INNER JOIN snapshot_root_nodes AS r ON r.hash = i.parent
+                    WHERE r.state <> ?
+                 UNION ALL
+                 SELECT c.hash
+                    FROM snapshot_inner_nodes AS c
+                    INNER JOIN inner_nodes AS p ON p.hash = c.parent
+             )
+         SELECT block_id
+             FROM snapshot_leaf_nodes
+             WHERE parent IN inner_nodes",
+    )
+    .bind(NodeState::Approved)
+    .fetch(conn)
+    .map_ok(|row| row.get::<BlockId, _>(0));
+
+    while let Some(block_id) = block_ids.try_next().await? {
+        reachable.insert(&block_id);
+    }
+
+    Ok(())
+}
+
+/// Paginated list of the blocks eligible for collection in the given GC epoch.
+pub(crate) struct EligibleBlockIdsPage {
+    db: db::Pool,
+    epoch: u64,
+    lower_bound: Option<BlockId>,
+    page_size: u32,
+}
+
+impl EligibleBlockIdsPage {
+    pub(super) fn new(db: db::Pool, epoch: u64, page_size: u32) -> Self {
+        Self {
+            db,
+            epoch,
+            lower_bound: None,
+            page_size,
+        }
+    }
+
+    /// Returns the next page of the results. If the returned collection is empty it means the end
+    /// of the results was reached.
+    pub async fn next(&mut self) -> Result<Vec<BlockId>, Error> {
+        let mut conn = self.db.acquire().await?;
+
+        let ids: Vec<BlockId> = sqlx::query(
+            "SELECT block_id
+             FROM block_marks
+             WHERE epoch <= ? AND block_id > COALESCE(?, x'')
+             ORDER BY block_id
+             LIMIT ?",
+        )
+        .bind(self.epoch as i64)
+        .bind(self.lower_bound.as_ref())
+        .bind(self.page_size)
+        .fetch(&mut *conn)
+        .map_ok(|row| row.get(0))
+        .err_into::<Error>()
+        .try_collect()
+        .await?;
+
+        self.lower_bound = ids.last().copied();
+
+        Ok(ids)
+    }
+}
+
+/// Paginated list of the blocks removed by the collector (see `set_collected`).
+pub(crate) struct CollectedBlockIdsPage {
+    db: db::Pool,
+    lower_bound: Option<BlockId>,
+    page_size: u32,
+}
+
+impl CollectedBlockIdsPage {
+    pub(super) fn new(db: db::Pool, page_size: u32) -> Self {
+        Self {
+            db,
+            lower_bound: None,
+            page_size,
+        }
+    }
+
+    /// Returns the next page of the results. If the returned collection is empty it means the end
+    /// of the results was reached.
+    pub async fn next(&mut self) -> Result<Vec<BlockId>, Error> {
+        let mut conn = self.db.acquire().await?;
+
+        let ids: Vec<BlockId> = sqlx::query(
+            "SELECT block_id
+             FROM missing_blocks
+             WHERE collected = 1 AND block_id > COALESCE(?, x'')
+             ORDER BY block_id
+             LIMIT ?",
+        )
+        .bind(self.lower_bound.as_ref())
+        .bind(self.page_size)
+        .fetch(&mut *conn)
+        .map_ok(|row| row.get(0))
+        .err_into::<Error>()
+        .try_collect()
+        .await?;
+
+        self.lower_bound = ids.last().copied();
+
+        Ok(ids)
+    }
+}
+
+fn push_ids<'a>(builder: &mut QueryBuilder<'a, Sqlite>, block_ids: &'a [BlockId]) {
+    builder.push("(");
+
+    let mut separated = builder.separated(", ");
+    for block_id in block_ids {
+        separated.push_bind(block_id);
+    }
+
+    builder.push(")");
+}
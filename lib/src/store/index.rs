@@ -3,19 +3,20 @@
 use super::{
     cache::CacheTransaction,
     error::Error,
-    inner_node,
+    inner_node, leaf_node,
     quota::{self, QuotaError},
-    receive_filter, root_node,
+    root_node,
 };
 use crate::{
-    collections::HashMap,
+    collections::{HashMap, HashSet},
     crypto::{sign::PublicKey, Hash},
     db,
     future::try_collect_into,
-    protocol::NodeState,
+    protocol::{NodeState, Summary, EMPTY_INNER_HASH, EMPTY_LEAF_HASH},
     storage_size::StorageSize,
 };
 use sqlx::Row;
+use std::mem;
 
 /// Status of receiving nodes from remote replica.
 #[derive(Debug)]
@@ -51,52 +52,91 @@ pub(super) async fn parent_exists(conn: &mut db::Connection, hash: &Hash) -> Res
 
 /// Update summary of the nodes with the specified hashes and all their ancestor nodes.
 /// Returns the affected snapshots and their states.
+///
+/// The nodes are processed layer by layer, bottom-up. Nodes reached from multiple children are
+/// updated only once per layer, so the cost is proportional to the number of distinct affected
+/// nodes, not to the number of input nodes times the tree depth.
 pub(super) async fn update_summaries(
     write_tx: &mut db::WriteTransaction,
     cache_tx: &mut CacheTransaction,
-    mut nodes: Vec<Hash>,
+    nodes: Vec<Hash>,
     reason: UpdateSummaryReason,
 ) -> Result<HashMap<Hash, NodeState>, Error> {
     let mut states = HashMap::default();
+    let mut layer: HashSet<_> = nodes.into_iter().collect();
+    let mut next_layer = HashSet::default();
 
-    while let Some(hash) = nodes.pop() {
-        let summary = inner_node::compute_summary(write_tx, &hash).await?;
+    while !layer.is_empty() {
+        for hash in layer.drain() {
+            let summary = compute_summary(write_tx, cache_tx, &hash).await?;
 
-        // First try inner nodes ...
-        let node_infos = inner_node::update_summaries(write_tx, &hash, summary).await?;
-        if !node_infos.is_empty() {
-            // ... success.
+            // First try inner nodes ...
+            let node_infos = inner_node::update_summaries(write_tx, &hash, summary).await?;
+            if !node_infos.is_empty() {
+                // ... success.
 
-            for (parent_hash, bucket) in node_infos {
-                cache_tx.update_inner_summary(parent_hash, bucket, summary);
-                nodes.push(parent_hash);
-            }
+                for (parent_hash, bucket) in node_infos {
+                    cache_tx.update_inner_summary(parent_hash, bucket, summary);
+                    next_layer.insert(parent_hash);
+                }
 
-            match reason {
-                // If block was removed we need to remove the corresponding receive filter entries
-                // so if the block becomes needed again we can request it again.
-                UpdateSummaryReason::BlockRemoved => {
-                    receive_filter::remove(write_tx, &hash).await?
+                match reason {
+                    // If block was removed we need to remove the corresponding receive filter
+                    // entries so if the block becomes needed again we can request it again.
+                    UpdateSummaryReason::BlockRemoved => cache_tx.remove_received(&hash),
+                    UpdateSummaryReason::Other => (),
                 }
-                UpdateSummaryReason::Other => (),
-            }
-        } else {
-            // ... no hits. Let's try root nodes.
-            let state = root_node::update_summaries(write_tx, &hash, summary).await?;
-            let summary = summary.with_state(state);
+            } else {
+                // ... no hits. Let's try root nodes.
+                let state = root_node::update_summaries(write_tx, &hash, summary).await?;
+                let summary = summary.with_state(state);
 
-            cache_tx.update_root_summary(hash, summary);
+                cache_tx.update_root_summary(hash, summary);
 
-            states
-                .entry(hash)
-                .or_insert(summary.state)
-                .update(summary.state);
+                states
+                    .entry(hash)
+                    .or_insert(summary.state)
+                    .update(summary.state);
+            }
         }
+
+        mem::swap(&mut layer, &mut next_layer);
     }
 
     Ok(states)
 }
 
+// Like `inner_node::compute_summary` but reuses the inner node children already loaded in this
+// transaction, with their summaries kept up to date by `update_summaries`. Leaf node children are
+// always loaded from the db because their block presence is changed outside of `CacheTransaction`.
+async fn compute_summary(
+    conn: &mut db::Connection,
+    cache_tx: &mut CacheTransaction,
+    parent_hash: &Hash,
+) -> Result<Summary, Error> {
+    if let Some(children) = cache_tx.get_inner_children(parent_hash) {
+        return Ok(Summary::from_inners(children));
+    }
+
+    if parent_hash == &*EMPTY_INNER_HASH || parent_hash == &*EMPTY_LEAF_HASH {
+        return inner_node::compute_summary(conn, parent_hash).await;
+    }
+
+    let children = inner_node::load_children(conn, parent_hash).await?;
+    if !children.is_empty() {
+        let summary = Summary::from_inners(&children);
+        cache_tx.put_inner_children(*parent_hash, children);
+        return Ok(summary);
+    }
+
+    let children = leaf_node::load_children(conn, parent_hash).await?;
+    if !children.is_empty() {
+        return Ok(Summary::from_leaves(&children));
+    }
+
+    Ok(Summary::INCOMPLETE)
+}
+
 pub(super) async fn finalize(
     write_tx: &mut db::WriteTransaction,
     cache_tx: &mut CacheTransaction,
@@ -602,6 +642,125 @@ mod tests {
         pool.close().await.unwrap();
     }
 
+    #[proptest]
+    fn batch_summary(
+        #[strategy(1usize..=32)] leaf_count: usize,
+        #[strategy(test_utils::rng_seed_strategy())] rng_seed: u64,
+    ) {
+        test_utils::run(batch_summary_case(leaf_count, rng_seed))
+    }
+
+    // Updating the summaries of many nodes at once gives the same result as updating them one by
+    // one.
+    async fn batch_summary_case(leaf_count: usize, rng_seed: u64) {
+        let mut rng = StdRng::seed_from_u64(rng_seed);
+        let (_base_dir, pool) = db::create_temp().await.unwrap();
+        let cache = Arc::new(Cache::new());
+
+        let mut write_tx = pool.begin_write().await.unwrap();
+        let mut cache_tx = cache.begin();
+
+        let writer_id = PublicKey::generate(&mut rng);
+        let write_keys = Keypair::generate(&mut rng);
+        let snapshot = Snapshot::generate(&mut rng, leaf_count);
+
+        let (mut root_node, _) = root_node::create(
+            &mut write_tx,
+            Proof::new(
+                writer_id,
+                VersionVector::first(writer_id),
+                *snapshot.root_hash(),
+                &write_keys,
+            ),
+            Summary::INCOMPLETE,
+            RootNodeFilter::Any,
+        )
+        .await
+        .unwrap();
+
+        for layer in snapshot.inner_layers() {
+            for (parent_hash, nodes) in layer.inner_maps() {
+                inner_node::save_all(&mut write_tx, &nodes.clone().into_incomplete(), parent_hash)
+                    .await
+                    .unwrap();
+            }
+        }
+
+        for (parent_hash, nodes) in snapshot.leaf_sets() {
+            leaf_node::save_all(&mut write_tx, &nodes.clone().into_missing(), parent_hash)
+                .await
+                .unwrap();
+        }
+
+        let parent_hashes: Vec<_> = snapshot.leaf_sets().map(|(hash, _)| *hash).collect();
+
+        let states = update_summaries(
+            &mut write_tx,
+            &mut cache_tx,
+            parent_hashes.clone(),
+            UpdateSummaryReason::Other,
+        )
+        .await
+        .unwrap();
+
+        assert_eq!(states.len(), 1);
+        assert_eq!(
+            states.get(&root_node.proof.hash),
+            Some(&NodeState::Complete)
+        );
+
+        reload_root_node(&mut write_tx, &mut root_node)
+            .await
+            .unwrap();
+        assert_eq!(root_node.summary.state, NodeState::Complete);
+        assert_eq!(root_node.summary.block_presence, MultiBlockPresence::None);
+
+        for block_id in snapshot.blocks().keys() {
+            leaf_node::set_present(&mut write_tx, block_id)
+                .await
+                .unwrap();
+        }
+
+        // Duplicates are fine.
+        let nodes = parent_hashes
+            .iter()
+            .chain(&parent_hashes)
+            .copied()
+            .collect();
+
+        update_summaries(
+            &mut write_tx,
+            &mut cache_tx,
+            nodes,
+            UpdateSummaryReason::Other,
+        )
+        .await
+        .unwrap();
+
+        reload_root_node(&mut write_tx, &mut root_node)
+            .await
+            .unwrap();
+        assert_eq!(root_node.summary.block_presence, MultiBlockPresence::Full);
+
+        // The children kept in the cache transaction are up to date.
+        let cached: Vec<_> = cache_tx
+            .get_inner_children(&root_node.proof.hash)
+            .cloned()
+            .unwrap()
+            .into_iter()
+            .collect();
+        let loaded: Vec<_> = inner_node::load_children(&mut write_tx, &root_node.proof.hash)
+            .await
+            .unwrap()
+            .into_iter()
+            .collect();
+        assert_eq!(cached, loaded);
+
+        // HACK: prevent "too many open files" error.
+        drop(write_tx);
+        pool.close().await.unwrap();
+    }
+
     async fn setup() -> (TempDir, db::Pool) {
         db::create_temp().await.unwrap()
     }
@@ -1,11 +1,11 @@
-use super::{error::Error, leaf_node, ReceiveFilter};
+use super::{cache::CacheTransaction, error::Error, leaf_node, ReceiveFilter};
 use crate::{
     crypto::{sign::PublicKey, Hash},
     db,
     protocol::{InnerNode, InnerNodes, LeafNodes, Summary, EMPTY_INNER_HASH, EMPTY_LEAF_HASH},
 };
 use futures_util::{future, Stream, TryStreamExt};
-use sqlx::Row;
+use sqlx::{QueryBuilder, Row};
 use std::convert::TryInto;
 
 #[derive(Default)]
@@ -57,6 +57,30 @@ pub(super) async fn load_children(
     .map_err(From::from)
 }
 
+/// Load the hashes of all inner nodes in the subtree of the given root node.
+pub(super) async fn load_descendant_hashes(
+    conn: &mut db::Connection,
+    root: &Hash,
+) -> Result<Vec<Hash>, Error> {
+    sqlx::query(
+        "WITH RECURSIVE
+             inner_nodes(hash) AS (
+                 SELECT hash FROM snapshot_inner_nodes WHERE parent = ?
+                 UNION
+                 SELECT c.hash
+                     FROM snapshot_inner_nodes AS c
+                     INNER JOIN inner_nodes AS p ON p.hash = c.parent
+             )
+         SELECT hash FROM inner_nodes",
+    )
+    .bind(root)
+    .fetch(conn)
+    .map_ok(|row| row.get(0))
+    .err_into()
+    .try_collect()
+    .await
+}
+
 /// Load all inner nodes with the specified parent hash.
 pub(super) fn load_parent_hashes<'a>(
     conn: &'a mut db::Connection,
@@ -93,6 +117,7 @@ pub(super) async fn load(
 }
 
 /// Saves this inner node into the db unless it already exists.
+#[cfg(test)]
 pub(super) async fn save(
     tx: &mut db::WriteTransaction,
     node: &InnerNode,
@@ -124,14 +149,36 @@ pub(super) async fn save(
     Ok(())
 }
 
-/// Atomically saves all nodes in this map to the db.
+/// Atomically saves all nodes in this map to the db, skipping those that already exist. The nodes
+/// are inserted using multi-row inserts to reduce the per statement overhead.
 pub(super) async fn save_all(
     tx: &mut db::WriteTransaction,
     nodes: &InnerNodes,
     parent: &Hash,
 ) -> Result<(), Error> {
-    for (bucket, node) in nodes {
-        save(tx, node, parent, bucket).await?;
+    // Each row binds 5 variables.
+    const BATCH_SIZE: usize = db::MAX_VARIABLES / 5;
+
+    let nodes: Vec<_> = nodes.into_iter().collect();
+
+    for batch in nodes.chunks(BATCH_SIZE) {
+        let mut builder = QueryBuilder::new(
+            "INSERT INTO snapshot_inner_nodes (parent, bucket, hash, state, block_presence) ",
+        );
+
+        builder.push_values(batch, |mut row, (bucket, node)| {
+            debug_assert_ne!(node.hash, *EMPTY_INNER_HASH);
+            debug_assert_ne!(node.hash, *EMPTY_LEAF_HASH);
+
+            row.push_bind(parent)
+                .push_bind(*bucket)
+                .push_bind(&node.hash)
+                .push_bind(node.summary.state)
+                .push_bind(&node.summary.block_presence);
+        });
+
+        builder.push(" ON CONFLICT (parent, bucket) DO NOTHING");
+        builder.build().execute(&mut *tx).await?;
     }
 
     Ok(())
@@ -246,23 +293,23 @@ async fn inherit_summary(conn: &mut db::Connection, node: &mut InnerNode) -> Res
 /// Filter nodes that the remote replica has some blocks in that the local one is missing.
 pub(super) async fn filter_nodes_with_new_blocks(
     tx: &mut db::WriteTransaction,
+    cache_tx: &mut CacheTransaction,
     remote_nodes: &InnerNodes,
     receive_filter: &ReceiveFilter,
 ) -> Result<Vec<InnerNode>, Error> {
     let mut output = Vec::with_capacity(remote_nodes.len());
 
     for (_, remote_node) in remote_nodes {
-        if !receive_filter
-            .check(tx, &remote_node.hash, &remote_node.summary.block_presence)
-            .await?
-        {
-            continue;
-        }
+        let hash = &remote_node.hash;
+        let presence = &remote_node.summary.block_presence;
 
-        let local_node = load(tx, &remote_node.hash).await?;
+        let local_node = load(tx, hash).await?;
         let insert = if let Some(local_node) = local_node {
-            local_node.summary.is_outdated(&remote_node.summary)
+            receive_filter.check(cache_tx.received_mut(), hash, presence)
+                && local_node.summary.is_outdated(&remote_node.summary)
         } else {
+            receive_filter.insert_missing(cache_tx.received_mut(), hash, presence);
+
             // node not present locally - we implicitly treat this as if the local replica
             // had zero blocks under this node unless the remote node is empty, in that
             // case we ignore it.
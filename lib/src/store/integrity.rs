@@ -3,9 +3,9 @@ use crate::db;
 use sqlx::Row;
 use tracing::instrument;
 
+/// Checks for nodes whose parents don't exist.
 #[instrument(skip_all)]
-pub(super) async fn check(conn: &mut db::Connection) -> Result<bool, Error> {
-    // Check orphaned nodes
+pub(super) async fn check_nodes(conn: &mut db::Connection) -> Result<bool, Error> {
     let count = db::decode_u64(
         sqlx::query(
             "SELECT COUNT(*)
@@ -28,7 +28,15 @@ pub(super) async fn check(conn: &mut db::Connection) -> Result<bool, Error> {
         return Ok(false);
     }
 
-    // Check orphaned blocks
+    // TODO: Check for root nodes with invalid signatures
+    // TODO: Check for child nodes with invalid hashes
+
+    Ok(true)
+}
+
+/// Checks for blocks not referenced from any leaf node.
+#[instrument(skip_all)]
+pub(super) async fn check_blocks(conn: &mut db::Connection) -> Result<bool, Error> {
     let count = db::decode_u64(
         sqlx::query(
             "SELECT COUNT(*)
@@ -45,8 +53,6 @@ pub(super) async fn check(conn: &mut db::Connection) -> Result<bool, Error> {
         return Ok(false);
     }
 
-    // TODO: Check for root nodes with invalid signatures
-    // TODO: Check for child nodes with invalid hashes
     // TODO: Check for blocks with invalid ids
 
     Ok(true)
@@ -5,7 +5,7 @@ use crate::{
     protocol::{BlockId, LeafNode, LeafNodes, SingleBlockPresence},
 };
 use futures_util::{Stream, TryStreamExt};
-use sqlx::Row;
+use sqlx::{QueryBuilder, Row};
 
 #[cfg(test)]
 use {super::inner_node, crate::protocol::INNER_LAYER_COUNT, async_recursion::async_recursion};
@@ -67,6 +67,7 @@ pub(super) fn load_locators<'a>(
 }
 
 /// Saves the node to the db unless it already exists.
+#[cfg(test)]
 async fn save(tx: &mut db::WriteTransaction, node: &LeafNode, parent: &Hash) -> Result<(), Error> {
     sqlx::query(
         "INSERT INTO snapshot_leaf_nodes (parent, locator, block_id, block_presence)
@@ -83,13 +84,32 @@ async fn save(tx: &mut db::WriteTransaction, node: &LeafNode, parent: &Hash) ->
     Ok(())
 }
 
+/// Saves all the nodes to the db, skipping those that already exist. The nodes are inserted using
+/// multi-row inserts to reduce the per statement overhead.
 pub(super) async fn save_all(
     tx: &mut db::WriteTransaction,
     nodes: &LeafNodes,
     parent: &Hash,
 ) -> Result<(), Error> {
-    for node in nodes {
-        save(tx, node, parent).await?;
+    // Each row binds 4 variables.
+    const BATCH_SIZE: usize = db::MAX_VARIABLES / 4;
+
+    let nodes: Vec<_> = nodes.into_iter().collect();
+
+    for batch in nodes.chunks(BATCH_SIZE) {
+        let mut builder = QueryBuilder::new(
+            "INSERT INTO snapshot_leaf_nodes (parent, locator, block_id, block_presence) ",
+        );
+
+        builder.push_values(batch, |mut row, node| {
+            row.push_bind(parent)
+                .push_bind(&node.locator)
+                .push_bind(&node.block_id)
+                .push_bind(node.block_presence);
+        });
+
+        builder.push(" ON CONFLICT (parent, locator, block_id) DO NOTHING");
+        builder.build().execute(&mut *tx).await?;
     }
 
     Ok(())
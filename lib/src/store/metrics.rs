@@ -0,0 +1,24 @@
+use metrics::Histogram;
+
+/// Latency histograms of the store operations.
+pub(crate) struct StoreMetrics {
+    /// Time to read a block from the db.
+    pub block_read_time: Histogram,
+    /// Time to commit a write transaction.
+    pub commit_time: Histogram,
+    /// Time waiting for a read connection.
+    pub acquire_time: Histogram,
+    /// Time waiting for a write transaction to begin.
+    pub begin_write_time: Histogram,
+}
+
+impl StoreMetrics {
+    pub fn noop() -> Self {
+        Self {
+            block_read_time: Histogram::noop(),
+            commit_time: Histogram::noop(),
+            acquire_time: Histogram::noop(),
+            begin_write_time: Histogram::noop(),
+        }
+    }
+}
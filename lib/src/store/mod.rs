@@ -4,10 +4,12 @@ mod block_ids;
 mod cache;
 mod changeset;
 mod error;
+mod gc;
 mod index;
 mod inner_node;
 mod integrity;
 mod leaf_node;
+mod metrics;
 mod migrations;
 mod patch;
 mod quota;
@@ -21,15 +23,20 @@ pub use error::Error;
 pub use migrations::DATA_VERSION;
 
 pub(crate) use {
-    block_ids::BlockIdsPage, changeset::Changeset,
+    block_ids::{BlockIdsPage, MissingBlockIdsPage},
+    cache::{CacheCapacity, CacheMetrics},
+    changeset::Changeset,
+    gc::{CollectedBlockIdsPage, EligibleBlockIdsPage, ReachableBlocks},
     inner_node::ReceiveStatus as InnerNodeReceiveStatus,
-    leaf_node::ReceiveStatus as LeafNodeReceiveStatus, receive_filter::ReceiveFilter,
+    leaf_node::ReceiveStatus as LeafNodeReceiveStatus,
+    metrics::StoreMetrics,
+    receive_filter::ReceiveFilter,
     root_node::ReceiveStatus as RootNodeReceiveStatus,
 };
 
 use self::{
     block_expiration_tracker::BlockExpirationTracker,
-    cache::{Cache, CacheTransaction},
+    cache::{BlockCache, Cache, CacheTransaction},
     index::UpdateSummaryReason,
 };
 use crate::{
@@ -49,12 +56,12 @@ use crate::{
     storage_size::StorageSize,
     sync::broadcast_hash_set,
 };
-use futures_util::{Stream, TryStreamExt};
+use futures_util::{future, Stream, TryStreamExt};
 use std::{
     borrow::Cow,
     ops::{Deref, DerefMut},
     sync::Arc,
-    time::Duration,
+    time::{Duration, Instant},
 };
 // TODO: Consider creating an async `RwLock` in the `deadlock` module and use it here.
 use tokio::sync::RwLock;
@@ -64,19 +71,44 @@ use tokio::sync::RwLock;
 pub(crate) struct Store {
     db: db::Pool,
     cache: Arc<Cache>,
+    block_cache: Arc<BlockCache>,
     pub client_reload_index_tx: broadcast_hash_set::Sender<PublicKey>,
     block_expiration_tracker: Arc<RwLock<Option<Arc<BlockExpirationTracker>>>>,
+    metrics: Arc<StoreMetrics>,
 }
 
 impl Store {
     pub fn new(db: db::Pool) -> Self {
+        Self::with_cache(
+            db,
+            CacheCapacity::default(),
+            CacheMetrics::noop(),
+            CacheMetrics::noop(),
+            StoreMetrics::noop(),
+        )
+    }
+
+    /// Creates the store whose index node cache and decrypted block cache take approximately at
+    /// most the given amounts of memory.
+    pub fn with_cache(
+        db: db::Pool,
+        cache_capacity: CacheCapacity,
+        index_cache_metrics: CacheMetrics,
+        block_cache_metrics: CacheMetrics,
+        metrics: StoreMetrics,
+    ) -> Self {
         let client_reload_index_tx = broadcast_hash_set::channel().0;
 
         Self {
             db,
-            cache: Arc::new(Cache::new()),
+            cache: Arc::new(Cache::with_capacity(
+                cache_capacity.index,
+                index_cache_metrics,
+            )),
+            block_cache: Arc::new(BlockCache::new(cache_capacity.block, block_cache_metrics)),
             client_reload_index_tx,
             block_expiration_tracker: Arc::new(RwLock::new(None)),
+            metrics: Arc::new(metrics),
         }
     }
 
@@ -89,9 +121,15 @@ impl Store {
         migrations::run_data(self, this_writer_id, write_keys).await
     }
 
-    /// Check data integrity
+    /// Check data integrity. The individual checks run concurrently, each on its own connection.
     pub async fn check_integrity(&self) -> Result<bool, Error> {
-        integrity::check(self.acquire_read().await?.db()).await
+        let (nodes, blocks) = future::try_join(
+            async { integrity::check_nodes(self.acquire_read().await?.db()).await },
+            async { integrity::check_blocks(self.acquire_read().await?.db()).await },
+        )
+        .await?;
+
+        Ok(nodes && blocks)
     }
 
     pub async fn set_block_expiration(
@@ -120,6 +158,7 @@ impl Store {
             block_download_tracker,
             self.client_reload_index_tx.clone(),
             self.cache.clone(),
+            self.block_cache.clone(),
         )
         .await?;
 
@@ -143,35 +182,54 @@ impl Store {
 
     /// Acquires a `Reader`
     pub async fn acquire_read(&self) -> Result<Reader, Error> {
+        let start = Instant::now();
+        let conn = self.db.acquire().await?;
+        self.metrics.acquire_time.record(start.elapsed());
+
         Ok(Reader {
-            inner: Handle::Connection(self.db.acquire().await?),
+            inner: Handle::Connection(conn),
             cache: self.cache.begin(),
+            block_cache: self.block_cache.clone(),
             block_expiration_tracker: self.block_expiration_tracker.read().await.clone(),
+            metrics: self.metrics.clone(),
         })
     }
 
     /// Begins a `ReadTransaction`
     pub async fn begin_read(&self) -> Result<ReadTransaction, Error> {
+        let start = Instant::now();
+        let tx = self.db.begin_read().await?;
+        self.metrics.acquire_time.record(start.elapsed());
+
         Ok(ReadTransaction {
             inner: Reader {
-                inner: Handle::ReadTransaction(self.db.begin_read().await?),
+                inner: Handle::ReadTransaction(tx),
                 cache: self.cache.begin(),
+                block_cache: self.block_cache.clone(),
                 block_expiration_tracker: self.block_expiration_tracker.read().await.clone(),
+                metrics: self.metrics.clone(),
             },
         })
     }
 
     /// Begins a `WriteTransaction`
     pub async fn begin_write(&self) -> Result<WriteTransaction, Error> {
+        let start = Instant::now();
+        let tx = self.db.begin_write().await?;
+        self.metrics.begin_write_time.record(start.elapsed());
+
         Ok(WriteTransaction {
             inner: ReadTransaction {
                 inner: Reader {
-                    inner: Handle::WriteTransaction(self.db.begin_write().await?),
+                    inner: Handle::WriteTransaction(tx),
                     cache: self.cache.begin(),
+                    block_cache: self.block_cache.clone(),
                     block_expiration_tracker: self.block_expiration_tracker.read().await.clone(),
+                    metrics: self.metrics.clone(),
                 },
             },
             untrack_blocks: None,
+            evicted_blocks: Vec::new(),
         })
     }
 
@@ -254,7 +312,7 @@ impl Store {
     }
 
     pub fn receive_filter(&self) -> ReceiveFilter {
-        ReceiveFilter::new(self.db.clone())
+        ReceiveFilter::new(self.cache.received_nodes().clone())
     }
 
     /// Returns all block ids referenced from complete snapshots. The result is paginated (with
@@ -263,6 +321,24 @@ impl Store {
         BlockIdsPage::new(self.db.clone(), page_size)
     }
 
+    /// Returns the ids of all missing blocks referenced from the latest approved snapshot of any
+    /// branch. Paginated like `block_ids`.
+    pub fn missing_block_ids(&self, page_size: u32) -> MissingBlockIdsPage {
+        MissingBlockIdsPage::new(self.db.clone(), page_size)
+    }
+
+    /// Returns the blocks eligible for garbage collection in the given GC epoch (see
+    /// `WriteTransaction::begin_gc_epoch`). Paginated like `block_ids`.
+    pub fn eligible_block_ids(&self, epoch: u64, page_size: u32) -> EligibleBlockIdsPage {
+        EligibleBlockIdsPage::new(self.db.clone(), epoch, page_size)
+    }
+
+    /// Returns the blocks removed by the garbage collector (see
+    /// `WriteTransaction::remove_unreachable_block`). Paginated like `block_ids`.
+    pub fn collected_block_ids(&self, page_size: u32) -> CollectedBlockIdsPage {
+        CollectedBlockIdsPage::new(self.db.clone(), page_size)
+    }
+
     pub async fn debug_print_root_node(&self, printer: DebugPrinter) {
         match self.acquire_read().await {
             Ok(mut reader) => root_node::debug_print(reader.db(), printer).await,
@@ -287,10 +363,30 @@ impl Store {
 pub(crate) struct Reader {
     inner: Handle,
     cache: CacheTransaction,
+    block_cache: Arc<BlockCache>,
     block_expiration_tracker: Option<Arc<BlockExpirationTracker>>,
+    metrics: Arc<StoreMetrics>,
 }
 
 impl Reader {
+    /// Returns the decrypted content of the block if it's in the cache. Counts as a block read for
+    /// the purpose of block expiration.
+    pub fn get_cached_block(&self, id: &BlockId) -> Option<BlockContent> {
+        let content = self.block_cache.get(id)?;
+
+        if let Some(expiration_tracker) = &self.block_expiration_tracker {
+            expiration_tracker.handle_block_update(id, false);
+        }
+
+        Some(content)
+    }
+
+    /// Puts the decrypted content of the block into the cache. The cache is shared by all readers
+    /// of this store.
+    pub fn cache_block(&self, id: BlockId, content: BlockContent) {
+        self.block_cache.put(id, content);
+    }
+
     /// Reads a block from the store into a buffer.
     ///
     /// # Panics
@@ -301,7 +397,9 @@ impl Reader {
         id: &BlockId,
         content: &mut BlockContent,
     ) -> Result<BlockNonce, Error> {
+        let start = Instant::now();
         let result = block::read(self.db(), id, content).await;
+        self.metrics.block_read_time.record(start.elapsed());
 
         if let Some(expiration_tracker) = &self.block_expiration_tracker {
             let is_missing = matches!(result, Err(Error::BlockNotFound));
@@ -415,6 +513,11 @@ impl Reader {
         leaf_node::load_children(self.db(), parent_hash).await
     }
 
+    /// Load the hashes of all inner nodes in the snapshot with the given root hash.
+    pub async fn load_inner_node_hashes(&mut self, root_hash: &Hash) -> Result<Vec<Hash>, Error> {
+        inner_node::load_descendant_hashes(self.db(), root_hash).await
+    }
+
     pub fn load_locators<'a>(
         &'a mut self,
         block_id: &'a BlockId,
@@ -430,6 +533,20 @@ impl Reader {
         root_node::load_node_state_of_missing(self.db(), block_id).await
     }
 
+    /// Have any blocks been written since the start of the current garbage collection epoch?
+    pub async fn has_blocks_written_since_gc_epoch(&mut self) -> Result<bool, Error> {
+        gc::has_new_blocks(self.db()).await
+    }
+
+    /// Inserts all blocks referenced from the snapshots that are not approved yet into
+    /// `reachable`.
+    pub async fn load_unapproved_blocks(
+        &mut self,
+        reachable: &mut ReachableBlocks,
+    ) -> Result<(), Error> {
+        gc::load_unapproved(self.db(), reachable).await
+    }
+
     pub(super) fn missing_block_ids_in_branch<'a>(
         &'a mut self,
         branch_id: &'a PublicKey,
@@ -523,6 +640,8 @@ impl DerefMut for ReadTransaction {
 pub(crate) struct WriteTransaction {
     inner: ReadTransaction,
     untrack_blocks: Option<block_expiration_tracker::UntrackTransaction>,
+    // Blocks to evict from the block cache once the transaction is committed.
+    evicted_blocks: Vec<BlockId>,
 }
 
 impl WriteTransaction {
@@ -548,8 +667,13 @@ impl WriteTransaction {
                         },
                 },
             untrack_blocks,
+            evicted_blocks,
         } = self;
 
+        // Evicted only after the commit. Otherwise another reader could put the block back into
+        // the cache before the removal becomes visible to it.
+        evicted_blocks.push(*id);
+
         if let Some(tracker) = block_expiration_tracker {
             let untrack_tx = untrack_blocks.get_or_insert_with(|| tracker.begin_untrack_blocks());
             untrack_tx.untrack(*id);
@@ -558,6 +682,26 @@ impl WriteTransaction {
         Ok(())
     }
 
+    /// Removes the specified block because it's unreachable. Like `remove_block` but the block
+    /// is not requested from other replicas again unless it's later passed to
+    /// `uncollect_blocks`.
+    pub async fn remove_unreachable_block(&mut self, id: &BlockId) -> Result<(), Error> {
+        self.remove_block(id).await?;
+        gc::set_collected(self.db(), id).await
+    }
+
+    /// Starts a new garbage collection epoch and returns it. All blocks written before this call
+    /// are then returned from `Store::eligible_block_ids` for it, the ones written after are not.
+    pub async fn begin_gc_epoch(&mut self) -> Result<u64, Error> {
+        gc::begin_epoch(self.db()).await
+    }
+
+    /// Makes the given blocks, previously removed with `remove_unreachable_block`, requestable
+    /// again.
+    pub async fn uncollect_blocks(&mut self, block_ids: &[BlockId]) -> Result<(), Error> {
+        gc::uncollect(self.db(), block_ids).await
+    }
+
     pub async fn remove_branch(&mut self, root_node: &RootNode) -> Result<(), Error> {
         root_node::remove_older(self.db(), root_node).await?;
         root_node::remove(self.db(), root_node).await?;
@@ -626,7 +770,7 @@ impl WriteTransaction {
         }
 
         let request_children =
-            inner_node::filter_nodes_with_new_blocks(db, &nodes, receive_filter).await?;
+            inner_node::filter_nodes_with_new_blocks(db, cache, &nodes, receive_filter).await?;
 
         let mut nodes = nodes.into_inner().into_incomplete();
         inner_node::inherit_summaries(db, &mut nodes).await?;
@@ -700,36 +844,18 @@ impl WriteTransaction {
     }
 
     pub async fn commit(self) -> Result<(), Error> {
-        let inner = self.inner.inner.inner.into_write();
-        let cache = self.inner.inner.cache;
+        let metrics = self.inner.inner.metrics.clone();
+        let start = Instant::now();
 
-        match (cache.is_dirty(), self.untrack_blocks) {
-            (true, Some(untrack)) => {
-                inner
-                    .commit_and_then(move || {
-                        cache.commit();
-                        untrack.commit();
-                    })
-                    .await?
-            }
-            (false, Some(untrack)) => {
-                inner
-                    .commit_and_then(move || {
-                        untrack.commit();
-                    })
-                    .await?
-            }
-            (true, None) => {
-                inner
-                    .commit_and_then(move || {
-                        cache.commit();
-                    })
-                    .await?
-            }
-            (false, None) => {
-                inner.commit().await?;
-            }
-        };
+        let (inner, on_commit) = self.into_db_and_on_commit();
+
+        if let Some(on_commit) = on_commit {
+            inner.commit_and_then(on_commit).await?;
+        } else {
+            inner.commit().await?;
+        }
+
+        metrics.commit_time.record(start.elapsed());
 
         Ok(())
     }
@@ -749,7 +875,7 @@ impl WriteTransaction {
 
         for _ in 0..INNER_LAYER_COUNT {
             for node in &nodes {
-                receive_filter.remove(self.db(), node).await?;
+                receive_filter.remove(node);
 
                 let mut parents = inner_node::load_parent_hashes(self.db(), node);
 
@@ -776,39 +902,60 @@ impl WriteTransaction {
         F: FnOnce() -> R + Send + 'static,
         R: Send + 'static,
     {
+        let metrics = self.inner.inner.metrics.clone();
+        let start = Instant::now();
+
+        let (inner, on_commit) = self.into_db_and_on_commit();
+
+        let output = if let Some(on_commit) = on_commit {
+            inner
+                .commit_and_then(move || {
+                    on_commit();
+                    f()
+                })
+                .await?
+        } else {
+            inner.commit_and_then(f).await?
+        };
+
+        metrics.commit_time.record(start.elapsed());
+
+        Ok(output)
+    }
+
+    // Splits this transaction into the underlying database transaction and the changes to the
+    // in-memory state that must be applied only after it's been successfully committed (or `None`
+    // if there are no such changes).
+    fn into_db_and_on_commit(
+        self,
+    ) -> (db::WriteTransaction, Option<impl FnOnce() + Send + 'static>) {
         let inner = self.inner.inner.inner.into_write();
         let cache = self.inner.inner.cache;
+        let block_cache = self.inner.inner.block_cache;
+        let untrack = self.untrack_blocks;
+        let evicted_blocks = self.evicted_blocks;
+
+        let cache_dirty = cache.is_dirty();
+
+        if !cache_dirty && untrack.is_none() && evicted_blocks.is_empty() {
+            return (inner, None);
+        }
 
-        Ok(match (cache.is_dirty(), self.untrack_blocks) {
-            (true, Some(untrack)) => {
-                inner
-                    .commit_and_then(move || {
-                        cache.commit();
-                        untrack.commit();
-                        f()
-                    })
-                    .await?
+        let on_commit = move || {
+            if cache_dirty {
+                cache.commit();
             }
-            (false, Some(untrack)) => {
-                inner
-                    .commit_and_then(move || {
-                        untrack.commit();
-                        f()
-                    })
-                    .await?
+
+            if let Some(untrack) = untrack {
+                untrack.commit();
             }
-            (true, None) => {
-                inner
-                    .commit_and_then(move || {
-                        cache.commit();
-                        f()
-                    })
-                    .await?
+
+            for id in &evicted_blocks {
+                block_cache.remove(id);
             }
-            (false, None) => inner.commit_and_then(f).await?,
-        })
+        };
 
-        //Ok(inner.commit_and_then(then).await?)
+        (inner, Some(on_commit))
     }
 
     // Access the underlying database transaction.
@@ -1,155 +1,273 @@
-use super::error::Error;
-use crate::{crypto::Hash, db, protocol::MultiBlockPresence};
-use sqlx::Row;
-use std::sync::atomic::{AtomicU64, Ordering};
-use tokio::task;
+use crate::{collections::HashMap, crypto::Hash, protocol::MultiBlockPresence};
+use deadlock::BlockingMutex;
+use lru::LruCache;
+use std::sync::{
+    atomic::{AtomicU64, Ordering},
+    Arc,
+};
+
+// Max number of nodes remembered per filter. Forgetting a node is safe, at worst it gets processed
+// again.
+const MAX_NODES_PER_FILTER: usize = 64 * 1024;
 
 /// Filter for received nodes to avoid processing a node that doesn't contain any new information
 /// compared to the last time we received that same node.
 pub(crate) struct ReceiveFilter {
     id: u64,
-    db: db::Pool,
+    nodes: Arc<ReceivedNodes>,
 }
 
 impl ReceiveFilter {
-    pub(super) fn new(db: db::Pool) -> Self {
+    pub(super) fn new(nodes: Arc<ReceivedNodes>) -> Self {
         static NEXT_ID: AtomicU64 = AtomicU64::new(0);
 
-        Self {
-            id: NEXT_ID.fetch_add(1, Ordering::Relaxed),
-            db,
-        }
+        let id = NEXT_ID.fetch_add(1, Ordering::Relaxed);
+        nodes.insert_client(id);
+
+        Self { id, nodes }
     }
 
-    pub async fn reset(&self) -> Result<(), Error> {
-        try_remove_all(&self.db, self.id).await
+    pub fn reset(&self) {
+        self.nodes.insert_client(self.id);
     }
 
-    pub async fn check(
+    /// Returns whether the node contains new information. If so, its block presence is recorded
+    /// in `tx` and gets into the filter only when `tx` is committed.
+    pub(super) fn check(
         &self,
-        tx: &mut db::WriteTransaction,
+        tx: &mut ReceiveFilterTransaction,
         hash: &Hash,
         new_presence: &MultiBlockPresence,
-    ) -> Result<bool, Error> {
-        if let Some((row_id, old_presence)) = load(tx, self.id, hash).await? {
+    ) -> bool {
+        let old_presence = self
+            .nodes
+            .0
+            .lock()
+            .unwrap()
+            .get_mut(&self.id)
+            .and_then(|nodes| nodes.get(hash).copied());
+
+        if let Some(old_presence) = old_presence {
             if !old_presence.is_outdated(new_presence) {
-                return Ok(false);
+                return false;
             }
-
-            update(tx, row_id, new_presence).await?;
-        } else {
-            insert(tx, self.id, hash, new_presence).await?;
         }
 
-        Ok(true)
+        tx.updates.push(Update::Seen {
+            client_id: self.id,
+            hash: *hash,
+            presence: *new_presence,
+        });
+
+        true
     }
 
-    pub async fn remove(&self, tx: &mut db::WriteTransaction, hash: &Hash) -> Result<(), Error> {
-        sqlx::query("DELETE FROM received_nodes WHERE hash = ? AND client_id = ?")
-            .bind(hash)
-            .bind(db::encode_u64(self.id))
-            .execute(tx)
-            .await?;
-        Ok(())
+    /// Records a node that is not stored locally. If any filter has seen it before, the node must
+    /// have been removed since, so those entries are discarded. Like `check`, this takes effect
+    /// only when `tx` is committed.
+    pub(super) fn insert_missing(
+        &self,
+        tx: &mut ReceiveFilterTransaction,
+        hash: &Hash,
+        presence: &MultiBlockPresence,
+    ) {
+        tx.updates.push(Update::Missing {
+            client_id: self.id,
+            hash: *hash,
+            presence: *presence,
+        });
+    }
+
+    pub fn remove(&self, hash: &Hash) {
+        if let Some(nodes) = self.nodes.0.lock().unwrap().get_mut(&self.id) {
+            nodes.pop(hash);
+        }
     }
 }
 
 impl Drop for ReceiveFilter {
     fn drop(&mut self) {
-        task::spawn(remove_all(self.db.clone(), self.id));
+        self.nodes.remove_client(self.id);
     }
 }
 
-pub(super) async fn remove(tx: &mut db::WriteTransaction, hash: &Hash) -> Result<(), Error> {
-    sqlx::query("DELETE FROM received_nodes WHERE hash = ?")
-        .bind(hash)
-        .execute(tx)
-        .await?;
-    Ok(())
+/// Block presence of the received nodes as last seen by each `ReceiveFilter`, keyed by the filter
+/// id. Kept in memory only because the entries don't outlive their filters anyway.
+#[derive(Default)]
+pub(super) struct ReceivedNodes(BlockingMutex<HashMap<u64, LruCache<Hash, MultiBlockPresence>>>);
+
+impl ReceivedNodes {
+    /// Removes the node from all the filters.
+    pub fn remove(&self, hash: &Hash) {
+        for nodes in self.0.lock().unwrap().values_mut() {
+            nodes.pop(hash);
+        }
+    }
+
+    // Registers the filter, discarding its entries if it's already registered.
+    fn insert_client(&self, client_id: u64) {
+        let old = self
+            .0
+            .lock()
+            .unwrap()
+            .insert(client_id, LruCache::unbounded());
+
+        // Free the entries (up to `MAX_NODES_PER_FILTER`) only after the lock is released so the
+        // other filters don't wait for it.
+        drop(old);
+    }
+
+    fn remove_client(&self, client_id: u64) {
+        let old = self.0.lock().unwrap().remove(&client_id);
+
+        // Same as in `insert_client`.
+        drop(old);
+    }
 }
 
-async fn load(
-    conn: &mut db::Connection,
-    client_id: u64,
-    hash: &Hash,
-) -> Result<Option<(u64, MultiBlockPresence)>, Error> {
-    let row = sqlx::query(
-        "SELECT rowid, block_presence
-         FROM received_nodes
-         WHERE client_id = ? AND hash = ?",
-    )
-    .bind(db::encode_u64(client_id))
-    .bind(hash)
-    .fetch_optional(conn)
-    .await?;
-
-    let row = if let Some(row) = row {
-        row
-    } else {
-        return Ok(None);
-    };
-
-    let id = db::decode_u64(row.get(0));
-    let presence = row.get(1);
-
-    Ok(Some((id, presence)))
+/// Updates of the receive filters made during a store transaction.
+#[derive(Default)]
+pub(super) struct ReceiveFilterTransaction {
+    updates: Vec<Update>,
 }
 
-async fn insert(
-    conn: &mut db::Connection,
-    client_id: u64,
-    hash: &Hash,
-    presence: &MultiBlockPresence,
-) -> Result<(), Error> {
-    sqlx::query(
-        "INSERT INTO received_nodes
-         (client_id, hash, block_presence)
-         VALUES (?, ?, ?)",
-    )
-    .bind(db::encode_u64(client_id))
-    .bind(hash)
-    .bind(presence)
-    .execute(conn)
-    .await?;
-
-    Ok(())
+impl ReceiveFilterTransaction {
+    pub fn is_empty(&self) -> bool {
+        self.updates.is_empty()
+    }
+
+    pub fn commit(self, nodes: &ReceivedNodes) {
+        let mut filters = nodes.0.lock().unwrap();
+
+        for update in self.updates {
+            match update {
+                Update::Seen {
+                    client_id,
+                    hash,
+                    presence,
+                } => {
+                    // The filter might have been dropped or reset in the meantime.
+                    if let Some(nodes) = filters.get_mut(&client_id) {
+                        put(nodes, hash, presence);
+                    }
+                }
+                Update::Missing {
+                    client_id,
+                    hash,
+                    presence,
+                } => {
+                    for nodes in filters.values_mut() {
+                        nodes.pop(&hash);
+                    }
+
+                    if let Some(nodes) = filters.get_mut(&client_id) {
+                        put(nodes, hash, presence);
+                    }
+                }
+            }
+        }
+    }
 }
 
-async fn update(
-    conn: &mut db::Connection,
-    row_id: u64,
-    presence: &MultiBlockPresence,
-) -> Result<(), Error> {
-    sqlx::query(
-        "UPDATE received_nodes
-         SET block_presence = ?
-         WHERE rowid = ?",
-    )
-    .bind(presence)
-    .bind(db::encode_u64(row_id))
-    .execute(conn)
-    .await?;
-
-    Ok(())
+enum Update {
+    Seen {
+        client_id: u64,
+        hash: Hash,
+        presence: MultiBlockPresence,
+    },
+    Missing {
+        client_id: u64,
+        hash: Hash,
+        presence: MultiBlockPresence,
+    },
 }
 
-async fn remove_all(pool: db::Pool, client_id: u64) {
-    if let Err(error) = try_remove_all(&pool, client_id).await {
-        tracing::error!(
-            "Failed to cleanup ReceiveFilter(client_id: {}): {:?}",
-            client_id,
-            error
-        );
+// Not using a bounded `LruCache` because that one preallocates its whole capacity.
+fn put(nodes: &mut LruCache<Hash, MultiBlockPresence>, hash: Hash, presence: MultiBlockPresence) {
+    if nodes.len() >= MAX_NODES_PER_FILTER && !nodes.contains(&hash) {
+        nodes.pop_lru();
     }
+
+    nodes.put(hash, presence);
 }
 
-async fn try_remove_all(pool: &db::Pool, client_id: u64) -> Result<(), Error> {
-    let mut tx = pool.begin_write().await?;
-    sqlx::query("DELETE FROM received_nodes WHERE client_id = ?")
-        .bind(db::encode_u64(client_id))
-        .execute(&mut tx)
-        .await?;
-    tx.commit().await?;
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn check() {
+        let nodes = Arc::new(ReceivedNodes::default());
+        let filter = ReceiveFilter::new(nodes.clone());
+        let hash = rand::random();
+
+        let mut presence = MultiBlockPresence::None;
 
-    Ok(())
+        assert!(check_and_commit(&nodes, &filter, &hash, &presence));
+        assert!(!check_and_commit(&nodes, &filter, &hash, &presence));
+
+        presence = MultiBlockPresence::Full;
+        assert!(check_and_commit(&nodes, &filter, &hash, &presence));
+        assert!(!check_and_commit(&nodes, &filter, &hash, &presence));
+
+        // Other filters are not affected
+        let other = ReceiveFilter::new(nodes.clone());
+        assert!(check_and_commit(&nodes, &other, &hash, &presence));
+
+        nodes.remove(&hash);
+        assert!(check_and_commit(&nodes, &filter, &hash, &presence));
+        assert!(check_and_commit(&nodes, &other, &hash, &presence));
+
+        // Inserting a missing node discards the entries of all the filters
+        let mut tx = ReceiveFilterTransaction::default();
+        other.insert_missing(&mut tx, &hash, &presence);
+        tx.commit(&nodes);
+
+        assert!(check_and_commit(&nodes, &filter, &hash, &presence));
+        assert!(!check_and_commit(&nodes, &other, &hash, &presence));
+    }
+
+    #[test]
+    fn uncommitted_updates_are_discarded() {
+        let nodes = Arc::new(ReceivedNodes::default());
+        let filter = ReceiveFilter::new(nodes.clone());
+        let hash = rand::random();
+        let presence = MultiBlockPresence::Full;
+
+        let mut tx = ReceiveFilterTransaction::default();
+        assert!(filter.check(&mut tx, &hash, &presence));
+        drop(tx);
+
+        assert!(check_and_commit(&nodes, &filter, &hash, &presence));
+    }
+
+    #[test]
+    fn drop_removes_entries() {
+        let nodes = Arc::new(ReceivedNodes::default());
+        let filter = ReceiveFilter::new(nodes.clone());
+        let other = ReceiveFilter::new(nodes.clone());
+
+        assert!(check_and_commit(
+            &nodes,
+            &filter,
+            &rand::random(),
+            &MultiBlockPresence::Full
+        ));
+        drop(filter);
+        drop(other);
+
+        assert!(nodes.0.lock().unwrap().is_empty());
+    }
+
+    fn check_and_commit(
+        nodes: &ReceivedNodes,
+        filter: &ReceiveFilter,
+        hash: &Hash,
+        presence: &MultiBlockPresence,
+    ) -> bool {
+        let mut tx = ReceiveFilterTransaction::default();
+        let output = filter.check(&mut tx, hash, presence);
+        tx.commit(nodes);
+        output
+    }
 }
@@ -181,6 +181,66 @@ async fn remove_block() {
     assert!(!tx.block_exists(&block_id).await.unwrap());
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn remove_block_evicts_from_cache_on_commit() {
+    let (_base_dir, store) = setup().await;
+
+    let read_key = SecretKey::random();
+    let write_keys = Keypair::random();
+    let branch_id = PublicKey::random();
+
+    let block: Block = rand::random();
+    let block_id = block.id;
+    let content = block.content.clone();
+
+    let mut tx = store.begin_write().await.unwrap();
+    let mut changeset = Changeset::new();
+    changeset.write_block(block);
+    changeset.link_block(
+        Locator::head(rand::random()).encode(&read_key),
+        block_id,
+        SingleBlockPresence::Present,
+    );
+    changeset
+        .apply(&mut tx, &branch_id, &write_keys)
+        .await
+        .unwrap();
+    tx.commit().await.unwrap();
+
+    store
+        .acquire_read()
+        .await
+        .unwrap()
+        .cache_block(block_id, content);
+
+    // Not evicted when the transaction is rolled back.
+    let mut tx = store.begin_write().await.unwrap();
+    tx.remove_block(&block_id).await.unwrap();
+    assert!(store
+        .acquire_read()
+        .await
+        .unwrap()
+        .get_cached_block(&block_id)
+        .is_some());
+    drop(tx);
+    assert!(store
+        .acquire_read()
+        .await
+        .unwrap()
+        .get_cached_block(&block_id)
+        .is_some());
+
+    let mut tx = store.begin_write().await.unwrap();
+    tx.remove_block(&block_id).await.unwrap();
+    tx.commit().await.unwrap();
+    assert!(store
+        .acquire_read()
+        .await
+        .unwrap()
+        .get_cached_block(&block_id)
+        .is_none());
+}
+
 #[tokio::test(flavor = "multi_thread")]
 async fn overwrite_block() {
     let (_base_dir, store) = setup().await;
@@ -229,6 +289,113 @@ async fn overwrite_block() {
     assert_eq!(tx.count_blocks().await.unwrap(), 1);
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn gc_epochs() {
+    let (_base_dir, store) = setup().await;
+    let mut rng = rand::thread_rng();
+
+    let read_key = SecretKey::random();
+    let write_keys = Keypair::random();
+    let branch_id = PublicKey::random();
+
+    let blocks: Vec<Block> = (0..3).map(|_| rng.gen()).collect();
+    let block_ids: Vec<_> = blocks.iter().map(|block| block.id).collect();
+
+    let mut tx = store.begin_write().await.unwrap();
+    let mut changeset = Changeset::new();
+    for block in blocks {
+        let locator = random_head_locator().encode(&read_key);
+        changeset.link_block(locator, block.id, SingleBlockPresence::Present);
+        changeset.write_block(block);
+    }
+    changeset
+        .apply(&mut tx, &branch_id, &write_keys)
+        .await
+        .unwrap();
+
+    assert!(tx.has_blocks_written_since_gc_epoch().await.unwrap());
+
+    let epoch = tx.begin_gc_epoch().await.unwrap();
+    assert!(!tx.has_blocks_written_since_gc_epoch().await.unwrap());
+
+    // Blocks written during the epoch are not eligible for collection in it.
+    let new_block: Block = rng.gen();
+    let new_block_id = new_block.id;
+    let mut changeset = Changeset::new();
+    changeset.link_block(
+        random_head_locator().encode(&read_key),
+        new_block.id,
+        SingleBlockPresence::Present,
+    );
+    changeset.write_block(new_block);
+    changeset
+        .apply(&mut tx, &branch_id, &write_keys)
+        .await
+        .unwrap();
+
+    tx.commit().await.unwrap();
+
+    let mut eligible = store
+        .eligible_block_ids(epoch, u32::MAX)
+        .next()
+        .await
+        .unwrap();
+    eligible.sort();
+
+    let mut expected = block_ids.clone();
+    expected.sort();
+
+    assert_eq!(eligible, expected);
+    assert!(!eligible.contains(&new_block_id));
+
+    // Collected blocks are not requested again...
+    let mut tx = store.begin_write().await.unwrap();
+    tx.remove_unreachable_block(&block_ids[1]).await.unwrap();
+    tx.commit().await.unwrap();
+
+    assert_eq!(
+        store.missing_block_ids(u32::MAX).next().await.unwrap(),
+        Vec::<BlockId>::new()
+    );
+
+    // ...unless they are found reachable later.
+    let mut reachable = ReachableBlocks::new(1);
+    reachable.insert(&block_ids[1]);
+
+    let collected = store.collected_block_ids(u32::MAX).next().await.unwrap();
+    assert_eq!(collected, vec![block_ids[1]]);
+    assert!(reachable.contains(&collected[0]));
+
+    let mut tx = store.begin_write().await.unwrap();
+    tx.uncollect_blocks(&collected).await.unwrap();
+    tx.commit().await.unwrap();
+
+    assert_eq!(
+        store.missing_block_ids(u32::MAX).next().await.unwrap(),
+        vec![block_ids[1]]
+    );
+}
+
+#[test]
+fn gc_reachable_blocks() {
+    let mut rng = rand::thread_rng();
+
+    let inserted: Vec<BlockId> = (0..1000).map(|_| rng.gen()).collect();
+    let mut reachable = ReachableBlocks::new(inserted.len() as u64);
+
+    for block_id in &inserted {
+        reachable.insert(block_id);
+    }
+
+    assert!(inserted.iter().all(|block_id| reachable.contains(block_id)));
+
+    let false_positives = (0..10000)
+        .map(|_| rng.gen::<BlockId>())
+        .filter(|block_id| reachable.contains(block_id))
+        .count();
+    assert!(false_positives < 50, "false_positives: {false_positives}");
+}
+
 #[ignore]
 #[tokio::test(flavor = "multi_thread")]
 async fn fallback() {
@@ -128,8 +128,22 @@ pub(crate) mod env {
 
     impl<'a> Env<'a> {
         pub fn new() -> Self {
+            Self::with_builder(turmoil::Builder::new())
+        }
+
+        /// Creates the environment whose network links delay each message by up to `latency` and
+        /// fail with the probability `loss` (per simulation step).
+        #[allow(unused)] // https://github.com/rust-lang/rust/issues/46379
+        pub fn with_link(latency: Duration, fail_rate: f64) -> Self {
+            let mut builder = turmoil::Builder::new();
+            builder.max_message_latency(latency).fail_rate(fail_rate);
+
+            Self::with_builder(builder)
+        }
+
+        fn with_builder(mut builder: turmoil::Builder) -> Self {
             let context = Context::new(&Handle::current());
-            let runner = turmoil::Builder::new()
+            let runner = builder
                 .simulation_duration(Duration::from_secs(90))
                 .build_with_rng(Box::new(rand::thread_rng()));
 
@@ -1,12 +1,16 @@
 mod add_labels;
+mod borrowed;
+#[cfg(feature = "influxdb")]
 mod influxdb;
 mod pair;
 mod shared;
 mod watch_recorder;
 
+#[cfg(feature = "influxdb")]
+pub use self::influxdb::{InfluxDbParams, InfluxDbRecorder};
 pub use self::{
     add_labels::AddLabels,
-    influxdb::{InfluxDbParams, InfluxDbRecorder},
+    borrowed::Borrowed,
     pair::Pair,
     shared::Shared,
     watch_recorder::{WatchRecorder, WatchRecorderSubscriber},
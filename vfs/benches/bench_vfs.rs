@@ -2,11 +2,11 @@ use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criteri
 use ouisync_lib::{Access, Repository, RepositoryParams, WriteSecrets};
 use ouisync_vfs::MountGuard;
 use rand::{rngs::StdRng, Rng, SeedableRng};
-use std::path::Path;
+use std::{fs, path::Path};
 use tempfile::TempDir;
 use tokio::runtime::{Handle, Runtime};
 
-criterion_group!(default, write_file);
+criterion_group!(default, write_file, read_file, create_files, read_dir, stat);
 criterion_main!(default);
 
 fn write_file(c: &mut Criterion) {
@@ -30,6 +30,101 @@ fn write_file(c: &mut Criterion) {
     group.finish();
 }
 
+fn read_file(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let file_size = 1024 * 1024;
+
+    let mut group = c.benchmark_group("vfs/read_file");
+    group.sample_size(50);
+    group.throughput(Throughput::Bytes(file_size));
+    group.bench_function(BenchmarkId::from_parameter(file_size), |b| {
+        b.iter_batched_ref(
+            || {
+                let (mut rng, base_dir, mount_guard) = runtime.block_on(utils::setup());
+                let file_path = base_dir.path().join("mnt").join("file.dat");
+                utils::write_file(&mut rng, &file_path, file_size);
+
+                (file_path, base_dir, mount_guard)
+            },
+            |(file_path, _base_dir, _mount_guard)| {
+                utils::read_file(file_path);
+            },
+            BatchSize::LargeInput,
+        );
+    });
+    group.finish();
+}
+
+/// Create many small files. Measures mostly the per-file overhead of the `create`, `write` and
+/// `release` calls.
+fn create_files(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("vfs/create_files");
+    group.sample_size(10);
+
+    for count in [64, 512] {
+        group.throughput(Throughput::Elements(count));
+        group.bench_function(BenchmarkId::from_parameter(count), |b| {
+            b.iter_batched_ref(
+                || runtime.block_on(utils::setup()),
+                |(rng, base_dir, _mount_guard)| {
+                    utils::write_files(rng, &base_dir.path().join("mnt"), count);
+                },
+                BatchSize::LargeInput,
+            );
+        });
+    }
+    group.finish();
+}
+
+/// List a directory with many entries (`opendir`, `readdir` and `releasedir`).
+fn read_dir(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let mut group = c.benchmark_group("vfs/read_dir");
+
+    for count in [16, 256] {
+        let (mut rng, base_dir, mount_guard) = runtime.block_on(utils::setup());
+        let dir_path = base_dir.path().join("mnt");
+        utils::write_files(&mut rng, &dir_path, count);
+
+        group.throughput(Throughput::Elements(count));
+        group.bench_function(BenchmarkId::from_parameter(count), |b| {
+            b.iter(|| fs::read_dir(&dir_path).unwrap().count());
+        });
+
+        drop(mount_guard);
+    }
+    group.finish();
+}
+
+/// Get the metadata of every file in a directory (`lookup` and `getattr`).
+fn stat(c: &mut Criterion) {
+    let runtime = Runtime::new().unwrap();
+
+    let count = 64;
+
+    let mut group = c.benchmark_group("vfs/stat");
+
+    let (mut rng, base_dir, mount_guard) = runtime.block_on(utils::setup());
+    let dir_path = base_dir.path().join("mnt");
+    utils::write_files(&mut rng, &dir_path, count);
+
+    group.throughput(Throughput::Elements(count));
+    group.bench_function(BenchmarkId::from_parameter(count), |b| {
+        b.iter(|| {
+            for i in 0..count {
+                fs::metadata(dir_path.join(format!("{i}.dat"))).unwrap();
+            }
+        });
+    });
+    group.finish();
+
+    drop(mount_guard);
+}
+
 mod utils {
     use super::*;
     use std::{
@@ -39,7 +134,8 @@ mod utils {
     };
 
     pub async fn setup() -> (StdRng, TempDir, MountGuard) {
-        let mut rng = StdRng::from_entropy();
+        // Fixed seed so the results are comparable across runs.
+        let mut rng = StdRng::seed_from_u64(0);
         let base_dir = TempDir::new_in(env!("CARGO_TARGET_TMPDIR")).unwrap();
         let mount_dir = base_dir.path().join("mnt");
 
@@ -68,6 +164,18 @@ mod utils {
         io::copy(&mut src, &mut dst).unwrap();
     }
 
+    /// Write `count` small files named `0.dat`, `1.dat`, ... into the directory at `path`.
+    pub fn write_files(rng: &mut StdRng, path: &Path, count: u64) {
+        for i in 0..count {
+            write_file(rng, &path.join(format!("{i}.dat")), 1024);
+        }
+    }
+
+    pub fn read_file(path: &Path) -> u64 {
+        let mut src = File::open(path).unwrap();
+        io::copy(&mut src, &mut io::sink()).unwrap()
+    }
+
     struct RngRead<'a>(&'a mut StdRng);
 
     impl Read for RngRead<'_> {
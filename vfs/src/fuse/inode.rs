@@ -92,6 +92,34 @@ impl InodeMap {
         }
     }
 
+    // Find the inode of an entry, if it has one, without counting it as a lookup.
+    pub fn find(&self, parent: Inode, unique_name: &str) -> Option<Inode> {
+        let key = Key {
+            parent,
+            unique_name: unique_name.to_owned(),
+        };
+
+        self.reverse.get(&key).copied()
+    }
+
+    // Returns whether `inode` is `ancestor` itself or is (transitively) inside it.
+    pub fn is_within(&self, mut inode: Inode, ancestor: Inode) -> bool {
+        loop {
+            if inode == ancestor {
+                return true;
+            }
+
+            if inode == FUSE_ROOT_ID {
+                return false;
+            }
+
+            match self.forward.get(inode_to_index(inode)) {
+                Some(data) => inode = data.parent,
+                None => return false,
+            }
+        }
+    }
+
     // Forget the given number of lookups of the given inode. If the number of lookups drops to
     // zero, the inode is removed.
     pub fn forget(&mut self, inode: Inode, lookups: u64) {
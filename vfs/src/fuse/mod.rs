@@ -3,6 +3,7 @@ mod flags;
 mod inode;
 mod multi_repo_vfs;
 mod utils;
+mod write_back;
 
 pub use multi_repo_vfs::MultiRepoVFS;
 
@@ -11,6 +12,7 @@ use self::{
     flags::{OpenFlags, RenameFlags},
     inode::{Inode, InodeMap, InodeView, Representation},
     utils::{FormatOptionScope, MaybeOwnedMut},
+    write_back::{self, WriteBack},
 };
 use fuser::{
     BackgroundSession, FileAttr, FileType, KernelConfig, MountOption, ReplyAttr, ReplyCreate,
@@ -30,7 +32,11 @@ use std::{
     sync::Arc,
     time::SystemTime,
 };
-use tokio::time::Duration;
+use tokio::{
+    sync::Mutex as AsyncMutex,
+    task::JoinHandle,
+    time::{self, Duration},
+};
 use tracing::{instrument, Span};
 
 // Name of the filesystem.
@@ -117,22 +123,46 @@ macro_rules! record_fmt {
 
 struct VirtualFilesystem {
     rt: tokio::runtime::Handle,
-    inner: Inner,
+    // Shared with the task that commits the modifications older than `write_back::MAX_AGE`.
+    inner: Arc<AsyncMutex<Inner>>,
+    write_back_task: JoinHandle<()>,
 }
 
 impl VirtualFilesystem {
     fn new(runtime_handle: tokio::runtime::Handle, repository: Arc<Repository>) -> Self {
+        let inner = Arc::new(AsyncMutex::new(Inner {
+            repository,
+            inodes: InodeMap::new(),
+            entries: EntryMap::default(),
+            write_back: WriteBack::default(),
+        }));
+
+        let write_back_task = runtime_handle.spawn(commit_expired(inner.clone()));
+
         Self {
             rt: runtime_handle,
-            inner: Inner {
-                repository,
-                inodes: InodeMap::new(),
-                entries: EntryMap::default(),
-            },
+            inner,
+            write_back_task,
         }
     }
 }
 
+impl Drop for VirtualFilesystem {
+    fn drop(&mut self) {
+        self.write_back_task.abort();
+    }
+}
+
+// Periodically commits the modifications that have been uncommitted for too long.
+async fn commit_expired(inner: Arc<AsyncMutex<Inner>>) {
+    let mut interval = time::interval(write_back::CHECK_INTERVAL);
+
+    loop {
+        interval.tick().await;
+        inner.lock().await.commit_expired().await;
+    }
+}
+
 impl fuser::Filesystem for VirtualFilesystem {
     fn init(&mut self, _req: &Request, config: &mut KernelConfig) -> Result<(), c_int> {
         tracing::debug!(?config, "init");
@@ -147,7 +177,11 @@ impl fuser::Filesystem for VirtualFilesystem {
     }
 
     fn lookup(&mut self, _req: &Request, parent: Inode, name: &OsStr, reply: ReplyEntry) {
-        let attr = try_request!(self.rt.block_on(self.inner.lookup(parent, name)), reply);
+        let attr = try_request!(
+            self.rt
+                .block_on(self.inner.blocking_lock().lookup(parent, name)),
+            reply
+        );
         reply.entry(&TTL, &attr, 0)
     }
 
@@ -156,11 +190,14 @@ impl fuser::Filesystem for VirtualFilesystem {
     // called for the entries in `readdir` though (see the comment in that function for more
     // details).
     fn forget(&mut self, _req: &Request, inode: Inode, lookups: u64) {
-        self.inner.forget(inode, lookups)
+        self.inner.blocking_lock().forget(inode, lookups)
     }
 
     fn getattr(&mut self, _req: &Request, inode: Inode, reply: ReplyAttr) {
-        let attr = try_request!(self.rt.block_on(self.inner.getattr(inode)), reply);
+        let attr = try_request!(
+            self.rt.block_on(self.inner.blocking_lock().getattr(inode)),
+            reply
+        );
         reply.attr(&TTL, &attr)
     }
 
@@ -183,7 +220,7 @@ impl fuser::Filesystem for VirtualFilesystem {
         reply: ReplyAttr,
     ) {
         let attr = try_request!(
-            self.rt.block_on(self.inner.setattr(
+            self.rt.block_on(self.inner.blocking_lock().setattr(
                 inode, mode, uid, gid, size, atime, mtime, ctime, fh, crtime, chgtime, bkuptime,
                 flags,
             )),
@@ -194,7 +231,8 @@ impl fuser::Filesystem for VirtualFilesystem {
 
     fn opendir(&mut self, _req: &Request, inode: Inode, flags: i32, reply: ReplyOpen) {
         let handle = try_request!(
-            self.rt.block_on(self.inner.opendir(inode, flags.into())),
+            self.rt
+                .block_on(self.inner.blocking_lock().opendir(inode, flags.into())),
             reply
         );
         // TODO: what about `flags`?
@@ -209,7 +247,12 @@ impl fuser::Filesystem for VirtualFilesystem {
         flags: i32,
         reply: ReplyEmpty,
     ) {
-        try_request!(self.inner.releasedir(inode, handle, flags.into()), reply);
+        try_request!(
+            self.inner
+                .blocking_lock()
+                .releasedir(inode, handle, flags.into()),
+            reply
+        );
         reply.ok();
     }
 
@@ -222,8 +265,11 @@ impl fuser::Filesystem for VirtualFilesystem {
         mut reply: ReplyDirectory,
     ) {
         try_request!(
-            self.rt
-                .block_on(self.inner.readdir(inode, handle, offset, &mut reply)),
+            self.rt.block_on(
+                self.inner
+                    .blocking_lock()
+                    .readdir(inode, handle, offset, &mut reply)
+            ),
             reply
         );
         reply.ok();
@@ -240,19 +286,27 @@ impl fuser::Filesystem for VirtualFilesystem {
     ) {
         let attr = try_request!(
             self.rt
-                .block_on(self.inner.mkdir(parent, name, mode, umask)),
+                .block_on(self.inner.blocking_lock().mkdir(parent, name, mode, umask)),
             reply
         );
         reply.entry(&TTL, &attr, 0);
     }
 
     fn rmdir(&mut self, _req: &Request, parent: Inode, name: &OsStr, reply: ReplyEmpty) {
-        try_request!(self.rt.block_on(self.inner.rmdir(parent, name)), reply);
+        try_request!(
+            self.rt
+                .block_on(self.inner.blocking_lock().rmdir(parent, name)),
+            reply
+        );
         reply.ok();
     }
 
     fn unlink(&mut self, _req: &Request, parent: Inode, name: &OsStr, reply: ReplyEmpty) {
-        try_request!(self.rt.block_on(self.inner.unlink(parent, name)), reply);
+        try_request!(
+            self.rt
+                .block_on(self.inner.blocking_lock().unlink(parent, name)),
+            reply
+        );
         reply.ok();
     }
 
@@ -266,7 +320,7 @@ impl fuser::Filesystem for VirtualFilesystem {
     ) {
         try_request!(
             self.rt
-                .block_on(self.inner.fsyncdir(inode, handle, datasync)),
+                .block_on(self.inner.blocking_lock().fsyncdir(inode, handle, datasync)),
             reply
         );
         reply.ok();
@@ -283,10 +337,14 @@ impl fuser::Filesystem for VirtualFilesystem {
         reply: ReplyCreate,
     ) {
         let (attr, handle, flags) = try_request!(
-            self.rt.block_on(
-                self.inner
-                    .create(parent, name, mode, umask, flags.into(), req)
-            ),
+            self.rt.block_on(self.inner.blocking_lock().create(
+                parent,
+                name,
+                mode,
+                umask,
+                flags.into(),
+                req
+            )),
             reply
         );
         reply.created(&TTL, &attr, 0, handle, flags);
@@ -294,7 +352,8 @@ impl fuser::Filesystem for VirtualFilesystem {
 
     fn open(&mut self, _req: &Request, inode: Inode, flags: i32, reply: ReplyOpen) {
         let (handle, flags) = try_request!(
-            self.rt.block_on(self.inner.open(inode, flags.into())),
+            self.rt
+                .block_on(self.inner.blocking_lock().open(inode, flags.into())),
             reply
         );
         reply.opened(handle, flags);
@@ -311,8 +370,12 @@ impl fuser::Filesystem for VirtualFilesystem {
         reply: ReplyEmpty,
     ) {
         try_request!(
-            self.rt
-                .block_on(self.inner.release(inode, handle, flags.into(), flush)),
+            self.rt.block_on(self.inner.blocking_lock().release(
+                inode,
+                handle,
+                flags.into(),
+                flush
+            )),
             reply
         );
         reply.ok()
@@ -330,8 +393,13 @@ impl fuser::Filesystem for VirtualFilesystem {
         reply: ReplyData,
     ) {
         let data = try_request!(
-            self.rt
-                .block_on(self.inner.read(inode, handle, offset, size, flags.into())),
+            self.rt.block_on(self.inner.blocking_lock().read(
+                inode,
+                handle,
+                offset,
+                size,
+                flags.into()
+            )),
             reply
         );
         reply.data(&data);
@@ -352,8 +420,13 @@ impl fuser::Filesystem for VirtualFilesystem {
         // TODO: what about `write_flags` and `lock_owner`?
 
         let size = try_request!(
-            self.rt
-                .block_on(self.inner.write(inode, handle, offset, data, flags.into())),
+            self.rt.block_on(self.inner.blocking_lock().write(
+                inode,
+                handle,
+                offset,
+                data,
+                flags.into()
+            )),
             reply
         );
         reply.written(size);
@@ -367,7 +440,11 @@ impl fuser::Filesystem for VirtualFilesystem {
         _lock_owner: u64,
         reply: ReplyEmpty,
     ) {
-        try_request!(self.rt.block_on(self.inner.flush(inode, handle)), reply);
+        try_request!(
+            self.rt
+                .block_on(self.inner.blocking_lock().flush(inode, handle)),
+            reply
+        );
         reply.ok();
     }
 
@@ -380,7 +457,8 @@ impl fuser::Filesystem for VirtualFilesystem {
         reply: ReplyEmpty,
     ) {
         try_request!(
-            self.rt.block_on(self.inner.fsync(inode, handle, datasync)),
+            self.rt
+                .block_on(self.inner.blocking_lock().fsync(inode, handle, datasync)),
             reply
         );
         reply.ok();
@@ -397,7 +475,7 @@ impl fuser::Filesystem for VirtualFilesystem {
         reply: ReplyEmpty,
     ) {
         try_request!(
-            self.rt.block_on(self.inner.rename(
+            self.rt.block_on(self.inner.blocking_lock().rename(
                 src_parent,
                 src_name,
                 dst_parent,
@@ -414,6 +492,7 @@ struct Inner {
     repository: Arc<Repository>,
     inodes: InodeMap,
     entries: EntryMap,
+    write_back: WriteBack,
 }
 
 impl Inner {
@@ -438,6 +517,7 @@ impl Inner {
         };
 
         let inode = self.inodes.lookup(parent, entry.name(), name, repr);
+        let len = self.uncommitted_len(inode)?.unwrap_or(len);
 
         // TODO: uid, gid
         Ok(make_file_attr(inode, entry.entry_type(), len, 0, 0))
@@ -453,6 +533,12 @@ impl Inner {
     async fn getattr(&mut self, inode: Inode) -> Result<FileAttr> {
         self.record_path(inode, None);
 
+        // The committed length would be outdated if the file has uncommitted modifications.
+        if let Some(len) = self.uncommitted_len(inode)? {
+            // TODO: uid, gid
+            return Ok(make_file_attr(inode, EntryType::File, len, 0, 0));
+        }
+
         let entry = self.open_entry_by_inode(self.inodes.get(inode)).await?;
 
         // TODO: uid, gid
@@ -530,13 +616,24 @@ impl Inner {
         let mut file = if let Some(handle) = handle {
             MaybeOwnedMut::Borrowed(self.entries.get_file_mut(handle)?)
         } else {
+            self.commit_inode(inode).await?;
             MaybeOwnedMut::Owned(self.open_file_by_inode(inode).await?)
         };
 
         if let Some(size) = size {
             file.fork(local_branch).await?;
             file.truncate(size)?;
-            file.flush().await?;
+
+            // Truncating an open file (`ftruncate`) is committed together with the subsequent
+            // writes to it.
+            if let Some(handle) = handle {
+                if self.write_back.record(handle, inode) {
+                    file.flush().await?;
+                    self.write_back.clear(handle);
+                }
+            } else {
+                file.flush().await?;
+            }
         }
 
         Ok(make_file_attr(
@@ -713,20 +810,30 @@ impl Inner {
     async fn open(&mut self, inode: Inode, flags: OpenFlags) -> Result<(FileHandle, u32)> {
         self.record_path(inode, None);
 
+        // The file is opened in its committed state, so commit the modifications made through the
+        // other handles first (e.g., the file was written, closed but not released yet).
+        self.commit_inode(inode).await?;
+
         let mut file = self.open_file_by_inode(inode).await?;
+        let truncate = flags.contains(OpenFlags::TRUNC);
 
-        if flags.contains(OpenFlags::TRUNC) {
+        if truncate {
             let local_branch = self.repository.local_branch()?;
 
             file.fork(local_branch).await?;
             file.truncate(0)?;
-            file.flush().await?;
         }
 
         // TODO: what about other flags (parameter)?
 
         let handle = self.entries.insert(JointEntry::File(file));
 
+        // The truncation is committed together with the subsequent writes (typically the file is
+        // being overwritten), not on its own.
+        if truncate {
+            self.write_back.record(handle, inode);
+        }
+
         // TODO: what about flags (return value)?
 
         Ok((handle, 0))
@@ -743,15 +850,15 @@ impl Inner {
         self.record_path(inode, None);
 
         // TODO: what about `flags`?
-        let file = self.entries.get_file_mut(handle)?;
 
-        if flush {
-            file.flush().await?;
-        }
+        // Commit any pending modifications regardless of `flush`, including a truncation by `open`
+        // with `O_TRUNC` that wasn't followed by any write. This is the last chance to do so.
+        let result = self.entries.get_file_mut(handle)?.flush().await;
 
         self.entries.remove(handle);
+        self.write_back.clear(handle);
 
-        Ok(())
+        result
     }
 
     #[instrument(skip(self, inode, flags), fields(path, ?flags), err(Debug))]
@@ -815,6 +922,10 @@ impl Inner {
         // so we need to do `write_all` not just `write`.
         file.write_all(data).await?;
 
+        if self.write_back.record(handle, inode) {
+            self.commit(handle).await?;
+        }
+
         Ok(data.len().try_into().unwrap_or(u32::MAX))
     }
 
@@ -822,7 +933,13 @@ impl Inner {
     async fn flush(&mut self, inode: Inode, handle: FileHandle) -> Result<()> {
         self.record_path(inode, None);
 
-        self.entries.get_file_mut(handle)?.flush().await
+        // Called on every `close` of the handle. The modifications are not committed here but
+        // on `release` (after the last `close`) or once they get too old (see `WriteBack`).
+        // Operations that would observe the committed state in the meantime commit them first
+        // (see `commit_inode` and `commit_subtree`).
+        self.entries.get_file_mut(handle)?;
+
+        Ok(())
     }
 
     #[instrument(skip(self, inode), fields(path), err(Debug))]
@@ -830,7 +947,7 @@ impl Inner {
         self.record_path(inode, None);
 
         // TODO: what about `datasync`?
-        self.entries.get_file_mut(handle)?.flush().await
+        self.commit(handle).await
     }
 
     #[instrument(skip(self, parent, name), fields(path), err(Debug))]
@@ -838,6 +955,11 @@ impl Inner {
         let name = name.to_str().ok_or(Error::NonUtf8FileName)?;
         self.record_path(parent, Some(name));
 
+        // A handle with uncommitted modifications would recreate the file when committed later.
+        if let Some(inode) = self.inodes.find(parent, name) {
+            self.commit_inode(inode).await?;
+        }
+
         let path = self.inodes.get(parent).calculate_path().join(name);
         self.repository.remove_entry(path).await?;
         Ok(())
@@ -875,6 +997,17 @@ impl Inner {
             self.inodes.path_display(dst_parent, Some(dst_name)),
         );
 
+        // The uncommitted modifications of the moved file (or of any file inside the moved
+        // directory) would be committed to the old path later.
+        if let Some(inode) = self.inodes.find(src_parent, src_name) {
+            self.commit_subtree(inode).await?;
+        }
+
+        // Likewise, those of the file being replaced would overwrite the moved entry.
+        if let Some(inode) = self.inodes.find(dst_parent, dst_name) {
+            self.commit_inode(inode).await?;
+        }
+
         let src_dir = self.inodes.get(src_parent).calculate_path();
 
         let dst_dir = if src_parent == dst_parent {
@@ -889,6 +1022,56 @@ impl Inner {
             .await
     }
 
+    // Commits the uncommitted modifications of the given handle.
+    async fn commit(&mut self, handle: FileHandle) -> Result<()> {
+        self.entries.get_file_mut(handle)?.flush().await?;
+        self.write_back.clear(handle);
+
+        Ok(())
+    }
+
+    // Commits the uncommitted modifications of all the handles of the given inode.
+    async fn commit_inode(&mut self, inode: Inode) -> Result<()> {
+        for handle in self.write_back.dirty_handles(inode) {
+            self.commit(handle).await?;
+        }
+
+        Ok(())
+    }
+
+    // Commits the uncommitted modifications of all the handles of the given inode and, if it's a
+    // directory, of all the inodes inside it.
+    async fn commit_subtree(&mut self, inode: Inode) -> Result<()> {
+        let handles = self
+            .write_back
+            .dirty_handles_where(|dirty_inode| self.inodes.is_within(dirty_inode, inode));
+
+        for handle in handles {
+            self.commit(handle).await?;
+        }
+
+        Ok(())
+    }
+
+    // Commits the modifications older than `write_back::MAX_AGE`.
+    async fn commit_expired(&mut self) {
+        for handle in self.write_back.expired() {
+            if let Err(error) = self.commit(handle).await {
+                tracing::error!(handle, ?error, "failed to commit expired modifications");
+            }
+        }
+    }
+
+    // Length of the file with the given inode including the modifications that are not committed
+    // yet (e.g., the truncation by `open` with `O_TRUNC`), if there are any.
+    fn uncommitted_len(&mut self, inode: Inode) -> Result<Option<u64>> {
+        let Some(handle) = self.write_back.dirty_handle(inode) else {
+            return Ok(None);
+        };
+
+        Ok(Some(self.entries.get_file_mut(handle)?.len()))
+    }
+
     async fn open_file_by_inode(&self, inode: Inode) -> Result<File> {
         let inode = self.inodes.get(inode);
         let branch_id = inode.representation().file_version()?;
@@ -0,0 +1,165 @@
+use super::{entry_map::FileHandle, inode::Inode};
+use std::{
+    collections::HashMap,
+    time::{Duration, Instant},
+};
+
+// Modifications of an open file are committed once they are this old, even if the file is still
+// open. Keeps long running writers (logs, downloads, ...) from hiding their changes from the peers
+// until they close the file.
+const MAX_AGE: Duration = Duration::from_secs(5);
+
+/// How often to check for the modifications older than `MAX_AGE`.
+pub(super) const CHECK_INTERVAL: Duration = Duration::from_secs(1);
+
+/// Tracks the file handles with uncommitted modifications.
+///
+/// The modifications of a handle are buffered in its `File` across any number of `write`s (up to
+/// the blob cache capacity) and committed as a single snapshot on `fsync` or `release`, or by a
+/// periodic check (see `expired`) once they are older than `MAX_AGE`. Closing the file (`flush`)
+/// doesn't commit, so a file closed more than once (e.g., after `dup`) is still committed only once.
+/// Each commit creates a new root node that needs to be propagated to the peers, so committing
+/// less often directly reduces the sync traffic.
+#[derive(Default)]
+pub(super) struct WriteBack {
+    dirty: HashMap<FileHandle, Dirty>,
+}
+
+impl WriteBack {
+    /// Records a modification of the given handle of the given inode. Returns whether its buffered
+    /// modifications should be committed now.
+    pub fn record(&mut self, handle: FileHandle, inode: Inode) -> bool {
+        let now = Instant::now();
+        let dirty = self.dirty.entry(handle).or_insert(Dirty {
+            inode,
+            since: now,
+            modified: now,
+        });
+
+        dirty.modified = now;
+        now.duration_since(dirty.since) >= MAX_AGE
+    }
+
+    /// Returns the handles whose modifications are older than `MAX_AGE`.
+    pub fn expired(&self) -> Vec<FileHandle> {
+        let now = Instant::now();
+
+        self.dirty
+            .iter()
+            .filter(|(_, dirty)| now.duration_since(dirty.since) >= MAX_AGE)
+            .map(|(handle, _)| *handle)
+            .collect()
+    }
+
+    /// Returns all the handles of the given inode with uncommitted modifications.
+    pub fn dirty_handles(&self, inode: Inode) -> Vec<FileHandle> {
+        self.dirty_handles_where(|dirty_inode| dirty_inode == inode)
+    }
+
+    /// Returns all the handles with uncommitted modifications whose inode matches `filter`.
+    pub fn dirty_handles_where(&self, mut filter: impl FnMut(Inode) -> bool) -> Vec<FileHandle> {
+        self.dirty
+            .iter()
+            .filter(|(_, dirty)| filter(dirty.inode))
+            .map(|(handle, _)| *handle)
+            .collect()
+    }
+
+    /// Records that the modifications of the given handle have been committed (or discarded).
+    pub fn clear(&mut self, handle: FileHandle) {
+        self.dirty.remove(&handle);
+    }
+
+    /// Returns the handle with the most recent uncommitted modifications of the given inode, if
+    /// any. Its `File` has a more up to date view of the file than the committed one.
+    pub fn dirty_handle(&self, inode: Inode) -> Option<FileHandle> {
+        self.dirty
+            .iter()
+            .filter(|(_, dirty)| dirty.inode == inode)
+            .max_by_key(|(_, dirty)| dirty.modified)
+            .map(|(handle, _)| *handle)
+    }
+}
+
+struct Dirty {
+    inode: Inode,
+    // Time of the first uncommitted modification.
+    since: Instant,
+    // Time of the last modification.
+    modified: Instant,
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn record_and_clear() {
+        let mut write_back = WriteBack::default();
+
+        assert!(!write_back.record(0, 1));
+        assert!(!write_back.record(0, 1));
+        assert!(!write_back.record(1, 2));
+
+        // Backdate the first modification past the max age.
+        write_back.dirty.get_mut(&0).unwrap().since -= MAX_AGE;
+        assert!(write_back.record(0, 1));
+        assert!(!write_back.record(1, 2));
+
+        write_back.clear(0);
+        assert!(!write_back.record(0, 1));
+    }
+
+    #[test]
+    fn expired() {
+        let mut write_back = WriteBack::default();
+        assert_eq!(write_back.expired(), Vec::<FileHandle>::new());
+
+        write_back.record(0, 1);
+        write_back.record(1, 2);
+        assert_eq!(write_back.expired(), Vec::<FileHandle>::new());
+
+        write_back.dirty.get_mut(&1).unwrap().since -= MAX_AGE;
+        assert_eq!(write_back.expired(), vec![1]);
+
+        write_back.clear(1);
+        assert_eq!(write_back.expired(), Vec::<FileHandle>::new());
+    }
+
+    #[test]
+    fn dirty_handles_where() {
+        let mut write_back = WriteBack::default();
+
+        write_back.record(0, 1);
+        write_back.record(1, 2);
+        write_back.record(2, 3);
+
+        let mut handles = write_back.dirty_handles_where(|inode| inode >= 2);
+        handles.sort();
+        assert_eq!(handles, vec![1, 2]);
+
+        assert_eq!(write_back.dirty_handles(1), vec![0]);
+        assert_eq!(write_back.dirty_handles(4), Vec::<FileHandle>::new());
+    }
+
+    #[test]
+    fn dirty_handle() {
+        let mut write_back = WriteBack::default();
+        assert_eq!(write_back.dirty_handle(1), None);
+
+        write_back.record(0, 1);
+        write_back.record(1, 2);
+        assert_eq!(write_back.dirty_handle(1), Some(0));
+        assert_eq!(write_back.dirty_handle(2), Some(1));
+
+        write_back.record(2, 1);
+        write_back.dirty.get_mut(&0).unwrap().modified -= MAX_AGE;
+        assert_eq!(write_back.dirty_handle(1), Some(2));
+
+        write_back.clear(2);
+        assert_eq!(write_back.dirty_handle(1), Some(0));
+
+        write_back.clear(0);
+        assert_eq!(write_back.dirty_handle(1), None);
+    }
+}
@@ -180,6 +180,30 @@ async fn append_to_file() {
     assert_eq!(content, b"foobar");
 }
 
+#[tokio::test(flavor = "multi_thread")]
+async fn overwrite_file() {
+    let (base_dir, _guard, span) = setup("").await;
+    let _span_guard = span.enter();
+
+    let path = base_dir.path().join("mnt").join("file.txt");
+
+    fs::write(&path, b"foobar").await.unwrap();
+
+    // Truncated on open, committed together with the write.
+    fs::write(&path, b"baz").await.unwrap();
+    assert_eq!(fs::read(&path).await.unwrap(), b"baz");
+
+    // Truncated via an open handle.
+    let file = OpenOptions::new().write(true).open(&path).await.unwrap();
+    file.set_len(2).await.unwrap();
+    drop(file);
+    assert_eq!(fs::read(&path).await.unwrap(), b"ba");
+
+    // Truncated without any subsequent write.
+    File::create(&path).await.unwrap();
+    assert_eq!(fs::read(&path).await.unwrap(), b"");
+}
+
 #[proptest]
 fn seek_and_read(
     #[strategy(0usize..64 * 1024)] len: usize,